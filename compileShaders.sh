@@ -1,2 +1,19 @@
-/Users/jannis/VulkanSDK/1.3.243.0/macOS/bin/glslc shaders/shader.vert -o build/vert.spv
-/Users/jannis/VulkanSDK/1.3.243.0/macOS/bin/glslc shaders/shader.frag -o build/frag.spv
+/Users/jannis/VulkanSDK/1.3.243.0/macOS/bin/glslc shaders/pathtracer.comp -o build/pathtracer.spv
+/Users/jannis/VulkanSDK/1.3.243.0/macOS/bin/glslc -DWIDE_BVH shaders/pathtracer.comp -o build/pathtracer_wide.spv
+/Users/jannis/VulkanSDK/1.3.243.0/macOS/bin/glslc -DADAPTIVE shaders/pathtracer.comp -o build/pathtracer_adaptive.spv
+/Users/jannis/VulkanSDK/1.3.243.0/macOS/bin/glslc -DWIDE_BVH -DADAPTIVE shaders/pathtracer.comp -o build/pathtracer_wide_adaptive.spv
+/Users/jannis/VulkanSDK/1.3.243.0/macOS/bin/glslc shaders/lbvh_morton.comp -o build/lbvh_morton.spv
+/Users/jannis/VulkanSDK/1.3.243.0/macOS/bin/glslc shaders/radix_count.comp -o build/radix_count.spv
+/Users/jannis/VulkanSDK/1.3.243.0/macOS/bin/glslc shaders/radix_scan.comp -o build/radix_scan.spv
+/Users/jannis/VulkanSDK/1.3.243.0/macOS/bin/glslc shaders/radix_scatter.comp -o build/radix_scatter.spv
+/Users/jannis/VulkanSDK/1.3.243.0/macOS/bin/glslc shaders/lbvh_hierarchy.comp -o build/lbvh_hierarchy.spv
+/Users/jannis/VulkanSDK/1.3.243.0/macOS/bin/glslc shaders/lbvh_fit.comp -o build/lbvh_fit.spv
+/Users/jannis/VulkanSDK/1.3.243.0/macOS/bin/glslc shaders/wavefront_generate.comp -o build/wavefront_generate.spv
+/Users/jannis/VulkanSDK/1.3.243.0/macOS/bin/glslc shaders/wavefront_extend.comp -o build/wavefront_extend.spv
+/Users/jannis/VulkanSDK/1.3.243.0/macOS/bin/glslc -DWIDE_BVH shaders/wavefront_extend.comp -o build/wavefront_extend_wide.spv
+/Users/jannis/VulkanSDK/1.3.243.0/macOS/bin/glslc shaders/wavefront_shade.comp -o build/wavefront_shade.spv
+/Users/jannis/VulkanSDK/1.3.243.0/macOS/bin/glslc shaders/wavefront_advance.comp -o build/wavefront_advance.spv
+/Users/jannis/VulkanSDK/1.3.243.0/macOS/bin/glslc shaders/wavefront_shadow.comp -o build/wavefront_shadow.spv
+/Users/jannis/VulkanSDK/1.3.243.0/macOS/bin/glslc -DWIDE_BVH shaders/wavefront_shadow.comp -o build/wavefront_shadow_wide.spv
+/Users/jannis/VulkanSDK/1.3.243.0/macOS/bin/glslc shaders/wavefront_accumulate.comp -o build/wavefront_accumulate.spv
+/Users/jannis/VulkanSDK/1.3.243.0/macOS/bin/glslc shaders/convergence.comp -o build/convergence.spv
@@ -0,0 +1,149 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+// A range of device memory handed out by GpuAllocator
+struct GpuAllocation {
+    enum Kind : uint8_t {
+        GENERAL, LINEAR, DEDICATED
+    };
+
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    // Points at offset for host visible memory, which stays mapped for the block's lifetime
+    void* mapped = nullptr;
+
+    // Allocator bookkeeping
+    uint32_t pool = 0;
+    uint32_t block = 0;
+    uint32_t range = 0;
+    Kind kind = GENERAL;
+};
+
+// Sub-allocates buffers and images from large vkAllocateMemory blocks instead of one
+// allocation per resource, which would run into maxMemoryAllocationCount and fragment.
+//  - General allocations use a TLSF allocator per block (two level segregated fit: O(1)
+//    allocate and free with immediate coalescing), for long lived resources.
+//  - Linear arenas bump allocate and are reset as a whole, for per frame or staging data.
+//  - Requests of at least half a block get a dedicated allocation.
+// Linear (buffers) and optimal tiling (images) resources live in separate pools, so
+// bufferImageGranularity never has to be considered. Thread safe.
+class GpuAllocator {
+public:
+    struct Stats {
+        // Bytes obtained from vkAllocateMemory
+        VkDeviceSize reservedBytes = 0;
+        // Bytes handed out, including alignment padding
+        VkDeviceSize usedBytes = 0;
+        VkDeviceSize largestFreeRange = 0;
+        uint32_t allocationCount = 0;
+        uint32_t blockCount = 0;
+        uint32_t dedicatedCount = 0;
+        // 0 when all free memory is one range, towards 1 the more it is split up
+        double fragmentation() const;
+    };
+
+    GpuAllocator(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize blockSize = 64ull << 20);
+    // Frees all blocks and arenas, general and dedicated allocations have to be freed before
+    void destroy();
+
+    GpuAllocation allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool optimalImage = false);
+    void free(GpuAllocation& allocation);
+
+    // Allocates and binds memory for the resource
+    GpuAllocation allocateBuffer(VkBuffer buffer, VkMemoryPropertyFlags properties);
+    GpuAllocation allocateImage(VkImage image, VkMemoryPropertyFlags properties);
+
+    // Linear arenas hold buffers only. allocateLinear returns an empty allocation (memory ==
+    // VK_NULL_HANDLE) when the arena is full, free is a no-op for linear allocations.
+    uint32_t createLinearArena(VkDeviceSize capacity, VkMemoryPropertyFlags properties);
+    GpuAllocation allocateLinear(uint32_t arena, const VkMemoryRequirements& requirements);
+    // Everything allocated from the arena must no longer be in use by the GPU
+    void resetLinear(uint32_t arena);
+
+    Stats stats();
+    // Per memory type breakdown
+    void printStats(std::ostream& out);
+
+private:
+    // Second level subdivisions per power of two, and sizes below 2^SMALL_LOG2 share the first level
+    static constexpr uint32_t SL_LOG2 = 4;
+    static constexpr uint32_t SL_COUNT = 1u << SL_LOG2;
+    static constexpr uint32_t SMALL_LOG2 = 8;
+    static constexpr uint32_t FL_COUNT = 64 - SMALL_LOG2 + 1;
+    static constexpr uint32_t NONE = 0xFFFFFFFFu;
+
+    struct Range {
+        VkDeviceSize offset;
+        VkDeviceSize size;
+        // Neighbours in address order and in the free list of the range's size class
+        uint32_t prevPhysical;
+        uint32_t nextPhysical;
+        uint32_t prevFree;
+        uint32_t nextFree;
+        bool free;
+    };
+
+    // One vkAllocateMemory block managed by TLSF
+    struct Block {
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkDeviceSize size = 0;
+        uint8_t* mapped = nullptr;
+        std::vector<Range> ranges;
+        std::vector<uint32_t> unusedRanges;
+        uint64_t firstLevelMap = 0;
+        uint32_t secondLevelMap[FL_COUNT]{};
+        uint32_t freeLists[FL_COUNT][SL_COUNT];
+        VkDeviceSize usedBytes = 0;
+        uint32_t allocationCount = 0;
+    };
+
+    struct Pool {
+        uint32_t memoryType;
+        std::vector<std::unique_ptr<Block>> blocks;
+    };
+
+    struct Arena {
+        uint32_t memoryType;
+        VkDeviceMemory memory;
+        VkDeviceSize capacity;
+        VkDeviceSize head;
+        uint8_t* mapped;
+        uint32_t allocationCount;
+    };
+
+    struct Dedicated {
+        uint32_t memoryType;
+        VkDeviceSize size;
+    };
+
+    static void mapping(VkDeviceSize size, uint32_t& firstLevel, uint32_t& secondLevel);
+    static void insertFree(Block& block, uint32_t range);
+    static void removeFree(Block& block, uint32_t range);
+    static uint32_t newRange(Block& block);
+    // Returns the range holding the allocation or NONE, offset receives its aligned start
+    static uint32_t allocateFromBlock(Block& block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset);
+    static void freeInBlock(Block& block, uint32_t range);
+
+    VkDeviceMemory allocateMemory(uint32_t memoryType, VkDeviceSize size, void** mapped);
+    std::unique_ptr<Block> createBlock(uint32_t memoryType, VkDeviceSize size);
+
+    VkPhysicalDevice physicalDevice;
+    VkDevice device;
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    VkDeviceSize blockSize;
+    uint32_t maxAllocations;
+    uint32_t liveAllocations = 0;
+
+    std::mutex mutex;
+    // Two pools per memory type: index 2 * type for buffers, 2 * type + 1 for optimal images
+    std::vector<Pool> pools;
+    std::vector<Arena> arenas;
+    std::vector<Dedicated> dedicated;
+    std::vector<uint32_t> unusedDedicated;
+};
@@ -3,18 +3,62 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
+#include <chrono>
+#include <future>
+#include <memory>
 #include <optional>
 #include <vector>
+#include "settings.h"
+#include "threadpool.h"
+#include "asyncloader.h"
+#include "scene.h"
+#include "bvh.h"
+#include "lbvh.h"
+#include "widebvh.h"
+#include "wavefront.h"
+#include "timeline.h"
+#include "allocator.h"
+#include "upload.h"
+#include "splitframe.h"
+#include "convergence.h"
+#include "profiler.h"
 
 class RayTracingApplication {
 
     struct QueueFamilyIndicies {
+        // Family that can run the path tracing kernel and blit the result (graphics + compute)
         std::optional<uint32_t> graphicsFamily;
         std::optional<uint32_t> presentFamily;
+        // Any compute capable family, used when rendering headless
+        std::optional<uint32_t> computeFamily;
+        // Transfer only family (the DMA engines on discrete GPUs), uploads use the render queue without one
+        std::optional<uint32_t> transferFamily;
+        // Compute family without graphics, BVH builds run there while the render queue keeps going
+        std::optional<uint32_t> asyncComputeFamily;
 
-        bool isComplete(){
+        bool isComplete(bool headless){
+            if(headless) return computeFamily.has_value();
             return graphicsFamily.has_value() && presentFamily.has_value();
         }
+        uint32_t renderFamily(bool headless){
+            return headless ? computeFamily.value() : graphicsFamily.value();
+        }
+    };
+
+    // What pickPhysicalDevice ranks the devices by
+    struct DeviceRating {
+        VkPhysicalDevice device;
+        // Position in vkEnumeratePhysicalDevices, what --device <index> refers to
+        uint32_t index;
+        VkPhysicalDeviceProperties properties;
+        // Largest device local heap
+        VkDeviceSize localMemory;
+        // 0 when the device does not report it (Vulkan 1.0)
+        uint32_t subgroupSize;
+        // Queues summed over all compute capable families
+        uint32_t computeQueues;
+        bool suitable;
+        uint64_t score;
     };
 
     struct SwapChainSupportDetails {
@@ -23,8 +67,49 @@ class RayTracingApplication {
         std::vector<VkPresentModeKHR> presentModes;
     };
 
+    // Prepended to the serialized VkPipelineCache. The driver version is not part of the
+    // Vulkan cache header, but driver updates may still reject or miscompile old blobs.
+    struct PipelineCacheFileHeader {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t vendorID;
+        uint32_t deviceID;
+        uint32_t driverVersion;
+        uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+        uint64_t dataSize;
+        uint64_t dataHash;
+    };
+
+    struct Buffer {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        GpuAllocation allocation;
+        VkDeviceSize size = 0;
+    };
+
+    // Everything one of the frames in flight records into and waits on
+    struct FrameResources {
+        VkCommandPool commandPool = VK_NULL_HANDLE;
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        VkSemaphore imageAvailable = VK_NULL_HANDLE;
+        // renderTimeline value of the last submission from this slot
+        uint64_t submitted = 0;
+    };
+
+    // Must match the push_constant block in shaders/pathtracer.comp
+    struct PushConstants {
+        uint32_t frameIndex;
+        uint32_t samplesPerPixel;
+        uint32_t maxBounces;
+    };
+
 public:
+    explicit RayTracingApplication(const RenderSettings& settings);
     void run();
+
+    // Headless with keepAccumulation: rgb sums and sample counts of the last frame, 4 floats per pixel
+    const std::vector<float>& accumulation() const { return finalAccumulation; }
+    // Headless: wall time of the frames, without start up and readback
+    double renderSeconds() const { return lastRenderSeconds; }
 private:
     void initWindow();
     void initVulkan();
@@ -36,11 +121,38 @@ private:
     void createLogicalDevice();
     void createSwapChain();
     void createImageViews();
-    void createGraphicsPipeline();
+    void createPipelineCache();
+    void savePipelineCache();
+    void createCommandPool();
+    // Maps the profiler's GPU timestamps onto the trace clock, only when tracing
+    void calibrateGpuClock();
+    void createStorageImages();
+    void createSceneBuffers();
+    void buildBVHOnGpu();
+    void collapseWideBVH(const BVH& binary);
+    void createDescriptorSets();
+    void createComputePipeline();
+    void createWavefront();
+    void createFrameResources();
+    void createSyncObjects();
+    VkCommandBuffer beginFrame(FrameResources& frame);
     void mainLoop();
+    void drawFrame();
+    // Rebuilds the swapchain with its views and present semaphores, the storage images keep the render extent
+    void recreateSwapChain();
+    void renderHeadless();
+    // Submits one headless frame with the current frameIndex, checkConvergence reduces the tile errors
+    void submitHeadlessFrame(bool checkConvergence = false);
+    void createSplitFrameWorkers();
+    void renderSplitFrames();
+    // Renders frames [first, first + count) on this device and waits for them, returns the seconds it took
+    double renderFrameRange(uint32_t first, uint32_t count);
+    void readAccumulation(std::vector<float>& pixels);
+    void saveOutputImage(const std::string& filename);
     void cleanup();
 
     bool isDeviceSuitable(VkPhysicalDevice device);
+    DeviceRating rateDevice(VkPhysicalDevice device, uint32_t index);
     QueueFamilyIndicies findQueueFamilies(VkPhysicalDevice device);
     bool checkValidationLayerSupport();
     void checkAndAddInstanceExtensionSupport(std::vector<const char*>& requiredExtensions);
@@ -50,8 +162,36 @@ private:
     VkSurfaceFormatKHR chooseSwapChainFormat(const std::vector<VkSurfaceFormatKHR>& formats);
     VkPresentModeKHR chooseSwapChainPresent(const std::vector<VkPresentModeKHR>& presentModes);
     VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities);
+    VkExtent2D chooseWorkgroupSize();
+
+    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, GpuAllocation& allocation);
+    // Host visible transfer destination, from readbackArena while it has room
+    Buffer createReadbackBuffer(VkDeviceSize size);
+    void createImage(VkExtent2D extent, VkFormat format, VkImageUsageFlags usage, VkImage& image, GpuAllocation& allocation, VkImageView& view);
+    Buffer createDeviceLocalBuffer(const void* data, VkDeviceSize size, VkBufferUsageFlags usage);
+    void downloadBuffer(const Buffer& buffer, void* data, VkDeviceSize size);
+    void destroyBuffer(Buffer& buffer);
+    VkCommandBuffer beginSingleTimeCommands();
+    void endSingleTimeCommands(VkCommandBuffer commandBuffer);
+    // Like endSingleTimeCommands without waiting, the command buffer is freed once the returned value completed
+    uint64_t submitSingleTimeCommands(VkCommandBuffer commandBuffer);
+    // One time commands for the async compute queue, the render queue without one. Returns an
+    // asyncTimeline value; the next render submission waits for it.
+    VkCommandBuffer beginAsyncCommands();
+    uint64_t submitAsyncCommands(VkCommandBuffer commandBuffer);
+    // Every submission to the render queue, adds the waits for uploads and async compute work
+    uint64_t submitRender(const GpuTimeline::Submission& submission);
+    void recordComputePass(VkCommandBuffer commandBuffer);
+    void recordBlit(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+    void reportThroughput();
+    void collectStageTimes(uint32_t frameSlot);
+    void printStageTimes(const double totals[WavefrontPathTracer::STAGE_COUNT], uint32_t frames);
+    // Collects every frame slot once the GPU is idle, prints and writes the final pass statistics
+    void finishProfiling();
+    void writeProfile();
 
     std::vector<const char*> getRequiredExtensions();
+    std::vector<const char*> getRequiredDeviceExtensions();
 
     static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
             VkDebugUtilsMessageTypeFlagsEXT messageType,
@@ -59,22 +199,127 @@ private:
             void* pUserData);
 
 private:
-    GLFWwindow* window;
+    RenderSettings settings;
+    ThreadPool threadPool;
+    AsyncLoader assetLoader{threadPool};
+    AssetHandle pathTracerShader;
+    // Variant tracing only the active tiles of the convergence monitor, loaded with --adaptive
+    AssetHandle adaptiveShader;
+    Scene scene;
+    BVH bvh;
+    // Only filled with --wide-bvh, replaces bvh in the node and triangle index buffers
+    WideBVH wideBvh;
+    // Builds scene and bvh on its own thread (the builder itself fans out onto threadPool).
+    // Declared after them so it is joined before they are destroyed.
+    std::future<void> sceneBuild;
+    GLFWwindow* window = nullptr;
     VkInstance instance;
     VkDebugUtilsMessengerEXT debugMessenger;
     VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
     VkDevice device;
-    VkQueue graphicsQueue;
+    // Queue the path tracer is submitted to: the graphics family when presenting, any compute family headless
+    VkQueue renderQueue;
     VkQueue presentQueue;
-    VkSurfaceKHR surface;
-    VkSwapchainKHR swapChain;
+    // Instance API version, at least 1.1 is needed to query timeline semaphore support
+    uint32_t apiVersion = VK_API_VERSION_1_0;
+    // Every submission to renderQueue goes through it
+    std::optional<GpuTimeline> renderTimeline;
+    // Only set with a dedicated transfer family
+    VkQueue transferQueue = VK_NULL_HANDLE;
+    std::optional<GpuTimeline> transferTimeline;
+    // Owns all device memory; the readback arena is reset whenever no readback buffer is alive
+    std::optional<GpuAllocator> allocator;
+    uint32_t readbackArena = 0;
+    uint32_t readbackBuffersInUse = 0;
+    // Scene data is streamed through it, render submissions go through it to acquire the uploads
+    std::optional<UploadQueue> uploader;
+    // Only set with a compute only family, asyncTimeline falls back to renderTimeline
+    VkQueue computeQueue = VK_NULL_HANDLE;
+    std::optional<GpuTimeline> computeTimeline;
+    GpuTimeline* asyncTimeline = nullptr;
+    VkCommandPool asyncCommandPool = VK_NULL_HANDLE;
+    uint32_t asyncFamily = 0;
+    // Families the scene buffers are shared between, empty (exclusive buffers) without async compute
+    std::vector<uint32_t> sharedFamilies;
+    std::vector<GpuTimeline::Wait> pendingRenderWaits;
+    // --multi-gpu: the other suitable devices, best first, and the workers rendering on them
+    std::vector<VkPhysicalDevice> splitFrameDevices;
+    std::vector<std::unique_ptr<SplitFrameWorker>> splitFrameWorkers;
+    VkSurfaceKHR surface = VK_NULL_HANDLE;
+    VkSwapchainKHR swapChain = VK_NULL_HANDLE;
     std::vector<VkImage> swapChainImages;
     VkFormat swapChainImageFormat;
     VkExtent2D swapChainExtent;
     std::vector<VkImageView> swapChainImageViews;
+    VkExtent2D renderExtent;
+
+    // Only used for one time submits, every frame in flight has its own pool
+    VkCommandPool commandPool;
+    std::vector<FrameResources> frames;
+    uint32_t currentFrame = 0;
+    // One per swapchain image: a frame slot's semaphore could still be pending in an older present
+    std::vector<VkSemaphore> renderFinishedSemaphores;
+
+    // Progressive accumulation target (rgba32f) and the tonemapped image that gets blitted
+    VkImage accumulationImage;
+    GpuAllocation accumulationImageAllocation;
+    VkImageView accumulationImageView;
+    VkImage outputImage;
+    GpuAllocation outputImageAllocation;
+    VkImageView outputImageView;
+
+    Buffer vertexBuffer;
+    Buffer indexBuffer;
+    Buffer nodeBuffer;
+    Buffer triangleIndexBuffer;
+    Buffer triangleMaterialBuffer;
+    Buffer materialBuffer;
+    // Emissive triangle ids, only read by the wavefront shade kernel
+    Buffer lightBuffer;
+    uint32_t lightCount = 0;
+
+    VkDescriptorSetLayout descriptorSetLayout;
+    VkDescriptorPool descriptorPool;
+    VkDescriptorSet descriptorSet;
+    VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+    VkPipeline computePipeline = VK_NULL_HANDLE;
+    // Replaces computePipeline once adaptive sampling starts, same layout
+    VkPipeline adaptivePipeline = VK_NULL_HANDLE;
+    // Replaces computePipeline with --kernel wavefront
+    std::optional<WavefrontPathTracer> wavefront;
+    // Only with --target-noise
+    std::optional<ConvergenceMonitor> convergence;
+    // Only with --profile
+    std::optional<GpuProfiler> profiler;
+    // VK_EXT_calibrated_timestamps is enabled and can sample the device and the trace clock together
+    bool calibratedTimestamps = false;
+    VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+    VkExtent2D workgroupSize;
+
+    uint32_t frameIndex = 0;
+    std::vector<float> finalAccumulation;
+    double lastRenderSeconds = 0.0;
+    uint64_t samplesSinceReport = 0;
+    std::chrono::steady_clock::time_point lastReport;
+    // Wavefront stage times since the last report and over the whole run
+    double stageTimesSinceReport[WavefrontPathTracer::STAGE_COUNT]{};
+    double stageTimesTotal[WavefrontPathTracer::STAGE_COUNT]{};
+    uint32_t timedFramesSinceReport = 0;
+    uint32_t timedFramesTotal = 0;
 private:
-    const uint32_t WIDTH=800;
-    const uint32_t HEIGHT=600;
+    const uint32_t PIPELINE_CACHE_MAGIC = 0x43505256; // "VRPC"
+    const uint32_t PIPELINE_CACHE_VERSION = 1;
+    const uint32_t SAMPLES_PER_PIXEL=1;
+    const uint32_t MAX_BOUNCES=4;
+    // Frames between two convergence checks
+    const uint32_t CONVERGENCE_INTERVAL = 16;
+    // Frames every tile gets before adaptive sampling may retire it, a multiple of CONVERGENCE_INTERVAL.
+    // Fewer samples make the variance estimate of tiles that rarely find a light too unreliable.
+    const uint32_t ADAPTIVE_WARMUP_FRAMES = 64;
+    const VkDeviceSize READBACK_ARENA_SIZE = 32ull << 20;
+    const VkDeviceSize UPLOAD_RING_SIZE = 32ull << 20;
+    const VkFormat ACCUMULATION_FORMAT = VK_FORMAT_R32G32B32A32_SFLOAT;
+    const VkFormat OUTPUT_FORMAT = VK_FORMAT_R8G8B8A8_UNORM;
     const std::vector<const char*> validationLayers = {
         "VK_LAYER_KHRONOS_validation"
     };
@@ -83,7 +328,7 @@ private:
     };
     #ifdef DEBUG
         const bool enableValidationLayers = true;
-    #else 
+    #else
         const bool enableValidationLayers = false;
     #endif
 };
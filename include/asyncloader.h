@@ -0,0 +1,34 @@
+#pragma once
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "loader.h"
+#include "threadpool.h"
+
+struct LoadedAsset {
+    std::string name;
+    // Raw file contents
+    std::vector<char> data;
+};
+
+using AssetHandle = std::shared_future<std::shared_ptr<LoadedAsset>>;
+
+// Reads files on a worker pool, disk I/O of independent files overlaps.
+// Callers upload the finished payloads themselves (the application through its UploadQueue).
+class AsyncLoader {
+public:
+    explicit AsyncLoader(ThreadPool& pool);
+    // Waits for outstanding loads
+    ~AsyncLoader();
+
+    AssetHandle load(const std::string& filename);
+    // Blocks until every load issued so far has finished (or failed)
+    void waitIdle();
+
+private:
+    ThreadPool& pool;
+    std::mutex mutex;
+    std::vector<AssetHandle> pending;
+};
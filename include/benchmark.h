@@ -0,0 +1,77 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "bvh.h"
+#include "cpurenderer.h"
+#include "scene.h"
+#include "threadpool.h"
+
+struct BenchmarkSettings {
+    std::string outputFile = "benchmark.json";
+    // Stored in the JSON as is, e.g. the commit hash
+    std::string label;
+    // Smaller meshes and shorter measurements, for a smoke run
+    bool quick = false;
+    // Threads of the BVH builder and the glTF loader, 0 starts one per hardware thread
+    uint32_t threads = 0;
+    // glTF models benchmarked after the synthetic meshes, each in the empty Cornell box
+    std::vector<std::string> meshFiles;
+
+    static BenchmarkSettings fromArguments(int argc, char** argv);
+};
+
+// Microbenchmarks of the CPU side of the acceleration structures: BVH build throughput,
+// the packet kernels' ray-triangle and ray-box tests, and closest hit traversal of coherent
+// (camera) and incoherent (random) rays. Every kernel runs for every instruction set the CPU
+// supports, on synthetic meshes of growing size, the Cornell box and glTF models. Everything is
+// single threaded except the SAH build, so the numbers are comparable between machines.
+class Benchmark {
+public:
+    explicit Benchmark(const BenchmarkSettings& settings);
+
+    // Prints every result and writes them to settings.outputFile
+    void run();
+
+private:
+    struct Mesh {
+        std::string name;
+        Scene scene;
+    };
+
+    struct Result {
+        std::string group;
+        std::string variant;
+        std::string mesh;
+        size_t triangles;
+        double value;
+        std::string unit;
+    };
+
+    std::vector<Mesh> createMeshes();
+    void benchmarkBuilds(const Mesh& mesh);
+    void benchmarkKernels(const Mesh& mesh, const BVH& bvh);
+    void benchmarkTraversal(const Mesh& mesh, const BVH& bvh);
+    // Seconds per call of func, the best of repeated calls for at least minSeconds
+    double measure(const std::function<void()>& func) const;
+    void addResult(const std::string& group, const std::string& variant, const Mesh& mesh, double value, const std::string& unit);
+    void writeReport() const;
+
+    // Rays through the pixels of a RAY_GRID_SIZE^2 image from the CPU renderer's camera, in 4x4
+    // pixel blocks so every packet covers a compact footprint
+    static std::vector<CpuRay> coherentRays();
+    // Origins inside bounds, directions uniform on the sphere
+    static std::vector<CpuRay> incoherentRays(const AABB& bounds, uint32_t count);
+
+    BenchmarkSettings settings;
+    ThreadPool threadPool;
+    double minSeconds;
+    std::vector<CpuIsa> isas;
+    std::vector<Result> results;
+
+    static constexpr uint32_t RAY_GRID_SIZE = 256;
+    // Triangles and boxes tested by the intersection kernels, they stay in L1
+    static constexpr uint32_t KERNEL_PRIMITIVES = 256;
+    static constexpr uint32_t KERNEL_RAYS = 1024;
+};
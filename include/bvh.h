@@ -0,0 +1,82 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include "scene.h"
+#include "threadpool.h"
+
+// 32 byte node, must match shaders/bvh.glsl.
+// Interior nodes (triangleCount == 0) store the index of their left child, the right child follows it.
+// Leaves store the first entry in BVH::triangleIndices.
+struct BVHNode {
+    glm::vec3 aabbMin;
+    uint32_t leftFirst;
+    glm::vec3 aabbMax;
+    uint32_t triangleCount;
+
+    bool isLeaf() const { return triangleCount > 0; }
+};
+static_assert(sizeof(BVHNode) == 32, "BVHNode must stay 32 bytes for the GPU layout");
+
+struct BVH {
+    std::vector<BVHNode> nodes;
+    // Triangle ids reordered so that every leaf references a contiguous range
+    std::vector<uint32_t> triangleIndices;
+    // Edges from the root to the deepest leaf
+    uint32_t depth = 0;
+
+    // Traversal pushes at most one node per level, so this is also the stack size the
+    // kernels need (BVH_STACK_SIZE in shaders/bvh.glsl and cpupacket.h). No builder emits deeper trees.
+    static constexpr uint32_t MAX_DEPTH = 64;
+};
+
+struct AABB {
+    glm::vec3 min = glm::vec3(1e30f);
+    glm::vec3 max = glm::vec3(-1e30f);
+
+    void grow(const glm::vec3& p) { min = glm::min(min, p); max = glm::max(max, p); }
+    void grow(const AABB& b) { min = glm::min(min, b.min); max = glm::max(max, b.max); }
+    bool valid() const { return min.x <= max.x; }
+    float area() const {
+        if(!valid()) return 0.0f;
+        glm::vec3 e = max - min;
+        return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+};
+
+// Top down builder using a binned surface area heuristic. Large subtrees are built
+// as independent tasks on the thread pool. Once a subtree could no longer reach its leaves
+// within BVH::MAX_DEPTH it is split at the object median instead, which bounds its depth.
+class BVHBuilder {
+public:
+    struct Options {
+        // Clamped to [2, 64]
+        uint32_t binCount = 16;
+        // Leaves never hold more triangles than this
+        uint32_t maxLeafSize = 4;
+        // Subtrees with at least this many triangles are handed to another worker
+        uint32_t parallelThreshold = 8192;
+        float traversalCost = 1.0f;
+        float intersectionCost = 1.0f;
+    };
+
+    explicit BVHBuilder(ThreadPool& pool);
+    BVHBuilder(ThreadPool& pool, const Options& options);
+
+    BVH build(const Scene& scene);
+
+    // Duration of the last build in milliseconds
+    double lastBuildMilliseconds() const { return buildMilliseconds; }
+
+private:
+    struct BuildContext;
+
+    void buildNode(BuildContext& ctx, uint32_t nodeIndex, uint32_t first, uint32_t count, uint32_t depth);
+    void spawn(BuildContext& ctx, uint32_t nodeIndex, uint32_t first, uint32_t count, uint32_t depth);
+    // Levels below a node of count triangles if every split halves it
+    uint32_t balancedDepth(uint32_t count) const;
+
+    ThreadPool& pool;
+    Options options;
+    double buildMilliseconds = 0.0;
+};
@@ -0,0 +1,74 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan.h>
+#include "allocator.h"
+
+// Tracks the luminance variance of the progressive accumulation. A pass after every frame
+// derives the frame's sample from the change of the accumulated sum and adds its square to a
+// moment buffer, so it works with any kernel writing the accumulation image. On request the
+// pass also reduces the relative standard error of the pixel means to one RMS value per tile
+// and compacts the tiles above a threshold into an indirect dispatch for adaptive sampling.
+// Like the kernels it starts over at frame 0.
+class ConvergenceMonitor {
+public:
+    struct Stats {
+        // Relative standard error of the pixel means, RMS per tile
+        float maxTileError;
+        float meanTileError;
+        uint32_t tiles;
+        // Tiles above the threshold of the reduction
+        uint32_t activeTiles;
+    };
+
+    // kernelWorkgroup is the workgroup size of the kernel dispatched from activeTiles, it has to divide TILE_SIZE
+    ConvergenceMonitor(GpuAllocator& allocator, VkDevice device, VkPipelineCache pipelineCache, VkImageView accumulationImage,
+                       VkExtent2D extent, uint32_t samplesPerPixel, VkExtent2D kernelWorkgroup);
+    void destroy();
+
+    // Must follow the kernel that accumulated frameIndex. reduce writes the tile errors readStats returns
+    // and replaces activeTiles with the tiles whose error is above threshold (all of them if it is negative).
+    void record(VkCommandBuffer cmd, uint32_t frameIndex, bool reduce, float threshold);
+    // Only valid once the last reducing frame has finished executing
+    Stats readStats() const;
+
+    // VkDispatchIndirectCommand at offset 0 followed by the tile ids, see shaders/pathtracer.comp.
+    // Only valid after the first reducing frame.
+    VkBuffer activeTiles() const { return activeTileBuffer; }
+
+    // Matches local_size in shaders/convergence.comp
+    static constexpr uint32_t TILE_SIZE = 16;
+
+private:
+    // Must match the push_constant block in shaders/convergence.comp
+    struct PushConstants {
+        uint32_t frameIndex;
+        uint32_t samplesPerPixel;
+        uint32_t reduce;
+        uint32_t tilesX;
+        float threshold;
+    };
+
+    GpuAllocator* allocator;
+    VkDevice device;
+    uint32_t tilesX;
+    uint32_t tilesY;
+    uint32_t samplesPerPixel;
+    VkExtent2D kernelWorkgroup;
+    float reducedThreshold = -1.0f;
+
+    VkDescriptorSetLayout setLayout;
+    VkPipelineLayout pipelineLayout;
+    VkDescriptorPool descriptorPool;
+    VkDescriptorSet descriptorSet;
+    VkPipeline pipeline;
+
+    // Two floats per pixel: luminance sum up to the previous frame, sum of squared frame luminances
+    VkBuffer moments;
+    GpuAllocation momentAllocation;
+    // One float per tile, host visible
+    VkBuffer tileErrors;
+    GpuAllocation tileErrorAllocation;
+    VkBuffer activeTileBuffer;
+    GpuAllocation activeTileAllocation;
+};
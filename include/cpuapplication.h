@@ -0,0 +1,40 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "bvh.h"
+#include "scene.h"
+#include "settings.h"
+#include "threadpool.h"
+#include "tilescheduler.h"
+
+// Headless rendering without Vulkan: the scene of RayTracingApplication traced by CpuRenderer.
+// Runs where there is no GPU and is the reference the compute path is compared against.
+class CpuApplication {
+public:
+    explicit CpuApplication(const RenderSettings& settings);
+    void run();
+
+    // Accumulated rgb sums and sample counts of the last run, 4 floats per pixel
+    const std::vector<float>& accumulation() const { return pixels; }
+    // Wall time of the frames, without building the scene
+    double renderSeconds() const { return lastRenderSeconds; }
+
+private:
+    void buildScene();
+    void render();
+    void saveOutputImage(const std::string& filename);
+
+    RenderSettings settings;
+    // Builds the BVH
+    ThreadPool threadPool;
+    // Renders, pinned workers with a deque each
+    TileScheduler scheduler;
+    Scene scene;
+    BVH bvh;
+    std::vector<float> pixels;
+    double lastRenderSeconds = 0.0;
+
+    // Same as RayTracingApplication, so both render the same image
+    const uint32_t SAMPLES_PER_PIXEL = 1;
+    const uint32_t MAX_BOUNCES = 4;
+};
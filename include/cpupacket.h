@@ -0,0 +1,537 @@
+#pragma once
+#include <math.h>
+#include <cstdint>
+#include "cpurenderer.h"
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+// Packet path tracer shared by src/cpupacket_*.cpp. Each of them is compiled for another
+// instruction set, so everything here has internal linkage: an inline function compiled with
+// AVX-512 must never be picked by the linker for a caller running on an SSE only CPU. For the
+// same reason the kernels do not call into glm or the standard containers.
+namespace {
+
+// The <cmath> float overloads (std::sqrt, ...) are inline functions with external linkage as well,
+// these call the compiler builtins or the C library directly
+#if defined(__GNUC__) || defined(__clang__)
+float squareRoot(float a) { return __builtin_sqrtf(a); }
+float absolute(float a) { return __builtin_fabsf(a); }
+float cosine(float a) { return __builtin_cosf(a); }
+float sine(float a) { return __builtin_sinf(a); }
+float tangent(float a) { return __builtin_tanf(a); }
+#else
+float squareRoot(float a) { return ::sqrtf(a); }
+float absolute(float a) { return ::fabsf(a); }
+float cosine(float a) { return ::cosf(a); }
+float sine(float a) { return ::sinf(a); }
+float tangent(float a) { return ::tanf(a); }
+#endif
+
+// Lane wise operations of one instruction set. Masks are opaque, bits() turns them into one bit per lane.
+struct SimdScalar {
+    static constexpr uint32_t WIDTH = 1;
+    // Pixels covered by one packet
+    static constexpr uint32_t PACKET_WIDTH = 1;
+    static constexpr uint32_t PACKET_HEIGHT = 1;
+    using Float = float;
+    using Mask = bool;
+
+    static Float set(float a) { return a; }
+    static Float load(const float* p) { return *p; }
+    static void store(float* p, Float a) { *p = a; }
+    static Float add(Float a, Float b) { return a + b; }
+    static Float sub(Float a, Float b) { return a - b; }
+    static Float mul(Float a, Float b) { return a * b; }
+    static Float div(Float a, Float b) { return a / b; }
+    static Float min(Float a, Float b) { return a < b ? a : b; }
+    static Float max(Float a, Float b) { return a > b ? a : b; }
+    static Float abs(Float a) { return absolute(a); }
+    static Mask less(Float a, Float b) { return a < b; }
+    static Mask lessEqual(Float a, Float b) { return a <= b; }
+    static Mask both(Mask a, Mask b) { return a && b; }
+    static Float select(Mask m, Float a, Float b) { return m ? a : b; }
+    static uint32_t bits(Mask m) { return m ? 1u : 0u; }
+    static Mask fromBits(uint32_t bits) { return (bits & 1u) != 0; }
+};
+
+#if defined(__SSE2__) || defined(_M_X64)
+struct SimdSSE {
+    static constexpr uint32_t WIDTH = 4;
+    static constexpr uint32_t PACKET_WIDTH = 2;
+    static constexpr uint32_t PACKET_HEIGHT = 2;
+    using Float = __m128;
+    using Mask = __m128;
+
+    static Float set(float a) { return _mm_set1_ps(a); }
+    static Float load(const float* p) { return _mm_load_ps(p); }
+    static void store(float* p, Float a) { _mm_store_ps(p, a); }
+    static Float add(Float a, Float b) { return _mm_add_ps(a, b); }
+    static Float sub(Float a, Float b) { return _mm_sub_ps(a, b); }
+    static Float mul(Float a, Float b) { return _mm_mul_ps(a, b); }
+    static Float div(Float a, Float b) { return _mm_div_ps(a, b); }
+    static Float min(Float a, Float b) { return _mm_min_ps(a, b); }
+    static Float max(Float a, Float b) { return _mm_max_ps(a, b); }
+    static Float abs(Float a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+    static Mask less(Float a, Float b) { return _mm_cmplt_ps(a, b); }
+    static Mask lessEqual(Float a, Float b) { return _mm_cmple_ps(a, b); }
+    static Mask both(Mask a, Mask b) { return _mm_and_ps(a, b); }
+    static Float select(Mask m, Float a, Float b) { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+    static uint32_t bits(Mask m) { return static_cast<uint32_t>(_mm_movemask_ps(m)); }
+    static Mask fromBits(uint32_t bits) {
+        __m128i lanes = _mm_setr_epi32(1, 2, 4, 8);
+        __m128i set = _mm_and_si128(_mm_set1_epi32(static_cast<int>(bits)), lanes);
+        return _mm_castsi128_ps(_mm_cmpeq_epi32(set, lanes));
+    }
+};
+#endif
+
+#ifdef __AVX2__
+struct SimdAVX2 {
+    static constexpr uint32_t WIDTH = 8;
+    static constexpr uint32_t PACKET_WIDTH = 4;
+    static constexpr uint32_t PACKET_HEIGHT = 2;
+    using Float = __m256;
+    using Mask = __m256;
+
+    static Float set(float a) { return _mm256_set1_ps(a); }
+    static Float load(const float* p) { return _mm256_load_ps(p); }
+    static void store(float* p, Float a) { _mm256_store_ps(p, a); }
+    static Float add(Float a, Float b) { return _mm256_add_ps(a, b); }
+    static Float sub(Float a, Float b) { return _mm256_sub_ps(a, b); }
+    static Float mul(Float a, Float b) { return _mm256_mul_ps(a, b); }
+    static Float div(Float a, Float b) { return _mm256_div_ps(a, b); }
+    static Float min(Float a, Float b) { return _mm256_min_ps(a, b); }
+    static Float max(Float a, Float b) { return _mm256_max_ps(a, b); }
+    static Float abs(Float a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+    static Mask less(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    static Mask lessEqual(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+    static Mask both(Mask a, Mask b) { return _mm256_and_ps(a, b); }
+    static Float select(Mask m, Float a, Float b) { return _mm256_blendv_ps(b, a, m); }
+    static uint32_t bits(Mask m) { return static_cast<uint32_t>(_mm256_movemask_ps(m)); }
+    static Mask fromBits(uint32_t bits) {
+        __m256i lanes = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+        __m256i set = _mm256_and_si256(_mm256_set1_epi32(static_cast<int>(bits)), lanes);
+        return _mm256_castsi256_ps(_mm256_cmpeq_epi32(set, lanes));
+    }
+};
+#endif
+
+#ifdef __AVX512F__
+struct SimdAVX512 {
+    static constexpr uint32_t WIDTH = 16;
+    static constexpr uint32_t PACKET_WIDTH = 4;
+    static constexpr uint32_t PACKET_HEIGHT = 4;
+    using Float = __m512;
+    using Mask = __mmask16;
+
+    static Float set(float a) { return _mm512_set1_ps(a); }
+    static Float load(const float* p) { return _mm512_load_ps(p); }
+    static void store(float* p, Float a) { _mm512_store_ps(p, a); }
+    static Float add(Float a, Float b) { return _mm512_add_ps(a, b); }
+    static Float sub(Float a, Float b) { return _mm512_sub_ps(a, b); }
+    static Float mul(Float a, Float b) { return _mm512_mul_ps(a, b); }
+    static Float div(Float a, Float b) { return _mm512_div_ps(a, b); }
+    static Float min(Float a, Float b) { return _mm512_min_ps(a, b); }
+    static Float max(Float a, Float b) { return _mm512_max_ps(a, b); }
+    static Float abs(Float a) { return _mm512_castsi512_ps(_mm512_and_si512(_mm512_castps_si512(a), _mm512_set1_epi32(0x7FFFFFFF))); }
+    static Mask less(Float a, Float b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+    static Mask lessEqual(Float a, Float b) { return _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ); }
+    static Mask both(Mask a, Mask b) { return static_cast<Mask>(a & b); }
+    static Float select(Mask m, Float a, Float b) { return _mm512_mask_blend_ps(m, b, a); }
+    static uint32_t bits(Mask m) { return static_cast<uint32_t>(m); }
+    static Mask fromBits(uint32_t bits) { return static_cast<Mask>(bits); }
+};
+#endif
+
+const float INF = 1e30f;
+const uint32_t NO_TRIANGLE = 0xFFFFFFFFu;
+// Builders never emit deeper trees and the traversal defers at most one node per level
+const uint32_t BVH_STACK_SIZE = BVH::MAX_DEPTH;
+const float PI = 3.14159265359f;
+
+uint32_t laneCount(uint32_t bits) {
+    uint32_t count = 0;
+    for(; bits != 0; bits &= bits - 1) count++;
+    return count;
+}
+
+struct Float3 {
+    float x, y, z;
+};
+
+Float3 operator+(Float3 a, Float3 b) { return {a.x + b.x, a.y + b.y, a.z + b.z}; }
+Float3 operator*(Float3 a, Float3 b) { return {a.x * b.x, a.y * b.y, a.z * b.z}; }
+Float3 operator*(Float3 a, float s) { return {a.x * s, a.y * s, a.z * s}; }
+float dot(Float3 a, Float3 b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+Float3 cross(Float3 a, Float3 b) { return {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x}; }
+Float3 normalize(Float3 a) { return a * (1.0f / squareRoot(dot(a, a))); }
+
+// Random numbers, sampling and camera of shaders/common.glsl
+uint32_t pcgHash(uint32_t v) {
+    uint32_t state = v * 747796405u + 2891336453u;
+    uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+float random(uint32_t& seed) {
+    seed = pcgHash(seed);
+    return static_cast<float>(seed) / 4294967296.0f;
+}
+
+Float3 sampleCosineHemisphere(Float3 n, uint32_t& seed) {
+    float r1 = 2.0f * PI * random(seed);
+    float r2 = random(seed);
+    float r2s = squareRoot(r2);
+    Float3 w = n;
+    Float3 u = normalize(cross(absolute(w.x) > 0.1f ? Float3{0.0f, 1.0f, 0.0f} : Float3{1.0f, 0.0f, 0.0f}, w));
+    Float3 v = cross(w, u);
+    return normalize(u * (cosine(r1) * r2s) + v * (sine(r1) * r2s) + w * squareRoot(1.0f - r2));
+}
+
+void cameraRay(uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint32_t& seed, Float3& origin, Float3& direction) {
+    float aspect = static_cast<float>(width) / static_cast<float>(height);
+    float tanHalfFov = tangent(45.0f * PI / 180.0f * 0.5f);
+    // Two statements: the order of the two random() calls has to match the shader
+    float jitterX = random(seed);
+    float jitterY = random(seed);
+    float ndcX = ((static_cast<float>(x) + jitterX) / static_cast<float>(width)) * 2.0f - 1.0f;
+    float ndcY = ((static_cast<float>(y) + jitterY) / static_cast<float>(height)) * 2.0f - 1.0f;
+    origin = {0.0f, 0.0f, 3.4f};
+    direction = normalize(Float3{ndcX * aspect * tanHalfFov, -ndcY * tanHalfFov, -1.0f});
+}
+
+template<typename S>
+class PacketTracer {
+public:
+    using Float = typename S::Float;
+    using Mask = typename S::Mask;
+    static constexpr uint32_t WIDTH = S::WIDTH;
+
+    // Rays in structure of arrays layout, lanes outside active are ignored
+    struct alignas(64) Packet {
+        float origin[3][WIDTH];
+        float direction[3][WIDTH];
+        float t[WIDTH];
+        uint32_t triangle[WIDTH];
+        uint32_t active;
+    };
+
+    explicit PacketTracer(const CpuFrame& frame) : frame(frame) {}
+
+    // Closest hit of every active lane, traversal order and tie breaking follow shaders/bvh.glsl
+    void trace(Packet& packet) const {
+        Float origin[3];
+        Float invDirection[3];
+        Float direction[3];
+        for(int axis = 0; axis < 3; axis++) {
+            origin[axis] = S::load(packet.origin[axis]);
+            direction[axis] = S::load(packet.direction[axis]);
+            invDirection[axis] = S::div(S::set(1.0f), direction[axis]);
+        }
+        for(uint32_t lane = 0; lane < WIDTH; lane++) {
+            packet.t[lane] = INF;
+            packet.triangle[lane] = NO_TRIANGLE;
+        }
+        Float tHit = S::set(INF);
+        Mask active = S::fromBits(packet.active);
+
+        uint32_t stack[BVH_STACK_SIZE];
+        uint32_t stackSize = 0;
+        uint32_t nodeIndex = 0;
+        Float tRoot;
+        // The slab test would treat the inverted box of an empty scene as unbounded
+        if(frame.nodes[0].aabbMin.x > frame.nodes[0].aabbMax.x) return;
+        if(S::bits(intersectAABB(origin, invDirection, frame.nodes[0], tHit, active, tRoot)) == 0) return;
+
+        while(true) {
+            const BVHNode& node = frame.nodes[nodeIndex];
+            if(node.triangleCount > 0) {
+                for(uint32_t i = 0; i < node.triangleCount; i++) {
+                    uint32_t triangle = frame.triangleIndices[node.leftFirst + i];
+                    Mask closer = intersectTriangle(origin, direction, frame.triangles[triangle], tHit, active, tHit);
+                    for(uint32_t bits = S::bits(closer), lane = 0; bits != 0; bits >>= 1, lane++) {
+                        if(bits & 1u) packet.triangle[lane] = triangle;
+                    }
+                }
+                if(stackSize == 0) break;
+                nodeIndex = stack[--stackSize];
+                continue;
+            }
+
+            uint32_t left = node.leftFirst;
+            uint32_t right = left + 1;
+            Float tLeft, tRight;
+            Mask hitLeft = intersectAABB(origin, invDirection, frame.nodes[left], tHit, active, tLeft);
+            Mask hitRight = intersectAABB(origin, invDirection, frame.nodes[right], tHit, active, tRight);
+            uint32_t leftBits = S::bits(hitLeft);
+            uint32_t rightBits = S::bits(hitRight);
+            if(leftBits == 0 && rightBits == 0) {
+                if(stackSize == 0) break;
+                nodeIndex = stack[--stackSize];
+            }else if(rightBits == 0) {
+                nodeIndex = left;
+            }else if(leftBits == 0) {
+                nodeIndex = right;
+            }else {
+                // Nearer child for most lanes first; with one lane this is the shader's order
+                tLeft = S::select(hitLeft, tLeft, S::set(INF));
+                tRight = S::select(hitRight, tRight, S::set(INF));
+                uint32_t leftNearer = laneCount(S::bits(S::both(hitLeft, S::lessEqual(tLeft, tRight))));
+                uint32_t rightNearer = laneCount(S::bits(S::both(hitRight, S::less(tRight, tLeft))));
+                if(rightNearer > leftNearer) {
+                    uint32_t swap = left; left = right; right = swap;
+                }
+                nodeIndex = left;
+                stack[stackSize++] = right;
+            }
+        }
+        S::store(packet.t, tHit);
+    }
+
+    // Traces samplesPerPixel paths through every pixel of the packet at (x, y), adds them to the
+    // accumulation and returns the rays traced
+    uint64_t renderPacket(uint32_t x, uint32_t y) const {
+        uint32_t pixelX[WIDTH], pixelY[WIDTH], seed[WIDTH];
+        float color[WIDTH][3];
+        uint32_t inside = 0;
+        for(uint32_t lane = 0; lane < WIDTH; lane++) {
+            pixelX[lane] = x + lane % S::PACKET_WIDTH;
+            pixelY[lane] = y + lane / S::PACKET_WIDTH;
+            if(pixelX[lane] >= frame.width || pixelY[lane] >= frame.height) continue;
+            inside |= 1u << lane;
+            seed[lane] = pcgHash((pixelY[lane] * frame.width + pixelX[lane]) ^ pcgHash(frame.frameIndex));
+            color[lane][0] = color[lane][1] = color[lane][2] = 0.0f;
+        }
+        if(inside == 0) return 0;
+
+        uint64_t rays = 0;
+        Packet packet;
+        for(uint32_t s = 0; s < frame.samplesPerPixel; s++) {
+            Float3 throughput[WIDTH];
+            for(uint32_t lane = 0; lane < WIDTH; lane++) {
+                Float3 origin{0.0f, 0.0f, 0.0f}, direction{0.0f, 0.0f, -1.0f};
+                if(inside & (1u << lane)) cameraRay(pixelX[lane], pixelY[lane], frame.width, frame.height, seed[lane], origin, direction);
+                setRay(packet, lane, origin, direction);
+                throughput[lane] = {1.0f, 1.0f, 1.0f};
+            }
+            packet.active = inside;
+
+            for(uint32_t bounce = 0; bounce <= frame.maxBounces && packet.active != 0; bounce++) {
+                trace(packet);
+                rays += laneCount(packet.active);
+                for(uint32_t lane = 0; lane < WIDTH; lane++) {
+                    if((packet.active & (1u << lane)) == 0) continue;
+                    if(packet.triangle[lane] == NO_TRIANGLE || !shade(packet, lane, bounce, throughput[lane], color[lane], seed[lane])) {
+                        packet.active &= ~(1u << lane);
+                    }
+                }
+            }
+        }
+
+        for(uint32_t lane = 0; lane < WIDTH; lane++) {
+            if((inside & (1u << lane)) == 0) continue;
+            float* pixel = frame.accumulation + 4 * (static_cast<size_t>(pixelY[lane]) * frame.width + pixelX[lane]);
+            // Progressive accumulation like the megakernel: rgb sum, alpha sample count
+            if(frame.frameIndex == 0) pixel[0] = pixel[1] = pixel[2] = pixel[3] = 0.0f;
+            pixel[0] += color[lane][0];
+            pixel[1] += color[lane][1];
+            pixel[2] += color[lane][2];
+            pixel[3] += static_cast<float>(frame.samplesPerPixel);
+        }
+        return rays;
+    }
+
+    // Fills the lanes from count consecutive rays (at most WIDTH), the rest stay inactive
+    static void loadRays(Packet& packet, const CpuRay* rays, uint32_t count) {
+        packet.active = 0;
+        for(uint32_t lane = 0; lane < WIDTH; lane++) {
+            Float3 origin{0.0f, 0.0f, 0.0f}, direction{0.0f, 0.0f, -1.0f};
+            if(lane < count) {
+                origin = {rays[lane].origin[0], rays[lane].origin[1], rays[lane].origin[2]};
+                direction = {rays[lane].direction[0], rays[lane].direction[1], rays[lane].direction[2]};
+                packet.active |= 1u << lane;
+            }
+            setRay(packet, lane, origin, direction);
+        }
+    }
+
+    // The active lanes against triangles [0, triangleCount), keeping the closest hit like trace()
+    // does. Returns the number of lane hits
+    uint64_t intersectTriangles(const Packet& packet, uint32_t triangleCount) const {
+        Float origin[3], direction[3];
+        for(int axis = 0; axis < 3; axis++) {
+            origin[axis] = S::load(packet.origin[axis]);
+            direction[axis] = S::load(packet.direction[axis]);
+        }
+        Float tHit = S::set(INF);
+        Mask active = S::fromBits(packet.active);
+        uint64_t hits = 0;
+        for(uint32_t i = 0; i < triangleCount; i++) {
+            hits += laneCount(S::bits(intersectTriangle(origin, direction, frame.triangles[i], tHit, active, tHit)));
+        }
+        return hits;
+    }
+
+    // The active lanes against the boxes of nodes [0, nodeCount)
+    uint64_t intersectBoxes(const Packet& packet, uint32_t nodeCount) const {
+        Float origin[3], invDirection[3];
+        for(int axis = 0; axis < 3; axis++) {
+            origin[axis] = S::load(packet.origin[axis]);
+            invDirection[axis] = S::div(S::set(1.0f), S::load(packet.direction[axis]));
+        }
+        Mask active = S::fromBits(packet.active);
+        uint64_t hits = 0;
+        for(uint32_t i = 0; i < nodeCount; i++) {
+            Float enter;
+            hits += laneCount(S::bits(intersectAABB(origin, invDirection, frame.nodes[i], S::set(INF), active, enter)));
+        }
+        return hits;
+    }
+
+private:
+    static void setRay(Packet& packet, uint32_t lane, Float3 origin, Float3 direction) {
+        packet.origin[0][lane] = origin.x;
+        packet.origin[1][lane] = origin.y;
+        packet.origin[2][lane] = origin.z;
+        packet.direction[0][lane] = direction.x;
+        packet.direction[1][lane] = direction.y;
+        packet.direction[2][lane] = direction.z;
+    }
+
+    // One bounce of trace() in shaders/pathtracer.comp, false once the path ends
+    bool shade(Packet& packet, uint32_t lane, uint32_t bounce, Float3& throughput, float* color, uint32_t& seed) const {
+        const CpuTriangle& triangle = frame.triangles[packet.triangle[lane]];
+        const Material& material = frame.materials[triangle.material];
+        color[0] += throughput.x * material.emission.x;
+        color[1] += throughput.y * material.emission.y;
+        color[2] += throughput.z * material.emission.z;
+
+        Float3 origin{packet.origin[0][lane], packet.origin[1][lane], packet.origin[2][lane]};
+        Float3 direction{packet.direction[0][lane], packet.direction[1][lane], packet.direction[2][lane]};
+        Float3 hitPoint = origin + direction * packet.t[lane];
+        Float3 e1{triangle.e1[0], triangle.e1[1], triangle.e1[2]};
+        Float3 e2{triangle.e2[0], triangle.e2[1], triangle.e2[2]};
+        Float3 normal = normalize(cross(e1, e2));
+        if(dot(normal, direction) > 0.0f) normal = normal * -1.0f;
+
+        throughput = throughput * Float3{material.albedo.x, material.albedo.y, material.albedo.z};
+        if(bounce >= 2) {
+            float p = throughput.x > throughput.y ? throughput.x : throughput.y;
+            p = p > throughput.z ? p : throughput.z;
+            if(random(seed) > p) return false;
+            throughput = throughput * (1.0f / p);
+        }
+
+        // Also after the last bounce: the shader draws these random numbers too, later samples see the same sequence
+        setRay(packet, lane, hitPoint + normal * 1e-4f, sampleCosineHemisphere(normal, seed));
+        return true;
+    }
+
+    Mask intersectAABB(const Float* origin, const Float* invDirection, const BVHNode& node, Float tMax, Mask active, Float& enter) const {
+        const float aabbMin[3] = {node.aabbMin.x, node.aabbMin.y, node.aabbMin.z};
+        const float aabbMax[3] = {node.aabbMax.x, node.aabbMax.y, node.aabbMax.z};
+        Float tNear[3], tFar[3];
+        for(int axis = 0; axis < 3; axis++) {
+            Float t0 = S::mul(S::sub(S::set(aabbMin[axis]), origin[axis]), invDirection[axis]);
+            Float t1 = S::mul(S::sub(S::set(aabbMax[axis]), origin[axis]), invDirection[axis]);
+            tNear[axis] = S::min(t0, t1);
+            tFar[axis] = S::max(t0, t1);
+        }
+        enter = S::max(S::max(tNear[0], tNear[1]), S::max(tNear[2], S::set(0.0f)));
+        Float exit = S::min(S::min(tFar[0], tFar[1]), S::min(tFar[2], tMax));
+        return S::both(active, S::lessEqual(enter, exit));
+    }
+
+    // Moeller-Trumbore against all lanes. Lanes whose hit is closer than tMax get it in tHit, returns them
+    Mask intersectTriangle(const Float* origin, const Float* direction, const CpuTriangle& triangle, Float tMax, Mask active, Float& tHit) const {
+        Float e1[3] = {S::set(triangle.e1[0]), S::set(triangle.e1[1]), S::set(triangle.e1[2])};
+        Float e2[3] = {S::set(triangle.e2[0]), S::set(triangle.e2[1]), S::set(triangle.e2[2])};
+        Float p[3], s[3], q[3];
+        crossProduct(direction, e2, p);
+        Float det = dotProduct(e1, p);
+        Float invDet = S::div(S::set(1.0f), det);
+        for(int axis = 0; axis < 3; axis++) s[axis] = S::sub(origin[axis], S::set(triangle.v0[axis]));
+        Float u = S::mul(dotProduct(s, p), invDet);
+        crossProduct(s, e1, q);
+        Float v = S::mul(dotProduct(direction, q), invDet);
+        Float t = S::mul(dotProduct(e2, q), invDet);
+
+        Mask hit = S::both(active, S::lessEqual(S::set(1e-9f), S::abs(det)));
+        hit = S::both(hit, S::both(S::lessEqual(S::set(0.0f), u), S::lessEqual(u, S::set(1.0f))));
+        hit = S::both(hit, S::both(S::lessEqual(S::set(0.0f), v), S::lessEqual(S::add(u, v), S::set(1.0f))));
+        hit = S::both(hit, S::both(S::less(S::set(1e-4f), t), S::less(t, tMax)));
+        tHit = S::select(hit, t, tMax);
+        return hit;
+    }
+
+    static Float dotProduct(const Float* a, const Float* b) {
+        return S::add(S::add(S::mul(a[0], b[0]), S::mul(a[1], b[1])), S::mul(a[2], b[2]));
+    }
+
+    static void crossProduct(const Float* a, const Float* b, Float* result) {
+        result[0] = S::sub(S::mul(a[1], b[2]), S::mul(a[2], b[1]));
+        result[1] = S::sub(S::mul(a[2], b[0]), S::mul(a[0], b[2]));
+        result[2] = S::sub(S::mul(a[0], b[1]), S::mul(a[1], b[0]));
+    }
+
+    const CpuFrame& frame;
+};
+
+template<typename S>
+uint64_t renderTile(const CpuFrame& frame, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1) {
+    PacketTracer<S> tracer(frame);
+    uint64_t rays = 0;
+    for(uint32_t y = y0; y < y1; y += S::PACKET_HEIGHT) {
+        for(uint32_t x = x0; x < x1; x += S::PACKET_WIDTH) {
+            rays += tracer.renderPacket(x, y);
+        }
+    }
+    return rays;
+}
+
+template<typename S>
+void traceRays(const CpuFrame& frame, const CpuRay* rays, uint32_t count, float* t, uint32_t* triangles) {
+    PacketTracer<S> tracer(frame);
+    typename PacketTracer<S>::Packet packet;
+    for(uint32_t first = 0; first < count; first += S::WIDTH) {
+        uint32_t lanes = count - first < S::WIDTH ? count - first : S::WIDTH;
+        PacketTracer<S>::loadRays(packet, rays + first, lanes);
+        tracer.trace(packet);
+        for(uint32_t lane = 0; lane < lanes; lane++) {
+            t[first + lane] = packet.t[lane];
+            triangles[first + lane] = packet.triangle[lane];
+        }
+    }
+}
+
+template<typename S>
+uint64_t intersectTriangles(const CpuFrame& frame, const CpuRay* rays, uint32_t rayCount, uint32_t triangleCount) {
+    PacketTracer<S> tracer(frame);
+    typename PacketTracer<S>::Packet packet;
+    uint64_t hits = 0;
+    for(uint32_t first = 0; first < rayCount; first += S::WIDTH) {
+        PacketTracer<S>::loadRays(packet, rays + first, rayCount - first < S::WIDTH ? rayCount - first : S::WIDTH);
+        hits += tracer.intersectTriangles(packet, triangleCount);
+    }
+    return hits;
+}
+
+template<typename S>
+uint64_t intersectBoxes(const CpuFrame& frame, const CpuRay* rays, uint32_t rayCount, uint32_t nodeCount) {
+    PacketTracer<S> tracer(frame);
+    typename PacketTracer<S>::Packet packet;
+    uint64_t hits = 0;
+    for(uint32_t first = 0; first < rayCount; first += S::WIDTH) {
+        PacketTracer<S>::loadRays(packet, rays + first, rayCount - first < S::WIDTH ? rayCount - first : S::WIDTH);
+        hits += tracer.intersectBoxes(packet, nodeCount);
+    }
+    return hits;
+}
+
+template<typename S>
+CpuKernels makeKernels() {
+    return {S::WIDTH, &renderTile<S>, &traceRays<S>, &intersectTriangles<S>, &intersectBoxes<S>};
+}
+
+}
@@ -0,0 +1,99 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "bvh.h"
+#include "scene.h"
+#include "settings.h"
+#include "tilescheduler.h"
+
+// Triangle prepared for the packet kernels, the edges of shaders/intersect.glsl precomputed
+struct CpuTriangle {
+    float v0[3];
+    float e1[3];
+    float e2[3];
+    uint32_t material;
+};
+
+// Everything a packet kernel reads, raw pointers only (see include/cpupacket.h)
+struct CpuFrame {
+    const BVHNode* nodes;
+    const uint32_t* triangleIndices;
+    // By triangle id
+    const CpuTriangle* triangles;
+    const Material* materials;
+    uint32_t width;
+    uint32_t height;
+    uint32_t frameIndex;
+    uint32_t samplesPerPixel;
+    uint32_t maxBounces;
+    // rgb running sum and sample count per pixel, the layout of the GPU accumulation image
+    float* accumulation;
+};
+
+// Ray for CpuKernels::traceRays and the intersection kernels, direction need not be normalized
+struct CpuRay {
+    float origin[3];
+    float direction[3];
+};
+
+// The packet kernels compiled for one instruction set, src/cpupacket_*.cpp. Rays are handed out
+// in packets of packetWidth consecutive entries.
+struct CpuKernels {
+    uint32_t packetWidth;
+    // Renders the pixels [x0, x1) x [y0, y1) of frame, returns the number of rays traced
+    uint64_t (*renderTile)(const CpuFrame& frame, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1);
+    // Closest hit of count rays through the BVH of frame, t 1e30 and triangle 0xFFFFFFFF on a miss
+    void (*traceRays)(const CpuFrame& frame, const CpuRay* rays, uint32_t count, float* t, uint32_t* triangles);
+    // Every ray against the first triangleCount triangles or nodeCount node boxes, without a BVH.
+    // Return the number of hits; only the benchmarks use them
+    uint64_t (*intersectTriangles)(const CpuFrame& frame, const CpuRay* rays, uint32_t rayCount, uint32_t triangleCount);
+    uint64_t (*intersectBoxes)(const CpuFrame& frame, const CpuRay* rays, uint32_t rayCount, uint32_t nodeCount);
+
+    static CpuKernels scalar();
+    static CpuKernels sse();
+    static CpuKernels avx2();
+    static CpuKernels avx512();
+};
+
+// Reference path tracer on the CPU: traces the scene and binary BVH the GPU gets with the
+// megakernel's sampling and random numbers, so both converge to the same image. Rays are traced
+// in packets of 4 (SSE), 8 (AVX2) or 16 (AVX-512) lanes, picked at runtime from CPUID.
+class CpuRenderer {
+public:
+    // isa Auto picks the widest one detectIsa finds, anything else throws if the CPU lacks it
+    CpuRenderer(const Scene& scene, const BVH& bvh, TileScheduler& scheduler, uint32_t width, uint32_t height, CpuIsa isa);
+
+    // Widest instruction set both the CPU and the OS (saved register state) support
+    static CpuIsa detectIsa();
+    static const char* isaName(CpuIsa isa);
+    static uint32_t packetWidth(CpuIsa isa);
+    // Kernels of isa, which the CPU has to support
+    static CpuKernels kernelsFor(CpuIsa isa);
+    // Vertices and edges of every scene triangle, by triangle id
+    static std::vector<CpuTriangle> prepareTriangles(const Scene& scene);
+
+    // Adds frame frameIndex to the accumulation, frame 0 replaces it. Returns the rays traced
+    uint64_t renderFrame(uint32_t frameIndex, uint32_t samplesPerPixel, uint32_t maxBounces);
+    const std::vector<float>& accumulation() const { return pixels; }
+    CpuIsa isa() const { return selectedIsa; }
+    uint32_t tileSize() const { return tileEdge; }
+
+private:
+    // One per worker, on its own cache line
+    struct alignas(64) RayCounter {
+        uint64_t rays;
+    };
+
+    const Scene& scene;
+    const BVH& bvh;
+    TileScheduler& scheduler;
+    uint32_t width;
+    uint32_t height;
+    CpuIsa selectedIsa;
+    CpuKernels kernels;
+    std::vector<CpuTriangle> triangles;
+    std::vector<float> pixels;
+    std::vector<RayCounter> rayCounters;
+    // Edge of the square tiles, sized for the L1 cache and a multiple of every packet footprint
+    uint32_t tileEdge;
+};
@@ -0,0 +1,58 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "scene.h"
+#include "threadpool.h"
+
+// Triangles of one glTF mesh (all its triangle primitives) in the mesh's own space
+struct GltfMesh {
+    std::string name;
+    // w is 1, like Scene::vertices
+    std::vector<glm::vec4> vertices;
+    std::vector<uint32_t> indices;
+    // Per triangle, index into GltfModel::materials
+    std::vector<uint32_t> triangleMaterials;
+    glm::vec3 boundsMin = glm::vec3(1e30f);
+    glm::vec3 boundsMax = glm::vec3(-1e30f);
+};
+
+// A node of the scene that references a mesh, with the product of all transforms above it
+struct GltfInstance {
+    uint32_t mesh;
+    glm::mat4 transform;
+};
+
+struct GltfModel {
+    std::vector<GltfMesh> meshes;
+    std::vector<GltfInstance> instances;
+    // The file's materials followed by the default one of primitives without a material
+    std::vector<Material> materials;
+
+    size_t triangleCount() const;
+    // Bounds of the instances' transformed mesh boxes, so slightly larger than the triangles
+    void bounds(glm::vec3& min, glm::vec3& max) const;
+    // Uniform scale and translation that centers the model over the floor of [min, max] and fits it inside
+    glm::mat4 fitTransform(const glm::vec3& min, const glm::vec3& max) const;
+    // Appends every instance, transformed by transform after its own, and the materials to scene.
+    // Instances are written in parallel, each into its own range of the scene's arrays
+    void appendTo(Scene& scene, const glm::mat4& transform, ThreadPool& pool) const;
+};
+
+// glTF 2.0 importer for .gltf (external or base64 embedded buffers) and .glb files. Buffers are
+// memory mapped (Loader::mapFile) and accessors are decoded from the mapping straight into the
+// mesh streams, the JSON is parsed in place. Meshes are decoded in parallel on the pool.
+// Only triangle primitives are imported with their positions, the base color and emissive
+// factors become the material; textures, cameras, lights and animations are ignored.
+class GltfLoader {
+public:
+    static GltfModel load(const std::string& filename, ThreadPool& pool);
+    // The model of filename fitted into the empty Cornell box: the fixed camera frames it and
+    // the box's light illuminates it even if the file has no emissive materials
+    static Scene loadScene(const std::string& filename, ThreadPool& pool);
+
+    static constexpr uint32_t GLB_MAGIC = 0x46546C67;
+    static constexpr uint32_t GLB_CHUNK_JSON = 0x4E4F534A;
+    static constexpr uint32_t GLB_CHUNK_BIN = 0x004E4942;
+};
@@ -0,0 +1,13 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class ImageIO {
+public:
+    // Writes tightly packed 8 bit RGBA pixels as binary PPM (alpha is dropped)
+    static void writePPM(const std::string& filename, uint32_t width, uint32_t height, const uint8_t* rgba);
+    // Turns accumulated radiance (rgb running sum, alpha sample count) into 8 bit sRGB RGBA,
+    // the same transform the kernels apply to the output image
+    static void resolveAccumulation(const float* accumulated, size_t pixelCount, uint8_t* rgba);
+};
@@ -0,0 +1,93 @@
+#pragma once
+#include <cstdint>
+#include <ostream>
+#include <vector>
+#include <vulkan/vulkan.h>
+#include <glm/glm.hpp>
+#include "allocator.h"
+#include "bvh.h"
+#include "scene.h"
+
+// Linear BVH (Karras 2012) over 30 bit Morton codes of the triangle centroids.
+// Internal node i of the Karras hierarchy stores its children in slots 2i+1 and 2i+2,
+// which yields the same 32 byte layout (right child = left + 1) that BVHBuilder emits.
+// buildReference runs exactly the algorithm of the GPU passes and is used to validate them.
+// Prefix lengths grow strictly down the tree and ties are broken by the 32 bit index, so
+// no path holds more than 62 internal nodes and the tree always fits BVH::MAX_DEPTH.
+class LBVH {
+public:
+    static uint32_t mortonCode(const glm::vec3& unitPosition);
+    static void centroidBounds(const Scene& scene, glm::vec3& min, glm::vec3& max);
+    static BVH buildReference(const Scene& scene);
+    // Checks the structural invariants of candidate and compares it with reference.
+    // Returns false (and logs why) if candidate is not a valid BVH for scene.
+    static bool validate(const Scene& scene, const BVH& reference, const BVH& candidate, std::ostream& log);
+};
+
+// Records the LBVH build as compute passes: Morton codes, 8 pass 4 bit LSD radix sort,
+// hierarchy emission and bottom up AABB fitting.
+class GpuLBVHBuilder {
+public:
+    GpuLBVHBuilder(GpuAllocator& allocator, VkDevice device, VkPipelineCache pipelineCache);
+    void destroy();
+
+    // nodeBuffer needs room for 2N-1 nodes and triangleIndexBuffer for N indices.
+    // Scratch memory stays alive until the next record or destroy, so the command buffer
+    // has to finish executing before either is called.
+    void record(VkCommandBuffer cmd, const Scene& scene, VkBuffer vertexBuffer, VkBuffer indexBuffer,
+                VkBuffer nodeBuffer, VkBuffer triangleIndexBuffer);
+
+private:
+    // Must match the push_constant block in shaders/lbvh.glsl
+    struct PushConstants {
+        float sceneMin[3];
+        uint32_t triangleCount;
+        float sceneExtentInv[3];
+        uint32_t digitShift;
+        uint32_t chunkCount;
+    };
+
+    struct ScratchBuffer {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        GpuAllocation allocation;
+    };
+
+    enum Binding : uint32_t {
+        VERTICES, INDICES, KEYS_IN, VALUES_IN, KEYS_OUT, VALUES_OUT,
+        HISTOGRAM, PARENTS, SLOTS, FLAGS, NODES, BINDING_COUNT
+    };
+
+    void allocateScratch(uint32_t triangleCount);
+    void freeScratch();
+    void dispatch(VkCommandBuffer cmd, VkPipeline pipeline, VkDescriptorSet set, const PushConstants& push, uint32_t groups);
+
+    GpuAllocator* allocator;
+    VkDevice device;
+
+    VkDescriptorSetLayout setLayout;
+    VkPipelineLayout pipelineLayout;
+    VkDescriptorPool descriptorPool;
+    // [0] sorts A -> B, [1] sorts B -> A; hierarchy and fit read the final result from A
+    VkDescriptorSet descriptorSets[2];
+
+    VkPipeline mortonPipeline;
+    VkPipeline countPipeline;
+    VkPipeline scanPipeline;
+    VkPipeline scatterPipeline;
+    VkPipeline hierarchyPipeline;
+    VkPipeline fitPipeline;
+
+    uint32_t scratchCapacity = 0;
+    ScratchBuffer keys[2];
+    ScratchBuffer values[2];
+    ScratchBuffer histogram;
+    ScratchBuffer parents;
+    ScratchBuffer slots;
+    ScratchBuffer flags;
+
+    static constexpr uint32_t WORKGROUP_SIZE = 64;
+    // Keys every sort invocation handles serially, which keeps the scatter stable
+    static constexpr uint32_t SORT_CHUNK = 256;
+    static constexpr uint32_t RADIX_BITS = 4;
+    static constexpr uint32_t RADIX = 1 << RADIX_BITS;
+};
@@ -1,8 +1,52 @@
 #pragma once
+#include <cstddef>
 #include <vector>
 #include <string>
 
+enum class AccessPattern {
+    Normal,
+    Sequential,
+    Random
+};
+
+// Read-only view of a whole file. Large files are memory mapped straight from the page cache
+// and unmapped when the view is destroyed, small files are copied into an owned buffer.
+class FileView {
+public:
+    FileView() = default;
+    ~FileView();
+    FileView(FileView&& other) noexcept;
+    FileView& operator=(FileView&& other) noexcept;
+    FileView(const FileView&) = delete;
+    FileView& operator=(const FileView&) = delete;
+
+    const char* data() const;
+    size_t size() const;
+    bool isMapped() const { return mapping != nullptr; }
+
+    // Forwards to madvise for mapped views, no-op for buffered ones
+    void advise(AccessPattern pattern) const;
+    // Asks the kernel to start reading [offset, offset + length) ahead of use
+    void prefetch(size_t offset, size_t length) const;
+
+private:
+    friend class Loader;
+    void release();
+
+    void* mapping = nullptr;
+    size_t mappingSize = 0;
+    std::vector<char> buffer;
+};
+
 class Loader {
 public:
     static std::vector<char> readFile(const std::string& filename);
-};
\ No newline at end of file
+    // Files smaller than MAP_THRESHOLD are read into memory, mapping them costs more than copying
+    static FileView mapFile(const std::string& filename, AccessPattern pattern = AccessPattern::Sequential);
+    static bool fileExists(const std::string& filename);
+    // Writes into a uniquely named temporary file next to filename, syncs it and renames it over
+    // the target, so a crash, a concurrent reader or a concurrent writer never sees a half written file
+    static void writeFileAtomic(const std::string& filename, const std::vector<char>& data);
+
+    static constexpr size_t MAP_THRESHOLD = 64 * 1024;
+};
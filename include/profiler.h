@@ -0,0 +1,85 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+// Times named passes of every frame with timestamp query pairs and, if enabled, counts their
+// compute shader invocations with pipeline statistics queries. Every frame slot has its own
+// queries; they are read when the slot is reused, so the results are framesInFlight frames old
+// and reading them never stalls. Keeps the last WINDOW frames of every pass for min/avg/p99.
+class GpuProfiler {
+public:
+    struct PassStats {
+        std::string name;
+        uint32_t samples;
+        double minMs;
+        double avgMs;
+        double p99Ms;
+        // Average compute shader invocations, 0 without pipeline statistics
+        double invocations;
+    };
+
+    // pipelineStatistics needs the pipelineStatisticsQuery feature to be enabled on device
+    GpuProfiler(VkPhysicalDevice physicalDevice, VkDevice device, uint32_t queueFamily, uint32_t framesInFlight, bool pipelineStatistics);
+    void destroy();
+
+    // False if the queue family has no timestamp support, every other call is a no-op then
+    bool enabled() const { return timestampPool != VK_NULL_HANDLE; }
+
+    // Collects the frame last recorded into frameSlot, which must have finished, and resets its queries
+    void beginFrame(VkCommandBuffer cmd, uint32_t frameSlot);
+    // Passes must not nest, at most MAX_PASSES per frame
+    void beginPass(VkCommandBuffer cmd, const char* name);
+    void endPass(VkCommandBuffer cmd);
+    // Collects a finished slot without recording into it again, e.g. after the last frame
+    void collect(uint32_t frameSlot);
+
+    // Maps GPU ticks to Trace::now(), the passes collected from then on also become GPU trace zones
+    void calibrate(int64_t cpuTime, uint64_t gpuTicks);
+    // Fallback without VK_EXT_calibrated_timestamps: records a timestamp into a one time command buffer,
+    // finishCalibration places it halfway between the submission and the end of the wait for it
+    void recordCalibration(VkCommandBuffer cmd);
+    void finishCalibration(int64_t submitTime, int64_t completeTime);
+
+    std::vector<PassStats> stats() const;
+    void print(std::ostream& out) const;
+    void writeJson(const std::string& filename, const std::string& deviceName) const;
+
+private:
+    struct History {
+        std::string name;
+        std::deque<double> milliseconds;
+        std::deque<uint64_t> invocations;
+    };
+
+    struct FrameQueries {
+        // Names of the passes recorded into the slot, in query order
+        std::vector<std::string> passes;
+    };
+
+    History& history(const std::string& name);
+
+    VkDevice device;
+    VkQueryPool timestampPool = VK_NULL_HANDLE;
+    VkQueryPool statisticsPool = VK_NULL_HANDLE;
+    uint64_t timestampMask = 0;
+    float timestampPeriod = 0.0f;
+
+    // Query after the frame slots' ones, written by recordCalibration
+    uint32_t calibrationQuery = 0;
+    bool calibrated = false;
+    int64_t calibrationCpu = 0;
+    uint64_t calibrationGpu = 0;
+
+    std::vector<FrameQueries> frameQueries;
+    uint32_t currentSlot = 0;
+    bool passOpen = false;
+    // In order of first appearance
+    std::vector<History> histories;
+
+    static constexpr uint32_t MAX_PASSES = 16;
+    static constexpr size_t WINDOW = 512;
+};
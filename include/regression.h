@@ -0,0 +1,62 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+#include "settings.h"
+
+// Renders the canonical configurations of the compute path headless and compares every one
+// with the CPU renderer, for the Cornell box (or --scene) and every regression scene. Both use
+// the same scene, samples and random numbers, so the images only differ where floating point
+// differences send a path elsewhere; a broken kernel or BVH shows up as a large RMSE. Render
+// times are checked against a stored baseline, so one run catches correctness and performance
+// regressions. Run it on a software ICD (lavapipe) where there is no GPU.
+class RegressionHarness {
+public:
+    explicit RegressionHarness(const RenderSettings& settings);
+
+    // Writes the images, diffs of the failing cases and regression.json. False if any case failed
+    bool run();
+
+private:
+    struct Case {
+        std::string name;
+        BVHBuildMode bvhBuildMode;
+        bool wideBVH;
+    };
+
+    struct Result {
+        // <scene>/<case>, the key of the baseline
+        std::string name;
+        double cpuSeconds;
+        double gpuSeconds;
+        // 0 without a baseline
+        double baselineSeconds;
+        double rmse;
+        // Largest difference of one channel, in [0, 1]
+        double maxError;
+        bool accurate;
+        bool fast;
+    };
+
+    // Renders every case of one scene (empty: the Cornell box) and appends the results
+    void runScene(const std::string& sceneFile, std::vector<Result>& results);
+
+    // RMSE and largest difference of the resolved 8 bit sRGB images, scaled to [0, 1]
+    void compare(const std::vector<uint8_t>& a, const std::vector<uint8_t>& b, double& rmse, double& maxError) const;
+    void writeDiffImage(const std::string& filename, const std::vector<uint8_t>& a, const std::vector<uint8_t>& b) const;
+    void writeReport(const std::vector<Result>& results) const;
+    // Lines of "<scene>/<case> <seconds>" after a "settings <width> <height> <frames>" line
+    // that has to match this run, comments start with #
+    void readBaseline();
+    void writeBaseline(const std::vector<Result>& results) const;
+    std::vector<uint8_t> resolve(const std::vector<float>& accumulation) const;
+    std::string path(const std::string& filename) const;
+
+    RenderSettings settings;
+    size_t pixelCount;
+    std::map<std::string, double> baseline;
+
+    // The difference image is scaled up by this, small errors would be invisible otherwise
+    static constexpr int DIFF_SCALE = 4;
+};
@@ -0,0 +1,36 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+// std430 layout, must match shaders/scene.glsl
+struct Material {
+    glm::vec4 albedo;
+    glm::vec4 emission;
+};
+
+struct Scene {
+    // xyz position, w unused (keeps the std430 stride at 16 bytes)
+    std::vector<glm::vec4> vertices;
+    // Three vertex indices per triangle
+    std::vector<uint32_t> indices;
+    std::vector<uint32_t> triangleMaterials;
+    std::vector<Material> materials;
+
+    size_t triangleCount() const { return indices.size() / 3; }
+    // Triangles whose material emits light, the light list for next event estimation
+    std::vector<uint32_t> emissiveTriangles() const;
+
+    uint32_t addMaterial(const glm::vec3& albedo, const glm::vec3& emission = glm::vec3(0.0f));
+    void addTriangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, uint32_t material);
+    // Corners in counter clockwise order seen from the side the normal points to
+    void addQuad(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, const glm::vec3& d, uint32_t material);
+    // Axis aligned box rotated around the y axis
+    void addBox(const glm::vec3& center, const glm::vec3& halfExtent, float angleY, uint32_t material);
+    void addSphere(const glm::vec3& center, float radius, uint32_t subdivisions, uint32_t material);
+
+    // Walls and ceiling light of the Cornell box without its contents
+    static Scene createCornellRoom();
+    // The classic Cornell box with two boxes and a tessellated sphere, fits into [-1, 1]^3
+    static Scene createCornellBox();
+};
@@ -0,0 +1,101 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+enum class BVHBuildMode {
+    // Binned SAH on the CPU thread pool
+    SAH,
+    // Karras LBVH, CPU reference implementation
+    LBVH,
+    // Karras LBVH built by compute passes on the render queue
+    LBVHGpu
+};
+
+enum class RenderKernel {
+    // One compute shader traces whole paths
+    Megakernel,
+    // Separate generate, extend, shade and shadow kernels connected by ray queues
+    Wavefront
+};
+
+// Instruction set of the CPU renderer's ray packets
+enum class CpuIsa {
+    // Widest one the CPU supports
+    Auto,
+    Scalar,
+    SSE,
+    AVX2,
+    AVX512
+};
+
+struct RenderSettings {
+    // Headless mode renders without window/surface/swapchain and writes the result to outputFile
+    bool headless = false;
+    uint32_t width = 800;
+    uint32_t height = 600;
+    // With targetNoise the most frames rendered before giving up on convergence
+    uint32_t frameCount = 64;
+    // Headless stops once every tile's relative standard error is below it, 0 always renders frameCount frames
+    float targetNoise = 0.0f;
+    // With targetNoise: after a warm up only trace the tiles that are still above it
+    bool adaptive = false;
+    std::string outputFile = "output.ppm";
+    // glTF 2.0 (.gltf or .glb) model rendered in the empty Cornell box, empty renders the furnished box
+    std::string sceneFile;
+    // Serialized VkPipelineCache, empty disables persistence
+    std::string pipelineCacheFile = "pipeline_cache.bin";
+    BVHBuildMode bvhBuildMode = BVHBuildMode::SAH;
+    // Compare the GPU LBVH against the CPU reference after building it
+    bool validateBVH = false;
+    // Collapse the binary BVH into the compressed 8 wide layout before rendering
+    bool wideBVH = false;
+    RenderKernel kernel = RenderKernel::Megakernel;
+    // Frames the CPU may record ahead of the GPU
+    uint32_t framesInFlight = 2;
+    // Synchronize with timeline semaphores when the device supports them, fences and binary semaphores otherwise
+    bool timelineSemaphores = true;
+    // Physical device by index or (part of its) name, empty picks the highest scoring one
+    std::string device;
+    // Upload on a transfer only queue family when the device has one
+    bool transferQueue = true;
+    // Build BVHs on a compute only queue family when the device has one
+    bool asyncCompute = true;
+    // Headless only: also render on every other suitable GPU, each one accumulates a share of the frames
+    bool multiGpu = false;
+
+    // Time the passes of every frame with GPU queries, reported with the throughput
+    bool profile = false;
+    // Also count compute shader invocations per pass, needs the pipelineStatisticsQuery feature
+    bool pipelineStatistics = false;
+    // Rewritten with the rolling pass statistics on every report, empty disables it
+    std::string profileJson;
+    // Chrome trace of CPU zones and GPU passes written on exit, empty disables tracing. Implies profile
+    std::string traceFile;
+
+    // Render headless on the CPU instead of Vulkan, the reference for the compute path
+    bool cpu = false;
+    CpuIsa cpuIsa = CpuIsa::Auto;
+    // Render threads of the CPU renderer, 0 starts one per CPU the process may run on
+    uint32_t cpuThreads = 0;
+    // Pin every render thread to its own CPU (Linux only)
+    bool pinThreads = true;
+
+    // Render the canonical configurations on the GPU and the CPU, compare them and write the
+    // images and a report into this directory. Empty renders normally
+    std::string regressionDir;
+    // Largest RMSE of the 8 bit sRGB images (scaled to [0, 1]) a regression case may have
+    float rmseThreshold = 0.02f;
+    // glTF scenes the regression run renders after sceneFile (the Cornell box by default)
+    std::vector<std::string> regressionScenes;
+    // Stored GPU render times of the regression cases, empty skips the performance check
+    std::string baselineFile;
+    // A regression case fails when it renders this fraction slower than its baseline
+    float timeTolerance = 0.5f;
+    // Rewrite baselineFile with the times of this run instead of checking against it
+    bool updateBaseline = false;
+    // Not a command line option: headless runs keep the final accumulation for accumulation()
+    bool keepAccumulation = false;
+
+    static RenderSettings fromArguments(int argc, char** argv);
+};
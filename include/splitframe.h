@@ -0,0 +1,76 @@
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+#include "allocator.h"
+#include "timeline.h"
+
+// Additional GPU for split frame rendering. Owns a logical device with its own copy of the
+// scene and the megakernel and accumulates the sample ranges (frame index ranges) it is given
+// into its own rgba32f image; the application sums the accumulation images of all devices.
+class SplitFrameWorker {
+public:
+    // sceneBuffers holds the contents of the six scene bindings of shaders/scene.glsl in order
+    SplitFrameWorker(VkPhysicalDevice physicalDevice, const std::vector<char>& shaderCode, VkExtent2D extent,
+                     uint32_t samplesPerPixel, uint32_t maxBounces, const std::vector<std::vector<char>>& sceneBuffers);
+    void destroy();
+
+    // Renders frames [firstFrame, firstFrame + count) and waits for them, returns the seconds it took
+    double render(uint32_t firstFrame, uint32_t count);
+    // Accumulated rgb sums and sample counts, 4 floats per pixel
+    void readAccumulation(std::vector<float>& pixels);
+    const std::string& name() const { return deviceName; }
+
+private:
+    // Must match the push_constant block in shaders/pathtracer.comp
+    struct PushConstants {
+        uint32_t frameIndex;
+        uint32_t samplesPerPixel;
+        uint32_t maxBounces;
+    };
+
+    struct Buffer {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        GpuAllocation allocation;
+    };
+
+    static constexpr uint32_t SCENE_BUFFERS = 6;
+    // Frames recorded into one command buffer, keeps single submissions short
+    static constexpr uint32_t FRAMES_PER_SUBMIT = 8;
+
+    void createDevice(VkPhysicalDevice physicalDevice);
+    void createImages();
+    void uploadScene(const std::vector<std::vector<char>>& sceneBuffers);
+    void createPipeline(VkPhysicalDevice physicalDevice, const std::vector<char>& shaderCode);
+    VkCommandBuffer beginCommands();
+    uint64_t submitCommands(VkCommandBuffer cmd);
+
+    std::string deviceName;
+    VkDevice device = VK_NULL_HANDLE;
+    VkQueue queue = VK_NULL_HANDLE;
+    uint32_t queueFamily = 0;
+    std::optional<GpuAllocator> allocator;
+    std::optional<GpuTimeline> timeline;
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+
+    VkExtent2D extent;
+    uint32_t samplesPerPixel;
+    uint32_t maxBounces;
+    VkExtent2D workgroupSize;
+
+    VkImage accumulationImage = VK_NULL_HANDLE;
+    GpuAllocation accumulationAllocation;
+    VkImageView accumulationView = VK_NULL_HANDLE;
+    VkImage outputImage = VK_NULL_HANDLE;
+    GpuAllocation outputAllocation;
+    VkImageView outputView = VK_NULL_HANDLE;
+    Buffer sceneBuffers[SCENE_BUFFERS];
+
+    VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+    VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+    VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+    VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+};
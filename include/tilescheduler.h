@@ -0,0 +1,75 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Spreads the tiles of an image over persistent worker threads, one per CPU. The tiles are
+// ordered along a Hilbert curve and dealt out as contiguous runs, so every worker starts on a
+// compact region; a worker that runs dry steals from the far end of another worker's run,
+// first from workers on its own NUMA node. Every worker owns a Chase-Lev style deque, there is
+// no lock on the tiles. Workers are pinned to their CPU where the platform allows it (Linux).
+class TileScheduler {
+public:
+    // (tileX, tileY, worker index)
+    using Task = std::function<void(uint32_t, uint32_t, uint32_t)>;
+
+    // threadCount 0 starts one worker per CPU the process may run on
+    TileScheduler(uint32_t threadCount, bool pinThreads);
+    ~TileScheduler();
+    TileScheduler(const TileScheduler&) = delete;
+    TileScheduler& operator=(const TileScheduler&) = delete;
+
+    // Runs task for every tile of a tilesX x tilesY grid and returns once all of them finished
+    void run(uint32_t tilesX, uint32_t tilesY, const Task& task);
+
+    uint32_t workerCount() const { return static_cast<uint32_t>(workers.size()); }
+    uint32_t nodeCount() const { return nodes; }
+    bool pinned() const { return pinThreads; }
+    // Tiles taken from other workers' deques during the last run
+    uint64_t lastSteals() const;
+
+    // Position of (x, y) along the Hilbert curve through a 2^order x 2^order grid
+    static uint32_t hilbertIndex(uint32_t order, uint32_t x, uint32_t y);
+    // Largest power of two square tile, at most 64 pixels, whose bytesPerPixel fill at most
+    // half of the L1 data cache
+    static uint32_t cacheTileSize(uint32_t bytesPerPixel);
+
+private:
+    struct alignas(64) Worker {
+        std::thread thread;
+        uint32_t cpu;
+        uint32_t node;
+        // Workers on the same node first, then the others
+        std::vector<uint32_t> victims;
+        // Packed (y << 16 | x) tiles in reverse run order: the owner pops at bottom and walks
+        // its run forwards, thieves take from top, the end of the run
+        std::vector<uint32_t> tiles;
+        std::atomic<int64_t> top{0};
+        std::atomic<int64_t> bottom{0};
+        uint64_t steals = 0;
+    };
+
+    enum class StealResult { Empty, Retry, Stolen };
+
+    void workerLoop(uint32_t index);
+    bool pop(Worker& worker, uint32_t& tile);
+    StealResult steal(Worker& victim, uint32_t& tile);
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    uint32_t nodes = 1;
+    bool pinThreads;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    // Bumped by run(), workers start the run when they see it change
+    uint64_t generation = 0;
+    uint32_t running = 0;
+    bool stopping = false;
+    const Task* task = nullptr;
+};
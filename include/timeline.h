@@ -0,0 +1,94 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+// Monotonic progress counter of the work submitted to one queue. Every submit signals the next
+// value; the host polls or waits for values and other timelines can wait for them on the GPU,
+// so producers and consumers only exchange numbers instead of fences.
+// Backed by a timeline semaphore (Vulkan 1.2 or VK_KHR_timeline_semaphore). Without them every
+// value gets a fence for the host and a binary semaphore that one GPU waiter can consume.
+class GpuTimeline {
+public:
+    // Value of another timeline a submission has to wait for on the GPU
+    struct Wait {
+        GpuTimeline* timeline;
+        uint64_t value;
+        VkPipelineStageFlags stage;
+    };
+
+    struct Submission {
+        std::vector<VkCommandBuffer> commandBuffers;
+        std::vector<Wait> waits;
+        // Plain binary semaphores, swapchain acquire and present cannot use timeline semaphores
+        std::vector<VkSemaphore> binaryWaits;
+        std::vector<VkPipelineStageFlags> binaryWaitStages;
+        std::vector<VkSemaphore> binarySignals;
+    };
+
+    // timelineSemaphores selects the backend, waitSemaphores and getCounterValue are the core or
+    // KHR entry points and only used with it
+    GpuTimeline(VkDevice device, VkQueue queue, bool timelineSemaphores,
+                PFN_vkWaitSemaphores waitSemaphores = nullptr, PFN_vkGetSemaphoreCounterValue getCounterValue = nullptr);
+    // Waits for everything submitted and runs the outstanding release callbacks
+    void destroy();
+
+    // Thread safe, returns the value signalled once the command buffers finished
+    uint64_t submit(const Submission& submission);
+    uint64_t lastSubmitted();
+    // Non-blocking
+    uint64_t completedValue();
+    bool isComplete(uint64_t value) { return value <= completedValue(); }
+    void wait(uint64_t value);
+
+    // Runs callback from a later collect once value completed, e.g. to free staging memory
+    void release(uint64_t value, std::function<void()> callback);
+    // Runs the release callbacks whose value completed, never blocks
+    void collect();
+
+    bool usesTimelineSemaphore() const { return timelineSemaphores; }
+
+private:
+    // Fallback bookkeeping for one submitted value
+    struct Pending {
+        uint64_t value;
+        VkFence fence;
+        // Signalled together with the fence, waited on by at most one other submission
+        VkSemaphore signal;
+        bool signalTaken;
+        // Binary semaphores this submission consumed, unsignalled again once it finished
+        std::vector<VkSemaphore> consumed;
+    };
+
+    struct Release {
+        uint64_t value;
+        std::function<void()> callback;
+    };
+
+    // Fallback: binary semaphore a GPU waiter can consume for value, VK_NULL_HANDLE if nothing
+    // needs to be waited for. Blocks on the fence if another submission already took it.
+    VkSemaphore takeSignal(uint64_t value);
+    // Fallback: retires finished submissions in order, mutex must be held
+    void retire(bool block, uint64_t until);
+    VkFence acquireFence();
+    VkSemaphore acquireSemaphore();
+
+    VkDevice device;
+    VkQueue queue;
+    bool timelineSemaphores;
+    PFN_vkWaitSemaphores waitSemaphores;
+    PFN_vkGetSemaphoreCounterValue getCounterValue;
+
+    std::mutex mutex;
+    VkSemaphore semaphore = VK_NULL_HANDLE;
+    uint64_t nextValue = 1;
+    uint64_t completed = 0;
+
+    std::deque<Pending> pending;
+    std::vector<VkFence> freeFences;
+    std::vector<VkSemaphore> freeSemaphores;
+    std::vector<Release> releases;
+};
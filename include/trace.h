@@ -0,0 +1,36 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+// Records CPU and GPU zones as Chrome trace events (chrome://tracing, ui.perfetto.dev).
+// Everything is a no-op until start() is called. Timestamps are steady_clock nanoseconds,
+// GPU zones have to be converted into that clock first (see GpuProfiler::calibrate).
+// Thread safe.
+class Trace {
+public:
+    // Scoped CPU zone on the calling thread
+    class Zone {
+    public:
+        explicit Zone(std::string name);
+        ~Zone();
+        Zone(const Zone&) = delete;
+        Zone& operator=(const Zone&) = delete;
+
+    private:
+        std::string name;
+        int64_t begin;
+    };
+
+    // The calling thread shows up as "main"
+    static void start();
+    static bool enabled();
+    static int64_t now();
+    // track names a GPU row, e.g. the queue the zone ran on
+    static void gpuZone(const std::string& name, const std::string& track, int64_t begin, int64_t end);
+    static void write(const std::string& filename);
+    // Quotes, backslashes and control characters escaped for a JSON string, shared by every JSON report
+    static std::string escapeJson(const std::string& text);
+
+    // Events beyond it are dropped, keeps long interactive runs bounded
+    static constexpr size_t MAX_EVENTS = 1 << 20;
+};
@@ -0,0 +1,94 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include <vulkan/vulkan.h>
+#include "allocator.h"
+#include "timeline.h"
+
+// Streams buffer uploads through a persistently mapped staging ring on the transfer queue.
+// Copies are batched per destination into as few vkCmdCopyBuffer regions as possible and
+// submitted together with the next consumer submission (or flush), so uploads overlap with
+// rendering. Ring space is recycled once the transfer timeline passed the batch using it.
+// With a dedicated transfer family the queue family ownership transfer is recorded on both
+// sides; otherwise transfer and consumer share one queue and only a memory barrier is needed.
+class UploadQueue {
+public:
+    // transfer may be the consumer timeline itself when there is no dedicated transfer queue
+    UploadQueue(GpuAllocator& allocator, VkDevice device, GpuTimeline& transfer, uint32_t transferFamily,
+                GpuTimeline& consumer, uint32_t consumerFamily, VkDeviceSize ringSize);
+    // Both timelines must be idle
+    void destroy();
+
+    // Copies data into the ring right away, blocks only while the ring is full. dst must not be
+    // in use by the consumer queue; concurrent buffers (VK_SHARING_MODE_CONCURRENT) skip the
+    // ownership transfer. Thread safe.
+    void upload(VkBuffer dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size, bool concurrent = false);
+    // Submits the batched copies, returns the transfer timeline value they complete with. Other
+    // queues than the consumer may wait for it to read concurrent buffers.
+    uint64_t flush();
+    // Submits to the consumer timeline after acquiring everything uploaded so far
+    uint64_t submit(const GpuTimeline::Submission& submission);
+
+    bool dedicatedQueue() const { return transfer != consumer; }
+
+private:
+    struct Batch {
+        uint64_t value;
+        // Ring head after the batch and the bytes it occupied, including padding
+        VkDeviceSize end;
+        VkDeviceSize bytes;
+        VkCommandBuffer commandBuffer;
+    };
+
+    struct Pending {
+        VkBuffer dst;
+        std::vector<VkBufferCopy> regions;
+    };
+
+    struct Acquire {
+        uint64_t value;
+        VkCommandBuffer commandBuffer;
+    };
+
+    // All below expect mutex to be held
+    VkDeviceSize reserve(VkDeviceSize size);
+    bool fits(VkDeviceSize size, VkDeviceSize& offset);
+    // Recycles ring space and command buffers of everything that completed, never blocks
+    void retire();
+    // release records the ownership release of every buffer written since the last flush
+    uint64_t submitBatch(bool release);
+    VkCommandBuffer acquireCommandBuffer(VkCommandPool pool, std::vector<VkCommandBuffer>& freeList);
+
+    GpuAllocator* allocator;
+    VkDevice device;
+    GpuTimeline* transfer;
+    GpuTimeline* consumer;
+    uint32_t transferFamily;
+    uint32_t consumerFamily;
+
+    std::mutex mutex;
+    VkBuffer ring = VK_NULL_HANDLE;
+    GpuAllocation ringAllocation;
+    VkDeviceSize capacity;
+    VkDeviceSize head = 0;
+    VkDeviceSize tail = 0;
+    VkDeviceSize used = 0;
+    VkDeviceSize pendingBytes = 0;
+
+    VkCommandPool transferPool = VK_NULL_HANDLE;
+    VkCommandPool consumerPool = VK_NULL_HANDLE;
+    std::vector<VkCommandBuffer> freeTransferBuffers;
+    std::vector<VkCommandBuffer> freeConsumerBuffers;
+
+    std::vector<Pending> pending;
+    std::deque<Batch> batches;
+    // Exclusive buffers written since the last release / released but not acquired by the consumer yet
+    std::vector<VkBuffer> written;
+    std::vector<VkBuffer> released;
+    uint64_t lastBatchValue = 0;
+    // Last batch the consumer waited for
+    uint64_t acquiredValue = 0;
+    std::deque<Acquire> acquires;
+};
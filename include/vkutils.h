@@ -0,0 +1,30 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <stdexcept>
+#include <vector>
+#include "allocator.h"
+
+#define VK_ASSERT(stmt, msg) if(stmt != VK_SUCCESS){throw std::runtime_error(msg);}
+
+// Helpers shared by the application and the GPU side subsystems that own their own pipelines
+class VkUtils {
+public:
+    static uint32_t findMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeFilter, VkMemoryPropertyFlags properties);
+    // Memory comes from the allocator's general (TLSF) pools. With more than one sharedFamilies
+    // the buffer uses VK_SHARING_MODE_CONCURRENT and needs no queue family ownership transfers.
+    static void createBuffer(GpuAllocator& allocator, VkDevice device, VkDeviceSize size, VkBufferUsageFlags usage,
+                             VkMemoryPropertyFlags properties, VkBuffer& buffer, GpuAllocation& allocation,
+                             const std::vector<uint32_t>& sharedFamilies = {});
+    static void destroyBuffer(GpuAllocator& allocator, VkDevice device, VkBuffer& buffer, GpuAllocation& allocation);
+    static VkShaderModule createShaderModule(VkDevice device, const std::vector<char>& code);
+    static VkPipeline createComputePipeline(VkDevice device, VkPipelineCache cache, VkPipelineLayout layout,
+                                            const std::vector<char>& code, const VkSpecializationInfo* specialization = nullptr);
+    // Full compute -> compute/transfer/host dependency, enough for the build passes
+    static void computeBarrier(VkCommandBuffer cmd);
+    // Like computeBarrier, but also makes the writes visible to vkCmdDispatchIndirect
+    static void indirectBarrier(VkCommandBuffer cmd);
+    // Copies a GENERAL layout image written by compute shaders into buffer for the host to read
+    static void recordImageReadback(VkCommandBuffer cmd, VkImage image, VkExtent2D extent, VkBuffer buffer);
+    // Square power of two tile for the path tracing kernel, the largest up to 16x16 the device accepts
+    static VkExtent2D chooseTileSize(const VkPhysicalDeviceLimits& limits);
+};
@@ -0,0 +1,126 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan.h>
+#include "allocator.h"
+
+// Path tracer split into one compute dispatch per stage and bounce (Laine et al. 2013).
+// Paths live in structure of arrays queues; shade compacts the surviving paths and the
+// shadow rays of next event estimation with atomic counters, and extend, shade and shadow
+// are launched indirectly with the live counts. Renders one path per pixel and frame.
+class WavefrontPathTracer {
+public:
+    enum Stage : uint32_t {
+        GENERATE, EXTEND, SHADE, SHADOW, ACCUMULATE, STAGE_COUNT
+    };
+
+    // Everything the kernels read besides their own queues, see shaders/wavefront.glsl
+    struct SceneBindings {
+        VkImageView accumulationImage;
+        VkImageView outputImage;
+        VkBuffer vertices;
+        VkBuffer indices;
+        VkBuffer nodes;
+        VkBuffer triangleIndices;
+        VkBuffer triangleMaterials;
+        VkBuffer materials;
+        // Emissive triangle ids used for next event estimation
+        VkBuffer lights;
+        uint32_t lightCount;
+    };
+
+    WavefrontPathTracer(VkPhysicalDevice physicalDevice, GpuAllocator& allocator, VkDevice device, VkPipelineCache pipelineCache, uint32_t queueFamily,
+                        VkExtent2D extent, uint32_t maxBounces, uint32_t framesInFlight, const SceneBindings& scene, bool wideBVH);
+    void destroy();
+
+    // Records a full frame, including accumulation into the storage images. frameSlot
+    // (< framesInFlight) selects the timestamp queries, the queues are shared by all frames.
+    void record(VkCommandBuffer cmd, uint32_t frameIndex, uint32_t frameSlot);
+
+    // GPU time of every stage in the frame last recorded into frameSlot, summed over all bounces.
+    // Must only be called once that frame has finished executing; returns false if the
+    // queue does not support timestamps or nothing has been recorded into the slot yet.
+    bool readStageTimes(uint32_t frameSlot, double milliseconds[STAGE_COUNT]);
+    static const char* stageName(Stage stage);
+
+private:
+    // Must match the push_constant block in shaders/wavefront.glsl
+    struct PushConstants {
+        uint32_t frameIndex;
+        uint32_t maxBounces;
+        uint32_t bounce;
+        uint32_t width;
+        uint32_t height;
+        uint32_t capacity;
+        uint32_t lightCount;
+    };
+
+    // Must match the Control block in shaders/wavefront.glsl
+    struct Control {
+        uint32_t extendArgs[3];
+        uint32_t shadowArgs[3];
+        uint32_t activeRays;
+        uint32_t activeShadowRays;
+        uint32_t nextRays;
+        uint32_t nextShadowRays;
+    };
+
+    struct QueueBuffer {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        GpuAllocation allocation;
+    };
+
+    enum Binding : uint32_t {
+        ACCUMULATION_IMAGE, OUTPUT_IMAGE,
+        VERTICES, INDICES, NODES, TRIANGLE_INDICES, TRIANGLE_MATERIALS, MATERIALS,
+        LIGHTS, RAYS, HITS, SHADOW_RAYS, CONTROL, RADIANCE, BINDING_COUNT
+    };
+    static constexpr uint32_t IMAGE_BINDINGS = 2;
+
+    void dispatch(VkCommandBuffer cmd, VkPipeline pipeline, uint32_t groups);
+    void dispatchIndirect(VkCommandBuffer cmd, VkPipeline pipeline, VkDeviceSize offset);
+    void timestamp(VkCommandBuffer cmd, uint32_t frameSlot, Stage stage);
+
+    VkPhysicalDevice physicalDevice;
+    GpuAllocator* allocator;
+    VkDevice device;
+    VkExtent2D extent;
+    uint32_t maxBounces;
+    PushConstants push{};
+
+    VkDescriptorSetLayout setLayout;
+    VkPipelineLayout pipelineLayout;
+    VkDescriptorPool descriptorPool;
+    VkDescriptorSet descriptorSet;
+
+    VkPipeline generatePipeline;
+    VkPipeline extendPipeline;
+    VkPipeline shadePipeline;
+    VkPipeline advancePipeline;
+    VkPipeline shadowPipeline;
+    VkPipeline accumulatePipeline;
+
+    QueueBuffer rays;
+    QueueBuffer hits;
+    QueueBuffer shadowRays;
+    QueueBuffer control;
+    QueueBuffer radiance;
+
+    // One timestamp after every dispatch, stages[i] is the stage that ran between query i and i + 1
+    struct FrameQueries {
+        uint32_t used = 0;
+        std::vector<Stage> stages;
+    };
+
+    // queryCount consecutive queries per frame slot
+    VkQueryPool queryPool = VK_NULL_HANDLE;
+    uint32_t queryCount = 0;
+    std::vector<FrameQueries> frameQueries;
+    uint64_t timestampMask = 0;
+    float timestampPeriod = 0.0f;
+
+    static constexpr uint32_t WORKGROUP_SIZE = 64;
+    // Two path queues of origin, direction and throughput
+    static constexpr uint32_t RAY_ATTRIBUTES = 3;
+    static constexpr uint32_t SHADOW_ATTRIBUTES = 3;
+};
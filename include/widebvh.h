@@ -0,0 +1,74 @@
+#pragma once
+#include <cstdint>
+#include <ostream>
+#include <vector>
+#include <glm/glm.hpp>
+#include "bvh.h"
+#include "scene.h"
+
+// 80 byte node of an 8 wide BVH (Ylitie et al. 2017), must match shaders/widebvh.glsl.
+// Child boxes are quantized to 8 bits per axis on a grid anchored at origin with a power
+// of two cell size per axis, so they always enclose the exact child bounds.
+struct WideBVHNode {
+    glm::vec3 origin;
+    // Biased float exponents of the grid cell size, cell = 2^(exponent - 127)
+    uint8_t exponent[3];
+    // Bit i is set when child slot i is an interior node
+    uint8_t internalMask;
+    // Interior children are stored consecutively from childBaseIndex in slot order
+    uint32_t childBaseIndex;
+    uint32_t triangleBaseIndex;
+    // Per slot: 0 = empty, interior = 0b001 << 5 | (24 + slot),
+    // leaf = unary triangle count (1-3) << 5 | offset from triangleBaseIndex
+    uint8_t meta[8];
+    uint8_t qloX[8];
+    uint8_t qloY[8];
+    uint8_t qloZ[8];
+    uint8_t qhiX[8];
+    uint8_t qhiY[8];
+    uint8_t qhiZ[8];
+};
+static_assert(sizeof(WideBVHNode) == 80, "WideBVHNode must stay 80 bytes for the GPU layout");
+
+struct WideBVH {
+    std::vector<WideBVHNode> nodes;
+    // Triangle ids, every leaf slot references at most three consecutive entries
+    std::vector<uint32_t> triangleIndices;
+    // Edges from the root to the deepest node, the traversal needs one stack entry per level
+    uint32_t depth = 0;
+};
+
+struct RayHit {
+    float t;
+    float u;
+    float v;
+    uint32_t triangle;
+};
+
+// Collapses a binary BVH into the compressed 8 wide layout and traverses it on the CPU
+// with the same algorithm as the GLSL kernel. Children are placed in the slots by octant and
+// the stack holds a node's remaining hit children as one entry (child base + hit mask), so
+// rays visit children roughly near to far without sorting, as in Ylitie et al.
+class BVH8 {
+public:
+    static constexpr uint32_t WIDTH = 8;
+    static constexpr uint32_t MAX_LEAF_TRIANGLES = 3;
+    static constexpr uint32_t STACK_SIZE = 64;
+
+    // Binary leaves are split into slots of up to three triangles, so they must not hold
+    // more than 12 triangles (true for the default BVHBuilder options and for LBVH).
+    // Throws if the wide tree is deeper than STACK_SIZE.
+    static WideBVH collapse(const Scene& scene, const BVH& bvh);
+
+    // Closest hit along origin + t * direction with t < tMax
+    static bool intersect(const Scene& scene, const WideBVH& bvh, const glm::vec3& origin,
+                          const glm::vec3& direction, float tMax, RayHit& hit);
+
+    // Checks the node structure and compares rayCount random rays against brute force.
+    // Returns false (and logs why) on the first mismatch.
+    static bool validate(const Scene& scene, const WideBVH& bvh, uint32_t rayCount, std::ostream& log);
+
+    // Moeller-Trumbore, same as intersectTriangle in shaders/bvh.glsl. Returns 1e30 on miss.
+    static float intersectTriangle(const Scene& scene, uint32_t triangle, const glm::vec3& origin,
+                                   const glm::vec3& direction, float& u, float& v);
+};
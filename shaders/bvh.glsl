@@ -0,0 +1,77 @@
+// Binary BVH traversal over the 32 byte node layout produced by BVHBuilder
+
+#include "intersect.glsl"
+
+// BVH::MAX_DEPTH, at most one node is deferred per level and the builders never emit deeper trees
+const int BVH_STACK_SIZE = 64;
+
+struct BVHNode {
+    vec3 aabbMin;
+    uint leftFirst;
+    vec3 aabbMax;
+    uint triangleCount;
+};
+
+layout(std430, binding = 4) readonly buffer NodeBuffer { BVHNode nodes[]; };
+
+bool traceBVH(vec3 origin, vec3 direction, float tMax, out Hit hit) {
+    hit.t = tMax;
+    hit.u = 0.0;
+    hit.v = 0.0;
+    hit.triangle = 0xFFFFFFFFu;
+
+    vec3 invDirection = 1.0 / direction;
+    uint stack[BVH_STACK_SIZE];
+    int stackSize = 0;
+    uint nodeIndex = 0;
+
+    // The slab test would treat the inverted box of an empty scene as unbounded
+    if(nodes[0].aabbMin.x > nodes[0].aabbMax.x) return false;
+    if(intersectAABB(origin, invDirection, nodes[0].aabbMin, nodes[0].aabbMax, hit.t) == INF) return false;
+
+    while(true) {
+        BVHNode node = nodes[nodeIndex];
+        if(node.triangleCount > 0) {
+            for(uint i = 0; i < node.triangleCount; i++) {
+                uint triangle = triangleIndices[node.leftFirst + i];
+                float u, v;
+                float t = intersectTriangle(origin, direction, triangle, u, v);
+                if(t < hit.t) {
+                    hit.t = t;
+                    hit.u = u;
+                    hit.v = v;
+                    hit.triangle = triangle;
+                }
+            }
+            if(stackSize == 0) break;
+            nodeIndex = stack[--stackSize];
+            continue;
+        }
+
+        // Visit the nearer child first and defer the other one
+        uint left = node.leftFirst;
+        uint right = left + 1;
+        float tLeft = intersectAABB(origin, invDirection, nodes[left].aabbMin, nodes[left].aabbMax, hit.t);
+        float tRight = intersectAABB(origin, invDirection, nodes[right].aabbMin, nodes[right].aabbMax, hit.t);
+        if(tLeft > tRight) {
+            float tt = tLeft; tLeft = tRight; tRight = tt;
+            uint tn = left; left = right; right = tn;
+        }
+
+        if(tLeft == INF) {
+            if(stackSize == 0) break;
+            nodeIndex = stack[--stackSize];
+        }else {
+            nodeIndex = left;
+            if(tRight != INF) stack[stackSize++] = right;
+        }
+    }
+
+    return hit.triangle != 0xFFFFFFFFu;
+}
+
+// Visibility query for shadow rays, reuses the closest hit search
+bool occludedBVH(vec3 origin, vec3 direction, float tMax) {
+    Hit hit;
+    return traceBVH(origin, direction, tMax, hit);
+}
@@ -0,0 +1,39 @@
+// Random numbers, sampling and camera shared by the megakernel and the wavefront kernels
+
+const float PI = 3.14159265359;
+
+uint pcgHash(uint v) {
+    uint state = v * 747796405u + 2891336453u;
+    uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+float random(inout uint seed) {
+    seed = pcgHash(seed);
+    return float(seed) / 4294967296.0;
+}
+
+vec3 sampleCosineHemisphere(vec3 n, inout uint seed) {
+    float r1 = 2.0 * PI * random(seed);
+    float r2 = random(seed);
+    float r2s = sqrt(r2);
+    vec3 w = n;
+    vec3 u = normalize(cross(abs(w.x) > 0.1 ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0), w));
+    vec3 v = cross(w, u);
+    return normalize(u * cos(r1) * r2s + v * sin(r1) * r2s + w * sqrt(1.0 - r2));
+}
+
+// Pinhole camera looking down -z, the pixel position is jittered for antialiasing
+void cameraRay(ivec2 pixel, ivec2 size, inout uint seed, out vec3 origin, out vec3 direction) {
+    float aspect = float(size.x) / float(size.y);
+    float tanHalfFov = tan(radians(45.0) * 0.5);
+    vec2 jitter = vec2(random(seed), random(seed));
+    vec2 ndc = ((vec2(pixel) + jitter) / vec2(size)) * 2.0 - 1.0;
+    origin = vec3(0.0, 0.0, 3.4);
+    direction = normalize(vec3(ndc.x * aspect * tanHalfFov, -ndc.y * tanHalfFov, -1.0));
+}
+
+vec3 linearToSRGB(vec3 color) {
+    color = clamp(color, 0.0, 1.0);
+    return mix(color * 12.92, 1.055 * pow(color, vec3(1.0 / 2.4)) - 0.055, step(vec3(0.0031308), color));
+}
@@ -0,0 +1,50 @@
+// Ray/primitive tests shared by the binary and the 8 wide BVH traversal
+
+const float INF = 1e30;
+
+struct Hit {
+    float t;
+    float u;
+    float v;
+    uint triangle;
+};
+
+// Moeller-Trumbore, returns INF on miss
+float intersectTriangle(vec3 origin, vec3 direction, uint triangle, out float u, out float v) {
+    vec3 v0 = vertices[indices[3 * triangle + 0]].xyz;
+    vec3 v1 = vertices[indices[3 * triangle + 1]].xyz;
+    vec3 v2 = vertices[indices[3 * triangle + 2]].xyz;
+    vec3 e1 = v1 - v0;
+    vec3 e2 = v2 - v0;
+    vec3 p = cross(direction, e2);
+    float det = dot(e1, p);
+    u = 0.0;
+    v = 0.0;
+    if(abs(det) < 1e-9) return INF;
+    float invDet = 1.0 / det;
+    vec3 s = origin - v0;
+    u = dot(s, p) * invDet;
+    if(u < 0.0 || u > 1.0) return INF;
+    vec3 q = cross(s, e1);
+    v = dot(direction, q) * invDet;
+    if(v < 0.0 || u + v > 1.0) return INF;
+    float t = dot(e2, q) * invDet;
+    return t > 1e-4 ? t : INF;
+}
+
+float intersectAABB(vec3 origin, vec3 invDirection, vec3 aabbMin, vec3 aabbMax, float tMax) {
+    vec3 t0 = (aabbMin - origin) * invDirection;
+    vec3 t1 = (aabbMax - origin) * invDirection;
+    vec3 tNear = min(t0, t1);
+    vec3 tFar = max(t0, t1);
+    float enter = max(max(tNear.x, tNear.y), max(tNear.z, 0.0));
+    float exit = min(min(tFar.x, tFar.y), min(tFar.z, tMax));
+    return enter <= exit ? enter : INF;
+}
+
+vec3 triangleNormal(uint triangle) {
+    vec3 v0 = vertices[indices[3 * triangle + 0]].xyz;
+    vec3 v1 = vertices[indices[3 * triangle + 1]].xyz;
+    vec3 v2 = vertices[indices[3 * triangle + 2]].xyz;
+    return normalize(cross(v1 - v0, v2 - v0));
+}
@@ -0,0 +1,40 @@
+// Bindings and helpers shared by the LBVH build passes, see GpuLBVHBuilder in include/lbvh.h
+
+struct BVHNode {
+    vec3 aabbMin;
+    uint leftFirst;
+    vec3 aabbMax;
+    uint triangleCount;
+};
+
+layout(push_constant) uniform PushConstants {
+    vec3 sceneMin;
+    uint triangleCount;
+    vec3 sceneExtentInv;
+    uint digitShift;
+    uint chunkCount;
+} pc;
+
+layout(std430, binding = 0) readonly buffer VertexBuffer { vec4 vertices[]; };
+layout(std430, binding = 1) readonly buffer IndexBuffer { uint indices[]; };
+layout(std430, binding = 2) buffer KeysIn { uint keysIn[]; };
+layout(std430, binding = 3) buffer ValuesIn { uint valuesIn[]; };
+layout(std430, binding = 4) buffer KeysOut { uint keysOut[]; };
+layout(std430, binding = 5) buffer ValuesOut { uint valuesOut[]; };
+layout(std430, binding = 6) buffer Histogram { uint histogram[]; };
+layout(std430, binding = 7) buffer Parents { uint parents[]; };
+layout(std430, binding = 8) buffer Slots { uint slots[]; };
+layout(std430, binding = 9) coherent buffer Flags { uint flags[]; };
+layout(std430, binding = 10) coherent buffer Nodes { BVHNode nodes[]; };
+
+const uint NONE = 0xFFFFFFFFu;
+const uint SORT_CHUNK = 256;
+const uint RADIX = 16;
+
+void triangleBounds(uint triangle, out vec3 bmin, out vec3 bmax) {
+    vec3 v0 = vertices[indices[3 * triangle + 0]].xyz;
+    vec3 v1 = vertices[indices[3 * triangle + 1]].xyz;
+    vec3 v2 = vertices[indices[3 * triangle + 2]].xyz;
+    bmin = min(min(v0, v1), v2);
+    bmax = max(max(v0, v1), v2);
+}
@@ -0,0 +1,13 @@
+// Scene buffers shared by every kernel that traces rays, see include/scene.h.
+// Binding 4 holds the BVH nodes and is declared by bvh.glsl or widebvh.glsl.
+
+struct Material {
+    vec4 albedo;
+    vec4 emission;
+};
+
+layout(std430, binding = 2) readonly buffer VertexBuffer { vec4 vertices[]; };
+layout(std430, binding = 3) readonly buffer IndexBuffer { uint indices[]; };
+layout(std430, binding = 5) readonly buffer TriangleIndexBuffer { uint triangleIndices[]; };
+layout(std430, binding = 6) readonly buffer TriangleMaterialBuffer { uint triangleMaterials[]; };
+layout(std430, binding = 7) readonly buffer MaterialBuffer { Material materials[]; };
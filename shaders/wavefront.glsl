@@ -0,0 +1,64 @@
+// State shared by the wavefront kernels, see WavefrontPathTracer in include/wavefront.h
+
+layout(binding = 0, rgba32f) uniform image2D accumulationImage;
+layout(binding = 1, rgba8) uniform writeonly image2D outputImage;
+
+// Must match WavefrontPathTracer::PushConstants
+layout(push_constant) uniform PushConstants {
+    uint frameIndex;
+    uint maxBounces;
+    uint bounce;
+    uint width;
+    uint height;
+    // Pixel count, every queue has room for one ray per pixel
+    uint capacity;
+    uint lightCount;
+} pc;
+
+#include "common.glsl"
+#include "scene.glsl"
+
+layout(std430, binding = 8) readonly buffer LightBuffer { uint lightTriangles[]; };
+
+// Two path queues (read by the current bounce, appended to for the next one), stored as
+// structure of arrays: every attribute is a contiguous run of capacity vec4s
+layout(std430, binding = 9) buffer RayQueue { vec4 rays[]; };
+// t, u, v, triangle bits of the closest hit of every path in the current queue
+layout(std430, binding = 10) buffer HitBuffer { vec4 hits[]; };
+layout(std430, binding = 11) buffer ShadowQueue { vec4 shadowRays[]; };
+// The first 24 bytes are the indirect dispatch arguments of extend/shade and shadow
+layout(std430, binding = 12) coherent buffer Control {
+    uint extendArgs[3];
+    uint shadowArgs[3];
+    uint activeRays;
+    uint activeShadowRays;
+    uint nextRays;
+    uint nextShadowRays;
+} control;
+// Radiance gathered by every pixel's path during the current frame
+layout(std430, binding = 13) buffer RadianceBuffer { vec4 radiance[]; };
+
+const uint WAVEFRONT_GROUP_SIZE = 64;
+
+// xyz origin, w pixel index
+const uint RAY_ORIGIN = 0;
+// xyz direction, w random number state
+const uint RAY_DIRECTION = 1;
+// rgb path throughput
+const uint RAY_THROUGHPUT = 2;
+const uint RAY_ATTRIBUTES = 3;
+
+uint rayIndex(uint queue, uint attribute, uint ray) {
+    return (queue * RAY_ATTRIBUTES + attribute) * pc.capacity + ray;
+}
+
+// xyz origin, w distance to the light sample
+const uint SHADOW_ORIGIN = 0;
+// xyz direction, w pixel index
+const uint SHADOW_DIRECTION = 1;
+// rgb radiance arriving at the pixel if the light sample is visible
+const uint SHADOW_RADIANCE = 2;
+
+uint shadowIndex(uint attribute, uint ray) {
+    return attribute * pc.capacity + ray;
+}
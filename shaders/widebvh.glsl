@@ -0,0 +1,92 @@
+// 8 wide BVH traversal over the 80 byte compressed node layout produced by BVH8::collapse
+// (include/widebvh.h). Nodes are read as five uvec4 since std430 has no 8 bit members.
+
+#include "intersect.glsl"
+
+// BVH8::STACK_SIZE, collapse rejects trees deeper than this and at most one entry is pushed per level
+const int BVH_STACK_SIZE = 64;
+
+layout(std430, binding = 4) readonly buffer NodeBuffer { uvec4 wideNodes[]; };
+
+// Byte slot (0-7) of the eight bytes stored in words.x (slots 0-3) and words.y (slots 4-7)
+uint nodeByte(uvec2 words, uint slot) {
+    return bitfieldExtract(slot < 4 ? words.x : words.y, int(8 * (slot & 3)), 8);
+}
+
+bool traceBVH(vec3 origin, vec3 direction, float tMax, out Hit hit) {
+    hit.t = tMax;
+    hit.u = 0.0;
+    hit.v = 0.0;
+    hit.triangle = 0xFFFFFFFFu;
+
+    vec3 invDirection = 1.0 / direction;
+    uint octant = (direction.x < 0.0 ? 1u : 0u) | (direction.y < 0.0 ? 2u : 0u) | (direction.z < 0.0 ? 4u : 0u);
+    // Hit interior children of one node not visited yet: x = child base,
+    // y = hit mask in traversal order (bit k is slot k ^ octant) | interior slot mask << 8
+    uvec2 stack[BVH_STACK_SIZE];
+    int stackSize = 0;
+    uint nodeIndex = 0;
+
+    while(true) {
+        uvec4 d0 = wideNodes[5 * nodeIndex + 0];
+        uvec4 d1 = wideNodes[5 * nodeIndex + 1];
+        uvec4 d2 = wideNodes[5 * nodeIndex + 2];
+        uvec4 d3 = wideNodes[5 * nodeIndex + 3];
+        uvec4 d4 = wideNodes[5 * nodeIndex + 4];
+
+        vec3 nodeOrigin = uintBitsToFloat(d0.xyz);
+        // A biased exponent shifted into place is exactly the power of two cell size
+        vec3 cell = uintBitsToFloat(uvec3(d0.w & 0xFFu, (d0.w >> 8) & 0xFFu, (d0.w >> 16) & 0xFFu) << 23);
+        uint internalMask = d0.w >> 24;
+        uint childBase = d1.x;
+        uint triangleBase = d1.y;
+
+        uvec2 group = uvec2(childBase, internalMask << 8);
+
+        for(uint slot = 0; slot < 8; slot++) {
+            uint meta = nodeByte(d1.zw, slot);
+            if(meta == 0) continue;
+            vec3 lo = vec3(nodeByte(d2.xy, slot), nodeByte(d2.zw, slot), nodeByte(d3.xy, slot));
+            vec3 hi = vec3(nodeByte(d3.zw, slot), nodeByte(d4.xy, slot), nodeByte(d4.zw, slot));
+            float t = intersectAABB(origin, invDirection, nodeOrigin + lo * cell, nodeOrigin + hi * cell, hit.t);
+            if(t == INF) continue;
+
+            if((internalMask & (1u << slot)) != 0) {
+                group.y |= 1u << (slot ^ octant);
+            }else {
+                // Leaf slot: unary triangle count in the top three bits, offset in the low five
+                uint first = triangleBase + (meta & 0x1Fu);
+                uint count = uint(bitCount(meta >> 5));
+                for(uint i = 0; i < count; i++) {
+                    uint triangle = triangleIndices[first + i];
+                    float u, v;
+                    float tt = intersectTriangle(origin, direction, triangle, u, v);
+                    if(tt < hit.t) {
+                        hit.t = tt;
+                        hit.u = u;
+                        hit.v = v;
+                        hit.triangle = triangle;
+                    }
+                }
+            }
+        }
+
+        // Continue with the first remaining child and defer the rest of its group as one entry
+        if((group.y & 0xFFu) == 0) {
+            if(stackSize == 0) break;
+            group = stack[--stackSize];
+        }
+        uint slot = uint(findLSB(group.y & 0xFFu)) ^ octant;
+        group.y &= group.y - 1u;
+        nodeIndex = group.x + uint(bitCount((group.y >> 8) & ((1u << slot) - 1u)));
+        if((group.y & 0xFFu) != 0) stack[stackSize++] = group;
+    }
+
+    return hit.triangle != 0xFFFFFFFFu;
+}
+
+// Visibility query for shadow rays, reuses the closest hit search
+bool occludedBVH(vec3 origin, vec3 direction, float tMax) {
+    Hit hit;
+    return traceBVH(origin, direction, tMax, hit);
+}
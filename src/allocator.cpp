@@ -0,0 +1,415 @@
+#include "allocator.h"
+#include <algorithm>
+#include <stdexcept>
+#include "vkutils.h"
+
+static uint32_t log2Floor(uint64_t v) {
+    uint32_t result = 0;
+    while(v >>= 1) result++;
+    return result;
+}
+
+static uint32_t lowestBit(uint64_t v) {
+    uint32_t result = 0;
+    while(!(v & 1)) {
+        v >>= 1;
+        result++;
+    }
+    return result;
+}
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+double GpuAllocator::Stats::fragmentation() const {
+    VkDeviceSize freeBytes = reservedBytes - usedBytes;
+    if(freeBytes == 0) return 0.0;
+    return 1.0 - static_cast<double>(largestFreeRange) / static_cast<double>(freeBytes);
+}
+
+GpuAllocator::GpuAllocator(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize blockSize)
+    : physicalDevice(physicalDevice), device(device), blockSize(blockSize) {
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(physicalDevice, &props);
+    maxAllocations = props.limits.maxMemoryAllocationCount;
+
+    pools.resize(2 * memoryProperties.memoryTypeCount);
+    for(uint32_t i = 0; i < pools.size(); i++) pools[i].memoryType = i / 2;
+}
+
+void GpuAllocator::destroy() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for(Pool& pool : pools) {
+        for(auto& block : pool.blocks) {
+            if(block) vkFreeMemory(device, block->memory, nullptr);
+        }
+        pool.blocks.clear();
+    }
+    for(Arena& arena : arenas) vkFreeMemory(device, arena.memory, nullptr);
+    arenas.clear();
+    liveAllocations = 0;
+}
+
+void GpuAllocator::mapping(VkDeviceSize size, uint32_t& firstLevel, uint32_t& secondLevel) {
+    if(size < (1ull << SMALL_LOG2)) {
+        firstLevel = 0;
+        secondLevel = static_cast<uint32_t>(size >> (SMALL_LOG2 - SL_LOG2));
+        return;
+    }
+    uint32_t log2 = log2Floor(size);
+    firstLevel = log2 - SMALL_LOG2 + 1;
+    secondLevel = static_cast<uint32_t>(size >> (log2 - SL_LOG2)) & (SL_COUNT - 1);
+}
+
+void GpuAllocator::insertFree(Block& block, uint32_t index) {
+    Range& range = block.ranges[index];
+    uint32_t fl, sl;
+    mapping(range.size, fl, sl);
+    range.free = true;
+    range.prevFree = NONE;
+    range.nextFree = block.freeLists[fl][sl];
+    if(range.nextFree != NONE) block.ranges[range.nextFree].prevFree = index;
+    block.freeLists[fl][sl] = index;
+    block.firstLevelMap |= 1ull << fl;
+    block.secondLevelMap[fl] |= 1u << sl;
+}
+
+void GpuAllocator::removeFree(Block& block, uint32_t index) {
+    Range& range = block.ranges[index];
+    uint32_t fl, sl;
+    mapping(range.size, fl, sl);
+    if(range.prevFree != NONE) block.ranges[range.prevFree].nextFree = range.nextFree;
+    else block.freeLists[fl][sl] = range.nextFree;
+    if(range.nextFree != NONE) block.ranges[range.nextFree].prevFree = range.prevFree;
+    if(block.freeLists[fl][sl] == NONE) {
+        block.secondLevelMap[fl] &= ~(1u << sl);
+        if(block.secondLevelMap[fl] == 0) block.firstLevelMap &= ~(1ull << fl);
+    }
+    range.free = false;
+}
+
+uint32_t GpuAllocator::newRange(Block& block) {
+    if(!block.unusedRanges.empty()) {
+        uint32_t index = block.unusedRanges.back();
+        block.unusedRanges.pop_back();
+        return index;
+    }
+    block.ranges.push_back(Range{});
+    return static_cast<uint32_t>(block.ranges.size() - 1);
+}
+
+uint32_t GpuAllocator::allocateFromBlock(Block& block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset) {
+    // Round the request up to the next size class so that every range found fits without a list walk
+    VkDeviceSize search = size + alignment - 1;
+    if(search >= (1ull << SMALL_LOG2)) search += (1ull << (log2Floor(search) - SL_LOG2)) - 1;
+    else search += (1ull << (SMALL_LOG2 - SL_LOG2)) - 1;
+    uint32_t fl, sl;
+    mapping(search, fl, sl);
+    if(fl >= FL_COUNT) return NONE;
+
+    uint32_t secondMap = block.secondLevelMap[fl] & (~0u << sl);
+    if(secondMap == 0) {
+        uint64_t firstMap = fl + 1 < 64 ? block.firstLevelMap & (~0ull << (fl + 1)) : 0;
+        if(firstMap == 0) return NONE;
+        fl = lowestBit(firstMap);
+        secondMap = block.secondLevelMap[fl];
+    }
+    sl = lowestBit(secondMap);
+
+    uint32_t index = block.freeLists[fl][sl];
+    removeFree(block, index);
+
+    // Padding in front of the aligned start goes back to the free lists
+    VkDeviceSize aligned = alignUp(block.ranges[index].offset, alignment);
+    VkDeviceSize padding = aligned - block.ranges[index].offset;
+    if(padding > 0) {
+        uint32_t front = newRange(block);
+        Range& range = block.ranges[index];
+        block.ranges[front] = {range.offset, padding, range.prevPhysical, index, NONE, NONE, false};
+        if(range.prevPhysical != NONE) block.ranges[range.prevPhysical].nextPhysical = front;
+        range.prevPhysical = front;
+        range.offset += padding;
+        range.size -= padding;
+        insertFree(block, front);
+    }
+
+    // Split off the tail unless it is too small to ever be useful
+    if(block.ranges[index].size - size >= (1ull << (SMALL_LOG2 - SL_LOG2))) {
+        uint32_t tail = newRange(block);
+        Range& range = block.ranges[index];
+        block.ranges[tail] = {range.offset + size, range.size - size, index, range.nextPhysical, NONE, NONE, false};
+        if(range.nextPhysical != NONE) block.ranges[range.nextPhysical].prevPhysical = tail;
+        range.nextPhysical = tail;
+        range.size = size;
+        insertFree(block, tail);
+    }
+
+    offset = block.ranges[index].offset;
+    block.usedBytes += block.ranges[index].size;
+    block.allocationCount++;
+    return index;
+}
+
+void GpuAllocator::freeInBlock(Block& block, uint32_t index) {
+    block.usedBytes -= block.ranges[index].size;
+    block.allocationCount--;
+
+    // Coalesce with free neighbours right away
+    uint32_t prev = block.ranges[index].prevPhysical;
+    if(prev != NONE && block.ranges[prev].free) {
+        removeFree(block, prev);
+        Range& range = block.ranges[index];
+        range.offset = block.ranges[prev].offset;
+        range.size += block.ranges[prev].size;
+        range.prevPhysical = block.ranges[prev].prevPhysical;
+        if(range.prevPhysical != NONE) block.ranges[range.prevPhysical].nextPhysical = index;
+        block.unusedRanges.push_back(prev);
+    }
+    uint32_t next = block.ranges[index].nextPhysical;
+    if(next != NONE && block.ranges[next].free) {
+        removeFree(block, next);
+        Range& range = block.ranges[index];
+        range.size += block.ranges[next].size;
+        range.nextPhysical = block.ranges[next].nextPhysical;
+        if(range.nextPhysical != NONE) block.ranges[range.nextPhysical].prevPhysical = index;
+        block.unusedRanges.push_back(next);
+    }
+    insertFree(block, index);
+}
+
+VkDeviceMemory GpuAllocator::allocateMemory(uint32_t memoryType, VkDeviceSize size, void** mapped) {
+    if(liveAllocations >= maxAllocations) {
+        throw std::runtime_error("maxMemoryAllocationCount reached!");
+    }
+    VkMemoryAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memoryType;
+    VkDeviceMemory memory;
+    VK_ASSERT(vkAllocateMemory(device, &allocInfo, nullptr, &memory), "Could not allocate device memory!");
+    liveAllocations++;
+
+    *mapped = nullptr;
+    if(memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        VK_ASSERT(vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, mapped), "Could not map device memory!");
+    }
+    return memory;
+}
+
+std::unique_ptr<GpuAllocator::Block> GpuAllocator::createBlock(uint32_t memoryType, VkDeviceSize size) {
+    auto block = std::make_unique<Block>();
+    void* mapped;
+    block->memory = allocateMemory(memoryType, size, &mapped);
+    block->mapped = static_cast<uint8_t*>(mapped);
+    block->size = size;
+    for(auto& lists : block->freeLists) {
+        for(uint32_t& head : lists) head = NONE;
+    }
+    block->ranges.push_back({0, size, NONE, NONE, NONE, NONE, false});
+    insertFree(*block, 0);
+    return block;
+}
+
+GpuAllocation GpuAllocator::allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool optimalImage) {
+    uint32_t memoryType = VkUtils::findMemoryType(physicalDevice, requirements.memoryTypeBits, properties);
+    std::lock_guard<std::mutex> lock(mutex);
+
+    GpuAllocation allocation;
+    allocation.size = requirements.size;
+
+    // Small heaps (e.g. the 256 MiB device local host visible heap) get smaller blocks
+    VkDeviceSize heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[memoryType].heapIndex].size;
+    VkDeviceSize poolBlockSize = std::min(blockSize, std::max<VkDeviceSize>(heapSize / 8, 1ull << 20));
+
+    if(requirements.size >= poolBlockSize / 2) {
+        void* mapped;
+        allocation.memory = allocateMemory(memoryType, requirements.size, &mapped);
+        allocation.mapped = mapped;
+        allocation.kind = GpuAllocation::DEDICATED;
+        if(unusedDedicated.empty()) {
+            allocation.block = static_cast<uint32_t>(dedicated.size());
+            dedicated.push_back({memoryType, requirements.size});
+        }else {
+            allocation.block = unusedDedicated.back();
+            unusedDedicated.pop_back();
+            dedicated[allocation.block] = {memoryType, requirements.size};
+        }
+        return allocation;
+    }
+
+    allocation.kind = GpuAllocation::GENERAL;
+    allocation.pool = 2 * memoryType + (optimalImage ? 1 : 0);
+    Pool& pool = pools[allocation.pool];
+    VkDeviceSize alignment = std::max<VkDeviceSize>(requirements.alignment, 1);
+    auto tryBlock = [&](uint32_t b) {
+        Block& block = *pool.blocks[b];
+        VkDeviceSize offset;
+        uint32_t range = allocateFromBlock(block, requirements.size, alignment, offset);
+        if(range == NONE) return false;
+        allocation.memory = block.memory;
+        allocation.offset = offset;
+        allocation.mapped = block.mapped ? block.mapped + offset : nullptr;
+        allocation.block = b;
+        allocation.range = range;
+        return true;
+    };
+    for(uint32_t b = 0; b < pool.blocks.size(); b++) {
+        if(pool.blocks[b] && tryBlock(b)) return allocation;
+    }
+
+    // Reuse a released slot or append, indices of live blocks stay stable
+    uint32_t slot = 0;
+    while(slot < pool.blocks.size() && pool.blocks[slot]) slot++;
+    if(slot == pool.blocks.size()) pool.blocks.emplace_back();
+    pool.blocks[slot] = createBlock(memoryType, poolBlockSize);
+    if(!tryBlock(slot)) throw std::runtime_error("Could not sub-allocate from a new memory block!");
+    return allocation;
+}
+
+void GpuAllocator::free(GpuAllocation& allocation) {
+    if(allocation.memory == VK_NULL_HANDLE) return;
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if(allocation.kind == GpuAllocation::DEDICATED) {
+        vkFreeMemory(device, allocation.memory, nullptr);
+        liveAllocations--;
+        dedicated[allocation.block].size = 0;
+        unusedDedicated.push_back(allocation.block);
+    }else if(allocation.kind == GpuAllocation::GENERAL) {
+        Pool& pool = pools[allocation.pool];
+        Block& block = *pool.blocks[allocation.block];
+        freeInBlock(block, allocation.range);
+
+        // Keep one empty block per pool around for the next allocation, release the others
+        if(block.allocationCount == 0) {
+            bool otherEmpty = false;
+            for(uint32_t b = 0; b < pool.blocks.size(); b++) {
+                if(b != allocation.block && pool.blocks[b] && pool.blocks[b]->allocationCount == 0) otherEmpty = true;
+            }
+            if(otherEmpty) {
+                vkFreeMemory(device, block.memory, nullptr);
+                liveAllocations--;
+                pool.blocks[allocation.block].reset();
+            }
+        }
+    }
+    allocation = GpuAllocation{};
+}
+
+GpuAllocation GpuAllocator::allocateBuffer(VkBuffer buffer, VkMemoryPropertyFlags properties) {
+    VkMemoryRequirements requirements;
+    vkGetBufferMemoryRequirements(device, buffer, &requirements);
+    GpuAllocation allocation = allocate(requirements, properties, false);
+    VK_ASSERT(vkBindBufferMemory(device, buffer, allocation.memory, allocation.offset), "Could not bind buffer memory!");
+    return allocation;
+}
+
+GpuAllocation GpuAllocator::allocateImage(VkImage image, VkMemoryPropertyFlags properties) {
+    VkMemoryRequirements requirements;
+    vkGetImageMemoryRequirements(device, image, &requirements);
+    GpuAllocation allocation = allocate(requirements, properties, true);
+    VK_ASSERT(vkBindImageMemory(device, image, allocation.memory, allocation.offset), "Could not bind image memory!");
+    return allocation;
+}
+
+uint32_t GpuAllocator::createLinearArena(VkDeviceSize capacity, VkMemoryPropertyFlags properties) {
+    uint32_t memoryType = VkUtils::findMemoryType(physicalDevice, ~0u, properties);
+    std::lock_guard<std::mutex> lock(mutex);
+    void* mapped;
+    VkDeviceMemory memory = allocateMemory(memoryType, capacity, &mapped);
+    arenas.push_back({memoryType, memory, capacity, 0, static_cast<uint8_t*>(mapped), 0});
+    return static_cast<uint32_t>(arenas.size() - 1);
+}
+
+GpuAllocation GpuAllocator::allocateLinear(uint32_t index, const VkMemoryRequirements& requirements) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Arena& arena = arenas[index];
+    GpuAllocation allocation;
+    if(!(requirements.memoryTypeBits & (1u << arena.memoryType))) return allocation;
+    VkDeviceSize offset = alignUp(arena.head, std::max<VkDeviceSize>(requirements.alignment, 1));
+    if(offset + requirements.size > arena.capacity) return allocation;
+
+    arena.head = offset + requirements.size;
+    arena.allocationCount++;
+    allocation.memory = arena.memory;
+    allocation.offset = offset;
+    allocation.size = requirements.size;
+    allocation.mapped = arena.mapped ? arena.mapped + offset : nullptr;
+    allocation.kind = GpuAllocation::LINEAR;
+    allocation.block = index;
+    return allocation;
+}
+
+void GpuAllocator::resetLinear(uint32_t index) {
+    std::lock_guard<std::mutex> lock(mutex);
+    arenas[index].head = 0;
+    arenas[index].allocationCount = 0;
+}
+
+static void addBlockStats(GpuAllocator::Stats& stats, VkDeviceSize size, VkDeviceSize used, uint32_t allocations) {
+    stats.reservedBytes += size;
+    stats.usedBytes += used;
+    stats.allocationCount += allocations;
+    stats.blockCount++;
+}
+
+GpuAllocator::Stats GpuAllocator::stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    Stats total;
+    for(const Pool& pool : pools) {
+        for(const auto& block : pool.blocks) {
+            if(!block) continue;
+            addBlockStats(total, block->size, block->usedBytes, block->allocationCount);
+            for(const Range& range : block->ranges) {
+                if(range.free) total.largestFreeRange = std::max(total.largestFreeRange, range.size);
+            }
+        }
+    }
+    for(const Arena& arena : arenas) {
+        addBlockStats(total, arena.capacity, arena.head, arena.allocationCount);
+        total.largestFreeRange = std::max(total.largestFreeRange, arena.capacity - arena.head);
+    }
+    for(const Dedicated& entry : dedicated) {
+        if(entry.size == 0) continue;
+        total.reservedBytes += entry.size;
+        total.usedBytes += entry.size;
+        total.allocationCount++;
+        total.dedicatedCount++;
+    }
+    return total;
+}
+
+void GpuAllocator::printStats(std::ostream& out) {
+    Stats total = stats();
+    std::lock_guard<std::mutex> lock(mutex);
+    out << "GPU memory: " << total.usedBytes / 1024 << " KiB used of " << total.reservedBytes / 1024 << " KiB reserved in "
+        << total.blockCount << " blocks + " << total.dedicatedCount << " dedicated, " << total.allocationCount
+        << " allocations, " << liveAllocations << "/" << maxAllocations << " vkAllocateMemory, fragmentation "
+        << total.fragmentation() << std::endl;
+    for(uint32_t type = 0; type < memoryProperties.memoryTypeCount; type++) {
+        VkDeviceSize reserved = 0;
+        VkDeviceSize used = 0;
+        for(uint32_t p = 2 * type; p < 2 * type + 2; p++) {
+            for(const auto& block : pools[p].blocks) {
+                if(!block) continue;
+                reserved += block->size;
+                used += block->usedBytes;
+            }
+        }
+        for(const Arena& arena : arenas) {
+            if(arena.memoryType != type) continue;
+            reserved += arena.capacity;
+            used += arena.head;
+        }
+        for(const Dedicated& entry : dedicated) {
+            if(entry.memoryType != type) continue;
+            reserved += entry.size;
+            used += entry.size;
+        }
+        if(reserved == 0) continue;
+        out << "  type " << type << " (flags 0x" << std::hex << memoryProperties.memoryTypes[type].propertyFlags << std::dec
+            << "): " << used / 1024 << " / " << reserved / 1024 << " KiB" << std::endl;
+    }
+}
@@ -7,29 +7,92 @@
 #include <cstdint>
 #include <limits>
 #include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <cctype>
+#include <future>
 #include "loader.h"
+#include "image.h"
+#include "gltf.h"
+#include "trace.h"
+#include "vkutils.h"
 
-#define VK_ASSERT(stmt, msg) if(stmt != VK_SUCCESS){throw std::runtime_error(msg);}
+
+RayTracingApplication::RayTracingApplication(const RenderSettings& settings) : settings(settings) {
+}
 
 void RayTracingApplication::run() {
-    initWindow();
+    if(!settings.traceFile.empty()) Trace::start();
+    if(!settings.headless) initWindow();
     initVulkan();
-    mainLoop();
+    if(settings.headless) {
+        renderHeadless();
+    }else {
+        mainLoop();
+    }
     cleanup();
+    if(!settings.traceFile.empty()) {
+        Trace::write(settings.traceFile);
+        std::cout << "Wrote trace to " << settings.traceFile << std::endl;
+    }
 }
 
 void RayTracingApplication::initVulkan() {
+    Trace::Zone zone("initVulkan");
+    // Kernels are read on the pool while the instance and device are being created
+    if(settings.kernel == RenderKernel::Megakernel) {
+        pathTracerShader = assetLoader.load(settings.wideBVH ? "pathtracer_wide.spv" : "pathtracer.spv");
+    }
+    if(settings.adaptive) {
+        adaptiveShader = assetLoader.load(settings.wideBVH ? "pathtracer_wide_adaptive.spv" : "pathtracer_adaptive.spv");
+    }
+    sceneBuild = std::async(std::launch::async, [this]() {
+        Trace::Zone zone("buildScene");
+        scene = settings.sceneFile.empty() ? Scene::createCornellBox() : GltfLoader::loadScene(settings.sceneFile, threadPool);
+        if(settings.bvhBuildMode == BVHBuildMode::SAH) {
+            BVHBuilder builder(threadPool);
+            bvh = builder.build(scene);
+        }else if(settings.bvhBuildMode == BVHBuildMode::LBVH || settings.validateBVH || scene.triangleCount() == 0) {
+            // The GPU path only needs the CPU tree as validation reference (or for an empty scene)
+            bvh = LBVH::buildReference(scene);
+        }
+        if(settings.wideBVH && (settings.bvhBuildMode != BVHBuildMode::LBVHGpu || scene.triangleCount() == 0)) {
+            collapseWideBVH(bvh);
+        }
+    });
+
     createInstance();
     setupDebugMessenger();
-    createSurface();
+    if(settings.headless) {
+        renderExtent = {settings.width, settings.height};
+    }else {
+        createSurface();
+    }
     pickPhysicalDevice();
     createLogicalDevice();
-    createSwapChain();
-    createImageViews();
-    createGraphicsPipeline();
+    createPipelineCache();
+    if(!settings.headless) {
+        createSwapChain();
+        createImageViews();
+        renderExtent = swapChainExtent;
+    }
+    createCommandPool();
+    calibrateGpuClock();
+    createStorageImages();
+    createSceneBuffers();
+    if(settings.headless && settings.targetNoise > 0.0f) {
+        convergence.emplace(*allocator, device, pipelineCache, accumulationImageView, renderExtent, SAMPLES_PER_PIXEL, chooseWorkgroupSize());
+    }
+    createDescriptorSets();
+    createComputePipeline();
+    createFrameResources();
+    createSyncObjects();
+    allocator->printStats(std::cout);
+    if(!splitFrameDevices.empty()) createSplitFrameWorkers();
 }
 
 void RayTracingApplication::createInstance() {
+    Trace::Zone zone("createInstance");
 
     if(enableValidationLayers && !checkValidationLayerSupport()) {
         throw std::runtime_error("Validation Layer requested, but not available!");
@@ -40,18 +103,32 @@ void RayTracingApplication::createInstance() {
     appInfo.pApplicationName = "Vulkan Raytracing";
     appInfo.pEngineName = "No Engine";
     appInfo.applicationVersion = VK_MAKE_VERSION(0,0,1);
-    appInfo.apiVersion = VK_API_VERSION_1_0;
+    // Up to 1.2 for core timeline semaphores, 1.0 loaders do not export vkEnumerateInstanceVersion
+    auto enumerateInstanceVersion = (PFN_vkEnumerateInstanceVersion) vkGetInstanceProcAddr(nullptr, "vkEnumerateInstanceVersion");
+    uint32_t instanceVersion = VK_API_VERSION_1_0;
+    if(enumerateInstanceVersion != nullptr) {
+        VK_ASSERT(enumerateInstanceVersion(&instanceVersion), "Could not query instance version!");
+    }
+    apiVersion = std::min(instanceVersion, VK_API_VERSION_1_2);
+    appInfo.apiVersion = apiVersion;
     appInfo.engineVersion = VK_MAKE_VERSION(0,0,1);
 
     std::vector<const char*> requiredExtensions = getRequiredExtensions();
     checkAndAddInstanceExtensionSupport(requiredExtensions);
 
+    bool portabilityEnumeration = false;
+    for(auto& ext : requiredExtensions) {
+        if(strncmp(ext, VK_KHR_PORTABILITY_ENUMERATION_EXTENSION_NAME, 256) == 0) portabilityEnumeration = true;
+    }
+
     VkInstanceCreateInfo instanceCreateInfo{};
     instanceCreateInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
     instanceCreateInfo.pApplicationInfo = &appInfo;
     instanceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(requiredExtensions.size());
     instanceCreateInfo.ppEnabledExtensionNames = requiredExtensions.data();
-    instanceCreateInfo.flags |= VK_INSTANCE_CREATE_ENUMERATE_PORTABILITY_BIT_KHR;
+    if(portabilityEnumeration) {
+        instanceCreateInfo.flags |= VK_INSTANCE_CREATE_ENUMERATE_PORTABILITY_BIT_KHR;
+    }
     if(enableValidationLayers){
         instanceCreateInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
         instanceCreateInfo.ppEnabledLayerNames = validationLayers.data();
@@ -67,6 +144,7 @@ void RayTracingApplication::createInstance() {
 }
 
 void RayTracingApplication::setupDebugMessenger() {
+    Trace::Zone zone("setupDebugMessenger");
     if(!enableValidationLayers) return;
 
     VkDebugUtilsMessengerCreateInfoEXT createInfo;
@@ -93,20 +171,120 @@ void RayTracingApplication::populateMessenger(VkDebugUtilsMessengerCreateInfoEXT
 }
 
 void RayTracingApplication::pickPhysicalDevice() {
+    Trace::Zone zone("pickPhysicalDevice");
     uint32_t deviceCount = 0;
     VK_ASSERT(vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr), "Could not enumerate physical devices");
     if(deviceCount == 0) throw std::runtime_error("Could not enumerate physical devices!");
     std::vector<VkPhysicalDevice> devices(deviceCount);
     VK_ASSERT(vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data()), "Could not enumerate physical devices");
-    
-    for(const auto& device : devices) {
-        if(isDeviceSuitable(device)) {
-            physicalDevice = device;
-            break;
+
+    std::vector<DeviceRating> ratings;
+    for(uint32_t i = 0; i < deviceCount; i++) {
+        ratings.push_back(rateDevice(devices[i], i));
+    }
+    std::stable_sort(ratings.begin(), ratings.end(), [](const DeviceRating& a, const DeviceRating& b) {
+        if(a.suitable != b.suitable) return a.suitable;
+        return a.score > b.score;
+    });
+
+    const DeviceRating* chosen = nullptr;
+    if(settings.device.empty()) {
+        if(ratings.front().suitable) chosen = &ratings.front();
+    }else {
+        bool isIndex = std::all_of(settings.device.begin(), settings.device.end(), [](char c) { return c >= '0' && c <= '9'; });
+        std::string wanted = settings.device;
+        std::transform(wanted.begin(), wanted.end(), wanted.begin(), [](char c) { return static_cast<char>(std::tolower(static_cast<unsigned char>(c))); });
+        for(const DeviceRating& rating : ratings) {
+            std::string name = rating.properties.deviceName;
+            std::transform(name.begin(), name.end(), name.begin(), [](char c) { return static_cast<char>(std::tolower(static_cast<unsigned char>(c))); });
+            bool match = isIndex ? std::to_string(rating.index) == settings.device : name.find(wanted) != std::string::npos;
+            if(match) {
+                chosen = &rating;
+                break;
+            }
+        }
+        if(chosen == nullptr) throw std::runtime_error("No physical device matches --device " + settings.device);
+        if(!chosen->suitable) {
+            throw std::runtime_error(std::string("Physical device ") + chosen->properties.deviceName + " is not suitable");
         }
     }
 
-    if(physicalDevice == VK_NULL_HANDLE) throw std::runtime_error("Could not find any suitable physical device");
+    std::cout << "Physical devices:" << std::endl;
+    for(const DeviceRating& rating : ratings) {
+        const char* type = "other";
+        switch(rating.properties.deviceType) {
+            case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: type = "discrete"; break;
+            case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: type = "integrated"; break;
+            case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: type = "virtual"; break;
+            case VK_PHYSICAL_DEVICE_TYPE_CPU: type = "cpu"; break;
+            default: break;
+        }
+        std::cout << (&rating == chosen ? " * " : "   ") << "[" << rating.index << "] " << rating.properties.deviceName
+                  << " (" << type << ", " << (rating.localMemory >> 20) << " MiB local, subgroup " << rating.subgroupSize
+                  << ", " << (rating.properties.limits.maxComputeSharedMemorySize >> 10) << " KiB shared, "
+                  << rating.computeQueues << " compute queues) ";
+        if(rating.suitable) std::cout << "score " << rating.score << std::endl;
+        else std::cout << "unsuitable" << std::endl;
+    }
+
+    if(chosen == nullptr) throw std::runtime_error("Could not find any suitable physical device");
+    physicalDevice = chosen->device;
+    if(settings.multiGpu) {
+        for(const DeviceRating& rating : ratings) {
+            if(rating.suitable && &rating != chosen) splitFrameDevices.push_back(rating.device);
+        }
+    }
+}
+
+RayTracingApplication::DeviceRating RayTracingApplication::rateDevice(VkPhysicalDevice phyDevice, uint32_t index) {
+    DeviceRating rating{};
+    rating.device = phyDevice;
+    rating.index = index;
+    rating.suitable = isDeviceSuitable(phyDevice);
+    vkGetPhysicalDeviceProperties(phyDevice, &rating.properties);
+
+    VkPhysicalDeviceMemoryProperties memory;
+    vkGetPhysicalDeviceMemoryProperties(phyDevice, &memory);
+    for(uint32_t i = 0; i < memory.memoryHeapCount; i++) {
+        if(memory.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+            rating.localMemory = std::max(rating.localMemory, memory.memoryHeaps[i].size);
+        }
+    }
+
+    if(apiVersion >= VK_API_VERSION_1_1 && rating.properties.apiVersion >= VK_API_VERSION_1_1) {
+        VkPhysicalDeviceSubgroupProperties subgroup{};
+        subgroup.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES;
+        VkPhysicalDeviceProperties2 props2{};
+        props2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        props2.pNext = &subgroup;
+        vkGetPhysicalDeviceProperties2(phyDevice, &props2);
+        rating.subgroupSize = subgroup.subgroupSize;
+    }
+
+    uint32_t familyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(phyDevice, &familyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> families(familyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(phyDevice, &familyCount, families.data());
+    for(const auto& family : families) {
+        if(family.queueFlags & VK_QUEUE_COMPUTE_BIT) rating.computeQueues += family.queueCount;
+    }
+
+    // Device type dominates: a discrete GPU beats any integrated one, and software rasterizers
+    // (llvmpipe, SwiftShader) only win when nothing else is there. The rest breaks ties
+    // between devices of the same type.
+    switch(rating.properties.deviceType) {
+        case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: rating.score = 10000; break;
+        case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: rating.score = 5000; break;
+        case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: rating.score = 3000; break;
+        case VK_PHYSICAL_DEVICE_TYPE_OTHER: rating.score = 1000; break;
+        default: rating.score = 0; break;
+    }
+    // Integrated GPUs report system memory as device local, so the heap counts only up to 16 GiB
+    rating.score += std::min<VkDeviceSize>(rating.localMemory >> 20, 16384) / 16;
+    rating.score += 4 * rating.subgroupSize;
+    rating.score += rating.properties.limits.maxComputeSharedMemorySize >> 10;
+    rating.score += 8 * std::min(rating.computeQueues, 16u);
+    return rating;
 }
 
 bool RayTracingApplication::isDeviceSuitable(VkPhysicalDevice phyDevice) {
@@ -116,19 +294,37 @@ bool RayTracingApplication::isDeviceSuitable(VkPhysicalDevice phyDevice) {
     vkGetPhysicalDeviceFeatures(phyDevice, &deviceFeatures);
     QueueFamilyIndicies indices = findQueueFamilies(phyDevice);
 
+    if(settings.headless) {
+        return indices.isComplete(true) && checkDeviceExtensionSupport(phyDevice);
+    }
+
     bool swapAdequate = false;
     if(checkDeviceExtensionSupport(phyDevice)){
         SwapChainSupportDetails details = querySwapChainSupport(phyDevice);
         swapAdequate = !details.formats.empty() && !details.presentModes.empty();
     }
 
-    return indices.isComplete() && swapAdequate;
+    return indices.isComplete(false) && swapAdequate;
 }
 
 VkSurfaceFormatKHR RayTracingApplication::chooseSwapChainFormat(const std::vector<VkSurfaceFormatKHR>& formats) {
+    // The kernel already applies the sRGB transfer function, so the blit target must not encode again
+    for(const auto& format : formats) {
+        if(format.format == VK_FORMAT_B8G8R8A8_UNORM && format.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) {
+            return format;
+        }
+    }
+    // Any other format without an sRGB encoding still shows the kernel's output unchanged
     for(const auto& format : formats) {
-        if(format.format == VK_FORMAT_B8G8R8A8_SRGB && format.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) {
+        switch(format.format) {
+        case VK_FORMAT_R8G8B8A8_UNORM:
+        case VK_FORMAT_B8G8R8A8_UNORM:
+        case VK_FORMAT_A8B8G8R8_UNORM_PACK32:
+        case VK_FORMAT_A2B10G10R10_UNORM_PACK32:
+        case VK_FORMAT_A2R10G10B10_UNORM_PACK32:
             return format;
+        default:
+            break;
         }
     }
     return formats[0];
@@ -171,17 +367,37 @@ RayTracingApplication::QueueFamilyIndicies RayTracingApplication::findQueueFamil
     std::vector<VkQueueFamilyProperties> queueProperties(queueFamilyCount);
     vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueProperties.data());
 
+    for(uint32_t family = 0; family < queueFamilyCount; family++) {
+        VkQueueFlags flags = queueProperties[family].queueFlags;
+        if((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) && !indicies.transferFamily.has_value()) {
+            indicies.transferFamily = family;
+        }
+        if((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT) && !indicies.asyncComputeFamily.has_value()) {
+            indicies.asyncComputeFamily = family;
+        }
+    }
+
     uint32_t i = 0;
     for(const auto& prop : queueProperties) {
+        if((prop.queueFlags & VK_QUEUE_COMPUTE_BIT) && !indicies.computeFamily.has_value()) {
+            indicies.computeFamily = i;
+        }
+        if(settings.headless) {
+            if(indicies.isComplete(true)) break;
+            i++;
+            continue;
+        }
+
         VkBool32 presentSupport = false;
         vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
-        if(prop.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+        // The path tracer dispatches and blits on the same queue
+        if((prop.queueFlags & VK_QUEUE_GRAPHICS_BIT) && (prop.queueFlags & VK_QUEUE_COMPUTE_BIT)) {
             indicies.graphicsFamily = i;
         }
         if(presentSupport){
             indicies.presentFamily = i;
         }
-        if(indicies.isComplete()) break;
+        if(indicies.isComplete(false)) break;
         i++;
     }
 
@@ -216,7 +432,10 @@ void RayTracingApplication::checkAndAddInstanceExtensionSupport(std::vector<cons
         // but we cannot add this later
         if(strncmp(vkExt.extensionName, VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME, 256) == 0) {
             requiredExtensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
-            break;
+        }
+        // Needed to see MoltenVK, but older loaders (and most software ICD setups) do not ship it
+        if(strncmp(vkExt.extensionName, VK_KHR_PORTABILITY_ENUMERATION_EXTENSION_NAME, 256) == 0) {
+            requiredExtensions.push_back(VK_KHR_PORTABILITY_ENUMERATION_EXTENSION_NAME);
         }
     }
 }
@@ -227,7 +446,8 @@ bool RayTracingApplication::checkDeviceExtensionSupport(VkPhysicalDevice phyDevi
     std::vector<VkExtensionProperties> availableExtensions(deviceExtensionCount);
     VK_ASSERT(vkEnumerateDeviceExtensionProperties(phyDevice, nullptr, &deviceExtensionCount, availableExtensions.data()), "Could not enumerate Device Extensions!");
     
-    std::set<std::string> reqExtensions(deviceExtensions.begin(), deviceExtensions.end());
+    std::vector<const char*> requiredDeviceExtensions = getRequiredDeviceExtensions();
+    std::set<std::string> reqExtensions(requiredDeviceExtensions.begin(), requiredDeviceExtensions.end());
 
     for(const auto& ext : availableExtensions) {
         reqExtensions.erase(ext.extensionName);
@@ -259,17 +479,25 @@ RayTracingApplication::SwapChainSupportDetails RayTracingApplication::querySwapC
 }
 
 std::vector<const char*> RayTracingApplication::getRequiredExtensions() {
-    uint32_t glfwExtensionCount;
-    const char** glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+    std::vector<const char*> extensions;
 
-    std::vector<const char*> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
+    if(!settings.headless) {
+        uint32_t glfwExtensionCount;
+        const char** glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+        extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+    }
 
     if(enableValidationLayers) extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
-    extensions.push_back(VK_KHR_PORTABILITY_ENUMERATION_EXTENSION_NAME);
 
     return extensions;
 }
 
+std::vector<const char*> RayTracingApplication::getRequiredDeviceExtensions() {
+    // Headless rendering never presents, so it must not depend on VK_KHR_swapchain
+    if(settings.headless) return {};
+    return deviceExtensions;
+}
+
 bool RayTracingApplication::checkValidationLayerSupport() {
     uint32_t layerCount = 0;
     VK_ASSERT(vkEnumerateInstanceLayerProperties(&layerCount, nullptr), "Failed to enumerate Layer Properties");
@@ -292,9 +520,17 @@ bool RayTracingApplication::checkValidationLayerSupport() {
 }
 
 void RayTracingApplication::createLogicalDevice() {
+    Trace::Zone zone("createLogicalDevice");
     QueueFamilyIndicies indices = findQueueFamilies(physicalDevice);
     std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-    std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily.value(), indices.presentFamily.value()};
+    std::set<uint32_t> uniqueQueueFamilies = {indices.renderFamily(settings.headless)};
+    if(!settings.headless) uniqueQueueFamilies.insert(indices.presentFamily.value());
+    bool dedicatedTransfer = settings.transferQueue && indices.transferFamily.has_value();
+    if(dedicatedTransfer) uniqueQueueFamilies.insert(indices.transferFamily.value());
+    // Headless rendering may already run on the first compute only family
+    bool dedicatedCompute = settings.asyncCompute && indices.asyncComputeFamily.has_value() &&
+                            indices.asyncComputeFamily.value() != indices.renderFamily(settings.headless);
+    if(dedicatedCompute) uniqueQueueFamilies.insert(indices.asyncComputeFamily.value());
 
     float queuePriotity = 1.0f;
     for(uint32_t queueFamily : uniqueQueueFamilies) {
@@ -314,7 +550,7 @@ void RayTracingApplication::createLogicalDevice() {
     VK_ASSERT(vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &deviceExtensionCount, availableExtensions.data()), "Could not enumerate Device Extensions!");
 
     // Fill enabledExtensions with required Extensions
-    std::vector<const char*> enabledExtensions(deviceExtensions.begin(), deviceExtensions.end());
+    std::vector<const char*> enabledExtensions = getRequiredDeviceExtensions();
     
     // Check if it has subset
     for(auto& ext : availableExtensions) {
@@ -323,6 +559,53 @@ void RayTracingApplication::createLogicalDevice() {
         }
     }
     VkPhysicalDeviceFeatures deviceFeatures{};
+    if(settings.pipelineStatistics) {
+        VkPhysicalDeviceFeatures supported;
+        vkGetPhysicalDeviceFeatures(physicalDevice, &supported);
+        deviceFeatures.pipelineStatisticsQuery = supported.pipelineStatisticsQuery;
+        if(!supported.pipelineStatisticsQuery) std::cout << "Pipeline statistics queries are not supported, profiling timestamps only" << std::endl;
+    }
+
+    // Timeline semaphores are core in 1.2 and need the extension before that
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(physicalDevice, &props);
+    bool coreTimeline = apiVersion >= VK_API_VERSION_1_2 && props.apiVersion >= VK_API_VERSION_1_2;
+    bool timelineExtension = false;
+    for(auto& ext : availableExtensions) {
+        if(strncmp(ext.extensionName, VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME, 256) == 0) timelineExtension = true;
+    }
+    VkPhysicalDeviceTimelineSemaphoreFeatures timelineFeatures{};
+    timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+    if(settings.timelineSemaphores && apiVersion >= VK_API_VERSION_1_1 && props.apiVersion >= VK_API_VERSION_1_1
+       && (coreTimeline || timelineExtension)) {
+        VkPhysicalDeviceFeatures2 features2{};
+        features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features2.pNext = &timelineFeatures;
+        vkGetPhysicalDeviceFeatures2(physicalDevice, &features2);
+    }
+    bool timelineSemaphores = timelineFeatures.timelineSemaphore == VK_TRUE;
+    if(timelineSemaphores && !coreTimeline) enabledExtensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+    timelineFeatures.pNext = nullptr;
+
+    // Trace timestamps are steady_clock, which is CLOCK_MONOTONIC on Linux. Other hosts calibrate with a submission
+    calibratedTimestamps = false;
+#ifdef __linux__
+    bool calibrationExtension = false;
+    for(auto& ext : availableExtensions) {
+        if(strncmp(ext.extensionName, VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME, 256) == 0) calibrationExtension = true;
+    }
+    auto getTimeDomains = (PFN_vkGetPhysicalDeviceCalibrateableTimeDomainsEXT) vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceCalibrateableTimeDomainsEXT");
+    if(!settings.traceFile.empty() && calibrationExtension && getTimeDomains != nullptr) {
+        uint32_t domainCount = 0;
+        getTimeDomains(physicalDevice, &domainCount, nullptr);
+        std::vector<VkTimeDomainEXT> domains(domainCount);
+        getTimeDomains(physicalDevice, &domainCount, domains.data());
+        bool deviceDomain = std::find(domains.begin(), domains.end(), VK_TIME_DOMAIN_DEVICE_EXT) != domains.end();
+        bool monotonicDomain = std::find(domains.begin(), domains.end(), VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT) != domains.end();
+        calibratedTimestamps = deviceDomain && monotonicDomain;
+    }
+    if(calibratedTimestamps) enabledExtensions.push_back(VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME);
+#endif
 
     VkDeviceCreateInfo createInfo{};
     createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -331,6 +614,7 @@ void RayTracingApplication::createLogicalDevice() {
     createInfo.pEnabledFeatures = &deviceFeatures;
     createInfo.enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size());
     createInfo.ppEnabledExtensionNames = enabledExtensions.data();
+    if(timelineSemaphores) createInfo.pNext = &timelineFeatures;
 
     if(enableValidationLayers) {
         createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
@@ -341,11 +625,57 @@ void RayTracingApplication::createLogicalDevice() {
 
     VK_ASSERT(vkCreateDevice(physicalDevice, &createInfo, nullptr, &device), "Could not create logical device!");
 
-    vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
-    vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+    vkGetDeviceQueue(device, indices.renderFamily(settings.headless), 0, &renderQueue);
+    if(!settings.headless) {
+        vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+    }
+
+    PFN_vkWaitSemaphores waitSemaphores = nullptr;
+    PFN_vkGetSemaphoreCounterValue getCounterValue = nullptr;
+    if(timelineSemaphores) {
+        waitSemaphores = (PFN_vkWaitSemaphores) vkGetDeviceProcAddr(device, coreTimeline ? "vkWaitSemaphores" : "vkWaitSemaphoresKHR");
+        getCounterValue = (PFN_vkGetSemaphoreCounterValue) vkGetDeviceProcAddr(device, coreTimeline ? "vkGetSemaphoreCounterValue" : "vkGetSemaphoreCounterValueKHR");
+    }
+    renderTimeline.emplace(device, renderQueue, timelineSemaphores, waitSemaphores, getCounterValue);
+    std::cout << "Synchronization: " << (timelineSemaphores ? "timeline semaphores" : "fences and binary semaphores") << std::endl;
+
+    allocator.emplace(physicalDevice, device);
+    readbackArena = allocator->createLinearArena(READBACK_ARENA_SIZE, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+    uint32_t renderFamily = indices.renderFamily(settings.headless);
+    if(dedicatedTransfer) {
+        vkGetDeviceQueue(device, indices.transferFamily.value(), 0, &transferQueue);
+        transferTimeline.emplace(device, transferQueue, timelineSemaphores, waitSemaphores, getCounterValue);
+        uploader.emplace(*allocator, device, *transferTimeline, indices.transferFamily.value(), *renderTimeline, renderFamily, UPLOAD_RING_SIZE);
+        std::cout << "Uploads: dedicated transfer queue (family " << indices.transferFamily.value() << ")" << std::endl;
+    }else {
+        uploader.emplace(*allocator, device, *renderTimeline, renderFamily, *renderTimeline, renderFamily, UPLOAD_RING_SIZE);
+        std::cout << "Uploads: render queue" << std::endl;
+    }
+
+    asyncTimeline = &*renderTimeline;
+    asyncFamily = renderFamily;
+    if(dedicatedCompute) {
+        asyncFamily = indices.asyncComputeFamily.value();
+        vkGetDeviceQueue(device, asyncFamily, 0, &computeQueue);
+        computeTimeline.emplace(device, computeQueue, timelineSemaphores, waitSemaphores, getCounterValue);
+        asyncTimeline = &*computeTimeline;
+        // Scene buffers are read (and the BVH written) on both queues
+        sharedFamilies = {renderFamily, asyncFamily};
+        if(dedicatedTransfer) sharedFamilies.push_back(indices.transferFamily.value());
+        std::cout << "Async compute: dedicated queue (family " << asyncFamily << ")" << std::endl;
+    }else {
+        std::cout << "Async compute: render queue" << std::endl;
+    }
+
+    if(settings.profile) {
+        profiler.emplace(physicalDevice, device, renderFamily, settings.framesInFlight, deviceFeatures.pipelineStatisticsQuery == VK_TRUE);
+        if(!profiler->enabled()) std::cout << "The render queue does not support timestamps, profiling is disabled" << std::endl;
+    }
 }
 
 void RayTracingApplication::createSwapChain() {
+    Trace::Zone zone("createSwapChain");
     SwapChainSupportDetails support = querySwapChainSupport(physicalDevice);
 
     VkSurfaceFormatKHR surfaceFormat = chooseSwapChainFormat(support.formats);
@@ -367,7 +697,10 @@ void RayTracingApplication::createSwapChain() {
     createInfo.imageColorSpace = surfaceFormat.colorSpace;
     createInfo.imageExtent = extent;
     createInfo.imageArrayLayers = 1;
-    createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    if(!(support.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT)) {
+        throw std::runtime_error("Swapchain images cannot be used as blit destination!");
+    }
+    createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
 
     QueueFamilyIndicies indices = findQueueFamilies(physicalDevice);
     uint32_t queueFamilyIndicies[] = {indices.graphicsFamily.value(), indices.presentFamily.value()};
@@ -398,6 +731,7 @@ void RayTracingApplication::createSwapChain() {
 }
 
 void RayTracingApplication::createImageViews() {
+    Trace::Zone zone("createImageViews");
     swapChainImageViews.resize(swapChainImages.size());
     for(size_t i = 0; i < swapChainImageViews.size(); i++){
         VkImageViewCreateInfo createInfo{};
@@ -419,13 +753,1063 @@ void RayTracingApplication::createImageViews() {
     }
 }
 
-void RayTracingApplication::createGraphicsPipeline() {
-    auto vertCode = Loader::readFile("vert.spv");
-    auto fragCode = Loader::readFile("frag.spv");
+static uint64_t hashBytes(const char* data, size_t size) {
+    // FNV-1a, only used to detect truncated or corrupted cache files
+    uint64_t hash = 14695981039346656037ull;
+    for(size_t i = 0; i < size; i++) {
+        hash ^= static_cast<uint8_t>(data[i]);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+void RayTracingApplication::createPipelineCache() {
+    Trace::Zone zone("createPipelineCache");
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(physicalDevice, &props);
+
+    std::vector<char> initialData;
+    if(!settings.pipelineCacheFile.empty() && Loader::fileExists(settings.pipelineCacheFile)) {
+        std::vector<char> file = Loader::readFile(settings.pipelineCacheFile);
+
+        PipelineCacheFileHeader header{};
+        bool valid = file.size() >= sizeof(header);
+        if(valid) {
+            memcpy(&header, file.data(), sizeof(header));
+            valid = header.magic == PIPELINE_CACHE_MAGIC
+                    && header.version == PIPELINE_CACHE_VERSION
+                    && header.vendorID == props.vendorID
+                    && header.deviceID == props.deviceID
+                    && header.driverVersion == props.driverVersion
+                    && memcmp(header.pipelineCacheUUID, props.pipelineCacheUUID, VK_UUID_SIZE) == 0
+                    && header.dataSize == file.size() - sizeof(header)
+                    && header.dataHash == hashBytes(file.data() + sizeof(header), header.dataSize);
+        }
+
+        if(valid) {
+            initialData.assign(file.begin() + sizeof(header), file.end());
+        }else {
+            std::cout << "Ignoring stale pipeline cache " << settings.pipelineCacheFile << std::endl;
+        }
+    }
+
+    VkPipelineCacheCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    createInfo.initialDataSize = initialData.size();
+    createInfo.pInitialData = initialData.empty() ? nullptr : initialData.data();
+
+    // Drivers are required to ignore incompatible data, but a broken blob must not keep us from starting
+    if(vkCreatePipelineCache(device, &createInfo, nullptr, &pipelineCache) != VK_SUCCESS) {
+        createInfo.initialDataSize = 0;
+        createInfo.pInitialData = nullptr;
+        VK_ASSERT(vkCreatePipelineCache(device, &createInfo, nullptr, &pipelineCache), "Could not create pipeline cache!");
+    }
+}
+
+void RayTracingApplication::savePipelineCache() {
+    if(settings.pipelineCacheFile.empty()) return;
+
+    size_t dataSize = 0;
+    VK_ASSERT(vkGetPipelineCacheData(device, pipelineCache, &dataSize, nullptr), "Could not get pipeline cache size!");
+
+    PipelineCacheFileHeader header{};
+    std::vector<char> file(sizeof(header) + dataSize);
+    VK_ASSERT(vkGetPipelineCacheData(device, pipelineCache, &dataSize, file.data() + sizeof(header)), "Could not get pipeline cache data!");
+    file.resize(sizeof(header) + dataSize);
+
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(physicalDevice, &props);
+    header.magic = PIPELINE_CACHE_MAGIC;
+    header.version = PIPELINE_CACHE_VERSION;
+    header.vendorID = props.vendorID;
+    header.deviceID = props.deviceID;
+    header.driverVersion = props.driverVersion;
+    memcpy(header.pipelineCacheUUID, props.pipelineCacheUUID, VK_UUID_SIZE);
+    header.dataSize = dataSize;
+    header.dataHash = hashBytes(file.data() + sizeof(header), dataSize);
+    memcpy(file.data(), &header, sizeof(header));
+
+    try {
+        Loader::writeFileAtomic(settings.pipelineCacheFile, file);
+    }catch(const std::exception& e) {
+        // Losing the cache only costs startup time on the next launch
+        std::cerr << e.what() << std::endl;
+    }
+}
+
+void RayTracingApplication::createCommandPool() {
+    Trace::Zone zone("createCommandPool");
+    QueueFamilyIndicies indices = findQueueFamilies(physicalDevice);
+
+    VkCommandPoolCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    createInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    createInfo.queueFamilyIndex = indices.renderFamily(settings.headless);
+
+    VK_ASSERT(vkCreateCommandPool(device, &createInfo, nullptr, &commandPool), "Could not create command pool!");
+
+    if(computeTimeline) {
+        createInfo.queueFamilyIndex = asyncFamily;
+        VK_ASSERT(vkCreateCommandPool(device, &createInfo, nullptr, &asyncCommandPool), "Could not create async compute command pool!");
+    }
+}
+
+void RayTracingApplication::calibrateGpuClock() {
+    if(!profiler || !profiler->enabled() || !Trace::enabled()) return;
+    Trace::Zone zone("calibrateGpuClock");
+    if(calibratedTimestamps) {
+        auto getTimestamps = (PFN_vkGetCalibratedTimestampsEXT) vkGetDeviceProcAddr(device, "vkGetCalibratedTimestampsEXT");
+        VkCalibratedTimestampInfoEXT infos[2]{};
+        infos[0].sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT;
+        infos[0].timeDomain = VK_TIME_DOMAIN_DEVICE_EXT;
+        infos[1].sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT;
+        infos[1].timeDomain = VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT;
+        uint64_t timestamps[2];
+        uint64_t maxDeviation;
+        VK_ASSERT(getTimestamps(device, 2, infos, timestamps, &maxDeviation), "Could not get calibrated timestamps!");
+        profiler->calibrate(static_cast<int64_t>(timestamps[1]), timestamps[0]);
+        std::cout << "GPU clock calibrated with VK_EXT_calibrated_timestamps (max deviation " << maxDeviation << " ns)" << std::endl;
+        return;
+    }
+
+    // The timestamp is written somewhere between submission and the end of the wait
+    VkCommandBuffer cmd = beginSingleTimeCommands();
+    profiler->recordCalibration(cmd);
+    int64_t submitTime = Trace::now();
+    endSingleTimeCommands(cmd);
+    int64_t completeTime = Trace::now();
+    profiler->finishCalibration(submitTime, completeTime);
+    std::cout << "GPU clock calibrated with a submission (uncertainty " << (completeTime - submitTime) / 1000 << " us)" << std::endl;
+}
+
+void RayTracingApplication::createImage(VkExtent2D extent, VkFormat format, VkImageUsageFlags usage, VkImage& image, GpuAllocation& allocation, VkImageView& view) {
+    VkImageCreateInfo imageInfo{};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.extent = {extent.width, extent.height, 1};
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.format = format;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageInfo.usage = usage;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    VK_ASSERT(vkCreateImage(device, &imageInfo, nullptr, &image), "Could not create image!");
+    allocation = allocator->allocateImage(image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    VkImageViewCreateInfo viewInfo{};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = format;
+    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    viewInfo.subresourceRange.baseMipLevel = 0;
+    viewInfo.subresourceRange.levelCount = 1;
+    viewInfo.subresourceRange.baseArrayLayer = 0;
+    viewInfo.subresourceRange.layerCount = 1;
+
+    VK_ASSERT(vkCreateImageView(device, &viewInfo, nullptr, &view), "Could not create image view!");
+}
+
+VkCommandBuffer RayTracingApplication::beginSingleTimeCommands() {
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandPool = commandPool;
+    allocInfo.commandBufferCount = 1;
+
+    VkCommandBuffer cmd;
+    VK_ASSERT(vkAllocateCommandBuffers(device, &allocInfo, &cmd), "Could not allocate command buffer!");
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    VK_ASSERT(vkBeginCommandBuffer(cmd, &beginInfo), "Could not begin command buffer!");
+
+    return cmd;
+}
+
+void RayTracingApplication::endSingleTimeCommands(VkCommandBuffer cmd) {
+    renderTimeline->wait(submitSingleTimeCommands(cmd));
+    renderTimeline->collect();
+}
+
+uint64_t RayTracingApplication::submitSingleTimeCommands(VkCommandBuffer cmd) {
+    VK_ASSERT(vkEndCommandBuffer(cmd), "Could not end command buffer!");
+
+    GpuTimeline::Submission submission;
+    submission.commandBuffers.push_back(cmd);
+    uint64_t value = submitRender(submission);
+    renderTimeline->release(value, [this, cmd]() {
+        vkFreeCommandBuffers(device, commandPool, 1, &cmd);
+    });
+    return value;
+}
+
+VkCommandBuffer RayTracingApplication::beginAsyncCommands() {
+    if(!computeTimeline) return beginSingleTimeCommands();
+
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandPool = asyncCommandPool;
+    allocInfo.commandBufferCount = 1;
+
+    VkCommandBuffer cmd;
+    VK_ASSERT(vkAllocateCommandBuffers(device, &allocInfo, &cmd), "Could not allocate command buffer!");
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    VK_ASSERT(vkBeginCommandBuffer(cmd, &beginInfo), "Could not begin command buffer!");
+    return cmd;
+}
+
+uint64_t RayTracingApplication::submitAsyncCommands(VkCommandBuffer cmd) {
+    if(!computeTimeline) return submitSingleTimeCommands(cmd);
+    VK_ASSERT(vkEndCommandBuffer(cmd), "Could not end command buffer!");
+
+    // Scene buffers are concurrent, waiting for the uploads is enough to read them
+    GpuTimeline::Submission submission;
+    submission.commandBuffers.push_back(cmd);
+    GpuTimeline* uploads = transferTimeline ? &*transferTimeline : &*renderTimeline;
+    submission.waits.push_back({uploads, uploader->flush(), VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT});
+    uint64_t value = computeTimeline->submit(submission);
+    computeTimeline->release(value, [this, cmd]() {
+        vkFreeCommandBuffers(device, asyncCommandPool, 1, &cmd);
+    });
+    pendingRenderWaits.push_back({&*computeTimeline, value, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT});
+    return value;
+}
+
+uint64_t RayTracingApplication::submitRender(const GpuTimeline::Submission& submission) {
+    GpuTimeline::Submission withWaits = submission;
+    withWaits.waits.insert(withWaits.waits.end(), pendingRenderWaits.begin(), pendingRenderWaits.end());
+    pendingRenderWaits.clear();
+    return uploader->submit(withWaits);
+}
+
+void RayTracingApplication::createStorageImages() {
+    Trace::Zone zone("createStorageImages");
+    // Split frame rendering reads the sums back to merge them with the other devices
+    bool readBack = settings.multiGpu || settings.keepAccumulation;
+    VkImageUsageFlags accumulationUsage = VK_IMAGE_USAGE_STORAGE_BIT | (readBack ? VK_IMAGE_USAGE_TRANSFER_SRC_BIT : 0);
+    createImage(renderExtent, ACCUMULATION_FORMAT, accumulationUsage,
+                accumulationImage, accumulationImageAllocation, accumulationImageView);
+    createImage(renderExtent, OUTPUT_FORMAT, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                outputImage, outputImageAllocation, outputImageView);
+
+    // Both images stay in GENERAL for their whole lifetime
+    VkCommandBuffer cmd = beginSingleTimeCommands();
+    VkImageMemoryBarrier barriers[2]{};
+    VkImage images[2] = {accumulationImage, outputImage};
+    for(int i = 0; i < 2; i++) {
+        barriers[i].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barriers[i].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barriers[i].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        barriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barriers[i].image = images[i];
+        barriers[i].subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+        barriers[i].srcAccessMask = 0;
+        barriers[i].dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    }
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0, 0, nullptr, 0, nullptr, 2, barriers);
+    endSingleTimeCommands(cmd);
+}
+
+RayTracingApplication::Buffer RayTracingApplication::createDeviceLocalBuffer(const void* data, VkDeviceSize size, VkBufferUsageFlags usage) {
+    Buffer result;
+    // Vulkan does not allow zero sized buffers, empty scene arrays still get a valid binding
+    result.size = std::max<VkDeviceSize>(size, 16);
+
+    if(data == nullptr) {
+        VkUtils::createBuffer(*allocator, device, result.size, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                              result.buffer, result.allocation, sharedFamilies);
+        return result;
+    }
+
+    VkUtils::createBuffer(*allocator, device, result.size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                          result.buffer, result.allocation, sharedFamilies);
+    // Copied on the transfer queue, the next render submission acquires it
+    uploader->upload(result.buffer, 0, data, size, !sharedFamilies.empty());
+    return result;
+}
+
+RayTracingApplication::Buffer RayTracingApplication::createReadbackBuffer(VkDeviceSize size) {
+    Buffer readback;
+    readback.size = size;
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    VK_ASSERT(vkCreateBuffer(device, &bufferInfo, nullptr, &readback.buffer), "Could not create readback buffer!");
+
+    VkMemoryRequirements requirements;
+    vkGetBufferMemoryRequirements(device, readback.buffer, &requirements);
+    readback.allocation = allocator->allocateLinear(readbackArena, requirements);
+    if(readback.allocation.memory != VK_NULL_HANDLE) {
+        readbackBuffersInUse++;
+    }else {
+        readback.allocation = allocator->allocate(requirements, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    }
+    VK_ASSERT(vkBindBufferMemory(device, readback.buffer, readback.allocation.memory, readback.allocation.offset), "Could not bind readback memory!");
+    return readback;
+}
+
+void RayTracingApplication::downloadBuffer(const Buffer& buffer, void* data, VkDeviceSize size) {
+    Buffer staging = createReadbackBuffer(size);
+
+    VkCommandBuffer cmd = beginSingleTimeCommands();
+    VkBufferCopy region{};
+    region.size = size;
+    vkCmdCopyBuffer(cmd, buffer.buffer, staging.buffer, 1, &region);
+    VkUtils::computeBarrier(cmd);
+    endSingleTimeCommands(cmd);
+
+    memcpy(data, staging.allocation.mapped, size);
+    destroyBuffer(staging);
+}
+
+void RayTracingApplication::destroyBuffer(Buffer& buffer) {
+    if(buffer.allocation.kind == GpuAllocation::LINEAR && --readbackBuffersInUse == 0) {
+        allocator->resetLinear(readbackArena);
+    }
+    VkUtils::destroyBuffer(*allocator, device, buffer.buffer, buffer.allocation);
+    buffer = Buffer{};
+}
+
+void RayTracingApplication::createSceneBuffers() {
+    Trace::Zone zone("createSceneBuffers");
+    sceneBuild.get();
+
+    const VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    vertexBuffer = createDeviceLocalBuffer(scene.vertices.data(), scene.vertices.size() * sizeof(glm::vec4), usage);
+    indexBuffer = createDeviceLocalBuffer(scene.indices.data(), scene.indices.size() * sizeof(uint32_t), usage);
+    // The GPU BVH builders read the scene straight from these buffers
+    if(settings.bvhBuildMode == BVHBuildMode::LBVHGpu && scene.triangleCount() > 0) {
+        buildBVHOnGpu();
+    }
+    if(settings.wideBVH) {
+        nodeBuffer = createDeviceLocalBuffer(wideBvh.nodes.data(), wideBvh.nodes.size() * sizeof(WideBVHNode), usage);
+        triangleIndexBuffer = createDeviceLocalBuffer(wideBvh.triangleIndices.data(), wideBvh.triangleIndices.size() * sizeof(uint32_t), usage);
+    }else if(nodeBuffer.buffer == VK_NULL_HANDLE) {
+        nodeBuffer = createDeviceLocalBuffer(bvh.nodes.data(), bvh.nodes.size() * sizeof(BVHNode), usage);
+        triangleIndexBuffer = createDeviceLocalBuffer(bvh.triangleIndices.data(), bvh.triangleIndices.size() * sizeof(uint32_t), usage);
+    }
+    triangleMaterialBuffer = createDeviceLocalBuffer(scene.triangleMaterials.data(), scene.triangleMaterials.size() * sizeof(uint32_t), usage);
+    materialBuffer = createDeviceLocalBuffer(scene.materials.data(), scene.materials.size() * sizeof(Material), usage);
+    std::vector<uint32_t> lights = scene.emissiveTriangles();
+    lightCount = static_cast<uint32_t>(lights.size());
+    lightBuffer = createDeviceLocalBuffer(lights.data(), lights.size() * sizeof(uint32_t), usage);
+    // Start the copies while the pipelines are being created
+    uploader->flush();
 }
 
+void RayTracingApplication::buildBVHOnGpu() {
+    Trace::Zone zone("buildBVHOnGpu");
+    size_t n = scene.triangleCount();
+    const VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    nodeBuffer = createDeviceLocalBuffer(nullptr, (2 * n - 1) * sizeof(BVHNode), usage);
+    triangleIndexBuffer = createDeviceLocalBuffer(nullptr, n * sizeof(uint32_t), usage);
+
+    GpuLBVHBuilder builder(*allocator, device, pipelineCache);
+
+    auto start = std::chrono::steady_clock::now();
+    VkCommandBuffer cmd = beginAsyncCommands();
+    builder.record(cmd, scene, vertexBuffer.buffer, indexBuffer.buffer, nodeBuffer.buffer, triangleIndexBuffer.buffer);
+    uint64_t built = submitAsyncCommands(cmd);
+    // Scratch memory and pipelines stay alive until the build retired
+    asyncTimeline->release(built, [builder]() mutable {
+        builder.destroy();
+    });
+
+    // The frames only need the tree on the GPU, they are queued behind the build without a host wait
+    if(settings.validateBVH || settings.wideBVH) {
+        asyncTimeline->wait(built);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "LBVH (GPU): " << n << " triangles in " << ms << " ms (" << ms / (n / 1e6)
+                  << " ms per million triangles, including submission)" << std::endl;
+    }else {
+        std::cout << "LBVH (GPU): " << n << " triangles queued" << std::endl;
+    }
+
+    if(settings.validateBVH || settings.wideBVH) {
+        BVH gpuBvh;
+        gpuBvh.nodes.resize(2 * n - 1);
+        gpuBvh.triangleIndices.resize(n);
+        downloadBuffer(nodeBuffer, gpuBvh.nodes.data(), gpuBvh.nodes.size() * sizeof(BVHNode));
+        downloadBuffer(triangleIndexBuffer, gpuBvh.triangleIndices.data(), n * sizeof(uint32_t));
+        if(settings.validateBVH && !LBVH::validate(scene, bvh, gpuBvh, std::cout)) {
+            throw std::runtime_error("GPU LBVH failed validation!");
+        }
+        // The collapse runs on the CPU, the binary buffers are replaced by the wide ones
+        if(settings.wideBVH) {
+            collapseWideBVH(gpuBvh);
+            destroyBuffer(nodeBuffer);
+            destroyBuffer(triangleIndexBuffer);
+        }
+    }
+}
+
+void RayTracingApplication::collapseWideBVH(const BVH& binary) {
+    wideBvh = BVH8::collapse(scene, binary);
+    if(settings.validateBVH && !BVH8::validate(scene, wideBvh, 1024, std::cout)) {
+        throw std::runtime_error("8 wide BVH failed validation!");
+    }
+}
+
+void RayTracingApplication::createDescriptorSets() {
+    Trace::Zone zone("createDescriptorSets");
+    // 0-1: accumulation and output image, 2-7: scene buffers (see shaders/scene.glsl), 8: active tiles with --adaptive
+    const uint32_t imageBindings = 2;
+    const uint32_t maxBufferBindings = 7;
+    const uint32_t bufferBindings = settings.adaptive ? 7 : 6;
+    VkDescriptorSetLayoutBinding bindings[imageBindings + maxBufferBindings]{};
+    for(uint32_t i = 0; i < imageBindings + bufferBindings; i++) {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = i < imageBindings ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = imageBindings + bufferBindings;
+    layoutInfo.pBindings = bindings;
+    VK_ASSERT(vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &descriptorSetLayout), "Could not create descriptor set layout!");
+
+    VkDescriptorPoolSize poolSizes[2]{};
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    poolSizes[0].descriptorCount = imageBindings;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSizes[1].descriptorCount = bufferBindings;
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = 2;
+    poolInfo.pPoolSizes = poolSizes;
+    poolInfo.maxSets = 1;
+    VK_ASSERT(vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool), "Could not create descriptor pool!");
+
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = descriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &descriptorSetLayout;
+    VK_ASSERT(vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet), "Could not allocate descriptor set!");
+
+    VkDescriptorImageInfo imageInfos[2]{};
+    imageInfos[0].imageView = accumulationImageView;
+    imageInfos[0].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    imageInfos[1].imageView = outputImageView;
+    imageInfos[1].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    VkBuffer buffers[maxBufferBindings] = {
+        vertexBuffer.buffer, indexBuffer.buffer, nodeBuffer.buffer, triangleIndexBuffer.buffer, triangleMaterialBuffer.buffer, materialBuffer.buffer,
+        convergence ? convergence->activeTiles() : VK_NULL_HANDLE
+    };
+    VkDescriptorBufferInfo bufferInfos[maxBufferBindings]{};
+    for(uint32_t i = 0; i < bufferBindings; i++) {
+        bufferInfos[i].buffer = buffers[i];
+        bufferInfos[i].offset = 0;
+        bufferInfos[i].range = VK_WHOLE_SIZE;
+    }
+
+    VkWriteDescriptorSet writes[imageBindings + maxBufferBindings]{};
+    for(uint32_t i = 0; i < imageBindings + bufferBindings; i++) {
+        writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[i].dstSet = descriptorSet;
+        writes[i].dstBinding = i;
+        writes[i].descriptorCount = 1;
+        if(i < imageBindings) {
+            writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            writes[i].pImageInfo = &imageInfos[i];
+        }else {
+            writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            writes[i].pBufferInfo = &bufferInfos[i - imageBindings];
+        }
+    }
+    vkUpdateDescriptorSets(device, imageBindings + bufferBindings, writes, 0, nullptr);
+}
+
+VkExtent2D RayTracingApplication::chooseWorkgroupSize() {
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(physicalDevice, &props);
+    return VkUtils::chooseTileSize(props.limits);
+}
+
+void RayTracingApplication::createComputePipeline() {
+    Trace::Zone zone("createComputePipeline");
+    if(settings.kernel == RenderKernel::Wavefront) {
+        createWavefront();
+        return;
+    }
+    const auto& compCode = pathTracerShader.get()->data;
+
+    workgroupSize = chooseWorkgroupSize();
+
+    // local_size_x_id = 0, local_size_y_id = 1
+    VkSpecializationMapEntry specEntries[2]{};
+    specEntries[0].constantID = 0;
+    specEntries[0].offset = offsetof(VkExtent2D, width);
+    specEntries[0].size = sizeof(uint32_t);
+    specEntries[1].constantID = 1;
+    specEntries[1].offset = offsetof(VkExtent2D, height);
+    specEntries[1].size = sizeof(uint32_t);
+
+    VkSpecializationInfo specInfo{};
+    specInfo.mapEntryCount = 2;
+    specInfo.pMapEntries = specEntries;
+    specInfo.dataSize = sizeof(VkExtent2D);
+    specInfo.pData = &workgroupSize;
+
+    VkPushConstantRange pushRange{};
+    pushRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushRange.offset = 0;
+    pushRange.size = sizeof(PushConstants);
+
+    VkPipelineLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    layoutInfo.setLayoutCount = 1;
+    layoutInfo.pSetLayouts = &descriptorSetLayout;
+    layoutInfo.pushConstantRangeCount = 1;
+    layoutInfo.pPushConstantRanges = &pushRange;
+    VK_ASSERT(vkCreatePipelineLayout(device, &layoutInfo, nullptr, &pipelineLayout), "Could not create pipeline layout!");
+
+    computePipeline = VkUtils::createComputePipeline(device, pipelineCache, pipelineLayout, compCode, &specInfo);
+    if(settings.adaptive) {
+        adaptivePipeline = VkUtils::createComputePipeline(device, pipelineCache, pipelineLayout, adaptiveShader.get()->data, &specInfo);
+    }
+}
+
+void RayTracingApplication::createWavefront() {
+    Trace::Zone zone("createWavefront");
+    WavefrontPathTracer::SceneBindings bindings{};
+    bindings.accumulationImage = accumulationImageView;
+    bindings.outputImage = outputImageView;
+    bindings.vertices = vertexBuffer.buffer;
+    bindings.indices = indexBuffer.buffer;
+    bindings.nodes = nodeBuffer.buffer;
+    bindings.triangleIndices = triangleIndexBuffer.buffer;
+    bindings.triangleMaterials = triangleMaterialBuffer.buffer;
+    bindings.materials = materialBuffer.buffer;
+    bindings.lights = lightBuffer.buffer;
+    bindings.lightCount = lightCount;
+
+    uint32_t queueFamily = findQueueFamilies(physicalDevice).renderFamily(settings.headless);
+    wavefront.emplace(physicalDevice, *allocator, device, pipelineCache, queueFamily, renderExtent, MAX_BOUNCES,
+                      settings.framesInFlight, bindings, settings.wideBVH);
+}
+
+void RayTracingApplication::createFrameResources() {
+    Trace::Zone zone("createFrameResources");
+    uint32_t renderFamily = findQueueFamilies(physicalDevice).renderFamily(settings.headless);
+    frames.resize(settings.framesInFlight);
+
+    for(FrameResources& frame : frames) {
+        // Transient pools are reset as a whole once their frame has finished
+        VkCommandPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        poolInfo.queueFamilyIndex = renderFamily;
+        VK_ASSERT(vkCreateCommandPool(device, &poolInfo, nullptr, &frame.commandPool), "Could not create frame command pool!");
+
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = frame.commandPool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = 1;
+        VK_ASSERT(vkAllocateCommandBuffers(device, &allocInfo, &frame.commandBuffer), "Could not allocate command buffer!");
+    }
+}
+
+void RayTracingApplication::createSyncObjects() {
+    Trace::Zone zone("createSyncObjects");
+    VkSemaphoreCreateInfo semaphoreInfo{};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    // Frame slots wait on renderTimeline values, only acquire and present need binary semaphores
+    for(FrameResources& frame : frames) {
+        if(!settings.headless) {
+            VK_ASSERT(vkCreateSemaphore(device, &semaphoreInfo, nullptr, &frame.imageAvailable), "Could not create semaphore!");
+        }
+    }
+    renderFinishedSemaphores.resize(swapChainImages.size());
+    for(VkSemaphore& semaphore : renderFinishedSemaphores) {
+        VK_ASSERT(vkCreateSemaphore(device, &semaphoreInfo, nullptr, &semaphore), "Could not create semaphore!");
+    }
+}
+
+VkCommandBuffer RayTracingApplication::beginFrame(FrameResources& frame) {
+    {
+        // Only blocks when the GPU is framesInFlight frames behind
+        Trace::Zone zone("waitForFrame");
+        renderTimeline->wait(frame.submitted);
+    }
+    renderTimeline->collect();
+    if(computeTimeline) computeTimeline->collect();
+    collectStageTimes(currentFrame);
+
+    VK_ASSERT(vkResetCommandPool(device, frame.commandPool, 0), "Could not reset command pool!");
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    VK_ASSERT(vkBeginCommandBuffer(frame.commandBuffer, &beginInfo), "Could not begin command buffer!");
+    if(profiler) profiler->beginFrame(frame.commandBuffer, currentFrame);
+    return frame.commandBuffer;
+}
+
+void RayTracingApplication::recordComputePass(VkCommandBuffer cmd) {
+    // Frames in flight are only ordered by submission, the previous frame's accumulation has to be visible
+    VkUtils::computeBarrier(cmd);
+
+    // The previous frame's blit has to finish reading the output image before the kernel overwrites it
+    VkImageMemoryBarrier outputBarrier{};
+    outputBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    outputBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+    outputBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    outputBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    outputBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    outputBarrier.image = outputImage;
+    outputBarrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    outputBarrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    outputBarrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0, 0, nullptr, 0, nullptr, 1, &outputBarrier);
+
+    if(wavefront) {
+        wavefront->record(cmd, frameIndex, currentFrame);
+        return;
+    }
+
+    PushConstants push{};
+    push.frameIndex = frameIndex;
+    push.samplesPerPixel = SAMPLES_PER_PIXEL;
+    push.maxBounces = MAX_BOUNCES;
+
+    // The tile list of the last convergence check decides which tiles keep being sampled
+    bool adaptive = adaptivePipeline != VK_NULL_HANDLE && frameIndex >= ADAPTIVE_WARMUP_FRAMES;
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, adaptive ? adaptivePipeline : computePipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+    vkCmdPushConstants(cmd, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &push);
+    if(adaptive) {
+        vkCmdDispatchIndirect(cmd, convergence->activeTiles(), 0);
+        return;
+    }
+    vkCmdDispatch(cmd,
+                  (renderExtent.width + workgroupSize.width - 1) / workgroupSize.width,
+                  (renderExtent.height + workgroupSize.height - 1) / workgroupSize.height,
+                  1);
+}
+
+void RayTracingApplication::recordBlit(VkCommandBuffer cmd, uint32_t imageIndex) {
+    VkImageMemoryBarrier barriers[2]{};
+    barriers[0].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barriers[0].oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barriers[0].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barriers[0].image = outputImage;
+    barriers[0].subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    barriers[0].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barriers[0].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+    barriers[1].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barriers[1].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barriers[1].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barriers[1].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barriers[1].image = swapChainImages[imageIndex];
+    barriers[1].subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    barriers[1].srcAccessMask = 0;
+    barriers[1].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0, 0, nullptr, 0, nullptr, 2, barriers);
+
+    VkImageBlit blit{};
+    blit.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    blit.srcOffsets[1] = {static_cast<int32_t>(renderExtent.width), static_cast<int32_t>(renderExtent.height), 1};
+    blit.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    // A recreated swapchain can differ from the render extent, the blit scales to it
+    blit.dstOffsets[1] = {static_cast<int32_t>(swapChainExtent.width), static_cast<int32_t>(swapChainExtent.height), 1};
+    vkCmdBlitImage(cmd, outputImage, VK_IMAGE_LAYOUT_GENERAL,
+                   swapChainImages[imageIndex], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                   1, &blit, VK_FILTER_NEAREST);
+
+    VkImageMemoryBarrier presentBarrier = barriers[1];
+    presentBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    presentBarrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    presentBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    presentBarrier.dstAccessMask = 0;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                         0, 0, nullptr, 0, nullptr, 1, &presentBarrier);
+}
+
+void RayTracingApplication::drawFrame() {
+    Trace::Zone zone("drawFrame");
+    FrameResources& frame = frames[currentFrame];
+    // The slot's last submission waits on imageAvailable, it has to be done before the semaphore is signaled again
+    renderTimeline->wait(frame.submitted);
+
+    uint32_t imageIndex;
+    VkResult acquired = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX, frame.imageAvailable, VK_NULL_HANDLE, &imageIndex);
+    if(acquired == VK_ERROR_OUT_OF_DATE_KHR) {
+        // Nothing was signaled or recorded yet, the next call retries with the new swapchain
+        recreateSwapChain();
+        return;
+    }
+    if(acquired != VK_SUBOPTIMAL_KHR) {
+        VK_ASSERT(acquired, "Could not acquire swapchain image!");
+    }
+    VkCommandBuffer commandBuffer = beginFrame(frame);
+
+    if(profiler) profiler->beginPass(commandBuffer, wavefront ? "wavefront" : "pathtrace");
+    recordComputePass(commandBuffer);
+    if(profiler) profiler->endPass(commandBuffer);
+    if(profiler) profiler->beginPass(commandBuffer, "blit");
+    recordBlit(commandBuffer, imageIndex);
+    if(profiler) profiler->endPass(commandBuffer);
+    VK_ASSERT(vkEndCommandBuffer(commandBuffer), "Could not end command buffer!");
+
+    GpuTimeline::Submission submission;
+    submission.commandBuffers.push_back(commandBuffer);
+    submission.binaryWaits.push_back(frame.imageAvailable);
+    submission.binaryWaitStages.push_back(VK_PIPELINE_STAGE_TRANSFER_BIT);
+    submission.binarySignals.push_back(renderFinishedSemaphores[imageIndex]);
+    frame.submitted = submitRender(submission);
+
+    VkPresentInfoKHR presentInfo{};
+    presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+    presentInfo.waitSemaphoreCount = 1;
+    presentInfo.pWaitSemaphores = &renderFinishedSemaphores[imageIndex];
+    presentInfo.swapchainCount = 1;
+    presentInfo.pSwapchains = &swapChain;
+    presentInfo.pImageIndices = &imageIndex;
+
+    VkResult presented = vkQueuePresentKHR(presentQueue, &presentInfo);
+    if(presented != VK_ERROR_OUT_OF_DATE_KHR && presented != VK_SUBOPTIMAL_KHR) {
+        VK_ASSERT(presented, "Could not present swapchain image!");
+    }
+
+    frameIndex++;
+    currentFrame = (currentFrame + 1) % static_cast<uint32_t>(frames.size());
+    samplesSinceReport += static_cast<uint64_t>(renderExtent.width) * renderExtent.height * SAMPLES_PER_PIXEL;
+
+    // The frame was still submitted, only the swapchain has to follow the surface
+    if(presented == VK_ERROR_OUT_OF_DATE_KHR) recreateSwapChain();
+}
+
+void RayTracingApplication::recreateSwapChain() {
+    Trace::Zone zone("recreateSwapChain");
+    // A minimized window has no extent to create a swapchain with
+    int width = 0, height = 0;
+    glfwGetFramebufferSize(window, &width, &height);
+    while((width == 0 || height == 0) && !glfwWindowShouldClose(window)) {
+        glfwWaitEvents();
+        glfwGetFramebufferSize(window, &width, &height);
+    }
+    VK_ASSERT(vkDeviceWaitIdle(device), "Could not wait for the device!");
+
+    for(VkSemaphore semaphore : renderFinishedSemaphores) {
+        vkDestroySemaphore(device, semaphore, nullptr);
+    }
+    for(auto& imageView : swapChainImageViews){
+        vkDestroyImageView(device, imageView, nullptr);
+    }
+    vkDestroySwapchainKHR(device, swapChain, nullptr);
+
+    createSwapChain();
+    createImageViews();
+
+    // The image count can change with the swapchain
+    VkSemaphoreCreateInfo semaphoreInfo{};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    renderFinishedSemaphores.resize(swapChainImages.size());
+    for(VkSemaphore& semaphore : renderFinishedSemaphores) {
+        VK_ASSERT(vkCreateSemaphore(device, &semaphoreInfo, nullptr, &semaphore), "Could not create semaphore!");
+    }
+}
+
+void RayTracingApplication::submitHeadlessFrame(bool checkConvergence) {
+    Trace::Zone zone("submitHeadlessFrame");
+    FrameResources& frame = frames[currentFrame];
+    VkCommandBuffer commandBuffer = beginFrame(frame);
+    if(profiler) profiler->beginPass(commandBuffer, wavefront ? "wavefront" : "pathtrace");
+    recordComputePass(commandBuffer);
+    if(profiler) profiler->endPass(commandBuffer);
+    if(convergence) {
+        // Tiles only retire once the warm up frames are in
+        bool retire = settings.adaptive && frameIndex + 1 >= ADAPTIVE_WARMUP_FRAMES;
+        if(profiler) profiler->beginPass(commandBuffer, "convergence");
+        convergence->record(commandBuffer, frameIndex, checkConvergence, retire ? settings.targetNoise : -1.0f);
+        if(profiler) profiler->endPass(commandBuffer);
+    }
+    VK_ASSERT(vkEndCommandBuffer(commandBuffer), "Could not end command buffer!");
+
+    GpuTimeline::Submission submission;
+    submission.commandBuffers.push_back(commandBuffer);
+    frame.submitted = submitRender(submission);
+
+    frameIndex++;
+    currentFrame = (currentFrame + 1) % static_cast<uint32_t>(frames.size());
+    samplesSinceReport += static_cast<uint64_t>(renderExtent.width) * renderExtent.height * SAMPLES_PER_PIXEL;
+}
+
+void RayTracingApplication::renderHeadless() {
+    if(!splitFrameWorkers.empty()) {
+        renderSplitFrames();
+        return;
+    }
+
+    lastReport = std::chrono::steady_clock::now();
+    auto start = lastReport;
+
+    // The tile errors of a check are read at the next one, by then that frame has long finished
+    uint64_t lastCheck = 0;
+    uint32_t framesRendered = 0;
+    for(; framesRendered < settings.frameCount; framesRendered++) {
+        bool check = convergence && frameIndex % CONVERGENCE_INTERVAL == CONVERGENCE_INTERVAL - 1;
+        if(check && lastCheck != 0) {
+            renderTimeline->wait(lastCheck);
+            ConvergenceMonitor::Stats stats = convergence->readStats();
+            if(stats.maxTileError <= settings.targetNoise) {
+                std::cout << "Converged after " << framesRendered << " frames: tile error max " << stats.maxTileError
+                          << ", mean " << stats.meanTileError << " (target " << settings.targetNoise << ")" << std::endl;
+                break;
+            }
+            if(settings.adaptive && frameIndex >= ADAPTIVE_WARMUP_FRAMES) {
+                std::cout << "Frame " << frameIndex << ": " << stats.activeTiles << " of " << stats.tiles << " tiles above target noise" << std::endl;
+            }
+        }
+
+        submitHeadlessFrame(check);
+        if(check) lastCheck = renderTimeline->lastSubmitted();
+        reportThroughput();
+    }
+
+    renderTimeline->wait(renderTimeline->lastSubmitted());
+    for(uint32_t slot = 0; slot < frames.size(); slot++) {
+        collectStageTimes(slot);
+    }
+    finishProfiling();
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    lastRenderSeconds = seconds;
+    uint64_t totalSamples = static_cast<uint64_t>(renderExtent.width) * renderExtent.height * SAMPLES_PER_PIXEL * framesRendered;
+    std::cout << "Rendered " << framesRendered << " frames in " << seconds << " s ("
+              << (totalSamples / seconds) / 1e6 << " MSamples/s)" << std::endl;
+    printStageTimes(stageTimesTotal, timedFramesTotal);
+    if(settings.keepAccumulation) readAccumulation(finalAccumulation);
+
+    saveOutputImage(settings.outputFile);
+}
+
+void RayTracingApplication::createSplitFrameWorkers() {
+    Trace::Zone zone("createSplitFrameWorkers");
+    // Scene and BVH exactly as this device's kernel sees them, including the GPU built BVH
+    std::vector<std::vector<char>> sceneData;
+    for(const Buffer* buffer : {&vertexBuffer, &indexBuffer, &nodeBuffer, &triangleIndexBuffer, &triangleMaterialBuffer, &materialBuffer}) {
+        sceneData.emplace_back(buffer->size);
+        downloadBuffer(*buffer, sceneData.back().data(), buffer->size);
+    }
+
+    // Device creation, uploads and pipeline compilation of all workers overlap
+    const std::vector<char>& shaderCode = pathTracerShader.get()->data;
+    std::vector<std::future<std::unique_ptr<SplitFrameWorker>>> pending;
+    for(VkPhysicalDevice phyDevice : splitFrameDevices) {
+        pending.push_back(std::async(std::launch::async, [&, phyDevice]() {
+            return std::make_unique<SplitFrameWorker>(phyDevice, shaderCode, renderExtent, SAMPLES_PER_PIXEL, MAX_BOUNCES, sceneData);
+        }));
+    }
+    for(auto& worker : pending) {
+        splitFrameWorkers.push_back(worker.get());
+        std::cout << "Split frame device: " << splitFrameWorkers.back()->name() << std::endl;
+    }
+}
+
+double RayTracingApplication::renderFrameRange(uint32_t first, uint32_t count) {
+    auto start = std::chrono::steady_clock::now();
+    frameIndex = first;
+    for(uint32_t i = 0; i < count; i++) {
+        submitHeadlessFrame();
+    }
+    renderTimeline->wait(renderTimeline->lastSubmitted());
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void RayTracingApplication::renderSplitFrames() {
+    // Frames are independent sample sets: every device accumulates its own frame indices and the
+    // sums are added at the end. Device 0 is this one, it renders frame 0 which clears the sum.
+    const size_t deviceCount = splitFrameWorkers.size() + 1;
+    std::vector<uint32_t> framesDone(deviceCount, 0);
+    std::vector<double> seconds(deviceCount, 0.0);
+    auto start = std::chrono::steady_clock::now();
+
+    uint32_t nextFrame = 0;
+    while(nextFrame < settings.frameCount) {
+        uint32_t remaining = settings.frameCount - nextFrame;
+        std::vector<uint32_t> share(deviceCount, 0);
+        if(nextFrame == 0) {
+            // Calibration round, one frame each
+            for(size_t d = 0; d < deviceCount && d < remaining; d++) share[d] = 1;
+        }else {
+            // Later rounds are split by measured frames per second; several rounds let the split follow clock changes
+            uint32_t budget = std::min(remaining, std::max(static_cast<uint32_t>(deviceCount), settings.frameCount / 8));
+            std::vector<double> rates(deviceCount);
+            double totalRate = 0.0;
+            for(size_t d = 0; d < deviceCount; d++) {
+                rates[d] = framesDone[d] / std::max(seconds[d], 1e-6);
+                totalRate += rates[d];
+            }
+            uint32_t assigned = 0;
+            for(size_t d = 0; d < deviceCount; d++) {
+                share[d] = static_cast<uint32_t>(budget * rates[d] / totalRate);
+                assigned += share[d];
+            }
+            share[std::max_element(rates.begin(), rates.end()) - rates.begin()] += budget - assigned;
+        }
+
+        std::vector<std::future<double>> jobs(splitFrameWorkers.size());
+        uint32_t first = nextFrame + share[0];
+        for(size_t w = 0; w < splitFrameWorkers.size(); w++) {
+            uint32_t count = share[w + 1];
+            if(count == 0) continue;
+            SplitFrameWorker* worker = splitFrameWorkers[w].get();
+            jobs[w] = std::async(std::launch::async, [worker, first, count]() { return worker->render(first, count); });
+            first += count;
+        }
+        if(share[0] > 0) seconds[0] += renderFrameRange(nextFrame, share[0]);
+        framesDone[0] += share[0];
+        for(size_t w = 0; w < jobs.size(); w++) {
+            if(jobs[w].valid()) seconds[w + 1] += jobs[w].get();
+            framesDone[w + 1] += share[w + 1];
+        }
+        nextFrame = first;
+    }
+    finishProfiling();
+
+    double totalSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    lastRenderSeconds = totalSeconds;
+    uint64_t totalSamples = static_cast<uint64_t>(renderExtent.width) * renderExtent.height * SAMPLES_PER_PIXEL * settings.frameCount;
+    std::cout << "Rendered " << settings.frameCount << " frames on " << deviceCount << " devices in " << totalSeconds << " s ("
+              << (totalSamples / totalSeconds) / 1e6 << " MSamples/s)" << std::endl;
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(physicalDevice, &props);
+    for(size_t d = 0; d < deviceCount; d++) {
+        std::cout << "  " << (d == 0 ? std::string(props.deviceName) : splitFrameWorkers[d - 1]->name()) << ": "
+                  << framesDone[d] << " frames (" << 100.0 * framesDone[d] / settings.frameCount << "%), "
+                  << framesDone[d] / std::max(seconds[d], 1e-6) << " frames/s" << std::endl;
+    }
+
+    std::vector<float> sum;
+    std::vector<float> pixels;
+    readAccumulation(sum);
+    for(auto& worker : splitFrameWorkers) {
+        worker->readAccumulation(pixels);
+        for(size_t i = 0; i < sum.size(); i++) sum[i] += pixels[i];
+    }
+    size_t pixelCount = static_cast<size_t>(renderExtent.width) * renderExtent.height;
+    std::vector<uint8_t> rgba(pixelCount * 4);
+    ImageIO::resolveAccumulation(sum.data(), pixelCount, rgba.data());
+    if(settings.keepAccumulation) finalAccumulation = sum;
+    ImageIO::writePPM(settings.outputFile, renderExtent.width, renderExtent.height, rgba.data());
+    std::cout << "Wrote " << settings.outputFile << std::endl;
+}
+
+void RayTracingApplication::readAccumulation(std::vector<float>& pixels) {
+    size_t floats = static_cast<size_t>(renderExtent.width) * renderExtent.height * 4;
+    Buffer readback = createReadbackBuffer(floats * sizeof(float));
+
+    VkCommandBuffer cmd = beginSingleTimeCommands();
+    VkUtils::recordImageReadback(cmd, accumulationImage, renderExtent, readback.buffer);
+    endSingleTimeCommands(cmd);
+
+    pixels.resize(floats);
+    memcpy(pixels.data(), readback.allocation.mapped, floats * sizeof(float));
+    destroyBuffer(readback);
+}
+
+void RayTracingApplication::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, GpuAllocation& allocation) {
+    VkUtils::createBuffer(*allocator, device, size, usage, properties, buffer, allocation);
+}
+
+void RayTracingApplication::saveOutputImage(const std::string& filename) {
+    VkDeviceSize size = static_cast<VkDeviceSize>(renderExtent.width) * renderExtent.height * 4;
+    Buffer readback = createReadbackBuffer(size);
+
+    VkCommandBuffer cmd = beginSingleTimeCommands();
+    VkUtils::recordImageReadback(cmd, outputImage, renderExtent, readback.buffer);
+    endSingleTimeCommands(cmd);
+
+    ImageIO::writePPM(filename, renderExtent.width, renderExtent.height, static_cast<const uint8_t*>(readback.allocation.mapped));
+    destroyBuffer(readback);
+
+    std::cout << "Wrote " << filename << std::endl;
+}
+
+void RayTracingApplication::reportThroughput() {
+    auto now = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(now - lastReport).count();
+    if(seconds < 1.0) return;
+
+    std::cout << "Frame " << frameIndex << ": "
+              << (samplesSinceReport / seconds) / 1e6 << " MSamples/s" << std::endl;
+    printStageTimes(stageTimesSinceReport, timedFramesSinceReport);
+    if(profiler) {
+        profiler->print(std::cout);
+        writeProfile();
+    }
+    samplesSinceReport = 0;
+    lastReport = now;
+    for(double& ms : stageTimesSinceReport) ms = 0.0;
+    timedFramesSinceReport = 0;
+}
+
+// Must only run once the frame last submitted from frameSlot has finished
+void RayTracingApplication::collectStageTimes(uint32_t frameSlot) {
+    double ms[WavefrontPathTracer::STAGE_COUNT];
+    if(!wavefront || !wavefront->readStageTimes(frameSlot, ms)) return;
+    for(uint32_t s = 0; s < WavefrontPathTracer::STAGE_COUNT; s++) {
+        stageTimesSinceReport[s] += ms[s];
+        stageTimesTotal[s] += ms[s];
+    }
+    timedFramesSinceReport++;
+    timedFramesTotal++;
+}
+
+void RayTracingApplication::finishProfiling() {
+    if(!profiler) return;
+    for(uint32_t slot = 0; slot < frames.size(); slot++) {
+        profiler->collect(slot);
+    }
+    profiler->print(std::cout);
+    writeProfile();
+}
+
+void RayTracingApplication::writeProfile() {
+    if(settings.profileJson.empty()) return;
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(physicalDevice, &props);
+    profiler->writeJson(settings.profileJson, props.deviceName);
+}
+
+void RayTracingApplication::printStageTimes(const double totals[WavefrontPathTracer::STAGE_COUNT], uint32_t frames) {
+    if(frames == 0) return;
+    std::cout << "  GPU ms per frame:";
+    for(uint32_t s = 0; s < WavefrontPathTracer::STAGE_COUNT; s++) {
+        std::cout << " " << WavefrontPathTracer::stageName(static_cast<WavefrontPathTracer::Stage>(s)) << " " << totals[s] / frames;
+    }
+    std::cout << std::endl;
+}
 
 void RayTracingApplication::createSurface(){
+    Trace::Zone zone("createSurface");
     VK_ASSERT(glfwCreateWindowSurface(instance, window, nullptr, &surface), "Could not create window surface!");
 }
 
@@ -435,22 +1819,74 @@ void RayTracingApplication::initWindow() {
     glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
     glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
     
-    window = glfwCreateWindow(WIDTH, HEIGHT, "Vulkan Raytracing", nullptr, nullptr);
+    window = glfwCreateWindow(settings.width, settings.height, "Vulkan Raytracing", nullptr, nullptr);
 }
 
 void RayTracingApplication::mainLoop() {
+    lastReport = std::chrono::steady_clock::now();
     while(!glfwWindowShouldClose(window)) {
         glfwPollEvents();
+        drawFrame();
+        reportThroughput();
     }
+
+    VK_ASSERT(vkDeviceWaitIdle(device), "Could not wait for device!");
+    finishProfiling();
 }
 
 void RayTracingApplication::cleanup() {
 
+    for(auto& worker : splitFrameWorkers) {
+        worker->destroy();
+    }
+    // Runs the pending releases, which still use the command pool and buffers
+    renderTimeline->destroy();
+    if(transferTimeline) transferTimeline->destroy();
+    if(computeTimeline) computeTimeline->destroy();
+    uploader->destroy();
+    for(FrameResources& frame : frames) {
+        vkDestroySemaphore(device, frame.imageAvailable, nullptr);
+        vkDestroyCommandPool(device, frame.commandPool, nullptr);
+    }
+    for(VkSemaphore semaphore : renderFinishedSemaphores) {
+        vkDestroySemaphore(device, semaphore, nullptr);
+    }
+    vkDestroyCommandPool(device, commandPool, nullptr);
+    if(asyncCommandPool != VK_NULL_HANDLE) vkDestroyCommandPool(device, asyncCommandPool, nullptr);
+
+    if(wavefront) wavefront->destroy();
+    if(convergence) convergence->destroy();
+    if(profiler) profiler->destroy();
+    vkDestroyPipeline(device, computePipeline, nullptr);
+    if(adaptivePipeline != VK_NULL_HANDLE) vkDestroyPipeline(device, adaptivePipeline, nullptr);
+    savePipelineCache();
+    vkDestroyPipelineCache(device, pipelineCache, nullptr);
+    vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+    vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+    vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+
+    destroyBuffer(vertexBuffer);
+    destroyBuffer(indexBuffer);
+    destroyBuffer(nodeBuffer);
+    destroyBuffer(triangleIndexBuffer);
+    destroyBuffer(triangleMaterialBuffer);
+    destroyBuffer(materialBuffer);
+    destroyBuffer(lightBuffer);
+
+    vkDestroyImageView(device, outputImageView, nullptr);
+    vkDestroyImage(device, outputImage, nullptr);
+    allocator->free(outputImageAllocation);
+    vkDestroyImageView(device, accumulationImageView, nullptr);
+    vkDestroyImage(device, accumulationImage, nullptr);
+    allocator->free(accumulationImageAllocation);
+    allocator->destroy();
+
     for(auto& imageView : swapChainImageViews){
         vkDestroyImageView(device, imageView, nullptr);
     }
 
-    vkDestroySwapchainKHR(device, swapChain, nullptr);
+    // Swapchain and surface functions are not available when their extensions were never enabled
+    if(!settings.headless) vkDestroySwapchainKHR(device, swapChain, nullptr);
     vkDestroyDevice(device, nullptr);
     if(enableValidationLayers){
         auto func = (PFN_vkDestroyDebugUtilsMessengerEXT) vkGetInstanceProcAddr(instance, "vkDestroyDebugUtilsMessengerEXT");
@@ -458,11 +1894,13 @@ void RayTracingApplication::cleanup() {
             func(instance, debugMessenger, nullptr);
         }
     }
-    vkDestroySurfaceKHR(instance, surface, nullptr);
+    if(!settings.headless) vkDestroySurfaceKHR(instance, surface, nullptr);
     vkDestroyInstance(instance, nullptr);
 
-    glfwDestroyWindow(window);
-    glfwTerminate();
+    if(!settings.headless) {
+        glfwDestroyWindow(window);
+        glfwTerminate();
+    }
 }
 
 VKAPI_ATTR VkBool32 VKAPI_CALL RayTracingApplication::debugCallback(VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
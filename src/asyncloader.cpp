@@ -0,0 +1,41 @@
+#include "asyncloader.h"
+#include <algorithm>
+#include <chrono>
+#include "trace.h"
+
+AsyncLoader::AsyncLoader(ThreadPool& pool) : pool(pool) {
+}
+
+AsyncLoader::~AsyncLoader() {
+    waitIdle();
+}
+
+AssetHandle AsyncLoader::load(const std::string& filename) {
+    auto future = pool.submit([filename]() {
+        Trace::Zone zone("load " + filename);
+        auto asset = std::make_shared<LoadedAsset>();
+        asset->name = filename;
+        asset->data = Loader::readFile(filename);
+        return asset;
+    });
+
+    AssetHandle handle = future.share();
+    std::lock_guard<std::mutex> lock(mutex);
+    // Forget handles that completed a while ago so the list does not grow without bound
+    pending.erase(std::remove_if(pending.begin(), pending.end(), [](const AssetHandle& h) {
+        return h.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }), pending.end());
+    pending.push_back(handle);
+    return handle;
+}
+
+void AsyncLoader::waitIdle() {
+    std::vector<AssetHandle> handles;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        handles.swap(pending);
+    }
+    for(auto& handle : handles) {
+        handle.wait();
+    }
+}
@@ -0,0 +1,261 @@
+#include "benchmark.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include "gltf.h"
+#include "lbvh.h"
+#include "loader.h"
+#include "trace.h"
+#include "widebvh.h"
+
+namespace {
+
+const float PI = 3.14159265359f;
+
+// Same rules as the renderer's options: plain digits that fit into 32 bits
+uint32_t parseUnsigned(const std::string& option, const std::string& value) {
+    bool digits = !value.empty() && value.find_first_not_of("0123456789") == std::string::npos;
+    try {
+        unsigned long long parsed = digits ? std::stoull(value) : 0;
+        if(digits && parsed <= UINT32_MAX) return static_cast<uint32_t>(parsed);
+    }catch(const std::exception&) {
+    }
+    throw std::runtime_error("Invalid value for " + option + ": " + value);
+}
+
+// The builders log every build, which would drown the results
+class QuietOutput {
+public:
+    QuietOutput() : previous(std::cout.rdbuf(nullptr)) {}
+    ~QuietOutput() { std::cout.rdbuf(previous); }
+
+private:
+    std::streambuf* previous;
+};
+
+// Randomly oriented triangles spread over [-1, 1]^3, sized so their density stays the same for every count
+Scene createTriangleSoup(uint32_t count) {
+    Scene scene;
+    uint32_t material = scene.addMaterial(glm::vec3(0.5f));
+    std::mt19937 rng(count);
+    std::uniform_real_distribution<float> position(-1.0f, 1.0f);
+    float size = 2.0f / std::cbrt(static_cast<float>(count));
+    for(uint32_t i = 0; i < count; i++) {
+        glm::vec3 center(position(rng), position(rng), position(rng));
+        glm::vec3 a = center + size * glm::vec3(position(rng), position(rng), position(rng));
+        glm::vec3 b = center + size * glm::vec3(position(rng), position(rng), position(rng));
+        glm::vec3 c = center + size * glm::vec3(position(rng), position(rng), position(rng));
+        scene.addTriangle(a, b, c, material);
+    }
+    return scene;
+}
+
+}
+
+BenchmarkSettings BenchmarkSettings::fromArguments(int argc, char** argv) {
+    BenchmarkSettings settings;
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        auto nextValue = [&]() -> std::string {
+            if(i + 1 >= argc) throw std::runtime_error("Missing value for " + arg);
+            return argv[++i];
+        };
+
+        if(arg == "--output") {
+            settings.outputFile = nextValue();
+        }else if(arg == "--label") {
+            settings.label = nextValue();
+        }else if(arg == "--quick") {
+            settings.quick = true;
+        }else if(arg == "--mesh") {
+            settings.meshFiles.push_back(nextValue());
+        }else if(arg == "--threads") {
+            settings.threads = parseUnsigned(arg, nextValue());
+        }else {
+            throw std::runtime_error("Unknown argument: " + arg);
+        }
+    }
+    return settings;
+}
+
+Benchmark::Benchmark(const BenchmarkSettings& settings)
+    : settings(settings), threadPool(settings.threads), minSeconds(settings.quick ? 0.05 : 0.5) {
+    CpuIsa widest = CpuRenderer::detectIsa();
+    for(CpuIsa isa : {CpuIsa::Scalar, CpuIsa::SSE, CpuIsa::AVX2, CpuIsa::AVX512}) {
+        if(isa <= widest) isas.push_back(isa);
+    }
+}
+
+void Benchmark::run() {
+    std::cout << "Benchmark: " << CpuRenderer::isaName(isas.back()) << " CPU, " << threadPool.size() << " build threads" << std::endl;
+    for(const Mesh& mesh : createMeshes()) {
+        std::cout << "== " << mesh.name << " (" << mesh.scene.triangleCount() << " triangles)" << std::endl;
+        BVH bvh;
+        {
+            QuietOutput quiet;
+            bvh = BVHBuilder(threadPool).build(mesh.scene);
+        }
+        benchmarkBuilds(mesh);
+        benchmarkKernels(mesh, bvh);
+        benchmarkTraversal(mesh, bvh);
+    }
+    writeReport();
+}
+
+std::vector<Benchmark::Mesh> Benchmark::createMeshes() {
+    std::vector<Mesh> meshes;
+    meshes.push_back({"cornell", Scene::createCornellBox()});
+    // 20 * 4^subdivisions triangles
+    std::vector<uint32_t> subdivisions = settings.quick ? std::vector<uint32_t>{5} : std::vector<uint32_t>{5, 6, 7};
+    for(uint32_t level : subdivisions) {
+        Mesh mesh{"sphere-" + std::to_string(level), Scene()};
+        mesh.scene.addSphere(glm::vec3(0.0f), 1.0f, level, mesh.scene.addMaterial(glm::vec3(0.5f)));
+        meshes.push_back(std::move(mesh));
+    }
+    std::vector<uint32_t> soups = settings.quick ? std::vector<uint32_t>{1u << 14} : std::vector<uint32_t>{1u << 16, 1u << 20};
+    for(uint32_t count : soups) {
+        meshes.push_back({"soup-" + std::to_string(count), createTriangleSoup(count)});
+    }
+    for(const std::string& file : settings.meshFiles) {
+        meshes.push_back({std::filesystem::path(file).filename().string(), GltfLoader::loadScene(file, threadPool)});
+    }
+    return meshes;
+}
+
+void Benchmark::benchmarkBuilds(const Mesh& mesh) {
+    double triangles = static_cast<double>(mesh.scene.triangleCount());
+    QuietOutput quiet;
+    BVH sah;
+    double seconds = measure([&]() { sah = BVHBuilder(threadPool).build(mesh.scene); });
+    addResult("build", "sah", mesh, triangles / seconds / 1e6, "Mtris/s");
+    seconds = measure([&]() { LBVH::buildReference(mesh.scene); });
+    addResult("build", "lbvh", mesh, triangles / seconds / 1e6, "Mtris/s");
+    seconds = measure([&]() { BVH8::collapse(mesh.scene, sah); });
+    addResult("build", "wide8-collapse", mesh, triangles / seconds / 1e6, "Mtris/s");
+}
+
+void Benchmark::benchmarkKernels(const Mesh& mesh, const BVH& bvh) {
+    std::vector<CpuTriangle> triangles = CpuRenderer::prepareTriangles(mesh.scene);
+    CpuFrame frame{bvh.nodes.data(), bvh.triangleIndices.data(), triangles.data(), mesh.scene.materials.data(), 0, 0, 0, 0, 0, nullptr};
+    std::vector<CpuRay> rays = incoherentRays({bvh.nodes[0].aabbMin, bvh.nodes[0].aabbMax}, KERNEL_RAYS);
+    uint32_t triangleCount = std::min(KERNEL_PRIMITIVES, static_cast<uint32_t>(triangles.size()));
+    uint32_t nodeCount = std::min(KERNEL_PRIMITIVES, static_cast<uint32_t>(bvh.nodes.size()));
+
+    uint64_t hits = 0;
+    for(CpuIsa isa : isas) {
+        CpuKernels kernels = CpuRenderer::kernelsFor(isa);
+        double seconds = measure([&]() { hits += kernels.intersectTriangles(frame, rays.data(), KERNEL_RAYS, triangleCount); });
+        addResult("ray-triangle", CpuRenderer::isaName(isa), mesh, static_cast<double>(KERNEL_RAYS) * triangleCount / seconds / 1e6, "Mtests/s");
+        seconds = measure([&]() { hits += kernels.intersectBoxes(frame, rays.data(), KERNEL_RAYS, nodeCount); });
+        addResult("ray-box", CpuRenderer::isaName(isa), mesh, static_cast<double>(KERNEL_RAYS) * nodeCount / seconds / 1e6, "Mtests/s");
+    }
+    // Keeps the hit counts, and with them the tests, alive
+    if(hits == 0) std::cout << "  (no ray hit any primitive)" << std::endl;
+}
+
+void Benchmark::benchmarkTraversal(const Mesh& mesh, const BVH& bvh) {
+    std::vector<CpuTriangle> triangles = CpuRenderer::prepareTriangles(mesh.scene);
+    CpuFrame frame{bvh.nodes.data(), bvh.triangleIndices.data(), triangles.data(), mesh.scene.materials.data(), 0, 0, 0, 0, 0, nullptr};
+    WideBVH wide;
+    {
+        QuietOutput quiet;
+        wide = BVH8::collapse(mesh.scene, bvh);
+    }
+
+    std::vector<CpuRay> coherent = coherentRays();
+    std::vector<CpuRay> incoherent = incoherentRays({bvh.nodes[0].aabbMin, bvh.nodes[0].aabbMax}, static_cast<uint32_t>(coherent.size()));
+    std::vector<float> t(coherent.size());
+    std::vector<uint32_t> hitTriangles(coherent.size());
+    for(int pass = 0; pass < 2; pass++) {
+        const std::vector<CpuRay>& rays = pass == 0 ? coherent : incoherent;
+        std::string group = pass == 0 ? "traversal-coherent" : "traversal-incoherent";
+        uint32_t count = static_cast<uint32_t>(rays.size());
+        for(CpuIsa isa : isas) {
+            CpuKernels kernels = CpuRenderer::kernelsFor(isa);
+            double seconds = measure([&]() { kernels.traceRays(frame, rays.data(), count, t.data(), hitTriangles.data()); });
+            addResult(group, CpuRenderer::isaName(isa), mesh, count / seconds / 1e6, "Mrays/s");
+        }
+        // The CPU model of the GPU's wide traversal, one ray at a time
+        double seconds = measure([&]() {
+            for(const CpuRay& ray : rays) {
+                RayHit hit;
+                glm::vec3 origin(ray.origin[0], ray.origin[1], ray.origin[2]);
+                glm::vec3 direction(ray.direction[0], ray.direction[1], ray.direction[2]);
+                BVH8::intersect(mesh.scene, wide, origin, direction, 1e30f, hit);
+            }
+        });
+        addResult(group, "wide8", mesh, count / seconds / 1e6, "Mrays/s");
+    }
+}
+
+double Benchmark::measure(const std::function<void()>& func) const {
+    double best = 1e30;
+    double total = 0.0;
+    for(uint32_t runs = 0; runs < 3 || total < minSeconds; runs++) {
+        auto start = std::chrono::steady_clock::now();
+        func();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        best = std::min(best, seconds);
+        total += seconds;
+    }
+    return best;
+}
+
+void Benchmark::addResult(const std::string& group, const std::string& variant, const Mesh& mesh, double value, const std::string& unit) {
+    results.push_back({group, variant, mesh.name, mesh.scene.triangleCount(), value, unit});
+    std::cout << "  " << group << " " << variant << ": " << value << " " << unit << std::endl;
+}
+
+void Benchmark::writeReport() const {
+    std::ostringstream json;
+    json << "{\n  \"label\": \"" << Trace::escapeJson(settings.label) << "\",\n  \"isa\": \"" << CpuRenderer::isaName(isas.back()) << "\",\n"
+         << "  \"buildThreads\": " << threadPool.size() << ",\n  \"results\": [";
+    for(size_t i = 0; i < results.size(); i++) {
+        const Result& result = results[i];
+        json << (i == 0 ? "\n" : ",\n")
+             << "    {\"group\": \"" << result.group << "\", \"variant\": \"" << result.variant << "\", \"mesh\": \"" << Trace::escapeJson(result.mesh)
+             << "\", \"triangles\": " << result.triangles << ", \"value\": " << result.value << ", \"unit\": \"" << result.unit << "\"}";
+    }
+    json << "\n  ]\n}\n";
+
+    std::string text = json.str();
+    Loader::writeFileAtomic(settings.outputFile, std::vector<char>(text.begin(), text.end()));
+    std::cout << "Wrote " << settings.outputFile << std::endl;
+}
+
+std::vector<CpuRay> Benchmark::coherentRays() {
+    // Camera of the CPU renderer and shaders/common.glsl, through the pixel centers
+    const float tanHalfFov = std::tan(45.0f * PI / 180.0f * 0.5f);
+    std::vector<CpuRay> rays;
+    rays.reserve(RAY_GRID_SIZE * RAY_GRID_SIZE);
+    for(uint32_t blockY = 0; blockY < RAY_GRID_SIZE; blockY += 4) {
+        for(uint32_t blockX = 0; blockX < RAY_GRID_SIZE; blockX += 4) {
+            for(uint32_t i = 0; i < 16; i++) {
+                float ndcX = ((blockX + i % 4) + 0.5f) / RAY_GRID_SIZE * 2.0f - 1.0f;
+                float ndcY = ((blockY + i / 4) + 0.5f) / RAY_GRID_SIZE * 2.0f - 1.0f;
+                glm::vec3 direction = glm::normalize(glm::vec3(ndcX * tanHalfFov, -ndcY * tanHalfFov, -1.0f));
+                rays.push_back({{0.0f, 0.0f, 3.4f}, {direction.x, direction.y, direction.z}});
+            }
+        }
+    }
+    return rays;
+}
+
+std::vector<CpuRay> Benchmark::incoherentRays(const AABB& bounds, uint32_t count) {
+    std::mt19937 rng(count);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::vector<CpuRay> rays(count);
+    for(CpuRay& ray : rays) {
+        glm::vec3 origin = bounds.min + glm::vec3(unit(rng), unit(rng), unit(rng)) * (bounds.max - bounds.min);
+        float z = 2.0f * unit(rng) - 1.0f;
+        float phi = 2.0f * PI * unit(rng);
+        float r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+        ray = {{origin.x, origin.y, origin.z}, {r * std::cos(phi), r * std::sin(phi), z}};
+    }
+    return rays;
+}
@@ -0,0 +1,15 @@
+#include "benchmark.h"
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+
+int main(int argc, char** argv) {
+    try {
+        Benchmark benchmark(BenchmarkSettings::fromArguments(argc, argv));
+        benchmark.run();
+    }catch(const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
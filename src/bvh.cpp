@@ -0,0 +1,238 @@
+#include "bvh.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+static constexpr uint32_t MAX_BINS = 64;
+
+struct BVHBuilder::BuildContext {
+    BVH* bvh;
+    std::vector<AABB> triangleBounds;
+    std::vector<glm::vec3> centroids;
+    std::atomic<uint32_t> nodeCount{1};
+    std::atomic<uint32_t> maxDepth{0};
+
+    // Outstanding subtree tasks, build() returns once this drops to zero
+    std::mutex mutex;
+    std::condition_variable done;
+    uint32_t pendingTasks = 0;
+    std::exception_ptr error;
+};
+
+BVHBuilder::BVHBuilder(ThreadPool& pool) : BVHBuilder(pool, Options{}) {
+}
+
+BVHBuilder::BVHBuilder(ThreadPool& pool, const Options& options) : pool(pool), options(options) {
+}
+
+BVH BVHBuilder::build(const Scene& scene) {
+    auto start = std::chrono::steady_clock::now();
+
+    BVH bvh;
+    uint32_t triangleCount = static_cast<uint32_t>(scene.triangleCount());
+    if(triangleCount == 0) {
+        // A single root with an inverted (empty) box, the traversals test for it before descending
+        AABB empty;
+        bvh.nodes.push_back({empty.min, 0, empty.max, 0});
+        return bvh;
+    }
+
+    BuildContext ctx;
+    ctx.bvh = &bvh;
+    ctx.triangleBounds.resize(triangleCount);
+    ctx.centroids.resize(triangleCount);
+    bvh.triangleIndices.resize(triangleCount);
+    bvh.nodes.resize(2 * static_cast<size_t>(triangleCount) - 1);
+
+    for(uint32_t i = 0; i < triangleCount; i++) {
+        AABB box;
+        for(uint32_t k = 0; k < 3; k++) {
+            const glm::vec4& v = scene.vertices[scene.indices[3 * i + k]];
+            box.grow(glm::vec3(v.x, v.y, v.z));
+        }
+        ctx.triangleBounds[i] = box;
+        ctx.centroids[i] = (box.min + box.max) * 0.5f;
+        bvh.triangleIndices[i] = i;
+    }
+
+    spawn(ctx, 0, 0, triangleCount, 0);
+    {
+        std::unique_lock<std::mutex> lock(ctx.mutex);
+        ctx.done.wait(lock, [&]() { return ctx.pendingTasks == 0; });
+    }
+    if(ctx.error) std::rethrow_exception(ctx.error);
+
+    bvh.nodes.resize(ctx.nodeCount.load());
+    bvh.depth = ctx.maxDepth.load();
+    if(bvh.depth > BVH::MAX_DEPTH) {
+        throw std::runtime_error("BVH depth " + std::to_string(bvh.depth) + " exceeds the traversal stack size");
+    }
+
+    buildMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "BVH: " << triangleCount << " triangles, " << bvh.nodes.size() << " nodes in "
+              << buildMilliseconds << " ms (" << buildMilliseconds / (triangleCount / 1e6) << " ms per million triangles)" << std::endl;
+
+    return bvh;
+}
+
+void BVHBuilder::spawn(BuildContext& ctx, uint32_t nodeIndex, uint32_t first, uint32_t count, uint32_t depth) {
+    {
+        std::lock_guard<std::mutex> lock(ctx.mutex);
+        ctx.pendingTasks++;
+    }
+    // Tasks never wait on each other, so a busy pool cannot deadlock the build
+    pool.submit([this, &ctx, nodeIndex, first, count, depth]() {
+        try {
+            buildNode(ctx, nodeIndex, first, count, depth);
+        }catch(...) {
+            std::lock_guard<std::mutex> lock(ctx.mutex);
+            if(!ctx.error) ctx.error = std::current_exception();
+        }
+        std::lock_guard<std::mutex> lock(ctx.mutex);
+        if(--ctx.pendingTasks == 0) ctx.done.notify_all();
+    });
+}
+
+uint32_t BVHBuilder::balancedDepth(uint32_t count) const {
+    uint32_t leafSize = std::max(options.maxLeafSize, 1u);
+    uint32_t depth = 0;
+    for(uint32_t leaves = (count + leafSize - 1) / leafSize; leaves > 1; leaves = (leaves + 1) / 2) {
+        depth++;
+    }
+    return depth;
+}
+
+void BVHBuilder::buildNode(BuildContext& ctx, uint32_t nodeIndex, uint32_t first, uint32_t count, uint32_t depth) {
+    std::vector<uint32_t>& indices = ctx.bvh->triangleIndices;
+
+    AABB bounds;
+    AABB centroidBounds;
+    for(uint32_t i = first; i < first + count; i++) {
+        bounds.grow(ctx.triangleBounds[indices[i]]);
+        centroidBounds.grow(ctx.centroids[indices[i]]);
+    }
+
+    BVHNode& node = ctx.bvh->nodes[nodeIndex];
+    node.aabbMin = bounds.min;
+    node.aabbMax = bounds.max;
+
+    auto makeLeaf = [&]() {
+        node.leftFirst = first;
+        node.triangleCount = count;
+        uint32_t deepest = ctx.maxDepth.load();
+        while(depth > deepest && !ctx.maxDepth.compare_exchange_weak(deepest, depth)) {
+        }
+    };
+
+    if(count == 1) {
+        makeLeaf();
+        return;
+    }
+
+    // Evaluate the SAH at every bin boundary on all three axes
+    const uint32_t binCount = std::clamp(options.binCount, 2u, MAX_BINS);
+    struct Bin {
+        AABB bounds;
+        uint32_t count = 0;
+    };
+    Bin bins[MAX_BINS];
+    float leftArea[MAX_BINS], rightArea[MAX_BINS];
+    uint32_t leftCount[MAX_BINS], rightCount[MAX_BINS];
+
+    float bestCost = 1e30f;
+    int bestAxis = -1;
+    uint32_t bestSplit = 0;
+
+    for(int axis = 0; axis < 3; axis++) {
+        float lo = centroidBounds.min[axis];
+        float hi = centroidBounds.max[axis];
+        if(hi <= lo) continue;
+        float scale = binCount / (hi - lo);
+
+        std::fill(bins, bins + binCount, Bin{});
+        for(uint32_t i = first; i < first + count; i++) {
+            uint32_t tri = indices[i];
+            uint32_t b = std::min(binCount - 1, static_cast<uint32_t>((ctx.centroids[tri][axis] - lo) * scale));
+            bins[b].count++;
+            bins[b].bounds.grow(ctx.triangleBounds[tri]);
+        }
+
+        AABB leftBox, rightBox;
+        uint32_t leftSum = 0, rightSum = 0;
+        for(uint32_t i = 0; i < binCount - 1; i++) {
+            leftSum += bins[i].count;
+            leftBox.grow(bins[i].bounds);
+            leftCount[i] = leftSum;
+            leftArea[i] = leftBox.area();
+
+            rightSum += bins[binCount - 1 - i].count;
+            rightBox.grow(bins[binCount - 1 - i].bounds);
+            rightCount[binCount - 2 - i] = rightSum;
+            rightArea[binCount - 2 - i] = rightBox.area();
+        }
+
+        for(uint32_t i = 0; i < binCount - 1; i++) {
+            if(leftCount[i] == 0 || rightCount[i] == 0) continue;
+            float cost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+            if(cost < bestCost) {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = i;
+            }
+        }
+    }
+
+    float parentArea = bounds.area();
+    float leafCost = options.intersectionCost * count;
+    float splitCost = parentArea > 0.0f
+        ? options.traversalCost + options.intersectionCost * bestCost / parentArea
+        : leafCost;
+
+    uint32_t leftSize;
+    if(depth + balancedDepth(count) >= BVH::MAX_DEPTH) {
+        // No slack left for unbalanced SAH splits, halving keeps every leaf within MAX_DEPTH
+        if(count <= options.maxLeafSize) {
+            makeLeaf();
+            return;
+        }
+        int axis = 0;
+        glm::vec3 extent = centroidBounds.max - centroidBounds.min;
+        if(extent.y > extent[axis]) axis = 1;
+        if(extent.z > extent[axis]) axis = 2;
+        leftSize = count / 2;
+        std::nth_element(indices.begin() + first, indices.begin() + first + leftSize, indices.begin() + first + count,
+                         [&](uint32_t a, uint32_t b) { return ctx.centroids[a][axis] < ctx.centroids[b][axis]; });
+    }else if(bestAxis >= 0 && (splitCost < leafCost || count > options.maxLeafSize)) {
+        float lo = centroidBounds.min[bestAxis];
+        float scale = binCount / (centroidBounds.max[bestAxis] - lo);
+        auto middle = std::partition(indices.begin() + first, indices.begin() + first + count, [&](uint32_t tri) {
+            uint32_t b = std::min(binCount - 1, static_cast<uint32_t>((ctx.centroids[tri][bestAxis] - lo) * scale));
+            return b <= bestSplit;
+        });
+        leftSize = static_cast<uint32_t>(middle - (indices.begin() + first));
+    }else if(count > options.maxLeafSize) {
+        // All centroids coincide, split the range in half to keep leaves bounded
+        leftSize = count / 2;
+    }else {
+        makeLeaf();
+        return;
+    }
+
+    uint32_t leftChild = ctx.nodeCount.fetch_add(2);
+    node.leftFirst = leftChild;
+    node.triangleCount = 0;
+
+    uint32_t rightSize = count - leftSize;
+    if(leftSize >= options.parallelThreshold) {
+        spawn(ctx, leftChild, first, leftSize, depth + 1);
+    }else {
+        buildNode(ctx, leftChild, first, leftSize, depth + 1);
+    }
+    buildNode(ctx, leftChild + 1, first + leftSize, rightSize, depth + 1);
+}
@@ -0,0 +1,147 @@
+#include "convergence.h"
+#include <algorithm>
+#include <stdexcept>
+#include "loader.h"
+#include "vkutils.h"
+
+ConvergenceMonitor::ConvergenceMonitor(GpuAllocator& allocator, VkDevice device, VkPipelineCache pipelineCache, VkImageView accumulationImage,
+                                       VkExtent2D extent, uint32_t samplesPerPixel, VkExtent2D kernelWorkgroup)
+    : allocator(&allocator), device(device), samplesPerPixel(samplesPerPixel), kernelWorkgroup(kernelWorkgroup) {
+    tilesX = (extent.width + TILE_SIZE - 1) / TILE_SIZE;
+    tilesY = (extent.height + TILE_SIZE - 1) / TILE_SIZE;
+
+    // 0: accumulation image, 1: moments, 2: tile errors, 3: active tiles
+    VkDescriptorSetLayoutBinding bindings[4]{};
+    for(uint32_t i = 0; i < 4; i++) {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = i == 0 ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = 4;
+    layoutInfo.pBindings = bindings;
+    VK_ASSERT(vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &setLayout), "Could not create convergence descriptor set layout!");
+
+    VkPushConstantRange pushRange{};
+    pushRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushRange.size = sizeof(PushConstants);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &setLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushRange;
+    VK_ASSERT(vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout), "Could not create convergence pipeline layout!");
+
+    VkDescriptorPoolSize poolSizes[2]{};
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    poolSizes[0].descriptorCount = 1;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSizes[1].descriptorCount = 3;
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = 2;
+    poolInfo.pPoolSizes = poolSizes;
+    poolInfo.maxSets = 1;
+    VK_ASSERT(vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool), "Could not create convergence descriptor pool!");
+
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = descriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &setLayout;
+    VK_ASSERT(vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet), "Could not allocate convergence descriptor set!");
+
+    VkDeviceSize pixels = static_cast<VkDeviceSize>(extent.width) * extent.height;
+    VkUtils::createBuffer(allocator, device, pixels * 2 * sizeof(float), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, moments, momentAllocation);
+    // Read by the host every few frames, small enough to live in host visible memory
+    VkUtils::createBuffer(allocator, device, static_cast<VkDeviceSize>(tilesX) * tilesY * sizeof(float), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, tileErrors, tileErrorAllocation);
+    VkUtils::createBuffer(allocator, device, sizeof(VkDispatchIndirectCommand) + static_cast<VkDeviceSize>(tilesX) * tilesY * sizeof(uint32_t),
+                          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, activeTileBuffer, activeTileAllocation);
+
+    VkDescriptorImageInfo imageInfo{};
+    imageInfo.imageView = accumulationImage;
+    imageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    VkDescriptorBufferInfo bufferInfos[3]{};
+    bufferInfos[0].buffer = moments;
+    bufferInfos[0].range = VK_WHOLE_SIZE;
+    bufferInfos[1].buffer = tileErrors;
+    bufferInfos[1].range = VK_WHOLE_SIZE;
+    bufferInfos[2].buffer = activeTileBuffer;
+    bufferInfos[2].range = VK_WHOLE_SIZE;
+
+    VkWriteDescriptorSet writes[4]{};
+    for(uint32_t i = 0; i < 4; i++) {
+        writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[i].dstSet = descriptorSet;
+        writes[i].dstBinding = i;
+        writes[i].descriptorCount = 1;
+        if(i == 0) {
+            writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            writes[i].pImageInfo = &imageInfo;
+        }else {
+            writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            writes[i].pBufferInfo = &bufferInfos[i - 1];
+        }
+    }
+    vkUpdateDescriptorSets(device, 4, writes, 0, nullptr);
+
+    pipeline = VkUtils::createComputePipeline(device, pipelineCache, pipelineLayout, Loader::readFile("convergence.spv"));
+}
+
+void ConvergenceMonitor::destroy() {
+    vkDestroyPipeline(device, pipeline, nullptr);
+    vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+    vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+    vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+    VkUtils::destroyBuffer(*allocator, device, moments, momentAllocation);
+    VkUtils::destroyBuffer(*allocator, device, tileErrors, tileErrorAllocation);
+    VkUtils::destroyBuffer(*allocator, device, activeTileBuffer, activeTileAllocation);
+}
+
+void ConvergenceMonitor::record(VkCommandBuffer cmd, uint32_t frameIndex, bool reduce, float threshold) {
+    if(reduce) {
+        // The kernels since the last reduction read the old dispatch size
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             0, 0, nullptr, 0, nullptr, 0, nullptr);
+        // The shader appends to x; y and z cover one tile with kernel workgroups
+        VkDispatchIndirectCommand dispatch{0, TILE_SIZE / kernelWorkgroup.width, TILE_SIZE / kernelWorkgroup.height};
+        vkCmdUpdateBuffer(cmd, activeTileBuffer, 0, sizeof(dispatch), &dispatch);
+    }
+    // The kernel's accumulation has to be visible; also orders this pass after the previous frame's one
+    VkUtils::computeBarrier(cmd);
+
+    if(reduce) reducedThreshold = threshold;
+    PushConstants push{frameIndex, samplesPerPixel, reduce ? 1u : 0u, tilesX, threshold};
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+    vkCmdPushConstants(cmd, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &push);
+    vkCmdDispatch(cmd, tilesX, tilesY, 1);
+
+    // Tile errors to the host, the tile list to the following kernels
+    if(reduce) {
+        VkUtils::computeBarrier(cmd);
+        VkUtils::indirectBarrier(cmd);
+    }
+}
+
+ConvergenceMonitor::Stats ConvergenceMonitor::readStats() const {
+    const float* errors = static_cast<const float*>(tileErrorAllocation.mapped);
+    Stats stats{0.0f, 0.0f, tilesX * tilesY, 0};
+    double sum = 0.0;
+    for(uint32_t i = 0; i < stats.tiles; i++) {
+        stats.maxTileError = std::max(stats.maxTileError, errors[i]);
+        sum += errors[i];
+        if(errors[i] > reducedThreshold) stats.activeTiles++;
+    }
+    stats.meanTileError = static_cast<float>(sum / stats.tiles);
+    return stats;
+}
@@ -0,0 +1,87 @@
+#include "cpuapplication.h"
+#include <chrono>
+#include <iostream>
+#include "cpurenderer.h"
+#include "gltf.h"
+#include "image.h"
+#include "lbvh.h"
+#include "trace.h"
+
+CpuApplication::CpuApplication(const RenderSettings& settings)
+    : settings(settings), scheduler(settings.cpuThreads, settings.pinThreads) {
+}
+
+void CpuApplication::run() {
+    if(!settings.traceFile.empty()) Trace::start();
+    buildScene();
+    render();
+    saveOutputImage(settings.outputFile);
+    if(!settings.traceFile.empty()) {
+        Trace::write(settings.traceFile);
+        std::cout << "Wrote trace to " << settings.traceFile << std::endl;
+    }
+}
+
+void CpuApplication::buildScene() {
+    Trace::Zone zone("buildScene");
+    scene = settings.sceneFile.empty() ? Scene::createCornellBox() : GltfLoader::loadScene(settings.sceneFile, threadPool);
+    if(settings.bvhBuildMode == BVHBuildMode::SAH) {
+        BVHBuilder builder(threadPool);
+        bvh = builder.build(scene);
+    }else {
+        // The GPU builder produces the reference tree, so lbvh-gpu traces the same one here
+        bvh = LBVH::buildReference(scene);
+    }
+}
+
+void CpuApplication::render() {
+    CpuRenderer renderer(scene, bvh, scheduler, settings.width, settings.height, settings.cpuIsa);
+    std::cout << "CPU renderer: " << CpuRenderer::isaName(renderer.isa()) << ", " << CpuRenderer::packetWidth(renderer.isa())
+              << " wide packets, " << scheduler.workerCount() << (scheduler.pinned() ? " pinned" : "") << " threads on "
+              << scheduler.nodeCount() << " NUMA node(s), " << renderer.tileSize() << "x" << renderer.tileSize() << " tiles" << std::endl;
+
+    auto start = std::chrono::steady_clock::now();
+    auto lastReport = start;
+    uint64_t raysSinceReport = 0;
+    uint64_t samplesSinceReport = 0;
+    uint64_t stealsSinceReport = 0;
+    uint64_t totalRays = 0;
+    uint64_t samplesPerFrame = static_cast<uint64_t>(settings.width) * settings.height * SAMPLES_PER_PIXEL;
+    for(uint32_t frameIndex = 0; frameIndex < settings.frameCount; frameIndex++) {
+        uint64_t rays;
+        {
+            Trace::Zone zone("renderFrame");
+            rays = renderer.renderFrame(frameIndex, SAMPLES_PER_PIXEL, MAX_BOUNCES);
+        }
+        raysSinceReport += rays;
+        stealsSinceReport += scheduler.lastSteals();
+        totalRays += rays;
+        samplesSinceReport += samplesPerFrame;
+
+        auto now = std::chrono::steady_clock::now();
+        double seconds = std::chrono::duration<double>(now - lastReport).count();
+        if(seconds >= 1.0) {
+            std::cout << "Frame " << frameIndex << ": " << (samplesSinceReport / seconds) / 1e6 << " MSamples/s, "
+                      << (raysSinceReport / seconds) / 1e6 << " Mrays/s, " << stealsSinceReport << " tiles stolen" << std::endl;
+            raysSinceReport = 0;
+            stealsSinceReport = 0;
+            samplesSinceReport = 0;
+            lastReport = now;
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    lastRenderSeconds = seconds;
+    std::cout << "Rendered " << settings.frameCount << " frames in " << seconds << " s ("
+              << (samplesPerFrame * settings.frameCount / seconds) / 1e6 << " MSamples/s, "
+              << (totalRays / seconds) / 1e6 << " Mrays/s)" << std::endl;
+    pixels = renderer.accumulation();
+}
+
+void CpuApplication::saveOutputImage(const std::string& filename) {
+    size_t pixelCount = static_cast<size_t>(settings.width) * settings.height;
+    std::vector<uint8_t> rgba(pixelCount * 4);
+    ImageIO::resolveAccumulation(pixels.data(), pixelCount, rgba.data());
+    ImageIO::writePPM(filename, settings.width, settings.height, rgba.data());
+    std::cout << "Wrote " << filename << std::endl;
+}
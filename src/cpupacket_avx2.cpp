@@ -0,0 +1,8 @@
+#include "cpupacket.h"
+
+// Built with AVX2 code generation (see CMakeLists.txt), only called after CpuRenderer::detectIsa found it
+#ifdef __AVX2__
+CpuKernels CpuKernels::avx2() {
+    return makeKernels<SimdAVX2>();
+}
+#endif
@@ -0,0 +1,8 @@
+#include "cpupacket.h"
+
+// Built with AVX-512 code generation (see CMakeLists.txt), only called after CpuRenderer::detectIsa found it
+#ifdef __AVX512F__
+CpuKernels CpuKernels::avx512() {
+    return makeKernels<SimdAVX512>();
+}
+#endif
@@ -0,0 +1,6 @@
+#include "cpupacket.h"
+
+// Portable fallback, also the only kernel on CPUs other than x86-64
+CpuKernels CpuKernels::scalar() {
+    return makeKernels<SimdScalar>();
+}
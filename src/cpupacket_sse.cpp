@@ -0,0 +1,8 @@
+#include "cpupacket.h"
+
+// Baseline of every x86-64 CPU, built without extra flags
+#if defined(__SSE2__) || defined(_M_X64)
+CpuKernels CpuKernels::sse() {
+    return makeKernels<SimdSSE>();
+}
+#endif
@@ -0,0 +1,151 @@
+#include "cpurenderer.h"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#if defined(__x86_64__) || defined(_M_X64)
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+namespace {
+
+#if defined(__x86_64__) || defined(_M_X64)
+void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t regs[4]) {
+#ifdef _MSC_VER
+    int values[4];
+    __cpuidex(values, static_cast<int>(leaf), static_cast<int>(subleaf));
+    for(int i = 0; i < 4; i++) regs[i] = static_cast<uint32_t>(values[i]);
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// Register state the OS saves on context switches (XCR0)
+uint64_t xgetbv() {
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    uint32_t low, high;
+    __asm__ volatile("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+    return (static_cast<uint64_t>(high) << 32) | low;
+#endif
+}
+#endif
+
+}
+
+CpuRenderer::CpuRenderer(const Scene& scene, const BVH& bvh, TileScheduler& scheduler, uint32_t width, uint32_t height, CpuIsa isa)
+    : scene(scene), bvh(bvh), scheduler(scheduler), width(width), height(height) {
+    CpuIsa supported = detectIsa();
+    selectedIsa = isa == CpuIsa::Auto ? supported : isa;
+    if(selectedIsa > supported) {
+        throw std::runtime_error(std::string("The CPU does not support ") + isaName(selectedIsa) + ", the widest available is " + isaName(supported));
+    }
+    kernels = kernelsFor(selectedIsa);
+    triangles = prepareTriangles(scene);
+    pixels.assign(static_cast<size_t>(width) * height * 4, 0.0f);
+    rayCounters.resize(scheduler.workerCount());
+    tileEdge = TileScheduler::cacheTileSize(4 * sizeof(float));
+}
+
+CpuIsa CpuRenderer::detectIsa() {
+#if defined(__x86_64__) || defined(_M_X64)
+    uint32_t regs[4];
+    cpuid(0, 0, regs);
+    uint32_t maxLeaf = regs[0];
+    cpuid(1, 0, regs);
+    bool fma = regs[2] & (1u << 12);
+    bool osxsave = regs[2] & (1u << 27);
+    bool avx = regs[2] & (1u << 28);
+    bool avx2 = false;
+    bool avx512 = false;
+    if(maxLeaf >= 7) {
+        cpuid(7, 0, regs);
+        avx2 = regs[1] & (1u << 5);
+        avx512 = regs[1] & (1u << 16);
+    }
+    // The instructions alone are not enough, the OS also has to save the wider registers
+    uint64_t xcr0 = osxsave ? xgetbv() : 0;
+    bool ymmState = (xcr0 & 0x6) == 0x6;
+    bool zmmState = (xcr0 & 0xE6) == 0xE6;
+
+    bool avx2Usable = avx && avx2 && fma && ymmState;
+    if(avx2Usable && avx512 && zmmState) return CpuIsa::AVX512;
+    if(avx2Usable) return CpuIsa::AVX2;
+    return CpuIsa::SSE;
+#else
+    return CpuIsa::Scalar;
+#endif
+}
+
+const char* CpuRenderer::isaName(CpuIsa isa) {
+    switch(isa) {
+        case CpuIsa::Scalar: return "scalar";
+        case CpuIsa::SSE: return "SSE";
+        case CpuIsa::AVX2: return "AVX2";
+        case CpuIsa::AVX512: return "AVX-512";
+        default: return "auto";
+    }
+}
+
+uint32_t CpuRenderer::packetWidth(CpuIsa isa) {
+    switch(isa) {
+        case CpuIsa::SSE: return 4;
+        case CpuIsa::AVX2: return 8;
+        case CpuIsa::AVX512: return 16;
+        default: return 1;
+    }
+}
+
+CpuKernels CpuRenderer::kernelsFor(CpuIsa isa) {
+#if defined(__x86_64__) || defined(_M_X64)
+    // The wider kernels are only compiled in on x86-64
+    if(isa == CpuIsa::SSE) return CpuKernels::sse();
+    if(isa == CpuIsa::AVX2) return CpuKernels::avx2();
+    if(isa == CpuIsa::AVX512) return CpuKernels::avx512();
+#endif
+    return CpuKernels::scalar();
+}
+
+std::vector<CpuTriangle> CpuRenderer::prepareTriangles(const Scene& scene) {
+    std::vector<CpuTriangle> triangles(scene.triangleCount());
+    for(size_t i = 0; i < triangles.size(); i++) {
+        glm::vec3 v0 = glm::vec3(scene.vertices[scene.indices[3 * i + 0]]);
+        glm::vec3 e1 = glm::vec3(scene.vertices[scene.indices[3 * i + 1]]) - v0;
+        glm::vec3 e2 = glm::vec3(scene.vertices[scene.indices[3 * i + 2]]) - v0;
+        CpuTriangle& triangle = triangles[i];
+        for(int axis = 0; axis < 3; axis++) {
+            triangle.v0[axis] = v0[axis];
+            triangle.e1[axis] = e1[axis];
+            triangle.e2[axis] = e2[axis];
+        }
+        triangle.material = scene.triangleMaterials[i];
+    }
+    return triangles;
+}
+
+uint64_t CpuRenderer::renderFrame(uint32_t frameIndex, uint32_t samplesPerPixel, uint32_t maxBounces) {
+    if(triangles.empty()) {
+        // Nothing to hit, the accumulation only gains samples
+        for(size_t i = 0; i < pixels.size(); i += 4) {
+            if(frameIndex == 0) pixels[i] = pixels[i + 1] = pixels[i + 2] = pixels[i + 3] = 0.0f;
+            pixels[i + 3] += static_cast<float>(samplesPerPixel);
+        }
+        return static_cast<uint64_t>(width) * height * samplesPerPixel;
+    }
+
+    CpuFrame frame{bvh.nodes.data(), bvh.triangleIndices.data(), triangles.data(), scene.materials.data(),
+                   width, height, frameIndex, samplesPerPixel, maxBounces, pixels.data()};
+    for(RayCounter& counter : rayCounters) counter.rays = 0;
+    scheduler.run((width + tileEdge - 1) / tileEdge, (height + tileEdge - 1) / tileEdge, [&](uint32_t tileX, uint32_t tileY, uint32_t worker) {
+        uint32_t x = tileX * tileEdge;
+        uint32_t y = tileY * tileEdge;
+        rayCounters[worker].rays += kernels.renderTile(frame, x, y, std::min(x + tileEdge, width), std::min(y + tileEdge, height));
+    });
+    uint64_t rays = 0;
+    for(const RayCounter& counter : rayCounters) rays += counter.rays;
+    return rays;
+}
@@ -0,0 +1,756 @@
+#include "gltf.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <future>
+#include <iostream>
+#include <stdexcept>
+#include <string_view>
+#include "loader.h"
+#include "trace.h"
+
+namespace {
+
+// JSON value whose strings point into the parsed text, which has to outlive it
+struct JsonValue {
+    enum class Type { Null, Bool, Number, String, Array, Object };
+
+    Type type = Type::Null;
+    bool boolean = false;
+    double number = 0.0;
+    // Between the quotes, escape sequences are left in place (see unescape)
+    std::string_view string;
+    // Array elements, or object members with their names in keys
+    std::vector<JsonValue> items;
+    std::vector<std::string_view> keys;
+
+    const JsonValue* find(std::string_view key) const {
+        for(size_t i = 0; i < keys.size(); i++) {
+            if(keys[i] == key) return &items[i];
+        }
+        return nullptr;
+    }
+};
+
+// Recursive descent parser for RFC 8259 JSON
+class JsonParser {
+public:
+    JsonParser(const char* text, size_t size) : text(text), size(size) {}
+
+    JsonValue parse() {
+        JsonValue value = parseValue(0);
+        skipWhitespace();
+        if(pos != size) fail("unexpected trailing characters");
+        return value;
+    }
+
+private:
+    JsonValue parseValue(uint32_t depth) {
+        // Deeply nested input would otherwise overflow the stack
+        if(depth > MAX_DEPTH) fail("nested too deeply");
+        skipWhitespace();
+        if(pos >= size) fail("unexpected end");
+        JsonValue value;
+        char c = text[pos];
+        if(c == '{') {
+            value.type = JsonValue::Type::Object;
+            pos++;
+            skipWhitespace();
+            if(pos < size && text[pos] == '}') {
+                pos++;
+                return value;
+            }
+            while(true) {
+                skipWhitespace();
+                if(pos >= size || text[pos] != '"') fail("expected a member name");
+                value.keys.push_back(parseString());
+                skipWhitespace();
+                expect(':');
+                value.items.push_back(parseValue(depth + 1));
+                skipWhitespace();
+                if(pos < size && text[pos] == ',') {
+                    pos++;
+                    continue;
+                }
+                expect('}');
+                return value;
+            }
+        }else if(c == '[') {
+            value.type = JsonValue::Type::Array;
+            pos++;
+            skipWhitespace();
+            if(pos < size && text[pos] == ']') {
+                pos++;
+                return value;
+            }
+            while(true) {
+                value.items.push_back(parseValue(depth + 1));
+                skipWhitespace();
+                if(pos < size && text[pos] == ',') {
+                    pos++;
+                    continue;
+                }
+                expect(']');
+                return value;
+            }
+        }else if(c == '"') {
+            value.type = JsonValue::Type::String;
+            value.string = parseString();
+        }else if(literal("true")) {
+            value.type = JsonValue::Type::Bool;
+            value.boolean = true;
+        }else if(literal("false")) {
+            value.type = JsonValue::Type::Bool;
+        }else if(literal("null")) {
+            value.type = JsonValue::Type::Null;
+        }else {
+            value.type = JsonValue::Type::Number;
+            value.number = parseNumber();
+        }
+        return value;
+    }
+
+    std::string_view parseString() {
+        size_t start = ++pos;
+        while(pos < size && text[pos] != '"') {
+            pos += text[pos] == '\\' ? 2 : 1;
+        }
+        if(pos >= size) fail("unterminated string");
+        return std::string_view(text + start, pos++ - start);
+    }
+
+    double parseNumber() {
+        size_t start = pos;
+        while(pos < size && text[pos] != '\0' && (std::strchr("+-.eE", text[pos]) != nullptr || (text[pos] >= '0' && text[pos] <= '9'))) pos++;
+        // The text is not null terminated, strtod gets a copy
+        char number[64];
+        size_t length = pos - start;
+        if(length == 0 || length >= sizeof(number)) fail("invalid value");
+        std::memcpy(number, text + start, length);
+        number[length] = '\0';
+        char* end;
+        double value = std::strtod(number, &end);
+        if(end != number + length) fail("invalid number");
+        return value;
+    }
+
+    bool literal(const char* word) {
+        size_t length = std::strlen(word);
+        if(size - pos < length || std::memcmp(text + pos, word, length) != 0) return false;
+        pos += length;
+        return true;
+    }
+
+    void expect(char c) {
+        if(pos >= size || text[pos] != c) fail(std::string("expected '") + c + "'");
+        pos++;
+    }
+
+    void skipWhitespace() {
+        while(pos < size && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\n' || text[pos] == '\r')) pos++;
+    }
+
+    [[noreturn]] void fail(const std::string& message) const {
+        throw std::runtime_error("Invalid glTF JSON at byte " + std::to_string(pos) + ": " + message);
+    }
+
+    const char* text;
+    size_t size;
+    size_t pos = 0;
+
+    static constexpr uint32_t MAX_DEPTH = 256;
+};
+
+void appendUtf8(std::string& result, uint32_t codePoint) {
+    if(codePoint < 0x80) {
+        result += static_cast<char>(codePoint);
+    }else if(codePoint < 0x800) {
+        result += static_cast<char>(0xC0 | codePoint >> 6);
+        result += static_cast<char>(0x80 | (codePoint & 0x3F));
+    }else {
+        result += static_cast<char>(0xE0 | codePoint >> 12);
+        result += static_cast<char>(0x80 | (codePoint >> 6 & 0x3F));
+        result += static_cast<char>(0x80 | (codePoint & 0x3F));
+    }
+}
+
+// Value of the hex digits of an escape sequence, which has to be complete
+uint32_t parseHex(std::string_view digits, size_t count) {
+    if(digits.size() < count) throw std::runtime_error("glTF: truncated escape sequence");
+    uint32_t value = 0;
+    for(size_t i = 0; i < count; i++) {
+        char c = digits[i];
+        uint32_t digit;
+        if(c >= '0' && c <= '9') digit = c - '0';
+        else if(c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+        else if(c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+        else throw std::runtime_error("glTF: invalid hex digit in escape sequence");
+        value = value << 4 | digit;
+    }
+    return value;
+}
+
+// Resolves the escape sequences of a JSON string (surrogate pairs are not combined)
+std::string unescape(std::string_view raw) {
+    std::string result;
+    for(size_t i = 0; i < raw.size(); i++) {
+        if(raw[i] != '\\' || i + 1 >= raw.size()) {
+            result += raw[i];
+            continue;
+        }
+        char c = raw[++i];
+        switch(c) {
+            case 'b': result += '\b'; break;
+            case 'f': result += '\f'; break;
+            case 'n': result += '\n'; break;
+            case 'r': result += '\r'; break;
+            case 't': result += '\t'; break;
+            case 'u':
+                appendUtf8(result, parseHex(raw.substr(i + 1), 4));
+                i += 4;
+                break;
+            default: result += c; break;
+        }
+    }
+    return result;
+}
+
+std::string percentDecode(const std::string& uri) {
+    std::string result;
+    for(size_t i = 0; i < uri.size(); i++) {
+        if(uri[i] == '%') {
+            result += static_cast<char>(parseHex(std::string_view(uri).substr(i + 1), 2));
+            i += 2;
+        }else {
+            result += uri[i];
+        }
+    }
+    return result;
+}
+
+std::vector<char> decodeBase64(std::string_view text) {
+    std::vector<char> bytes;
+    bytes.reserve(text.size() / 4 * 3);
+    uint32_t bits = 0;
+    int bitCount = 0;
+    for(char c : text) {
+        int value;
+        if(c >= 'A' && c <= 'Z') value = c - 'A';
+        else if(c >= 'a' && c <= 'z') value = c - 'a' + 26;
+        else if(c >= '0' && c <= '9') value = c - '0' + 52;
+        else if(c == '+') value = 62;
+        else if(c == '/') value = 63;
+        else if(c == '=') break;
+        else throw std::runtime_error("Invalid base64 data in glTF buffer");
+        bits = bits << 6 | static_cast<uint32_t>(value);
+        bitCount += 6;
+        if(bitCount >= 8) {
+            bitCount -= 8;
+            bytes.push_back(static_cast<char>(bits >> bitCount & 0xFF));
+        }
+    }
+    return bytes;
+}
+
+const JsonValue& member(const JsonValue& object, std::string_view key) {
+    const JsonValue* value = object.find(key);
+    if(value == nullptr) throw std::runtime_error("glTF: missing required property " + std::string(key));
+    return *value;
+}
+
+uint32_t getUint(const JsonValue& object, std::string_view key, uint32_t fallback) {
+    const JsonValue* value = object.find(key);
+    if(value == nullptr) return fallback;
+    if(value->type != JsonValue::Type::Number || value->number < 0.0 || value->number > 4294967295.0) {
+        throw std::runtime_error("glTF: " + std::string(key) + " must be an unsigned integer");
+    }
+    return static_cast<uint32_t>(value->number);
+}
+
+uint32_t toIndex(const JsonValue& value) {
+    if(value.type != JsonValue::Type::Number || value.number < 0.0 || value.number > 4294967295.0) {
+        throw std::runtime_error("glTF: invalid index");
+    }
+    return static_cast<uint32_t>(value.number);
+}
+
+// Element index of an array member of the document root, range checked
+const JsonValue& element(const JsonValue& root, std::string_view array, uint32_t index) {
+    const JsonValue& items = member(root, array);
+    if(index >= items.items.size()) {
+        throw std::runtime_error("glTF: " + std::string(array) + " index " + std::to_string(index) + " out of range");
+    }
+    return items.items[index];
+}
+
+// Up to count numbers of an array member, the rest keep their value
+void getNumbers(const JsonValue& object, std::string_view key, float* values, size_t count) {
+    const JsonValue* array = object.find(key);
+    if(array == nullptr) return;
+    for(size_t i = 0; i < count && i < array->items.size(); i++) {
+        values[i] = static_cast<float>(array->items[i].number);
+    }
+}
+
+struct Document {
+    JsonValue root;
+    // Bytes of every buffer, pointing into a mapped file or a decoded data URI
+    std::vector<std::string_view> buffers;
+};
+
+// A typed view of a buffer, elements are stride bytes apart
+struct Accessor {
+    const char* data;
+    size_t count;
+    size_t stride;
+    uint32_t componentType;
+    uint32_t components;
+};
+
+const uint32_t COMPONENT_UNSIGNED_BYTE = 5121;
+const uint32_t COMPONENT_UNSIGNED_SHORT = 5123;
+const uint32_t COMPONENT_UNSIGNED_INT = 5125;
+const uint32_t COMPONENT_FLOAT = 5126;
+const uint32_t MODE_TRIANGLES = 4;
+
+uint32_t componentSize(uint32_t componentType) {
+    switch(componentType) {
+        case 5120: case 5121: return 1;
+        case 5122: case 5123: return 2;
+        case 5125: case 5126: return 4;
+        default: throw std::runtime_error("glTF: unknown component type " + std::to_string(componentType));
+    }
+}
+
+uint32_t componentCount(std::string_view type) {
+    if(type == "SCALAR") return 1;
+    if(type == "VEC2") return 2;
+    if(type == "VEC3") return 3;
+    if(type == "VEC4" || type == "MAT2") return 4;
+    if(type == "MAT3") return 9;
+    if(type == "MAT4") return 16;
+    throw std::runtime_error("glTF: unknown accessor type " + std::string(type));
+}
+
+// Resolves accessor index down to its bytes and checks they lie inside the buffer view
+Accessor resolveAccessor(const Document& document, uint32_t index) {
+    const JsonValue& accessor = element(document.root, "accessors", index);
+    if(accessor.find("sparse") != nullptr || accessor.find("bufferView") == nullptr) {
+        throw std::runtime_error("glTF: sparse accessors and accessors without a buffer view are not supported");
+    }
+    const JsonValue& view = element(document.root, "bufferViews", getUint(accessor, "bufferView", 0));
+    uint32_t bufferIndex = getUint(view, "buffer", 0);
+    if(bufferIndex >= document.buffers.size()) throw std::runtime_error("glTF: buffer index out of range");
+    std::string_view buffer = document.buffers[bufferIndex];
+
+    size_t viewOffset = getUint(view, "byteOffset", 0);
+    size_t viewLength = getUint(view, "byteLength", 0);
+    if(viewOffset > buffer.size() || viewLength > buffer.size() - viewOffset) {
+        throw std::runtime_error("glTF: buffer view exceeds its buffer");
+    }
+
+    Accessor result;
+    result.componentType = getUint(accessor, "componentType", 0);
+    result.components = componentCount(member(accessor, "type").string);
+    result.count = getUint(accessor, "count", 0);
+    size_t elementSize = static_cast<size_t>(componentSize(result.componentType)) * result.components;
+    result.stride = getUint(view, "byteStride", 0);
+    if(result.stride == 0) result.stride = elementSize;
+    size_t offset = getUint(accessor, "byteOffset", 0);
+    if(result.count > 0 && (offset > viewLength || (result.count - 1) * result.stride + elementSize > viewLength - offset)) {
+        throw std::runtime_error("glTF: accessor " + std::to_string(index) + " exceeds its buffer view");
+    }
+    result.data = buffer.data() + viewOffset + offset;
+    return result;
+}
+
+struct DecodedMesh {
+    GltfMesh mesh;
+    // Points, lines and strips are not imported
+    uint32_t skippedPrimitives = 0;
+};
+
+// Decodes the triangle primitives of mesh index straight from the buffers into the mesh streams
+DecodedMesh decodeMesh(const Document& document, uint32_t index, uint32_t defaultMaterial) {
+    Trace::Zone zone("decode mesh");
+    const JsonValue& json = element(document.root, "meshes", index);
+    DecodedMesh decoded;
+    GltfMesh& mesh = decoded.mesh;
+    if(const JsonValue* name = json.find("name")) mesh.name = unescape(name->string);
+
+    for(const JsonValue& primitive : member(json, "primitives").items) {
+        if(getUint(primitive, "mode", MODE_TRIANGLES) != MODE_TRIANGLES) {
+            decoded.skippedPrimitives++;
+            continue;
+        }
+        uint32_t material = defaultMaterial;
+        if(primitive.find("material") != nullptr) {
+            material = getUint(primitive, "material", 0);
+            if(material >= defaultMaterial) throw std::runtime_error("glTF: material index out of range");
+        }
+
+        const JsonValue& attributes = member(primitive, "attributes");
+        member(attributes, "POSITION");
+        Accessor positions = resolveAccessor(document, getUint(attributes, "POSITION", 0));
+        if(positions.componentType != COMPONENT_FLOAT || positions.components != 3) {
+            throw std::runtime_error("glTF: POSITION must be a float VEC3 accessor");
+        }
+        size_t base = mesh.vertices.size();
+        mesh.vertices.resize(base + positions.count);
+        for(size_t i = 0; i < positions.count; i++) {
+            // Strided and possibly unaligned, memcpy compiles to plain loads
+            float p[3];
+            std::memcpy(p, positions.data + i * positions.stride, sizeof(p));
+            glm::vec3 position(p[0], p[1], p[2]);
+            mesh.vertices[base + i] = glm::vec4(position, 1.0f);
+            mesh.boundsMin = glm::min(mesh.boundsMin, position);
+            mesh.boundsMax = glm::max(mesh.boundsMax, position);
+        }
+
+        size_t first = mesh.indices.size();
+        if(primitive.find("indices") != nullptr) {
+            Accessor indices = resolveAccessor(document, getUint(primitive, "indices", 0));
+            if(indices.components != 1) throw std::runtime_error("glTF: indices must be a SCALAR accessor");
+            size_t count = indices.count - indices.count % 3;
+            mesh.indices.resize(first + count);
+            for(size_t i = 0; i < count; i++) {
+                const char* element = indices.data + i * indices.stride;
+                uint32_t vertex;
+                if(indices.componentType == COMPONENT_UNSIGNED_BYTE) {
+                    vertex = static_cast<uint8_t>(*element);
+                }else if(indices.componentType == COMPONENT_UNSIGNED_SHORT) {
+                    uint16_t value;
+                    std::memcpy(&value, element, sizeof(value));
+                    vertex = value;
+                }else if(indices.componentType == COMPONENT_UNSIGNED_INT) {
+                    std::memcpy(&vertex, element, sizeof(vertex));
+                }else {
+                    throw std::runtime_error("glTF: indices must be unsigned integers");
+                }
+                if(vertex >= positions.count) throw std::runtime_error("glTF: vertex index out of range");
+                mesh.indices[first + i] = static_cast<uint32_t>(base + vertex);
+            }
+        }else {
+            size_t count = positions.count - positions.count % 3;
+            mesh.indices.resize(first + count);
+            for(size_t i = 0; i < count; i++) mesh.indices[first + i] = static_cast<uint32_t>(base + i);
+        }
+        mesh.triangleMaterials.resize(mesh.indices.size() / 3, material);
+    }
+    return decoded;
+}
+
+glm::mat4 nodeTransform(const JsonValue& node) {
+    glm::mat4 transform(1.0f);
+    if(node.find("matrix") != nullptr) {
+        float m[16] = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1};
+        getNumbers(node, "matrix", m, 16);
+        // Column major like glm
+        for(int column = 0; column < 4; column++) {
+            for(int row = 0; row < 4; row++) transform[column][row] = m[column * 4 + row];
+        }
+        return transform;
+    }
+    float t[3] = {0, 0, 0};
+    float r[4] = {0, 0, 0, 1};
+    float s[3] = {1, 1, 1};
+    getNumbers(node, "translation", t, 3);
+    getNumbers(node, "rotation", r, 4);
+    getNumbers(node, "scale", s, 3);
+    float length = std::sqrt(r[0] * r[0] + r[1] * r[1] + r[2] * r[2] + r[3] * r[3]);
+    if(!(length > 0.0f && std::isfinite(length))) {
+        // Not a rotation, keep the identity instead of turning the whole subtree into NaN
+        r[0] = r[1] = r[2] = 0.0f;
+        r[3] = length = 1.0f;
+    }
+    float x = r[0] / length, y = r[1] / length, z = r[2] / length, w = r[3] / length;
+    // T * R * S, the rotation matrix of the unit quaternion (x, y, z, w)
+    transform[0] = glm::vec4(1 - 2 * (y * y + z * z), 2 * (x * y + z * w), 2 * (x * z - y * w), 0) * s[0];
+    transform[1] = glm::vec4(2 * (x * y - z * w), 1 - 2 * (x * x + z * z), 2 * (y * z + x * w), 0) * s[1];
+    transform[2] = glm::vec4(2 * (x * z + y * w), 2 * (y * z - x * w), 1 - 2 * (x * x + y * y), 0) * s[2];
+    transform[3] = glm::vec4(t[0], t[1], t[2], 1);
+    return transform;
+}
+
+// Walks the node hierarchy of the default scene and records every mesh node with its world transform
+std::vector<GltfInstance> flattenNodes(const JsonValue& root) {
+    std::vector<GltfInstance> instances;
+    const JsonValue* nodes = root.find("nodes");
+    if(nodes == nullptr) return instances;
+
+    std::vector<uint32_t> roots;
+    const JsonValue* scenes = root.find("scenes");
+    if(scenes != nullptr && !scenes->items.empty()) {
+        const JsonValue& scene = element(root, "scenes", getUint(root, "scene", 0));
+        if(const JsonValue* sceneNodes = scene.find("nodes")) {
+            for(const JsonValue& node : sceneNodes->items) roots.push_back(toIndex(node));
+        }
+    }else {
+        // No scenes: every node that is nobody's child is a root
+        std::vector<bool> isChild(nodes->items.size(), false);
+        for(const JsonValue& node : nodes->items) {
+            if(const JsonValue* children = node.find("children")) {
+                for(const JsonValue& child : children->items) {
+                    if(toIndex(child) < isChild.size()) isChild[toIndex(child)] = true;
+                }
+            }
+        }
+        for(uint32_t i = 0; i < isChild.size(); i++) {
+            if(!isChild[i]) roots.push_back(i);
+        }
+    }
+
+    struct Entry {
+        uint32_t node;
+        glm::mat4 parent;
+        size_t depth;
+    };
+    std::vector<Entry> stack;
+    for(auto it = roots.rbegin(); it != roots.rend(); ++it) stack.push_back({*it, glm::mat4(1.0f), 0});
+    while(!stack.empty()) {
+        Entry entry = stack.back();
+        stack.pop_back();
+        // A hierarchy is a forest, deeper than the node count means a cycle
+        if(entry.depth > nodes->items.size()) throw std::runtime_error("glTF: the node hierarchy contains a cycle");
+        const JsonValue& node = element(root, "nodes", entry.node);
+        glm::mat4 transform = entry.parent * nodeTransform(node);
+        if(node.find("mesh") != nullptr) instances.push_back({getUint(node, "mesh", 0), transform});
+        if(const JsonValue* children = node.find("children")) {
+            for(auto it = children->items.rbegin(); it != children->items.rend(); ++it) {
+                stack.push_back({toIndex(*it), transform, entry.depth + 1});
+            }
+        }
+    }
+    return instances;
+}
+
+std::vector<Material> readMaterials(const JsonValue& root) {
+    std::vector<Material> materials;
+    if(const JsonValue* list = root.find("materials")) {
+        for(const JsonValue& json : list->items) {
+            float baseColor[4] = {1, 1, 1, 1};
+            float emissive[3] = {0, 0, 0};
+            if(const JsonValue* pbr = json.find("pbrMetallicRoughness")) getNumbers(*pbr, "baseColorFactor", baseColor, 4);
+            getNumbers(json, "emissiveFactor", emissive, 3);
+            float strength = 1.0f;
+            if(const JsonValue* extensions = json.find("extensions")) {
+                if(const JsonValue* emissiveStrength = extensions->find("KHR_materials_emissive_strength")) {
+                    if(const JsonValue* value = emissiveStrength->find("emissiveStrength")) strength = static_cast<float>(value->number);
+                }
+            }
+            materials.push_back({glm::vec4(baseColor[0], baseColor[1], baseColor[2], 1.0f),
+                                 glm::vec4(emissive[0] * strength, emissive[1] * strength, emissive[2] * strength, 0.0f)});
+        }
+    }
+    // The default material of the specification
+    materials.push_back({glm::vec4(1.0f), glm::vec4(0.0f)});
+    return materials;
+}
+
+}
+
+size_t GltfModel::triangleCount() const {
+    size_t count = 0;
+    for(const GltfInstance& instance : instances) count += meshes[instance.mesh].indices.size() / 3;
+    return count;
+}
+
+void GltfModel::bounds(glm::vec3& min, glm::vec3& max) const {
+    min = glm::vec3(1e30f);
+    max = glm::vec3(-1e30f);
+    for(const GltfInstance& instance : instances) {
+        const GltfMesh& mesh = meshes[instance.mesh];
+        if(mesh.vertices.empty()) continue;
+        for(int corner = 0; corner < 8; corner++) {
+            glm::vec3 p(corner & 1 ? mesh.boundsMax.x : mesh.boundsMin.x,
+                        corner & 2 ? mesh.boundsMax.y : mesh.boundsMin.y,
+                        corner & 4 ? mesh.boundsMax.z : mesh.boundsMin.z);
+            glm::vec3 world = glm::vec3(instance.transform * glm::vec4(p, 1.0f));
+            min = glm::min(min, world);
+            max = glm::max(max, world);
+        }
+    }
+}
+
+glm::mat4 GltfModel::fitTransform(const glm::vec3& min, const glm::vec3& max) const {
+    glm::vec3 modelMin, modelMax;
+    bounds(modelMin, modelMax);
+    glm::mat4 transform(1.0f);
+    if(modelMin.x > modelMax.x) return transform;
+
+    glm::vec3 extent = modelMax - modelMin;
+    glm::vec3 target = max - min;
+    float scale = 1e30f;
+    for(int axis = 0; axis < 3; axis++) {
+        if(extent[axis] > 0.0f) scale = std::min(scale, target[axis] / extent[axis]);
+    }
+    if(scale == 1e30f) scale = 1.0f;
+    glm::vec3 center = (modelMin + modelMax) * 0.5f;
+    transform[0][0] = transform[1][1] = transform[2][2] = scale;
+    transform[3] = glm::vec4((min.x + max.x) * 0.5f - center.x * scale, min.y - modelMin.y * scale,
+                             (min.z + max.z) * 0.5f - center.z * scale, 1.0f);
+    return transform;
+}
+
+void GltfModel::appendTo(Scene& scene, const glm::mat4& transform, ThreadPool& pool) const {
+    Trace::Zone zone("append glTF instances");
+    uint32_t materialBase = static_cast<uint32_t>(scene.materials.size());
+    scene.materials.insert(scene.materials.end(), materials.begin(), materials.end());
+
+    std::vector<size_t> vertexOffsets, indexOffsets;
+    size_t vertexCount = scene.vertices.size();
+    size_t indexCount = scene.indices.size();
+    for(const GltfInstance& instance : instances) {
+        vertexOffsets.push_back(vertexCount);
+        indexOffsets.push_back(indexCount);
+        vertexCount += meshes[instance.mesh].vertices.size();
+        indexCount += meshes[instance.mesh].indices.size();
+    }
+    if(vertexCount > 0xFFFFFFFFu) throw std::runtime_error("glTF: the scene has more vertices than 32 bit indices can address");
+    scene.vertices.resize(vertexCount);
+    scene.indices.resize(indexCount);
+    scene.triangleMaterials.resize(indexCount / 3);
+
+    std::vector<std::future<void>> tasks;
+    for(size_t i = 0; i < instances.size(); i++) {
+        tasks.push_back(pool.submit([&, i]() {
+            const GltfMesh& mesh = meshes[instances[i].mesh];
+            glm::mat4 world = transform * instances[i].transform;
+            glm::vec4* vertices = scene.vertices.data() + vertexOffsets[i];
+            for(size_t v = 0; v < mesh.vertices.size(); v++) vertices[v] = world * mesh.vertices[v];
+            uint32_t* indices = scene.indices.data() + indexOffsets[i];
+            uint32_t base = static_cast<uint32_t>(vertexOffsets[i]);
+            for(size_t v = 0; v < mesh.indices.size(); v++) indices[v] = base + mesh.indices[v];
+            uint32_t* triangleMaterials = scene.triangleMaterials.data() + indexOffsets[i] / 3;
+            for(size_t t = 0; t < mesh.triangleMaterials.size(); t++) triangleMaterials[t] = materialBase + mesh.triangleMaterials[t];
+        }));
+    }
+    for(auto& task : tasks) task.get();
+}
+
+GltfModel GltfLoader::load(const std::string& filename, ThreadPool& pool) {
+    Trace::Zone zone("load " + filename);
+    auto start = std::chrono::steady_clock::now();
+    // Everything the document's strings and buffers point into. Moving a FileView or a vector keeps
+    // the bytes where they are, so both may grow
+    std::vector<FileView> files;
+    std::vector<std::vector<char>> decodedBuffers;
+
+    files.push_back(Loader::mapFile(filename, AccessPattern::Normal));
+    const FileView& file = files.back();
+    std::string_view json(file.data(), file.size());
+    std::string_view binaryChunk;
+    bool binary = false;
+    if(file.size() >= 12) {
+        uint32_t magic;
+        std::memcpy(&magic, file.data(), sizeof(magic));
+        binary = magic == GLB_MAGIC;
+    }
+    if(binary) {
+        // 12 byte header, then chunks of (length, type, data) padded to 4 bytes; JSON first, BIN optional
+        uint32_t header[3];
+        std::memcpy(header, file.data(), sizeof(header));
+        if(header[1] != 2) throw std::runtime_error("glTF: " + filename + " is not a glTF 2.0 binary");
+        size_t length = std::min<size_t>(header[2], file.size());
+        json = {};
+        for(size_t offset = 12; offset + 8 <= length;) {
+            uint32_t chunk[2];
+            std::memcpy(chunk, file.data() + offset, sizeof(chunk));
+            if(chunk[0] > length - offset - 8) throw std::runtime_error("glTF: truncated chunk in " + filename);
+            std::string_view data(file.data() + offset + 8, chunk[0]);
+            if(chunk[1] == GLB_CHUNK_JSON && json.empty()) json = data;
+            else if(chunk[1] == GLB_CHUNK_BIN && binaryChunk.empty()) binaryChunk = data;
+            offset += 8 + ((chunk[0] + 3u) & ~3u);
+        }
+        if(json.empty()) throw std::runtime_error("glTF: " + filename + " has no JSON chunk");
+    }
+
+    Document document;
+    document.root = JsonParser(json.data(), json.size()).parse();
+    const JsonValue& asset = member(document.root, "asset");
+    if(member(asset, "version").string.substr(0, 2) != "2.") {
+        throw std::runtime_error("glTF: " + filename + " is not glTF 2.0");
+    }
+
+    std::filesystem::path directory = std::filesystem::path(filename).parent_path();
+    if(const JsonValue* buffers = document.root.find("buffers")) {
+        for(size_t i = 0; i < buffers->items.size(); i++) {
+            const JsonValue& buffer = buffers->items[i];
+            size_t byteLength = getUint(buffer, "byteLength", 0);
+            std::string_view data;
+            const JsonValue* uriValue = buffer.find("uri");
+            if(uriValue == nullptr) {
+                // The BIN chunk of a .glb
+                if(i != 0 || !binary) throw std::runtime_error("glTF: buffer " + std::to_string(i) + " has no uri");
+                data = binaryChunk;
+                // Start reading mapped buffers now, the mesh tasks would otherwise fault them in page by page
+                files.front().prefetch(static_cast<size_t>(binaryChunk.data() - files.front().data()), byteLength);
+            }else {
+                std::string uri = unescape(uriValue->string);
+                if(uri.compare(0, 5, "data:") == 0) {
+                    size_t comma = uri.find(',');
+                    if(comma == std::string::npos || uri.rfind(";base64", comma) == std::string::npos) {
+                        throw std::runtime_error("glTF: only base64 data URIs are supported");
+                    }
+                    decodedBuffers.push_back(decodeBase64(std::string_view(uri).substr(comma + 1)));
+                    data = std::string_view(decodedBuffers.back().data(), decodedBuffers.back().size());
+                }else {
+                    files.push_back(Loader::mapFile((directory / percentDecode(uri)).string(), AccessPattern::Normal));
+                    files.back().prefetch(0, byteLength);
+                    data = std::string_view(files.back().data(), files.back().size());
+                }
+            }
+            if(data.size() < byteLength) throw std::runtime_error("glTF: buffer " + std::to_string(i) + " is shorter than its byteLength");
+            document.buffers.push_back(data.substr(0, byteLength));
+        }
+    }
+
+    GltfModel model;
+    model.materials = readMaterials(document.root);
+    model.instances = flattenNodes(document.root);
+    const JsonValue* meshes = document.root.find("meshes");
+    size_t meshCount = meshes != nullptr ? meshes->items.size() : 0;
+    for(const GltfInstance& instance : model.instances) {
+        if(instance.mesh >= meshCount) throw std::runtime_error("glTF: mesh index out of range");
+    }
+
+    // One task per mesh; every task has to finish before the document goes out of scope, even if one throws
+    uint32_t defaultMaterial = static_cast<uint32_t>(model.materials.size() - 1);
+    std::vector<std::future<DecodedMesh>> tasks;
+    for(uint32_t i = 0; i < meshCount; i++) {
+        tasks.push_back(pool.submit([&document, i, defaultMaterial]() { return decodeMesh(document, i, defaultMaterial); }));
+    }
+    model.meshes.resize(meshCount);
+    uint32_t skippedPrimitives = 0;
+    std::exception_ptr error;
+    for(size_t i = 0; i < tasks.size(); i++) {
+        try {
+            DecodedMesh decoded = tasks[i].get();
+            model.meshes[i] = std::move(decoded.mesh);
+            skippedPrimitives += decoded.skippedPrimitives;
+        }catch(...) {
+            if(!error) error = std::current_exception();
+        }
+    }
+    if(error) std::rethrow_exception(error);
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "glTF: " << filename << ", " << meshCount << " meshes, " << model.instances.size() << " instances, "
+              << model.triangleCount() << " triangles in " << ms << " ms" << std::endl;
+    if(skippedPrimitives > 0) {
+        std::cout << "glTF: skipped " << skippedPrimitives << " primitives that are not triangle lists" << std::endl;
+    }
+    return model;
+}
+
+Scene GltfLoader::loadScene(const std::string& filename, ThreadPool& pool) {
+    GltfModel model = load(filename, pool);
+    Scene scene = Scene::createCornellRoom();
+    // Stands on the floor and stays clear of the walls and the light
+    model.appendTo(scene, model.fitTransform(glm::vec3(-0.8f, -1.0f, -0.8f), glm::vec3(0.8f, 0.6f, 0.8f)), pool);
+    return scene;
+}
@@ -0,0 +1,45 @@
+#include "image.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+void ImageIO::writePPM(const std::string& filename, uint32_t width, uint32_t height, const uint8_t* rgba) {
+    std::ofstream file(filename, std::ios::binary);
+
+    if(!file.is_open()) {
+        throw std::runtime_error("Could not open file " + filename);
+    }
+
+    file << "P6\n" << width << " " << height << "\n255\n";
+
+    std::vector<uint8_t> row(static_cast<size_t>(width) * 3);
+    for(uint32_t y = 0; y < height; y++) {
+        const uint8_t* src = rgba + static_cast<size_t>(y) * width * 4;
+        for(uint32_t x = 0; x < width; x++) {
+            row[x * 3 + 0] = src[x * 4 + 0];
+            row[x * 3 + 1] = src[x * 4 + 1];
+            row[x * 3 + 2] = src[x * 4 + 2];
+        }
+        file.write(reinterpret_cast<const char*>(row.data()), row.size());
+    }
+
+    if(!file) {
+        throw std::runtime_error("Could not write file " + filename);
+    }
+}
+
+void ImageIO::resolveAccumulation(const float* accumulated, size_t pixelCount, uint8_t* rgba) {
+    for(size_t i = 0; i < pixelCount; i++) {
+        const float* pixel = accumulated + 4 * i;
+        float samples = std::max(pixel[3], 1.0f);
+        for(int c = 0; c < 3; c++) {
+            // linearToSRGB in shaders/common.glsl
+            float linear = std::clamp(pixel[c] / samples, 0.0f, 1.0f);
+            float srgb = linear < 0.0031308f ? linear * 12.92f : 1.055f * std::pow(linear, 1.0f / 2.4f) - 0.055f;
+            rgba[4 * i + c] = static_cast<uint8_t>(srgb * 255.0f + 0.5f);
+        }
+        rgba[4 * i + 3] = 255;
+    }
+}
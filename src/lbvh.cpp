@@ -0,0 +1,437 @@
+#include "lbvh.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include "loader.h"
+#include "vkutils.h"
+
+static uint32_t expandBits(uint32_t v) {
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+uint32_t LBVH::mortonCode(const glm::vec3& unitPosition) {
+    // Same float operations as lbvh_morton.comp so both sides quantize identically
+    uint32_t x = static_cast<uint32_t>(std::min(std::max(unitPosition.x * 1024.0f, 0.0f), 1023.0f));
+    uint32_t y = static_cast<uint32_t>(std::min(std::max(unitPosition.y * 1024.0f, 0.0f), 1023.0f));
+    uint32_t z = static_cast<uint32_t>(std::min(std::max(unitPosition.z * 1024.0f, 0.0f), 1023.0f));
+    return (expandBits(x) << 2) | (expandBits(y) << 1) | expandBits(z);
+}
+
+static AABB triangleBounds(const Scene& scene, uint32_t triangle) {
+    AABB box;
+    for(uint32_t k = 0; k < 3; k++) {
+        const glm::vec4& v = scene.vertices[scene.indices[3 * triangle + k]];
+        box.grow(glm::vec3(v.x, v.y, v.z));
+    }
+    return box;
+}
+
+void LBVH::centroidBounds(const Scene& scene, glm::vec3& min, glm::vec3& max) {
+    AABB bounds;
+    for(uint32_t i = 0; i < scene.triangleCount(); i++) {
+        AABB box = triangleBounds(scene, i);
+        bounds.grow((box.min + box.max) * 0.5f);
+    }
+    min = bounds.min;
+    max = bounds.max;
+}
+
+static glm::vec3 inverseExtent(const glm::vec3& min, const glm::vec3& max) {
+    glm::vec3 extent = max - min;
+    return glm::vec3(extent.x > 0.0f ? 1.0f / extent.x : 0.0f,
+                     extent.y > 0.0f ? 1.0f / extent.y : 0.0f,
+                     extent.z > 0.0f ? 1.0f / extent.z : 0.0f);
+}
+
+static int countLeadingZeros(uint32_t v) {
+    if(v == 0) return 32;
+    int n = 0;
+    while(!(v & 0x80000000u)) {
+        v <<= 1;
+        n++;
+    }
+    return n;
+}
+
+// Length of the common prefix of keys i and j, ties are broken by the index
+static int delta(const std::vector<uint32_t>& keys, int i, int j) {
+    if(j < 0 || j >= static_cast<int>(keys.size())) return -1;
+    if(keys[i] == keys[j]) return 32 + countLeadingZeros(static_cast<uint32_t>(i) ^ static_cast<uint32_t>(j));
+    return countLeadingZeros(keys[i] ^ keys[j]);
+}
+
+static uint32_t treeDepth(const BVH& bvh) {
+    uint32_t depth = 0;
+    std::vector<std::pair<uint32_t, uint32_t>> stack = {{0, 0}};
+    while(!stack.empty()) {
+        auto [index, level] = stack.back();
+        stack.pop_back();
+        const BVHNode& node = bvh.nodes[index];
+        if(node.isLeaf()) {
+            depth = std::max(depth, level);
+            continue;
+        }
+        stack.push_back({node.leftFirst, level + 1});
+        stack.push_back({node.leftFirst + 1, level + 1});
+    }
+    return depth;
+}
+
+BVH LBVH::buildReference(const Scene& scene) {
+    auto start = std::chrono::steady_clock::now();
+
+    BVH bvh;
+    uint32_t n = static_cast<uint32_t>(scene.triangleCount());
+    if(n == 0) {
+        AABB empty;
+        bvh.nodes.push_back({empty.min, 0, empty.max, 0});
+        return bvh;
+    }
+
+    glm::vec3 sceneMin, sceneMax;
+    centroidBounds(scene, sceneMin, sceneMax);
+    glm::vec3 invExtent = inverseExtent(sceneMin, sceneMax);
+
+    std::vector<AABB> bounds(n);
+    std::vector<uint32_t> codes(n);
+    for(uint32_t i = 0; i < n; i++) {
+        bounds[i] = triangleBounds(scene, i);
+        glm::vec3 centroid = (bounds[i].min + bounds[i].max) * 0.5f;
+        codes[i] = mortonCode((centroid - sceneMin) * invExtent);
+    }
+
+    // The GPU radix sort is stable, so equal codes keep their triangle order
+    bvh.triangleIndices.resize(n);
+    std::iota(bvh.triangleIndices.begin(), bvh.triangleIndices.end(), 0);
+    std::stable_sort(bvh.triangleIndices.begin(), bvh.triangleIndices.end(), [&](uint32_t a, uint32_t b) {
+        return codes[a] < codes[b];
+    });
+    std::vector<uint32_t> keys(n);
+    for(uint32_t i = 0; i < n; i++) keys[i] = codes[bvh.triangleIndices[i]];
+
+    // Karras node ids: internal nodes 0..n-2, leaves n-1..2n-2
+    const uint32_t NONE = 0xFFFFFFFFu;
+    std::vector<uint32_t> parents(2 * n - 1, NONE);
+    std::vector<uint32_t> slots(2 * n - 1, 0);
+
+    for(int i = 0; i < static_cast<int>(n) - 1; i++) {
+        int d = (delta(keys, i, i + 1) - delta(keys, i, i - 1)) >= 0 ? 1 : -1;
+        int deltaMin = delta(keys, i, i - d);
+        int lMax = 2;
+        while(delta(keys, i, i + lMax * d) > deltaMin) lMax *= 2;
+        int l = 0;
+        for(int t = lMax / 2; t >= 1; t /= 2) {
+            if(delta(keys, i, i + (l + t) * d) > deltaMin) l += t;
+        }
+        int j = i + l * d;
+        int deltaNode = delta(keys, i, j);
+        int s = 0;
+        int t = l;
+        do {
+            t = (t + 1) / 2;
+            if(delta(keys, i, i + (s + t) * d) > deltaNode) s += t;
+        } while(t > 1);
+        int gamma = i + s * d + std::min(d, 0);
+
+        uint32_t left = std::min(i, j) == gamma ? (n - 1) + gamma : gamma;
+        uint32_t right = std::max(i, j) == gamma + 1 ? (n - 1) + gamma + 1 : gamma + 1;
+        parents[left] = i;
+        parents[right] = i;
+        slots[left] = 2 * i + 1;
+        slots[right] = 2 * i + 2;
+    }
+
+    // Bottom up fitting exactly like lbvh_fit.comp: every leaf walks towards the root and
+    // the second child to arrive at a node computes its bounds
+    bvh.nodes.resize(2 * n - 1);
+    std::vector<uint32_t> visits(n > 1 ? n - 1 : 0, 0);
+    for(uint32_t j = 0; j < n; j++) {
+        uint32_t slot = n == 1 ? 0 : slots[(n - 1) + j];
+        const AABB& box = bounds[bvh.triangleIndices[j]];
+        bvh.nodes[slot] = {box.min, j, box.max, 1};
+
+        uint32_t node = parents[(n - 1) + j];
+        while(node != NONE && visits[node]++ > 0) {
+            const BVHNode& l = bvh.nodes[2 * node + 1];
+            const BVHNode& r = bvh.nodes[2 * node + 2];
+            uint32_t nodeSlot = node == 0 ? 0 : slots[node];
+            bvh.nodes[nodeSlot] = {glm::min(l.aabbMin, r.aabbMin), 2 * node + 1, glm::max(l.aabbMax, r.aabbMax), 0};
+            node = parents[node];
+        }
+    }
+
+    bvh.depth = treeDepth(bvh);
+    if(bvh.depth > BVH::MAX_DEPTH) {
+        throw std::runtime_error("LBVH depth " + std::to_string(bvh.depth) + " exceeds the traversal stack size");
+    }
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "LBVH (CPU): " << n << " triangles, " << bvh.nodes.size() << " nodes in " << ms
+              << " ms (" << ms / (n / 1e6) << " ms per million triangles)" << std::endl;
+    return bvh;
+}
+
+bool LBVH::validate(const Scene& scene, const BVH& reference, const BVH& candidate, std::ostream& log) {
+    size_t n = scene.triangleCount();
+    if(candidate.triangleIndices.size() != n || candidate.nodes.size() != (n == 0 ? 1 : 2 * n - 1)) {
+        log << "BVH validation: unexpected buffer sizes" << std::endl;
+        return false;
+    }
+
+    std::vector<uint32_t> seen(n, 0);
+    for(uint32_t t : candidate.triangleIndices) {
+        if(t >= n || seen[t]++ > 0) {
+            log << "BVH validation: triangle index buffer is not a permutation" << std::endl;
+            return false;
+        }
+    }
+
+    // Every node must enclose its children and every leaf its triangles
+    auto contains = [](const BVHNode& outer, const glm::vec3& lo, const glm::vec3& hi) {
+        return outer.aabbMin.x <= lo.x && outer.aabbMin.y <= lo.y && outer.aabbMin.z <= lo.z
+            && outer.aabbMax.x >= hi.x && outer.aabbMax.y >= hi.y && outer.aabbMax.z >= hi.z;
+    };
+    size_t reachedTriangles = 0;
+    std::vector<std::pair<uint32_t, uint32_t>> stack = {{0, 0}};
+    while(!stack.empty() && n > 0) {
+        auto [index, depth] = stack.back();
+        stack.pop_back();
+        const BVHNode& node = candidate.nodes[index];
+        if(depth > BVH::MAX_DEPTH) {
+            log << "BVH validation: node " << index << " is deeper than the traversal stack" << std::endl;
+            return false;
+        }
+        if(node.isLeaf()) {
+            for(uint32_t i = 0; i < node.triangleCount; i++) {
+                AABB box = triangleBounds(scene, candidate.triangleIndices[node.leftFirst + i]);
+                if(!contains(node, box.min, box.max)) {
+                    log << "BVH validation: leaf " << index << " does not enclose its triangles" << std::endl;
+                    return false;
+                }
+            }
+            reachedTriangles += node.triangleCount;
+            continue;
+        }
+        if(node.leftFirst + 1 >= candidate.nodes.size()) {
+            log << "BVH validation: node " << index << " points outside the node array" << std::endl;
+            return false;
+        }
+        for(uint32_t c = node.leftFirst; c <= node.leftFirst + 1; c++) {
+            if(!contains(node, candidate.nodes[c].aabbMin, candidate.nodes[c].aabbMax)) {
+                log << "BVH validation: node " << index << " does not enclose child " << c << std::endl;
+                return false;
+            }
+            stack.push_back({c, depth + 1});
+        }
+    }
+    if(reachedTriangles != n) {
+        log << "BVH validation: " << reachedTriangles << " of " << n << " triangles reachable" << std::endl;
+        return false;
+    }
+
+    // Differences to the reference are legal (the GPU may round a centroid differently), but worth knowing
+    size_t differentNodes = 0;
+    for(size_t i = 0; i < std::min(reference.nodes.size(), candidate.nodes.size()); i++) {
+        const BVHNode& a = reference.nodes[i];
+        const BVHNode& b = candidate.nodes[i];
+        if(a.leftFirst != b.leftFirst || a.triangleCount != b.triangleCount
+           || !(a.aabbMin == b.aabbMin) || !(a.aabbMax == b.aabbMax)) {
+            differentNodes++;
+        }
+    }
+    log << "BVH validation passed, " << differentNodes << " of " << candidate.nodes.size()
+        << " nodes differ from the CPU reference" << std::endl;
+    return true;
+}
+
+GpuLBVHBuilder::GpuLBVHBuilder(GpuAllocator& allocator, VkDevice device, VkPipelineCache pipelineCache)
+    : allocator(&allocator), device(device) {
+    VkDescriptorSetLayoutBinding bindings[BINDING_COUNT]{};
+    for(uint32_t i = 0; i < BINDING_COUNT; i++) {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = BINDING_COUNT;
+    layoutInfo.pBindings = bindings;
+    VK_ASSERT(vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &setLayout), "Could not create LBVH descriptor set layout!");
+
+    VkPushConstantRange pushRange{};
+    pushRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushRange.size = sizeof(PushConstants);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &setLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushRange;
+    VK_ASSERT(vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout), "Could not create LBVH pipeline layout!");
+
+    VkDescriptorPoolSize poolSize{};
+    poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSize.descriptorCount = 2 * BINDING_COUNT;
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = 1;
+    poolInfo.pPoolSizes = &poolSize;
+    poolInfo.maxSets = 2;
+    VK_ASSERT(vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool), "Could not create LBVH descriptor pool!");
+
+    VkDescriptorSetLayout layouts[2] = {setLayout, setLayout};
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = descriptorPool;
+    allocInfo.descriptorSetCount = 2;
+    allocInfo.pSetLayouts = layouts;
+    VK_ASSERT(vkAllocateDescriptorSets(device, &allocInfo, descriptorSets), "Could not allocate LBVH descriptor sets!");
+
+    mortonPipeline = VkUtils::createComputePipeline(device, pipelineCache, pipelineLayout, Loader::readFile("lbvh_morton.spv"));
+    countPipeline = VkUtils::createComputePipeline(device, pipelineCache, pipelineLayout, Loader::readFile("radix_count.spv"));
+    scanPipeline = VkUtils::createComputePipeline(device, pipelineCache, pipelineLayout, Loader::readFile("radix_scan.spv"));
+    scatterPipeline = VkUtils::createComputePipeline(device, pipelineCache, pipelineLayout, Loader::readFile("radix_scatter.spv"));
+    hierarchyPipeline = VkUtils::createComputePipeline(device, pipelineCache, pipelineLayout, Loader::readFile("lbvh_hierarchy.spv"));
+    fitPipeline = VkUtils::createComputePipeline(device, pipelineCache, pipelineLayout, Loader::readFile("lbvh_fit.spv"));
+}
+
+void GpuLBVHBuilder::destroy() {
+    freeScratch();
+    VkPipeline pipelines[] = {mortonPipeline, countPipeline, scanPipeline, scatterPipeline, hierarchyPipeline, fitPipeline};
+    for(VkPipeline pipeline : pipelines) {
+        vkDestroyPipeline(device, pipeline, nullptr);
+    }
+    vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+    vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+    vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+}
+
+void GpuLBVHBuilder::allocateScratch(uint32_t triangleCount) {
+    if(triangleCount <= scratchCapacity) return;
+    freeScratch();
+
+    uint32_t chunkCount = (triangleCount + SORT_CHUNK - 1) / SORT_CHUNK;
+    const VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    auto create = [&](ScratchBuffer& scratch, VkDeviceSize size) {
+        VkUtils::createBuffer(*allocator, device, size, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, scratch.buffer, scratch.allocation);
+    };
+
+    VkDeviceSize keyBytes = sizeof(uint32_t) * static_cast<VkDeviceSize>(triangleCount);
+    VkDeviceSize nodeIdBytes = sizeof(uint32_t) * (2 * static_cast<VkDeviceSize>(triangleCount) - 1);
+    for(int i = 0; i < 2; i++) {
+        create(keys[i], keyBytes);
+        create(values[i], keyBytes);
+    }
+    create(histogram, sizeof(uint32_t) * RADIX * static_cast<VkDeviceSize>(chunkCount));
+    create(parents, nodeIdBytes);
+    create(slots, nodeIdBytes);
+    create(flags, sizeof(uint32_t) * std::max<VkDeviceSize>(triangleCount - 1, 1));
+    scratchCapacity = triangleCount;
+}
+
+void GpuLBVHBuilder::freeScratch() {
+    ScratchBuffer* buffers[] = {&keys[0], &keys[1], &values[0], &values[1], &histogram, &parents, &slots, &flags};
+    for(ScratchBuffer* scratch : buffers) {
+        VkUtils::destroyBuffer(*allocator, device, scratch->buffer, scratch->allocation);
+    }
+    scratchCapacity = 0;
+}
+
+void GpuLBVHBuilder::dispatch(VkCommandBuffer cmd, VkPipeline pipeline, VkDescriptorSet set, const PushConstants& push, uint32_t groups) {
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &set, 0, nullptr);
+    vkCmdPushConstants(cmd, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &push);
+    vkCmdDispatch(cmd, groups, 1, 1);
+}
+
+void GpuLBVHBuilder::record(VkCommandBuffer cmd, const Scene& scene, VkBuffer vertexBuffer, VkBuffer indexBuffer,
+                            VkBuffer nodeBuffer, VkBuffer triangleIndexBuffer) {
+    uint32_t n = static_cast<uint32_t>(scene.triangleCount());
+    if(n == 0) throw std::runtime_error("GPU LBVH build needs at least one triangle");
+    allocateScratch(n);
+
+    // Set 0 sorts A -> B and is used by every non-sort pass, set 1 sorts B -> A
+    for(uint32_t s = 0; s < 2; s++) {
+        VkBuffer buffers[BINDING_COUNT] = {
+            vertexBuffer, indexBuffer,
+            keys[s].buffer, values[s].buffer, keys[1 - s].buffer, values[1 - s].buffer,
+            histogram.buffer, parents.buffer, slots.buffer, flags.buffer, nodeBuffer
+        };
+        VkDescriptorBufferInfo infos[BINDING_COUNT]{};
+        VkWriteDescriptorSet writes[BINDING_COUNT]{};
+        for(uint32_t i = 0; i < BINDING_COUNT; i++) {
+            infos[i].buffer = buffers[i];
+            infos[i].offset = 0;
+            infos[i].range = VK_WHOLE_SIZE;
+            writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writes[i].dstSet = descriptorSets[s];
+            writes[i].dstBinding = i;
+            writes[i].descriptorCount = 1;
+            writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            writes[i].pBufferInfo = &infos[i];
+        }
+        vkUpdateDescriptorSets(device, BINDING_COUNT, writes, 0, nullptr);
+    }
+
+    glm::vec3 sceneMin, sceneMax;
+    LBVH::centroidBounds(scene, sceneMin, sceneMax);
+    glm::vec3 invExtent = inverseExtent(sceneMin, sceneMax);
+
+    PushConstants push{};
+    push.sceneMin[0] = sceneMin.x;
+    push.sceneMin[1] = sceneMin.y;
+    push.sceneMin[2] = sceneMin.z;
+    push.sceneExtentInv[0] = invExtent.x;
+    push.sceneExtentInv[1] = invExtent.y;
+    push.sceneExtentInv[2] = invExtent.z;
+    push.triangleCount = n;
+    push.chunkCount = (n + SORT_CHUNK - 1) / SORT_CHUNK;
+
+    uint32_t leafGroups = (n + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE;
+    uint32_t chunkGroups = (push.chunkCount + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE;
+
+    vkCmdFillBuffer(cmd, parents.buffer, 0, VK_WHOLE_SIZE, 0xFFFFFFFFu);
+    vkCmdFillBuffer(cmd, slots.buffer, 0, VK_WHOLE_SIZE, 0);
+    vkCmdFillBuffer(cmd, flags.buffer, 0, VK_WHOLE_SIZE, 0);
+    VkUtils::computeBarrier(cmd);
+
+    dispatch(cmd, mortonPipeline, descriptorSets[0], push, leafGroups);
+    VkUtils::computeBarrier(cmd);
+
+    for(uint32_t pass = 0; pass < 32 / RADIX_BITS; pass++) {
+        push.digitShift = pass * RADIX_BITS;
+        VkDescriptorSet set = descriptorSets[pass % 2];
+        dispatch(cmd, countPipeline, set, push, chunkGroups);
+        VkUtils::computeBarrier(cmd);
+        dispatch(cmd, scanPipeline, set, push, 1);
+        VkUtils::computeBarrier(cmd);
+        dispatch(cmd, scatterPipeline, set, push, chunkGroups);
+        VkUtils::computeBarrier(cmd);
+    }
+
+    if(n > 1) {
+        dispatch(cmd, hierarchyPipeline, descriptorSets[0], push, (n - 1 + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE);
+        VkUtils::computeBarrier(cmd);
+    }
+    dispatch(cmd, fitPipeline, descriptorSets[0], push, leafGroups);
+    VkUtils::computeBarrier(cmd);
+
+    // After an even number of passes the sorted triangle ids are back in values[0]
+    VkBufferCopy region{};
+    region.size = sizeof(uint32_t) * static_cast<VkDeviceSize>(n);
+    vkCmdCopyBuffer(cmd, values[0].buffer, triangleIndexBuffer, 1, &region);
+    VkUtils::computeBarrier(cmd);
+}
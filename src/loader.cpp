@@ -1,6 +1,81 @@
 #include "loader.h"
 #include <fstream>
 #include <exception>
+#include <algorithm>
+#include <filesystem>
+#include <random>
+#include <stdexcept>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define LOADER_HAS_MMAP 1
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+FileView::~FileView() {
+    release();
+}
+
+FileView::FileView(FileView&& other) noexcept
+    : mapping(std::exchange(other.mapping, nullptr)),
+      mappingSize(std::exchange(other.mappingSize, 0)),
+      buffer(std::move(other.buffer)) {
+}
+
+FileView& FileView::operator=(FileView&& other) noexcept {
+    if(this != &other) {
+        release();
+        mapping = std::exchange(other.mapping, nullptr);
+        mappingSize = std::exchange(other.mappingSize, 0);
+        buffer = std::move(other.buffer);
+    }
+    return *this;
+}
+
+void FileView::release() {
+#ifdef LOADER_HAS_MMAP
+    if(mapping != nullptr) {
+        munmap(mapping, mappingSize);
+    }
+#endif
+    mapping = nullptr;
+    mappingSize = 0;
+    buffer.clear();
+}
+
+const char* FileView::data() const {
+    return mapping != nullptr ? static_cast<const char*>(mapping) : buffer.data();
+}
+
+size_t FileView::size() const {
+    return mapping != nullptr ? mappingSize : buffer.size();
+}
+
+void FileView::advise(AccessPattern pattern) const {
+#ifdef LOADER_HAS_MMAP
+    if(mapping == nullptr) return;
+    int advice = MADV_NORMAL;
+    if(pattern == AccessPattern::Sequential) advice = MADV_SEQUENTIAL;
+    if(pattern == AccessPattern::Random) advice = MADV_RANDOM;
+    madvise(mapping, mappingSize, advice);
+#endif
+}
+
+void FileView::prefetch(size_t offset, size_t length) const {
+#ifdef LOADER_HAS_MMAP
+    if(mapping == nullptr || offset >= mappingSize) return;
+    // madvise needs a page aligned start address
+    size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t alignedOffset = offset - offset % pageSize;
+    size_t end = std::min(mappingSize, offset + length);
+    madvise(static_cast<char*>(mapping) + alignedOffset, end - alignedOffset, MADV_WILLNEED);
+#endif
+}
 
 std::vector<char> Loader::readFile(const std::string& filename){
     std::ifstream file(filename, std::ios::ate | std::ios::binary);
@@ -16,4 +91,100 @@ std::vector<char> Loader::readFile(const std::string& filename){
     file.close();
 
     return buffer;
-}
\ No newline at end of file
+}
+
+FileView Loader::mapFile(const std::string& filename, AccessPattern pattern){
+    FileView view;
+#ifdef LOADER_HAS_MMAP
+    int fd = open(filename.c_str(), O_RDONLY);
+    if(fd < 0) {
+        throw std::runtime_error("Could not open file " + filename);
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0) {
+        close(fd);
+        throw std::runtime_error("Could not stat file " + filename);
+    }
+
+    size_t fileSize = static_cast<size_t>(st.st_size);
+    if(fileSize >= MAP_THRESHOLD) {
+        void* mapping = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        // The mapping keeps its own reference to the file
+        close(fd);
+        if(mapping == MAP_FAILED) {
+            throw std::runtime_error("Could not map file " + filename);
+        }
+        view.mapping = mapping;
+        view.mappingSize = fileSize;
+        view.advise(pattern);
+        return view;
+    }
+    close(fd);
+#endif
+    view.buffer = readFile(filename);
+    return view;
+}
+
+bool Loader::fileExists(const std::string& filename){
+    std::error_code ec;
+    return std::filesystem::is_regular_file(filename, ec);
+}
+
+void Loader::writeFileAtomic(const std::string& filename, const std::vector<char>& data){
+#ifdef LOADER_HAS_MMAP
+    // Unique per writer, so concurrent writers of the same target never share a temporary file
+    std::string tmpName = filename + ".XXXXXX";
+    int fd = mkstemp(tmpName.data());
+    if(fd < 0) {
+        throw std::runtime_error("Could not create temporary file for " + filename);
+    }
+    // mkstemp creates the file 0600, keep the mode a plain open would have given it
+    struct stat st;
+    fchmod(fd, stat(filename.c_str(), &st) == 0 ? (st.st_mode & 07777) : 0644);
+
+    size_t written = 0;
+    while(written < data.size()) {
+        ssize_t result = write(fd, data.data() + written, data.size() - written);
+        if(result < 0 && errno == EINTR) continue;
+        if(result <= 0) break;
+        written += static_cast<size_t>(result);
+    }
+    // The data has to be on disk before the rename makes it visible, or a crash can leave an empty file
+    bool ok = written == data.size() && fsync(fd) == 0;
+    ok = close(fd) == 0 && ok;
+    if(!ok || rename(tmpName.c_str(), filename.c_str()) != 0) {
+        unlink(tmpName.c_str());
+        throw std::runtime_error(ok ? "Could not replace file " + filename : "Could not write file " + tmpName);
+    }
+
+    // Persist the rename itself
+    std::string directory = std::filesystem::path(filename).parent_path().string();
+    int dirFd = open(directory.empty() ? "." : directory.c_str(), O_RDONLY);
+    if(dirFd >= 0) {
+        fsync(dirFd);
+        close(dirFd);
+    }
+#else
+    // No mkstemp: a random suffix keeps concurrent writers apart
+    std::string tmpName = filename + "." + std::to_string(std::random_device{}()) + ".tmp";
+    {
+        std::ofstream file(tmpName, std::ios::binary | std::ios::trunc);
+        if(!file.is_open()) {
+            throw std::runtime_error("Could not open file " + tmpName);
+        }
+        file.write(data.data(), data.size());
+        file.flush();
+        if(!file) {
+            throw std::runtime_error("Could not write file " + tmpName);
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tmpName, filename, ec);
+    if(ec) {
+        std::filesystem::remove(tmpName, ec);
+        throw std::runtime_error("Could not replace file " + filename);
+    }
+#endif
+}
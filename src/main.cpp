@@ -1,16 +1,27 @@
 #include "application.h"
+#include "cpuapplication.h"
+#include "regression.h"
+#include "settings.h"
 #include <stdexcept>
 #include <cstdlib>
 #include <iostream>
 
-int main() {
-    RayTracingApplication app;
-
+int main(int argc, char** argv) {
     try {
-        app.run();
+        RenderSettings settings = RenderSettings::fromArguments(argc, argv);
+        if(!settings.regressionDir.empty()) {
+            RegressionHarness harness(settings);
+            if(!harness.run()) return EXIT_FAILURE;
+        }else if(settings.cpu) {
+            CpuApplication app(settings);
+            app.run();
+        }else {
+            RayTracingApplication app(settings);
+            app.run();
+        }
     }catch(const std::exception& e) {
         std::cerr << e.what() << std::endl;
         return EXIT_FAILURE;
     }
     return 0;
-}
\ No newline at end of file
+}
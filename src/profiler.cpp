@@ -0,0 +1,190 @@
+#include "profiler.h"
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include "loader.h"
+#include "trace.h"
+#include "vkutils.h"
+
+GpuProfiler::GpuProfiler(VkPhysicalDevice physicalDevice, VkDevice device, uint32_t queueFamily, uint32_t framesInFlight, bool pipelineStatistics)
+    : device(device) {
+    uint32_t familyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> families(familyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, families.data());
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(physicalDevice, &props);
+    uint32_t validBits = families[queueFamily].timestampValidBits;
+    if(validBits == 0 || props.limits.timestampPeriod <= 0.0f) return;
+
+    timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+    timestampPeriod = props.limits.timestampPeriod;
+    frameQueries.resize(framesInFlight);
+    calibrationQuery = 2 * MAX_PASSES * framesInFlight;
+
+    VkQueryPoolCreateInfo queryInfo{};
+    queryInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    queryInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    queryInfo.queryCount = calibrationQuery + 1;
+    VK_ASSERT(vkCreateQueryPool(device, &queryInfo, nullptr, &timestampPool), "Could not create profiler query pool!");
+
+    if(pipelineStatistics) {
+        queryInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+        queryInfo.queryCount = MAX_PASSES * framesInFlight;
+        queryInfo.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT;
+        VK_ASSERT(vkCreateQueryPool(device, &queryInfo, nullptr, &statisticsPool), "Could not create profiler statistics pool!");
+    }
+}
+
+void GpuProfiler::destroy() {
+    if(timestampPool != VK_NULL_HANDLE) vkDestroyQueryPool(device, timestampPool, nullptr);
+    if(statisticsPool != VK_NULL_HANDLE) vkDestroyQueryPool(device, statisticsPool, nullptr);
+}
+
+void GpuProfiler::beginFrame(VkCommandBuffer cmd, uint32_t frameSlot) {
+    if(!enabled()) return;
+    collect(frameSlot);
+    currentSlot = frameSlot;
+    vkCmdResetQueryPool(cmd, timestampPool, 2 * MAX_PASSES * frameSlot, 2 * MAX_PASSES);
+    if(statisticsPool != VK_NULL_HANDLE) vkCmdResetQueryPool(cmd, statisticsPool, MAX_PASSES * frameSlot, MAX_PASSES);
+}
+
+void GpuProfiler::beginPass(VkCommandBuffer cmd, const char* name) {
+    if(!enabled()) return;
+    FrameQueries& queries = frameQueries[currentSlot];
+    if(passOpen || queries.passes.size() >= MAX_PASSES) throw std::runtime_error(std::string("Cannot profile pass ") + name);
+    uint32_t pass = static_cast<uint32_t>(queries.passes.size());
+    queries.passes.push_back(name);
+    passOpen = true;
+
+    // Bottom of pipe: written once everything before has finished, so the pass does not include earlier work
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampPool, 2 * (MAX_PASSES * currentSlot + pass));
+    if(statisticsPool != VK_NULL_HANDLE) vkCmdBeginQuery(cmd, statisticsPool, MAX_PASSES * currentSlot + pass, 0);
+}
+
+void GpuProfiler::endPass(VkCommandBuffer cmd) {
+    if(!enabled()) return;
+    uint32_t pass = static_cast<uint32_t>(frameQueries[currentSlot].passes.size()) - 1;
+    passOpen = false;
+    if(statisticsPool != VK_NULL_HANDLE) vkCmdEndQuery(cmd, statisticsPool, MAX_PASSES * currentSlot + pass);
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampPool, 2 * (MAX_PASSES * currentSlot + pass) + 1);
+}
+
+void GpuProfiler::collect(uint32_t frameSlot) {
+    if(!enabled()) return;
+    FrameQueries& queries = frameQueries[frameSlot];
+    uint32_t passes = static_cast<uint32_t>(queries.passes.size());
+    if(passes == 0) return;
+
+    std::vector<uint64_t> timestamps(2 * passes);
+    VkResult result = vkGetQueryPoolResults(device, timestampPool, 2 * MAX_PASSES * frameSlot, 2 * passes, timestamps.size() * sizeof(uint64_t),
+                                            timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    std::vector<uint64_t> invocations(passes, 0);
+    if(result == VK_SUCCESS && statisticsPool != VK_NULL_HANDLE) {
+        result = vkGetQueryPoolResults(device, statisticsPool, MAX_PASSES * frameSlot, passes, invocations.size() * sizeof(uint64_t),
+                                       invocations.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    }
+    if(result == VK_SUCCESS) {
+        for(uint32_t i = 0; i < passes; i++) {
+            History& pass = history(queries.passes[i]);
+            uint64_t ticks = (timestamps[2 * i + 1] - timestamps[2 * i]) & timestampMask;
+            pass.milliseconds.push_back(ticks * static_cast<double>(timestampPeriod) / 1e6);
+            if(calibrated && Trace::enabled()) {
+                int64_t begin = calibrationCpu + static_cast<int64_t>(((timestamps[2 * i] - calibrationGpu) & timestampMask) * static_cast<double>(timestampPeriod));
+                Trace::gpuZone(queries.passes[i], "render queue", begin, begin + static_cast<int64_t>(ticks * static_cast<double>(timestampPeriod)));
+            }
+            pass.invocations.push_back(invocations[i]);
+            if(pass.milliseconds.size() > WINDOW) {
+                pass.milliseconds.pop_front();
+                pass.invocations.pop_front();
+            }
+        }
+    }
+    queries.passes.clear();
+}
+
+void GpuProfiler::calibrate(int64_t cpuTime, uint64_t gpuTicks) {
+    calibrationCpu = cpuTime;
+    calibrationGpu = gpuTicks & timestampMask;
+    calibrated = true;
+}
+
+void GpuProfiler::recordCalibration(VkCommandBuffer cmd) {
+    if(!enabled()) return;
+    vkCmdResetQueryPool(cmd, timestampPool, calibrationQuery, 1);
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampPool, calibrationQuery);
+}
+
+void GpuProfiler::finishCalibration(int64_t submitTime, int64_t completeTime) {
+    if(!enabled()) return;
+    uint64_t ticks;
+    VkResult result = vkGetQueryPoolResults(device, timestampPool, calibrationQuery, 1, sizeof(ticks), &ticks, sizeof(ticks),
+                                            VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+    if(result == VK_SUCCESS) calibrate(submitTime + (completeTime - submitTime) / 2, ticks);
+}
+
+GpuProfiler::History& GpuProfiler::history(const std::string& name) {
+    for(History& pass : histories) {
+        if(pass.name == name) return pass;
+    }
+    histories.push_back({name, {}, {}});
+    return histories.back();
+}
+
+std::vector<GpuProfiler::PassStats> GpuProfiler::stats() const {
+    std::vector<PassStats> result;
+    for(const History& pass : histories) {
+        if(pass.milliseconds.empty()) continue;
+        std::vector<double> sorted(pass.milliseconds.begin(), pass.milliseconds.end());
+        std::sort(sorted.begin(), sorted.end());
+        double sum = 0.0;
+        for(double ms : sorted) sum += ms;
+        double invocations = 0.0;
+        for(uint64_t count : pass.invocations) invocations += static_cast<double>(count);
+
+        PassStats stats;
+        stats.name = pass.name;
+        stats.samples = static_cast<uint32_t>(sorted.size());
+        stats.minMs = sorted.front();
+        stats.avgMs = sum / sorted.size();
+        // Nearest rank
+        stats.p99Ms = sorted[(sorted.size() * 99 + 99) / 100 - 1];
+        stats.invocations = invocations / pass.invocations.size();
+        result.push_back(stats);
+    }
+    return result;
+}
+
+void GpuProfiler::print(std::ostream& out) const {
+    std::vector<PassStats> passes = stats();
+    if(passes.empty()) return;
+    out << "  GPU passes (ms, last " << passes.front().samples << " frames):";
+    for(const PassStats& pass : passes) {
+        out << " " << pass.name << " min " << pass.minMs << " avg " << pass.avgMs << " p99 " << pass.p99Ms;
+        if(statisticsPool != VK_NULL_HANDLE) out << " invocations " << static_cast<uint64_t>(pass.invocations);
+        out << ";";
+    }
+    out << std::endl;
+}
+
+void GpuProfiler::writeJson(const std::string& filename, const std::string& deviceName) const {
+    std::ostringstream json;
+    json << "{\n  \"device\": \"" << Trace::escapeJson(deviceName) << "\",\n"
+         << "  \"timestampPeriodNs\": " << timestampPeriod << ",\n"
+         << "  \"window\": " << WINDOW << ",\n"
+         << "  \"passes\": [";
+    std::vector<PassStats> passes = stats();
+    for(size_t i = 0; i < passes.size(); i++) {
+        const PassStats& pass = passes[i];
+        json << (i == 0 ? "\n" : ",\n")
+             << "    {\"name\": \"" << Trace::escapeJson(pass.name) << "\", \"samples\": " << pass.samples
+             << ", \"minMs\": " << pass.minMs << ", \"avgMs\": " << pass.avgMs << ", \"p99Ms\": " << pass.p99Ms;
+        if(statisticsPool != VK_NULL_HANDLE) json << ", \"computeInvocations\": " << pass.invocations;
+        json << "}";
+    }
+    json << "\n  ]\n}\n";
+
+    std::string text = json.str();
+    // Replaced atomically, a dashboard scraping the file never sees half of it
+    Loader::writeFileAtomic(filename, std::vector<char>(text.begin(), text.end()));
+}
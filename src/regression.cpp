@@ -0,0 +1,195 @@
+#include "regression.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include "application.h"
+#include "cpuapplication.h"
+#include "image.h"
+#include "loader.h"
+#include "trace.h"
+
+RegressionHarness::RegressionHarness(const RenderSettings& settings) : settings(settings) {
+    this->settings.headless = true;
+    this->settings.keepAccumulation = true;
+    // Every case would start the same trace again
+    this->settings.traceFile.clear();
+    pixelCount = static_cast<size_t>(settings.width) * settings.height;
+}
+
+bool RegressionHarness::run() {
+    std::error_code ec;
+    std::filesystem::create_directories(settings.regressionDir, ec);
+    if(ec) throw std::runtime_error("Could not create " + settings.regressionDir + ": " + ec.message());
+    if(!settings.baselineFile.empty() && !settings.updateBaseline) readBaseline();
+
+    std::vector<Result> results;
+    runScene(settings.sceneFile, results);
+    for(const std::string& scene : settings.regressionScenes) {
+        runScene(scene, results);
+    }
+
+    std::cout << "== Results (RMSE threshold " << settings.rmseThreshold << ", time tolerance " << settings.timeTolerance << ")" << std::endl;
+    bool passed = true;
+    for(const Result& result : results) {
+        std::cout << "  " << result.name << ": " << (result.accurate && result.fast ? "pass" : "FAIL") << ", RMSE " << result.rmse
+                  << ", max error " << result.maxError << ", GPU " << result.gpuSeconds << " s";
+        if(result.baselineSeconds > 0.0) {
+            std::cout << " (baseline " << result.baselineSeconds << " s" << (result.fast ? "" : ", too slow") << ")";
+        }else if(!settings.baselineFile.empty() && !settings.updateBaseline) {
+            std::cout << " (no baseline, record it with --update-baseline)";
+        }
+        std::cout << ", CPU " << result.cpuSeconds << " s" << std::endl;
+        passed = passed && result.accurate && result.fast;
+    }
+    writeReport(results);
+    if(settings.updateBaseline) writeBaseline(results);
+    return passed;
+}
+
+void RegressionHarness::runScene(const std::string& sceneFile, std::vector<Result>& results) {
+    std::string scene = sceneFile.empty() ? "cornell" : std::filesystem::path(sceneFile).stem().string();
+
+    // The reference: the CPU renderer traces the binary SAH BVH
+    RenderSettings cpuSettings = settings;
+    cpuSettings.cpu = true;
+    cpuSettings.sceneFile = sceneFile;
+    cpuSettings.bvhBuildMode = BVHBuildMode::SAH;
+    cpuSettings.outputFile = path(scene + "_cpu.ppm");
+    std::cout << "== " << scene << ": CPU reference" << std::endl;
+    CpuApplication cpu(cpuSettings);
+    cpu.run();
+    std::vector<uint8_t> reference = resolve(cpu.accumulation());
+
+    const Case cases[] = {
+        {"sah", BVHBuildMode::SAH, false},
+        {"lbvh", BVHBuildMode::LBVH, false},
+        {"lbvh-gpu", BVHBuildMode::LBVHGpu, false},
+        {"sah-wide", BVHBuildMode::SAH, true},
+        {"lbvh-gpu-wide", BVHBuildMode::LBVHGpu, true},
+    };
+    for(const Case& test : cases) {
+        RenderSettings gpuSettings = settings;
+        gpuSettings.sceneFile = sceneFile;
+        gpuSettings.bvhBuildMode = test.bvhBuildMode;
+        gpuSettings.wideBVH = test.wideBVH;
+        gpuSettings.outputFile = path(scene + "_" + test.name + ".ppm");
+        std::cout << "== " << scene << ": case " << test.name << std::endl;
+        RayTracingApplication gpu(gpuSettings);
+        gpu.run();
+        std::vector<uint8_t> image = resolve(gpu.accumulation());
+
+        Result result{scene + "/" + test.name, cpu.renderSeconds(), gpu.renderSeconds(), 0.0, 0.0, 0.0, false, true};
+        compare(image, reference, result.rmse, result.maxError);
+        result.accurate = result.rmse <= settings.rmseThreshold;
+        if(!result.accurate) writeDiffImage(path(scene + "_" + test.name + "_diff.ppm"), image, reference);
+        auto stored = baseline.find(result.name);
+        if(stored != baseline.end()) {
+            result.baselineSeconds = stored->second;
+            result.fast = result.gpuSeconds <= stored->second * (1.0 + settings.timeTolerance);
+        }else if(!settings.baselineFile.empty() && !settings.updateBaseline) {
+            // An unrecorded case would otherwise pass the time check forever
+            result.fast = false;
+        }
+        results.push_back(result);
+    }
+}
+
+std::vector<uint8_t> RegressionHarness::resolve(const std::vector<float>& accumulation) const {
+    if(accumulation.size() != pixelCount * 4) throw std::runtime_error("Regression run did not keep its accumulation");
+    std::vector<uint8_t> rgba(pixelCount * 4);
+    ImageIO::resolveAccumulation(accumulation.data(), pixelCount, rgba.data());
+    return rgba;
+}
+
+void RegressionHarness::compare(const std::vector<uint8_t>& a, const std::vector<uint8_t>& b, double& rmse, double& maxError) const {
+    double sum = 0.0;
+    int largest = 0;
+    for(size_t i = 0; i < pixelCount; i++) {
+        for(size_t c = 0; c < 3; c++) {
+            int difference = std::abs(static_cast<int>(a[4 * i + c]) - static_cast<int>(b[4 * i + c]));
+            sum += static_cast<double>(difference) * difference;
+            largest = std::max(largest, difference);
+        }
+    }
+    rmse = std::sqrt(sum / (pixelCount * 3)) / 255.0;
+    maxError = largest / 255.0;
+}
+
+void RegressionHarness::writeDiffImage(const std::string& filename, const std::vector<uint8_t>& a, const std::vector<uint8_t>& b) const {
+    std::vector<uint8_t> diff(pixelCount * 4, 255);
+    for(size_t i = 0; i < pixelCount; i++) {
+        for(size_t c = 0; c < 3; c++) {
+            int difference = std::abs(static_cast<int>(a[4 * i + c]) - static_cast<int>(b[4 * i + c])) * DIFF_SCALE;
+            diff[4 * i + c] = static_cast<uint8_t>(std::min(difference, 255));
+        }
+    }
+    ImageIO::writePPM(filename, settings.width, settings.height, diff.data());
+    std::cout << "Wrote " << filename << std::endl;
+}
+
+void RegressionHarness::writeReport(const std::vector<Result>& results) const {
+    std::ostringstream json;
+    json << "{\n  \"width\": " << settings.width << ",\n  \"height\": " << settings.height << ",\n"
+         << "  \"frames\": " << settings.frameCount << ",\n  \"rmseThreshold\": " << settings.rmseThreshold << ",\n"
+         << "  \"timeTolerance\": " << settings.timeTolerance << ",\n  \"cases\": [";
+    for(size_t i = 0; i < results.size(); i++) {
+        const Result& result = results[i];
+        json << (i == 0 ? "\n" : ",\n")
+             << "    {\"name\": \"" << Trace::escapeJson(result.name) << "\", \"passed\": " << (result.accurate && result.fast ? "true" : "false")
+             << ", \"rmse\": " << result.rmse << ", \"maxError\": " << result.maxError << ", \"gpuSeconds\": " << result.gpuSeconds
+             << ", \"baselineSeconds\": " << result.baselineSeconds << ", \"cpuSeconds\": " << result.cpuSeconds << "}";
+    }
+    json << "\n  ]\n}\n";
+
+    std::string text = json.str();
+    Loader::writeFileAtomic(path("regression.json"), std::vector<char>(text.begin(), text.end()));
+    std::cout << "Wrote " << path("regression.json") << std::endl;
+}
+
+void RegressionHarness::readBaseline() {
+    std::vector<char> file = Loader::readFile(settings.baselineFile);
+    std::istringstream text(std::string(file.begin(), file.end()));
+    std::string line;
+    bool matches = false;
+    while(std::getline(text, line)) {
+        std::istringstream fields(line);
+        std::string key;
+        if(!(fields >> key) || key[0] == '#') continue;
+        if(key == "settings") {
+            uint32_t width = 0, height = 0, frames = 0;
+            fields >> width >> height >> frames;
+            matches = width == settings.width && height == settings.height && frames == settings.frameCount;
+            continue;
+        }
+        double seconds;
+        if(!(fields >> seconds) || seconds <= 0.0) {
+            throw std::runtime_error("Invalid line in " + settings.baselineFile + ": " + line);
+        }
+        baseline[key] = seconds;
+    }
+    // Times of another resolution or frame count say nothing about this run
+    if(!matches) {
+        throw std::runtime_error(settings.baselineFile + " was recorded with other settings, rerun with --update-baseline");
+    }
+}
+
+void RegressionHarness::writeBaseline(const std::vector<Result>& results) const {
+    std::ostringstream text;
+    text << "# GPU render times of --regression in seconds, written by --update-baseline.\n"
+         << "# Only meaningful on the machine and ICD they were recorded on.\n"
+         << "settings " << settings.width << " " << settings.height << " " << settings.frameCount << "\n";
+    for(const Result& result : results) {
+        text << result.name << " " << result.gpuSeconds << "\n";
+    }
+    std::string data = text.str();
+    Loader::writeFileAtomic(settings.baselineFile, std::vector<char>(data.begin(), data.end()));
+    std::cout << "Wrote " << settings.baselineFile << std::endl;
+}
+
+std::string RegressionHarness::path(const std::string& filename) const {
+    return (std::filesystem::path(settings.regressionDir) / filename).string();
+}
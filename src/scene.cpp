@@ -0,0 +1,142 @@
+#include "scene.h"
+#include <cmath>
+#include <map>
+#include <utility>
+
+uint32_t Scene::addMaterial(const glm::vec3& albedo, const glm::vec3& emission) {
+    materials.push_back({glm::vec4(albedo, 0.0f), glm::vec4(emission, 0.0f)});
+    return static_cast<uint32_t>(materials.size() - 1);
+}
+
+std::vector<uint32_t> Scene::emissiveTriangles() const {
+    std::vector<uint32_t> lights;
+    for(uint32_t t = 0; t < triangleMaterials.size(); t++) {
+        const glm::vec4& emission = materials[triangleMaterials[t]].emission;
+        if(emission.x > 0.0f || emission.y > 0.0f || emission.z > 0.0f) lights.push_back(t);
+    }
+    return lights;
+}
+
+void Scene::addTriangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, uint32_t material) {
+    uint32_t base = static_cast<uint32_t>(vertices.size());
+    vertices.push_back(glm::vec4(a, 1.0f));
+    vertices.push_back(glm::vec4(b, 1.0f));
+    vertices.push_back(glm::vec4(c, 1.0f));
+    indices.push_back(base);
+    indices.push_back(base + 1);
+    indices.push_back(base + 2);
+    triangleMaterials.push_back(material);
+}
+
+void Scene::addQuad(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, const glm::vec3& d, uint32_t material) {
+    uint32_t base = static_cast<uint32_t>(vertices.size());
+    vertices.push_back(glm::vec4(a, 1.0f));
+    vertices.push_back(glm::vec4(b, 1.0f));
+    vertices.push_back(glm::vec4(c, 1.0f));
+    vertices.push_back(glm::vec4(d, 1.0f));
+    uint32_t quad[6] = {base, base + 1, base + 2, base, base + 2, base + 3};
+    indices.insert(indices.end(), quad, quad + 6);
+    triangleMaterials.push_back(material);
+    triangleMaterials.push_back(material);
+}
+
+void Scene::addBox(const glm::vec3& center, const glm::vec3& halfExtent, float angleY, uint32_t material) {
+    float c = std::cos(angleY);
+    float s = std::sin(angleY);
+    auto corner = [&](float x, float y, float z) {
+        glm::vec3 p = glm::vec3(x, y, z) * halfExtent;
+        return center + glm::vec3(c * p.x + s * p.z, p.y, -s * p.x + c * p.z);
+    };
+
+    glm::vec3 v[8] = {
+        corner(-1, -1, -1), corner(1, -1, -1), corner(1, 1, -1), corner(-1, 1, -1),
+        corner(-1, -1, 1), corner(1, -1, 1), corner(1, 1, 1), corner(-1, 1, 1),
+    };
+    addQuad(v[4], v[5], v[6], v[7], material); // +z
+    addQuad(v[1], v[0], v[3], v[2], material); // -z
+    addQuad(v[5], v[1], v[2], v[6], material); // +x
+    addQuad(v[0], v[4], v[7], v[3], material); // -x
+    addQuad(v[7], v[6], v[2], v[3], material); // +y
+    addQuad(v[0], v[1], v[5], v[4], material); // -y
+}
+
+void Scene::addSphere(const glm::vec3& center, float radius, uint32_t subdivisions, uint32_t material) {
+    // Icosphere: subdivide an icosahedron and project every vertex onto the sphere
+    const float t = (1.0f + std::sqrt(5.0f)) / 2.0f;
+    std::vector<glm::vec3> points = {
+        {-1, t, 0}, {1, t, 0}, {-1, -t, 0}, {1, -t, 0},
+        {0, -1, t}, {0, 1, t}, {0, -1, -t}, {0, 1, -t},
+        {t, 0, -1}, {t, 0, 1}, {-t, 0, -1}, {-t, 0, 1},
+    };
+    for(auto& p : points) p = glm::normalize(p);
+
+    std::vector<uint32_t> faces = {
+        0, 11, 5,  0, 5, 1,  0, 1, 7,  0, 7, 10,  0, 10, 11,
+        1, 5, 9,  5, 11, 4,  11, 10, 2,  10, 7, 6,  7, 1, 8,
+        3, 9, 4,  3, 4, 2,  3, 2, 6,  3, 6, 8,  3, 8, 9,
+        4, 9, 5,  2, 4, 11,  6, 2, 10,  8, 6, 7,  9, 8, 1,
+    };
+
+    for(uint32_t level = 0; level < subdivisions; level++) {
+        std::map<std::pair<uint32_t, uint32_t>, uint32_t> midpoints;
+        auto midpoint = [&](uint32_t a, uint32_t b) {
+            auto key = std::make_pair(std::min(a, b), std::max(a, b));
+            auto it = midpoints.find(key);
+            if(it != midpoints.end()) return it->second;
+            points.push_back(glm::normalize((points[a] + points[b]) * 0.5f));
+            uint32_t index = static_cast<uint32_t>(points.size() - 1);
+            midpoints[key] = index;
+            return index;
+        };
+
+        std::vector<uint32_t> refined;
+        refined.reserve(faces.size() * 4);
+        for(size_t i = 0; i < faces.size(); i += 3) {
+            uint32_t a = faces[i], b = faces[i + 1], c = faces[i + 2];
+            uint32_t ab = midpoint(a, b), bc = midpoint(b, c), ca = midpoint(c, a);
+            uint32_t tris[12] = {a, ab, ca,  b, bc, ab,  c, ca, bc,  ab, bc, ca};
+            refined.insert(refined.end(), tris, tris + 12);
+        }
+        faces.swap(refined);
+    }
+
+    uint32_t base = static_cast<uint32_t>(vertices.size());
+    for(const auto& p : points) {
+        vertices.push_back(glm::vec4(center + p * radius, 1.0f));
+    }
+    for(size_t i = 0; i < faces.size(); i += 3) {
+        indices.push_back(base + faces[i]);
+        indices.push_back(base + faces[i + 1]);
+        indices.push_back(base + faces[i + 2]);
+        triangleMaterials.push_back(material);
+    }
+}
+
+Scene Scene::createCornellRoom() {
+    Scene scene;
+    uint32_t white = scene.addMaterial(glm::vec3(0.73f));
+    uint32_t red = scene.addMaterial(glm::vec3(0.65f, 0.05f, 0.05f));
+    uint32_t green = scene.addMaterial(glm::vec3(0.12f, 0.45f, 0.15f));
+    uint32_t light = scene.addMaterial(glm::vec3(0.0f), glm::vec3(15.0f));
+
+    scene.addQuad({-1, -1, 1}, {1, -1, 1}, {1, -1, -1}, {-1, -1, -1}, white);  // floor
+    scene.addQuad({-1, 1, -1}, {1, 1, -1}, {1, 1, 1}, {-1, 1, 1}, white);      // ceiling
+    scene.addQuad({-1, -1, -1}, {1, -1, -1}, {1, 1, -1}, {-1, 1, -1}, white);  // back
+    scene.addQuad({-1, -1, 1}, {-1, -1, -1}, {-1, 1, -1}, {-1, 1, 1}, red);    // left
+    scene.addQuad({1, -1, -1}, {1, -1, 1}, {1, 1, 1}, {1, 1, -1}, green);      // right
+    scene.addQuad({-0.25f, 0.99f, -0.25f}, {0.25f, 0.99f, -0.25f}, {0.25f, 0.99f, 0.25f}, {-0.25f, 0.99f, 0.25f}, light);
+    return scene;
+}
+
+Scene Scene::createCornellBox() {
+    Scene scene = createCornellRoom();
+    // The room's first material
+    uint32_t white = 0;
+    uint32_t yellow = scene.addMaterial(glm::vec3(0.9f, 0.8f, 0.3f));
+
+    scene.addBox({-0.35f, -0.4f, -0.3f}, {0.3f, 0.6f, 0.3f}, 0.3f, white);
+    scene.addBox({0.4f, -0.7f, 0.35f}, {0.3f, 0.3f, 0.3f}, -0.3f, white);
+    scene.addSphere({0.4f, -0.1f, 0.35f}, 0.3f, 4, yellow);
+
+    return scene;
+}
@@ -0,0 +1,175 @@
+#include "settings.h"
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+static uint32_t parseUnsigned(const std::string& option, const std::string& value) {
+    // stoul accepts a sign (and wraps "-1") and more than 32 bits, only plain digits that fit are valid
+    bool digits = !value.empty() && value.find_first_not_of("0123456789") == std::string::npos;
+    try {
+        unsigned long long parsed = digits ? std::stoull(value) : 0;
+        if(digits && parsed <= UINT32_MAX) return static_cast<uint32_t>(parsed);
+    }catch(const std::exception&) {
+    }
+    throw std::runtime_error("Invalid value for " + option + ": " + value);
+}
+
+static float parseFloat(const std::string& option, const std::string& value) {
+    // stof stops at the first invalid character and accepts "nan" and "inf"
+    try {
+        size_t pos = 0;
+        float parsed = std::stof(value, &pos);
+        if(pos == value.size() && std::isfinite(parsed)) return parsed;
+    }catch(const std::exception&) {
+    }
+    throw std::runtime_error("Invalid value for " + option + ": " + value);
+}
+
+RenderSettings RenderSettings::fromArguments(int argc, char** argv) {
+    RenderSettings settings;
+
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        auto nextValue = [&]() -> std::string {
+            if(i + 1 >= argc) throw std::runtime_error("Missing value for " + arg);
+            return argv[++i];
+        };
+
+        if(arg == "--headless") {
+            settings.headless = true;
+        }else if(arg == "--width") {
+            settings.width = parseUnsigned(arg, nextValue());
+        }else if(arg == "--height") {
+            settings.height = parseUnsigned(arg, nextValue());
+        }else if(arg == "--frames") {
+            settings.frameCount = parseUnsigned(arg, nextValue());
+        }else if(arg == "--target-noise") {
+            settings.targetNoise = parseFloat(arg, nextValue());
+        }else if(arg == "--adaptive") {
+            settings.adaptive = true;
+        }else if(arg == "--output") {
+            settings.outputFile = nextValue();
+        }else if(arg == "--scene") {
+            settings.sceneFile = nextValue();
+        }else if(arg == "--pipeline-cache") {
+            settings.pipelineCacheFile = nextValue();
+        }else if(arg == "--no-pipeline-cache") {
+            settings.pipelineCacheFile.clear();
+        }else if(arg == "--bvh") {
+            std::string mode = nextValue();
+            if(mode == "sah") settings.bvhBuildMode = BVHBuildMode::SAH;
+            else if(mode == "lbvh") settings.bvhBuildMode = BVHBuildMode::LBVH;
+            else if(mode == "lbvh-gpu") settings.bvhBuildMode = BVHBuildMode::LBVHGpu;
+            else throw std::runtime_error("Unknown BVH build mode: " + mode);
+        }else if(arg == "--validate-bvh") {
+            settings.validateBVH = true;
+        }else if(arg == "--wide-bvh") {
+            settings.wideBVH = true;
+        }else if(arg == "--frames-in-flight") {
+            settings.framesInFlight = parseUnsigned(arg, nextValue());
+        }else if(arg == "--no-timeline-semaphores") {
+            settings.timelineSemaphores = false;
+        }else if(arg == "--device") {
+            settings.device = nextValue();
+        }else if(arg == "--no-transfer-queue") {
+            settings.transferQueue = false;
+        }else if(arg == "--no-async-compute") {
+            settings.asyncCompute = false;
+        }else if(arg == "--multi-gpu") {
+            settings.multiGpu = true;
+        }else if(arg == "--profile") {
+            settings.profile = true;
+        }else if(arg == "--pipeline-statistics") {
+            settings.profile = true;
+            settings.pipelineStatistics = true;
+        }else if(arg == "--profile-json") {
+            settings.profile = true;
+            settings.profileJson = nextValue();
+        }else if(arg == "--trace") {
+            settings.profile = true;
+            settings.traceFile = nextValue();
+        }else if(arg == "--cpu") {
+            settings.cpu = true;
+            settings.headless = true;
+        }else if(arg == "--cpu-isa") {
+            std::string isa = nextValue();
+            if(isa == "auto") settings.cpuIsa = CpuIsa::Auto;
+            else if(isa == "scalar") settings.cpuIsa = CpuIsa::Scalar;
+            else if(isa == "sse") settings.cpuIsa = CpuIsa::SSE;
+            else if(isa == "avx2") settings.cpuIsa = CpuIsa::AVX2;
+            else if(isa == "avx512") settings.cpuIsa = CpuIsa::AVX512;
+            else throw std::runtime_error("Unknown CPU instruction set: " + isa);
+        }else if(arg == "--cpu-threads") {
+            settings.cpuThreads = parseUnsigned(arg, nextValue());
+        }else if(arg == "--no-pin-threads") {
+            settings.pinThreads = false;
+        }else if(arg == "--regression") {
+            settings.regressionDir = nextValue();
+            settings.headless = true;
+        }else if(arg == "--rmse-threshold") {
+            settings.rmseThreshold = parseFloat(arg, nextValue());
+        }else if(arg == "--regression-scene") {
+            settings.regressionScenes.push_back(nextValue());
+        }else if(arg == "--baseline") {
+            settings.baselineFile = nextValue();
+        }else if(arg == "--time-tolerance") {
+            settings.timeTolerance = parseFloat(arg, nextValue());
+        }else if(arg == "--update-baseline") {
+            settings.updateBaseline = true;
+        }else if(arg == "--kernel") {
+            std::string kernel = nextValue();
+            if(kernel == "megakernel") settings.kernel = RenderKernel::Megakernel;
+            else if(kernel == "wavefront") settings.kernel = RenderKernel::Wavefront;
+            else throw std::runtime_error("Unknown render kernel: " + kernel);
+        }else {
+            throw std::runtime_error("Unknown argument: " + arg);
+        }
+    }
+
+    if(settings.width == 0 || settings.height == 0) {
+        throw std::runtime_error("Render size must not be zero");
+    }
+    if(settings.framesInFlight == 0) {
+        throw std::runtime_error("At least one frame has to be in flight");
+    }
+    if(settings.frameCount == 0) {
+        throw std::runtime_error("At least one frame has to be rendered");
+    }
+    if(settings.targetNoise < 0.0f) {
+        throw std::runtime_error("Target noise must not be negative");
+    }
+    if(settings.targetNoise > 0.0f && !settings.headless) {
+        // The window renders until it is closed, there is nothing to stop early
+        throw std::runtime_error("--target-noise needs --headless");
+    }
+    if(settings.targetNoise > 0.0f && settings.multiGpu) {
+        throw std::runtime_error("--target-noise is not supported with --multi-gpu");
+    }
+    if(settings.adaptive && (settings.targetNoise <= 0.0f || settings.kernel != RenderKernel::Megakernel)) {
+        throw std::runtime_error("--adaptive needs --target-noise and the megakernel");
+    }
+    if(settings.multiGpu && (!settings.headless || settings.kernel != RenderKernel::Megakernel)) {
+        throw std::runtime_error("--multi-gpu needs --headless and the megakernel");
+    }
+    if(!settings.regressionDir.empty() && (settings.cpu || settings.targetNoise > 0.0f || settings.kernel != RenderKernel::Megakernel)) {
+        // The wavefront kernels sample lights explicitly, their noise differs from the CPU renderer's
+        throw std::runtime_error("--regression compares the megakernel without --target-noise against the CPU renderer");
+    }
+    if(settings.regressionDir.empty() && (!settings.regressionScenes.empty() || !settings.baselineFile.empty() || settings.updateBaseline)) {
+        throw std::runtime_error("--regression-scene, --baseline and --update-baseline need --regression");
+    }
+    if(settings.updateBaseline && settings.baselineFile.empty()) {
+        throw std::runtime_error("--update-baseline needs --baseline");
+    }
+    if(settings.timeTolerance < 0.0f) {
+        throw std::runtime_error("Time tolerance must not be negative");
+    }
+    if(settings.rmseThreshold < 0.0f) {
+        throw std::runtime_error("RMSE threshold must not be negative");
+    }
+    if(settings.cpu && (settings.multiGpu || settings.targetNoise > 0.0f || settings.wideBVH)) {
+        throw std::runtime_error("--cpu does not support --multi-gpu, --target-noise or --wide-bvh");
+    }
+    return settings;
+}
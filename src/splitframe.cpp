@@ -0,0 +1,324 @@
+#include "splitframe.h"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include "vkutils.h"
+
+SplitFrameWorker::SplitFrameWorker(VkPhysicalDevice physicalDevice, const std::vector<char>& shaderCode, VkExtent2D extent,
+                                   uint32_t samplesPerPixel, uint32_t maxBounces, const std::vector<std::vector<char>>& sceneBuffers)
+    : extent(extent), samplesPerPixel(samplesPerPixel), maxBounces(maxBounces) {
+    createDevice(physicalDevice);
+    createImages();
+    uploadScene(sceneBuffers);
+    createPipeline(physicalDevice, shaderCode);
+}
+
+void SplitFrameWorker::createDevice(VkPhysicalDevice physicalDevice) {
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(physicalDevice, &props);
+    deviceName = props.deviceName;
+
+    uint32_t familyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> families(familyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, families.data());
+    auto compute = std::find_if(families.begin(), families.end(), [](const VkQueueFamilyProperties& family) {
+        return (family.queueFlags & VK_QUEUE_COMPUTE_BIT) != 0;
+    });
+    if(compute == families.end()) throw std::runtime_error("Split frame device " + deviceName + " has no compute queue!");
+    queueFamily = static_cast<uint32_t>(compute - families.begin());
+
+    float priority = 1.0f;
+    VkDeviceQueueCreateInfo queueInfo{};
+    queueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queueInfo.queueFamilyIndex = queueFamily;
+    queueInfo.queueCount = 1;
+    queueInfo.pQueuePriorities = &priority;
+
+    // Same rule as the primary device: VK_KHR_portability_subset has to be enabled when present
+    uint32_t extensionCount = 0;
+    VK_ASSERT(vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr), "Could not enumerate Device Extensions!");
+    std::vector<VkExtensionProperties> available(extensionCount);
+    VK_ASSERT(vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, available.data()), "Could not enumerate Device Extensions!");
+    std::vector<const char*> extensions;
+    for(const auto& extension : available) {
+        if(strcmp(extension.extensionName, "VK_KHR_portability_subset") == 0) extensions.push_back("VK_KHR_portability_subset");
+    }
+
+    VkPhysicalDeviceFeatures features{};
+    VkDeviceCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    createInfo.queueCreateInfoCount = 1;
+    createInfo.pQueueCreateInfos = &queueInfo;
+    createInfo.pEnabledFeatures = &features;
+    createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+    createInfo.ppEnabledExtensionNames = extensions.data();
+    VK_ASSERT(vkCreateDevice(physicalDevice, &createInfo, nullptr, &device), "Could not create split frame device!");
+    vkGetDeviceQueue(device, queueFamily, 0, &queue);
+
+    allocator.emplace(physicalDevice, device);
+    // Only the host waits on this queue, the fence backend is enough
+    timeline.emplace(device, queue, false);
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = queueFamily;
+    VK_ASSERT(vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool), "Could not create command pool!");
+}
+
+void SplitFrameWorker::createImages() {
+    auto create = [&](VkFormat format, VkImageUsageFlags usage, VkImage& image, GpuAllocation& allocation, VkImageView& view) {
+        VkImageCreateInfo imageInfo{};
+        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.extent = {extent.width, extent.height, 1};
+        imageInfo.mipLevels = 1;
+        imageInfo.arrayLayers = 1;
+        imageInfo.format = format;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        imageInfo.usage = usage;
+        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        VK_ASSERT(vkCreateImage(device, &imageInfo, nullptr, &image), "Could not create image!");
+        allocation = allocator->allocateImage(image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+        VkImageViewCreateInfo viewInfo{};
+        viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        viewInfo.image = image;
+        viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        viewInfo.format = format;
+        viewInfo.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+        VK_ASSERT(vkCreateImageView(device, &viewInfo, nullptr, &view), "Could not create image view!");
+    };
+    create(VK_FORMAT_R32G32B32A32_SFLOAT, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+           accumulationImage, accumulationAllocation, accumulationView);
+    create(VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_STORAGE_BIT, outputImage, outputAllocation, outputView);
+
+    VkCommandBuffer cmd = beginCommands();
+    VkImageMemoryBarrier barriers[2]{};
+    VkImage images[2] = {accumulationImage, outputImage};
+    for(int i = 0; i < 2; i++) {
+        barriers[i].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barriers[i].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barriers[i].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        barriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barriers[i].image = images[i];
+        barriers[i].subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+        barriers[i].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    }
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0, 0, nullptr, 0, nullptr, 2, barriers);
+    // The kernel only starts a new sum at frame 0, which belongs to the primary device
+    VkClearColorValue zero{};
+    VkImageSubresourceRange range = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    vkCmdClearColorImage(cmd, accumulationImage, VK_IMAGE_LAYOUT_GENERAL, &zero, 1, &range);
+    VkUtils::computeBarrier(cmd);
+    submitCommands(cmd);
+}
+
+void SplitFrameWorker::uploadScene(const std::vector<std::vector<char>>& data) {
+    if(data.size() != SCENE_BUFFERS) throw std::runtime_error("Split frame worker expects six scene buffers!");
+
+    std::vector<Buffer> staging(SCENE_BUFFERS);
+    VkCommandBuffer cmd = beginCommands();
+    for(uint32_t i = 0; i < SCENE_BUFFERS; i++) {
+        // Vulkan does not allow zero sized buffers
+        VkDeviceSize size = std::max<VkDeviceSize>(data[i].size(), 16);
+        VkUtils::createBuffer(*allocator, device, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                              VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                              staging[i].buffer, staging[i].allocation);
+        if(!data[i].empty()) memcpy(staging[i].allocation.mapped, data[i].data(), data[i].size());
+        VkUtils::createBuffer(*allocator, device, size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, sceneBuffers[i].buffer, sceneBuffers[i].allocation);
+
+        VkBufferCopy region{};
+        region.size = size;
+        vkCmdCopyBuffer(cmd, staging[i].buffer, sceneBuffers[i].buffer, 1, &region);
+    }
+    VkUtils::computeBarrier(cmd);
+    timeline->wait(submitCommands(cmd));
+    timeline->collect();
+    for(Buffer& buffer : staging) VkUtils::destroyBuffer(*allocator, device, buffer.buffer, buffer.allocation);
+}
+
+void SplitFrameWorker::createPipeline(VkPhysicalDevice physicalDevice, const std::vector<char>& shaderCode) {
+    // 0-1: accumulation and output image, 2-7: scene buffers, as in the primary device's set
+    const uint32_t imageBindings = 2;
+    VkDescriptorSetLayoutBinding bindings[imageBindings + SCENE_BUFFERS]{};
+    for(uint32_t i = 0; i < imageBindings + SCENE_BUFFERS; i++) {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = i < imageBindings ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = imageBindings + SCENE_BUFFERS;
+    layoutInfo.pBindings = bindings;
+    VK_ASSERT(vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &setLayout), "Could not create descriptor set layout!");
+
+    VkDescriptorPoolSize poolSizes[2]{};
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    poolSizes[0].descriptorCount = imageBindings;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSizes[1].descriptorCount = SCENE_BUFFERS;
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = 2;
+    poolInfo.pPoolSizes = poolSizes;
+    poolInfo.maxSets = 1;
+    VK_ASSERT(vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool), "Could not create descriptor pool!");
+
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = descriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &setLayout;
+    VK_ASSERT(vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet), "Could not allocate descriptor set!");
+
+    VkDescriptorImageInfo imageInfos[imageBindings]{};
+    imageInfos[0].imageView = accumulationView;
+    imageInfos[0].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    imageInfos[1].imageView = outputView;
+    imageInfos[1].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    VkDescriptorBufferInfo bufferInfos[SCENE_BUFFERS]{};
+    VkWriteDescriptorSet writes[imageBindings + SCENE_BUFFERS]{};
+    for(uint32_t i = 0; i < imageBindings + SCENE_BUFFERS; i++) {
+        writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[i].dstSet = descriptorSet;
+        writes[i].dstBinding = i;
+        writes[i].descriptorCount = 1;
+        if(i < imageBindings) {
+            writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            writes[i].pImageInfo = &imageInfos[i];
+        }else {
+            bufferInfos[i - imageBindings].buffer = sceneBuffers[i - imageBindings].buffer;
+            bufferInfos[i - imageBindings].range = VK_WHOLE_SIZE;
+            writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            writes[i].pBufferInfo = &bufferInfos[i - imageBindings];
+        }
+    }
+    vkUpdateDescriptorSets(device, imageBindings + SCENE_BUFFERS, writes, 0, nullptr);
+
+    VkPushConstantRange pushRange{};
+    pushRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushRange.size = sizeof(PushConstants);
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &setLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushRange;
+    VK_ASSERT(vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout), "Could not create pipeline layout!");
+
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(physicalDevice, &props);
+    workgroupSize = VkUtils::chooseTileSize(props.limits);
+
+    // local_size_x_id = 0, local_size_y_id = 1
+    VkSpecializationMapEntry specEntries[2]{};
+    specEntries[0].constantID = 0;
+    specEntries[0].offset = offsetof(VkExtent2D, width);
+    specEntries[0].size = sizeof(uint32_t);
+    specEntries[1].constantID = 1;
+    specEntries[1].offset = offsetof(VkExtent2D, height);
+    specEntries[1].size = sizeof(uint32_t);
+    VkSpecializationInfo specInfo{};
+    specInfo.mapEntryCount = 2;
+    specInfo.pMapEntries = specEntries;
+    specInfo.dataSize = sizeof(VkExtent2D);
+    specInfo.pData = &workgroupSize;
+
+    // No pipeline cache, its blob would be keyed to the primary device
+    pipeline = VkUtils::createComputePipeline(device, VK_NULL_HANDLE, pipelineLayout, shaderCode, &specInfo);
+}
+
+void SplitFrameWorker::destroy() {
+    timeline->destroy();
+    vkDestroyPipeline(device, pipeline, nullptr);
+    vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+    vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+    vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+    vkDestroyCommandPool(device, commandPool, nullptr);
+    for(Buffer& buffer : sceneBuffers) VkUtils::destroyBuffer(*allocator, device, buffer.buffer, buffer.allocation);
+    vkDestroyImageView(device, accumulationView, nullptr);
+    vkDestroyImage(device, accumulationImage, nullptr);
+    allocator->free(accumulationAllocation);
+    vkDestroyImageView(device, outputView, nullptr);
+    vkDestroyImage(device, outputImage, nullptr);
+    allocator->free(outputAllocation);
+    allocator->destroy();
+    vkDestroyDevice(device, nullptr);
+}
+
+double SplitFrameWorker::render(uint32_t firstFrame, uint32_t count) {
+    auto start = std::chrono::steady_clock::now();
+    uint32_t groupsX = (extent.width + workgroupSize.width - 1) / workgroupSize.width;
+    uint32_t groupsY = (extent.height + workgroupSize.height - 1) / workgroupSize.height;
+
+    for(uint32_t done = 0; done < count;) {
+        VkCommandBuffer cmd = beginCommands();
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+        for(uint32_t i = 0; i < FRAMES_PER_SUBMIT && done < count; i++, done++) {
+            // Also orders the first frame after the previous submission's last one
+            VkUtils::computeBarrier(cmd);
+            PushConstants push{firstFrame + done, samplesPerPixel, maxBounces};
+            vkCmdPushConstants(cmd, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &push);
+            vkCmdDispatch(cmd, groupsX, groupsY, 1);
+        }
+        submitCommands(cmd);
+    }
+    timeline->wait(timeline->lastSubmitted());
+    timeline->collect();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void SplitFrameWorker::readAccumulation(std::vector<float>& pixels) {
+    size_t floats = static_cast<size_t>(extent.width) * extent.height * 4;
+    Buffer readback;
+    VkUtils::createBuffer(*allocator, device, floats * sizeof(float), VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                          readback.buffer, readback.allocation);
+
+    VkCommandBuffer cmd = beginCommands();
+    VkUtils::recordImageReadback(cmd, accumulationImage, extent, readback.buffer);
+    timeline->wait(submitCommands(cmd));
+    timeline->collect();
+
+    pixels.resize(floats);
+    memcpy(pixels.data(), readback.allocation.mapped, floats * sizeof(float));
+    VkUtils::destroyBuffer(*allocator, device, readback.buffer, readback.allocation);
+}
+
+VkCommandBuffer SplitFrameWorker::beginCommands() {
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandPool = commandPool;
+    allocInfo.commandBufferCount = 1;
+    VkCommandBuffer cmd;
+    VK_ASSERT(vkAllocateCommandBuffers(device, &allocInfo, &cmd), "Could not allocate command buffer!");
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    VK_ASSERT(vkBeginCommandBuffer(cmd, &beginInfo), "Could not begin command buffer!");
+    return cmd;
+}
+
+uint64_t SplitFrameWorker::submitCommands(VkCommandBuffer cmd) {
+    VK_ASSERT(vkEndCommandBuffer(cmd), "Could not end command buffer!");
+    GpuTimeline::Submission submission;
+    submission.commandBuffers.push_back(cmd);
+    uint64_t value = timeline->submit(submission);
+    timeline->release(value, [this, cmd]() {
+        vkFreeCommandBuffers(device, commandPool, 1, &cmd);
+    });
+    return value;
+}
@@ -0,0 +1,258 @@
+#include "tilescheduler.h"
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include "trace.h"
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+struct Cpu {
+    uint32_t id;
+    uint32_t node;
+};
+
+#ifdef __linux__
+// Parses sysfs lists like "0-15,32-47"
+std::vector<uint32_t> parseCpuList(const std::string& list) {
+    std::vector<uint32_t> cpus;
+    size_t pos = 0;
+    while(pos < list.size()) {
+        size_t end = list.find(',', pos);
+        if(end == std::string::npos) end = list.size();
+        std::string range = list.substr(pos, end - pos);
+        size_t dash = range.find('-');
+        try {
+            uint32_t first = static_cast<uint32_t>(std::stoul(range.substr(0, dash)));
+            uint32_t last = dash == std::string::npos ? first : static_cast<uint32_t>(std::stoul(range.substr(dash + 1)));
+            for(uint32_t cpu = first; cpu <= last; cpu++) cpus.push_back(cpu);
+        }catch(const std::exception&) {
+        }
+        pos = end + 1;
+    }
+    return cpus;
+}
+#endif
+
+// CPUs the process may run on, grouped by NUMA node
+std::vector<Cpu> availableCpus() {
+    std::vector<Cpu> cpus;
+#ifdef __linux__
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if(sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        // Without sysfs (or on a single node machine) every CPU stays on node 0
+        std::vector<uint32_t> cpuNodes(CPU_SETSIZE, 0);
+        std::ifstream online("/sys/devices/system/node/online");
+        std::string nodeList;
+        std::getline(online, nodeList);
+        for(uint32_t node : parseCpuList(nodeList)) {
+            std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+            std::string list;
+            std::getline(file, list);
+            for(uint32_t cpu : parseCpuList(list)) {
+                if(cpu < CPU_SETSIZE) cpuNodes[cpu] = node;
+            }
+        }
+        for(uint32_t cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if(CPU_ISSET(cpu, &allowed)) cpus.push_back({cpu, cpuNodes[cpu]});
+        }
+        std::stable_sort(cpus.begin(), cpus.end(), [](const Cpu& a, const Cpu& b) { return a.node < b.node; });
+    }
+#endif
+    if(cpus.empty()) {
+        uint32_t count = std::max(std::thread::hardware_concurrency(), 1u);
+        for(uint32_t cpu = 0; cpu < count; cpu++) cpus.push_back({cpu, 0});
+    }
+    return cpus;
+}
+
+}
+
+TileScheduler::TileScheduler(uint32_t threadCount, bool pinThreads) : pinThreads(pinThreads) {
+    std::vector<Cpu> cpus = availableCpus();
+    uint32_t count = threadCount == 0 ? static_cast<uint32_t>(cpus.size()) : threadCount;
+
+    for(uint32_t i = 0; i < count; i++) {
+        auto worker = std::make_unique<Worker>();
+        worker->cpu = cpus[i % cpus.size()].id;
+        worker->node = cpus[i % cpus.size()].node;
+        workers.push_back(std::move(worker));
+    }
+    // Only the nodes that got workers
+    std::vector<uint32_t> nodeIds;
+    for(auto& worker : workers) {
+        if(std::find(nodeIds.begin(), nodeIds.end(), worker->node) == nodeIds.end()) nodeIds.push_back(worker->node);
+    }
+    nodes = static_cast<uint32_t>(nodeIds.size());
+
+    for(uint32_t i = 0; i < count; i++) {
+        Worker& worker = *workers[i];
+        // Neighbours first: on the same node they are the closest caches too
+        for(uint32_t offset = 1; offset < count; offset++) {
+            uint32_t victim = (i + offset) % count;
+            if(workers[victim]->node == worker.node) worker.victims.push_back(victim);
+        }
+        for(uint32_t offset = 1; offset < count; offset++) {
+            uint32_t victim = (i + offset) % count;
+            if(workers[victim]->node != worker.node) worker.victims.push_back(victim);
+        }
+    }
+
+    for(uint32_t i = 0; i < count; i++) {
+        workers[i]->thread = std::thread(&TileScheduler::workerLoop, this, i);
+#ifdef __linux__
+        if(pinThreads) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(workers[i]->cpu, &set);
+            pthread_setaffinity_np(workers[i]->thread.native_handle(), sizeof(set), &set);
+        }
+#endif
+    }
+}
+
+TileScheduler::~TileScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for(auto& worker : workers) {
+        worker->thread.join();
+    }
+}
+
+void TileScheduler::run(uint32_t tilesX, uint32_t tilesY, const Task& runTask) {
+    uint32_t order = 0;
+    while((1u << order) < std::max(tilesX, tilesY)) order++;
+    std::vector<std::pair<uint32_t, uint32_t>> curve;
+    curve.reserve(static_cast<size_t>(tilesX) * tilesY);
+    for(uint32_t y = 0; y < tilesY; y++) {
+        for(uint32_t x = 0; x < tilesX; x++) {
+            curve.push_back({hilbertIndex(order, x, y), y << 16 | x});
+        }
+    }
+    std::sort(curve.begin(), curve.end());
+
+    std::unique_lock<std::mutex> lock(mutex);
+    // Workers are ordered by node, so every node gets one contiguous part of the curve
+    size_t count = workers.size();
+    for(size_t i = 0; i < count; i++) {
+        Worker& worker = *workers[i];
+        size_t first = curve.size() * i / count;
+        size_t last = curve.size() * (i + 1) / count;
+        worker.tiles.clear();
+        for(size_t j = last; j > first; j--) worker.tiles.push_back(curve[j - 1].second);
+        worker.top = 0;
+        worker.bottom = static_cast<int64_t>(worker.tiles.size());
+        worker.steals = 0;
+    }
+    task = &runTask;
+    running = static_cast<uint32_t>(count);
+    generation++;
+    wake.notify_all();
+    finished.wait(lock, [this]() { return running == 0; });
+    task = nullptr;
+}
+
+uint64_t TileScheduler::lastSteals() const {
+    uint64_t steals = 0;
+    for(auto& worker : workers) steals += worker->steals;
+    return steals;
+}
+
+void TileScheduler::workerLoop(uint32_t index) {
+    Worker& self = *workers[index];
+    uint64_t seen = 0;
+    while(true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&]() { return stopping || generation != seen; });
+            if(stopping) return;
+            seen = generation;
+        }
+
+        {
+            Trace::Zone zone("tiles");
+            uint32_t tile;
+            while(true) {
+                bool found = pop(self, tile);
+                // Victims are only empty for good once a full pass saw nothing but empty deques
+                for(size_t v = 0; !found && v < self.victims.size();) {
+                    StealResult result = steal(*workers[self.victims[v]], tile);
+                    if(result == StealResult::Stolen) {
+                        found = true;
+                        self.steals++;
+                    }else if(result == StealResult::Empty) {
+                        v++;
+                    }
+                }
+                if(!found) break;
+                (*task)(tile & 0xFFFF, tile >> 16, index);
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if(--running == 0) finished.notify_all();
+    }
+}
+
+// Owner end. Sequentially consistent throughout: the bottom store has to be visible before top is read
+bool TileScheduler::pop(Worker& worker, uint32_t& tile) {
+    int64_t b = worker.bottom.load() - 1;
+    worker.bottom.store(b);
+    int64_t t = worker.top.load();
+    if(t > b) {
+        worker.bottom.store(b + 1);
+        return false;
+    }
+    tile = worker.tiles[b];
+    if(t < b) return true;
+    // Last tile, a thief may be taking it at the same time
+    bool won = worker.top.compare_exchange_strong(t, t + 1);
+    worker.bottom.store(b + 1);
+    return won;
+}
+
+TileScheduler::StealResult TileScheduler::steal(Worker& victim, uint32_t& tile) {
+    int64_t t = victim.top.load();
+    int64_t b = victim.bottom.load();
+    if(t >= b) return StealResult::Empty;
+    // Tiles are not written while a run is in progress, reading before the CAS is safe
+    tile = victim.tiles[t];
+    return victim.top.compare_exchange_strong(t, t + 1) ? StealResult::Stolen : StealResult::Retry;
+}
+
+uint32_t TileScheduler::hilbertIndex(uint32_t order, uint32_t x, uint32_t y) {
+    uint32_t index = 0;
+    for(uint32_t s = (1u << order) >> 1; s > 0; s >>= 1) {
+        uint32_t rx = (x & s) > 0;
+        uint32_t ry = (y & s) > 0;
+        index += s * s * ((3 * rx) ^ ry);
+        // Rotate the quadrant so the curve continues where the last one ended
+        if(ry == 0) {
+            if(rx == 1) {
+                x = s - 1 - (x & (s - 1));
+                y = s - 1 - (y & (s - 1));
+            }
+            std::swap(x, y);
+        }
+    }
+    return index;
+}
+
+uint32_t TileScheduler::cacheTileSize(uint32_t bytesPerPixel) {
+    long cacheSize = 32 * 1024;
+#if defined(__linux__) && defined(_SC_LEVEL1_DCACHE_SIZE)
+    long reported = sysconf(_SC_LEVEL1_DCACHE_SIZE);
+    if(reported > 0) cacheSize = reported;
+#endif
+    uint32_t size = 8;
+    while(size < 64 && static_cast<long>(4 * size * size * bytesPerPixel) <= cacheSize / 2) size *= 2;
+    return size;
+}
@@ -0,0 +1,214 @@
+#include "timeline.h"
+#include <stdexcept>
+#include "vkutils.h"
+
+GpuTimeline::GpuTimeline(VkDevice device, VkQueue queue, bool timelineSemaphores,
+                         PFN_vkWaitSemaphores waitSemaphores, PFN_vkGetSemaphoreCounterValue getCounterValue)
+    : device(device), queue(queue), timelineSemaphores(timelineSemaphores),
+      waitSemaphores(waitSemaphores), getCounterValue(getCounterValue) {
+    if(!timelineSemaphores) return;
+    if(waitSemaphores == nullptr || getCounterValue == nullptr) {
+        throw std::runtime_error("Timeline semaphore entry points are missing!");
+    }
+
+    VkSemaphoreTypeCreateInfo typeInfo{};
+    typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    typeInfo.initialValue = 0;
+
+    VkSemaphoreCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    createInfo.pNext = &typeInfo;
+    VK_ASSERT(vkCreateSemaphore(device, &createInfo, nullptr, &semaphore), "Could not create timeline semaphore!");
+}
+
+void GpuTimeline::destroy() {
+    wait(lastSubmitted());
+    collect();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for(VkFence fence : freeFences) vkDestroyFence(device, fence, nullptr);
+    for(VkSemaphore binary : freeSemaphores) vkDestroySemaphore(device, binary, nullptr);
+    freeFences.clear();
+    freeSemaphores.clear();
+    if(semaphore != VK_NULL_HANDLE) vkDestroySemaphore(device, semaphore, nullptr);
+    semaphore = VK_NULL_HANDLE;
+}
+
+uint64_t GpuTimeline::submit(const Submission& submission) {
+    std::vector<VkSemaphore> waits = submission.binaryWaits;
+    std::vector<VkPipelineStageFlags> waitStages = submission.binaryWaitStages;
+    std::vector<uint64_t> waitValues(waits.size(), 0);
+    std::vector<VkSemaphore> consumed;
+
+    // Resolved before taking our own lock, takeSignal locks the other timeline
+    for(const Wait& wait : submission.waits) {
+        // Submission order already serializes work on the same queue
+        if(wait.timeline->queue == queue) continue;
+        VkSemaphore waitSemaphore = wait.timeline->semaphore;
+        if(!timelineSemaphores) {
+            waitSemaphore = wait.timeline->takeSignal(wait.value);
+            if(waitSemaphore == VK_NULL_HANDLE) continue;
+            consumed.push_back(waitSemaphore);
+        }
+        waits.push_back(waitSemaphore);
+        waitStages.push_back(wait.stage);
+        waitValues.push_back(wait.value);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    uint64_t value = nextValue++;
+    std::vector<VkSemaphore> signals = submission.binarySignals;
+    std::vector<uint64_t> signalValues(signals.size(), 0);
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = static_cast<uint32_t>(submission.commandBuffers.size());
+    submitInfo.pCommandBuffers = submission.commandBuffers.data();
+
+    VkTimelineSemaphoreSubmitInfo timelineInfo{};
+    VkFence fence = VK_NULL_HANDLE;
+    if(timelineSemaphores) {
+        signals.push_back(semaphore);
+        signalValues.push_back(value);
+        // Values of binary semaphores in the lists are ignored
+        timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        timelineInfo.waitSemaphoreValueCount = static_cast<uint32_t>(waitValues.size());
+        timelineInfo.pWaitSemaphoreValues = waitValues.data();
+        timelineInfo.signalSemaphoreValueCount = static_cast<uint32_t>(signalValues.size());
+        timelineInfo.pSignalSemaphoreValues = signalValues.data();
+        submitInfo.pNext = &timelineInfo;
+    }else {
+        fence = acquireFence();
+        signals.push_back(acquireSemaphore());
+    }
+
+    submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waits.size());
+    submitInfo.pWaitSemaphores = waits.data();
+    submitInfo.pWaitDstStageMask = waitStages.data();
+    submitInfo.signalSemaphoreCount = static_cast<uint32_t>(signals.size());
+    submitInfo.pSignalSemaphores = signals.data();
+    VK_ASSERT(vkQueueSubmit(queue, 1, &submitInfo, fence), "Could not submit to the timeline queue!");
+
+    if(!timelineSemaphores) {
+        pending.push_back({value, fence, signals.back(), false, std::move(consumed)});
+    }
+    return value;
+}
+
+uint64_t GpuTimeline::lastSubmitted() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return nextValue - 1;
+}
+
+uint64_t GpuTimeline::completedValue() {
+    if(timelineSemaphores) {
+        uint64_t value = 0;
+        VK_ASSERT(getCounterValue(device, semaphore, &value), "Could not query timeline semaphore!");
+        return value;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    retire(false, 0);
+    return completed;
+}
+
+void GpuTimeline::wait(uint64_t value) {
+    if(value == 0) return;
+    if(timelineSemaphores) {
+        VkSemaphoreWaitInfo waitInfo{};
+        waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores = &semaphore;
+        waitInfo.pValues = &value;
+        VK_ASSERT(waitSemaphores(device, &waitInfo, UINT64_MAX), "Could not wait for timeline semaphore!");
+        return;
+    }
+    // Holds the lock while blocking, fences are recycled as soon as they are retired
+    std::lock_guard<std::mutex> lock(mutex);
+    retire(true, value);
+}
+
+void GpuTimeline::release(uint64_t value, std::function<void()> callback) {
+    std::lock_guard<std::mutex> lock(mutex);
+    releases.push_back({value, std::move(callback)});
+}
+
+void GpuTimeline::collect() {
+    uint64_t done = completedValue();
+    std::vector<std::function<void()>> ready;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for(size_t i = 0; i < releases.size();) {
+            if(releases[i].value <= done) {
+                ready.push_back(std::move(releases[i].callback));
+                releases[i] = std::move(releases.back());
+                releases.pop_back();
+            }else {
+                i++;
+            }
+        }
+    }
+    // Callbacks may submit or release again
+    for(auto& callback : ready) callback();
+}
+
+VkSemaphore GpuTimeline::takeSignal(uint64_t value) {
+    std::lock_guard<std::mutex> lock(mutex);
+    retire(false, 0);
+    if(value <= completed) return VK_NULL_HANDLE;
+    for(Pending& entry : pending) {
+        if(entry.value != value) continue;
+        if(entry.signalTaken) break;
+        entry.signalTaken = true;
+        return entry.signal;
+    }
+    // A binary semaphore is consumed by its first waiter, later ones have to wait on the host
+    retire(true, value);
+    return VK_NULL_HANDLE;
+}
+
+void GpuTimeline::retire(bool block, uint64_t until) {
+    while(!pending.empty()) {
+        Pending& entry = pending.front();
+        if(block && entry.value <= until) {
+            VK_ASSERT(vkWaitForFences(device, 1, &entry.fence, VK_TRUE, UINT64_MAX), "Could not wait for fence!");
+        }else if(vkGetFenceStatus(device, entry.fence) != VK_SUCCESS) {
+            break;
+        }
+
+        completed = entry.value;
+        VK_ASSERT(vkResetFences(device, 1, &entry.fence), "Could not reset fence!");
+        freeFences.push_back(entry.fence);
+        // Waits that executed leave their semaphores unsignalled and reusable
+        freeSemaphores.insert(freeSemaphores.end(), entry.consumed.begin(), entry.consumed.end());
+        // A signalled semaphore nobody waited for cannot be reused; a taken one is recycled by its waiter
+        if(!entry.signalTaken) vkDestroySemaphore(device, entry.signal, nullptr);
+        pending.pop_front();
+    }
+}
+
+VkFence GpuTimeline::acquireFence() {
+    if(!freeFences.empty()) {
+        VkFence fence = freeFences.back();
+        freeFences.pop_back();
+        return fence;
+    }
+    VkFenceCreateInfo fenceInfo{};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    VkFence fence;
+    VK_ASSERT(vkCreateFence(device, &fenceInfo, nullptr, &fence), "Could not create fence!");
+    return fence;
+}
+
+VkSemaphore GpuTimeline::acquireSemaphore() {
+    if(!freeSemaphores.empty()) {
+        VkSemaphore binary = freeSemaphores.back();
+        freeSemaphores.pop_back();
+        return binary;
+    }
+    VkSemaphoreCreateInfo semaphoreInfo{};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    VkSemaphore binary;
+    VK_ASSERT(vkCreateSemaphore(device, &semaphoreInfo, nullptr, &binary), "Could not create semaphore!");
+    return binary;
+}
@@ -0,0 +1,133 @@
+#include "trace.h"
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include "loader.h"
+
+namespace {
+
+struct Event {
+    std::string name;
+    uint32_t track;
+    int64_t begin;
+    int64_t end;
+};
+
+struct Track {
+    std::string name;
+    bool gpu;
+    std::thread::id thread;
+};
+
+std::atomic<bool> active{false};
+std::mutex mutex;
+int64_t origin = 0;
+std::vector<Event> events;
+std::vector<Track> tracks;
+size_t dropped = 0;
+
+// Expects mutex to be held
+uint32_t cpuTrack() {
+    std::thread::id id = std::this_thread::get_id();
+    for(uint32_t i = 0; i < tracks.size(); i++) {
+        if(!tracks[i].gpu && tracks[i].thread == id) return i;
+    }
+    tracks.push_back({"thread " + std::to_string(tracks.size()), false, id});
+    return static_cast<uint32_t>(tracks.size() - 1);
+}
+
+uint32_t gpuTrack(const std::string& name) {
+    for(uint32_t i = 0; i < tracks.size(); i++) {
+        if(tracks[i].gpu && tracks[i].name == name) return i;
+    }
+    tracks.push_back({name, true, {}});
+    return static_cast<uint32_t>(tracks.size() - 1);
+}
+
+void record(const std::string& name, uint32_t track, int64_t begin, int64_t end) {
+    if(events.size() >= Trace::MAX_EVENTS) {
+        dropped++;
+        return;
+    }
+    events.push_back({name, track, begin, end});
+}
+
+}
+
+std::string Trace::escapeJson(const std::string& text) {
+    static const char HEX[] = "0123456789abcdef";
+    std::string result;
+    for(char c : text) {
+        unsigned char byte = static_cast<unsigned char>(c);
+        if(c == '"' || c == '\\') {
+            result += '\\';
+            result += c;
+        }else if(byte < 0x20) {
+            result += "\\u00";
+            result += HEX[byte >> 4];
+            result += HEX[byte & 0xF];
+        }else {
+            result += c;
+        }
+    }
+    return result;
+}
+
+Trace::Zone::Zone(std::string name) : name(std::move(name)), begin(active.load(std::memory_order_relaxed) ? now() : -1) {
+}
+
+Trace::Zone::~Zone() {
+    if(begin < 0) return;
+    int64_t end = now();
+    std::lock_guard<std::mutex> lock(mutex);
+    record(name, cpuTrack(), begin, end);
+}
+
+void Trace::start() {
+    std::lock_guard<std::mutex> lock(mutex);
+    origin = now();
+    tracks.push_back({"main", false, std::this_thread::get_id()});
+    active = true;
+}
+
+bool Trace::enabled() {
+    return active.load(std::memory_order_relaxed);
+}
+
+int64_t Trace::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Trace::gpuZone(const std::string& name, const std::string& track, int64_t begin, int64_t end) {
+    if(!enabled()) return;
+    std::lock_guard<std::mutex> lock(mutex);
+    record(name, gpuTrack(track), begin, end);
+}
+
+void Trace::write(const std::string& filename) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::ostringstream json;
+    json << std::fixed << std::setprecision(3);
+    json << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    // CPU threads in process 1, GPU queues in process 2
+    json << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"CPU\"}},\n";
+    json << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 2, \"args\": {\"name\": \"GPU\"}}";
+    for(uint32_t i = 0; i < tracks.size(); i++) {
+        json << ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": " << (tracks[i].gpu ? 2 : 1) << ", \"tid\": " << i
+             << ", \"args\": {\"name\": \"" << escapeJson(tracks[i].name) << "\"}}";
+    }
+    // Complete events, microseconds since start()
+    for(const Event& event : events) {
+        json << ",\n{\"name\": \"" << escapeJson(event.name) << "\", \"ph\": \"X\", \"pid\": " << (tracks[event.track].gpu ? 2 : 1)
+             << ", \"tid\": " << event.track << ", \"ts\": " << (event.begin - origin) / 1e3
+             << ", \"dur\": " << (event.end - event.begin) / 1e3 << "}";
+    }
+    json << "\n], \"otherData\": {\"droppedEvents\": " << dropped << "}}\n";
+
+    std::string text = json.str();
+    Loader::writeFileAtomic(filename, std::vector<char>(text.begin(), text.end()));
+}
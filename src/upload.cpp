@@ -0,0 +1,239 @@
+#include "upload.h"
+#include <algorithm>
+#include <cstring>
+#include "vkutils.h"
+
+// Keeps ring offsets friendly for wide copies, vkCmdCopyBuffer itself has no alignment requirement
+static const VkDeviceSize RING_ALIGNMENT = 16;
+// Accesses the consumer may perform on uploaded buffers
+static const VkAccessFlags CONSUMER_ACCESS = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT |
+                                             VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+static const VkPipelineStageFlags CONSUMER_STAGES = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT;
+
+static VkCommandPool createPool(VkDevice device, uint32_t family) {
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.queueFamilyIndex = family;
+    VkCommandPool pool;
+    VK_ASSERT(vkCreateCommandPool(device, &poolInfo, nullptr, &pool), "Could not create upload command pool!");
+    return pool;
+}
+
+UploadQueue::UploadQueue(GpuAllocator& allocator, VkDevice device, GpuTimeline& transfer, uint32_t transferFamily,
+                         GpuTimeline& consumer, uint32_t consumerFamily, VkDeviceSize ringSize)
+    : allocator(&allocator), device(device), transfer(&transfer), consumer(&consumer),
+      transferFamily(transferFamily), consumerFamily(consumerFamily), capacity(ringSize) {
+    VkUtils::createBuffer(allocator, device, capacity, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, ring, ringAllocation);
+    transferPool = createPool(device, transferFamily);
+    consumerPool = createPool(device, consumerFamily);
+}
+
+void UploadQueue::destroy() {
+    std::lock_guard<std::mutex> lock(mutex);
+    vkDestroyCommandPool(device, transferPool, nullptr);
+    vkDestroyCommandPool(device, consumerPool, nullptr);
+    VkUtils::destroyBuffer(*allocator, device, ring, ringAllocation);
+    batches.clear();
+    acquires.clear();
+    freeTransferBuffers.clear();
+    freeConsumerBuffers.clear();
+}
+
+void UploadQueue::upload(VkBuffer dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size, bool concurrent) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    std::lock_guard<std::mutex> lock(mutex);
+    retire();
+
+    if(!concurrent && std::find(written.begin(), written.end(), dst) == written.end()) written.push_back(dst);
+
+    while(size > 0) {
+        // Half the ring at most, so the next chunk can be filled while this one is copied
+        VkDeviceSize chunk = std::min(size, capacity / 2);
+        VkDeviceSize offset = reserve(chunk);
+        memcpy(static_cast<uint8_t*>(ringAllocation.mapped) + offset, bytes, chunk);
+
+        // Looked up after reserve, which may have submitted the pending copies
+        auto it = std::find_if(pending.begin(), pending.end(), [dst](const Pending& p) { return p.dst == dst; });
+        if(it == pending.end()) it = pending.insert(pending.end(), {dst, {}});
+        std::vector<VkBufferCopy>& regions = it->regions;
+        if(!regions.empty() && regions.back().srcOffset + regions.back().size == offset &&
+           regions.back().dstOffset + regions.back().size == dstOffset) {
+            regions.back().size += chunk;
+        }else {
+            regions.push_back({offset, dstOffset, chunk});
+        }
+
+        bytes += chunk;
+        dstOffset += chunk;
+        size -= chunk;
+    }
+}
+
+uint64_t UploadQueue::flush() {
+    std::lock_guard<std::mutex> lock(mutex);
+    retire();
+    return submitBatch(true);
+}
+
+uint64_t UploadQueue::submit(const GpuTimeline::Submission& submission) {
+    std::lock_guard<std::mutex> lock(mutex);
+    retire();
+    if(!pending.empty() || !written.empty()) submitBatch(true);
+    if(lastBatchValue <= acquiredValue) return consumer->submit(submission);
+
+    GpuTimeline::Submission withAcquire = submission;
+    VkCommandBuffer cmd = VK_NULL_HANDLE;
+    if(!dedicatedQueue()) {
+        cmd = acquireCommandBuffer(consumerPool, freeConsumerBuffers);
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = CONSUMER_ACCESS;
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, CONSUMER_STAGES, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+    }else {
+        // The semaphore wait alone makes concurrent buffers visible
+        withAcquire.waits.push_back({transfer, lastBatchValue, CONSUMER_STAGES});
+        if(!released.empty()) {
+            cmd = acquireCommandBuffer(consumerPool, freeConsumerBuffers);
+            std::vector<VkBufferMemoryBarrier> barriers(released.size());
+            for(size_t i = 0; i < released.size(); i++) {
+                barriers[i].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+                barriers[i].srcAccessMask = 0;
+                barriers[i].dstAccessMask = CONSUMER_ACCESS;
+                barriers[i].srcQueueFamilyIndex = transferFamily;
+                barriers[i].dstQueueFamilyIndex = consumerFamily;
+                barriers[i].buffer = released[i];
+                barriers[i].size = VK_WHOLE_SIZE;
+            }
+            // Chains with the semaphore wait, which blocks the same stages
+            vkCmdPipelineBarrier(cmd, CONSUMER_STAGES, CONSUMER_STAGES, 0, 0, nullptr,
+                                 static_cast<uint32_t>(barriers.size()), barriers.data(), 0, nullptr);
+        }
+    }
+
+    if(cmd != VK_NULL_HANDLE) {
+        VK_ASSERT(vkEndCommandBuffer(cmd), "Could not end command buffer!");
+        withAcquire.commandBuffers.insert(withAcquire.commandBuffers.begin(), cmd);
+    }
+    uint64_t value = consumer->submit(withAcquire);
+    if(cmd != VK_NULL_HANDLE) acquires.push_back({value, cmd});
+    released.clear();
+    acquiredValue = lastBatchValue;
+    return value;
+}
+
+VkDeviceSize UploadQueue::reserve(VkDeviceSize size) {
+    VkDeviceSize offset;
+    while(!fits(size, offset)) {
+        if(batches.empty()) {
+            // Only copies that were never submitted are left in the ring
+            submitBatch(false);
+        }else {
+            transfer->wait(batches.front().value);
+            retire();
+        }
+    }
+    return offset;
+}
+
+bool UploadQueue::fits(VkDeviceSize size, VkDeviceSize& offset) {
+    if(used == 0) head = tail = 0;
+    VkDeviceSize start = (head + RING_ALIGNMENT - 1) / RING_ALIGNMENT * RING_ALIGNMENT;
+    if(head > tail || used == 0) {
+        if(start + size <= capacity) {
+            offset = start;
+        }else if(size <= tail) {
+            // Wrap around, the rest of this lap stays unused
+            offset = 0;
+        }else {
+            return false;
+        }
+    }else {
+        // head == tail with used > 0 means the ring is full
+        if(start + size > tail) return false;
+        offset = start;
+    }
+
+    VkDeviceSize consumed = offset >= head ? offset + size - head : capacity - head + size;
+    used += consumed;
+    pendingBytes += consumed;
+    head = offset + size;
+    return true;
+}
+
+void UploadQueue::retire() {
+    while(!batches.empty() && transfer->isComplete(batches.front().value)) {
+        Batch& batch = batches.front();
+        tail = batch.end;
+        used -= batch.bytes;
+        VK_ASSERT(vkResetCommandBuffer(batch.commandBuffer, 0), "Could not reset command buffer!");
+        freeTransferBuffers.push_back(batch.commandBuffer);
+        batches.pop_front();
+    }
+    while(!acquires.empty() && consumer->isComplete(acquires.front().value)) {
+        VK_ASSERT(vkResetCommandBuffer(acquires.front().commandBuffer, 0), "Could not reset command buffer!");
+        freeConsumerBuffers.push_back(acquires.front().commandBuffer);
+        acquires.pop_front();
+    }
+}
+
+uint64_t UploadQueue::submitBatch(bool release) {
+    if(pending.empty() && (!release || written.empty())) return lastBatchValue;
+
+    VkCommandBuffer cmd = acquireCommandBuffer(transferPool, freeTransferBuffers);
+    for(const Pending& copy : pending) {
+        vkCmdCopyBuffer(cmd, ring, copy.dst, static_cast<uint32_t>(copy.regions.size()), copy.regions.data());
+    }
+    // Also covers the copies of earlier partial batches, they were submitted to the same queue
+    if(release && dedicatedQueue() && !written.empty()) {
+        std::vector<VkBufferMemoryBarrier> barriers(written.size());
+        for(size_t i = 0; i < written.size(); i++) {
+            barriers[i].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+            barriers[i].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barriers[i].dstAccessMask = 0;
+            barriers[i].srcQueueFamilyIndex = transferFamily;
+            barriers[i].dstQueueFamilyIndex = consumerFamily;
+            barriers[i].buffer = written[i];
+            barriers[i].size = VK_WHOLE_SIZE;
+        }
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr,
+                             static_cast<uint32_t>(barriers.size()), barriers.data(), 0, nullptr);
+    }
+    VK_ASSERT(vkEndCommandBuffer(cmd), "Could not end command buffer!");
+
+    GpuTimeline::Submission submission;
+    submission.commandBuffers.push_back(cmd);
+    uint64_t value = transfer->submit(submission);
+    batches.push_back({value, head, pendingBytes, cmd});
+    pendingBytes = 0;
+    pending.clear();
+    if(release) {
+        released.insert(released.end(), written.begin(), written.end());
+        written.clear();
+    }
+    lastBatchValue = value;
+    return value;
+}
+
+VkCommandBuffer UploadQueue::acquireCommandBuffer(VkCommandPool pool, std::vector<VkCommandBuffer>& freeList) {
+    VkCommandBuffer cmd;
+    if(!freeList.empty()) {
+        cmd = freeList.back();
+        freeList.pop_back();
+    }else {
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandPool = pool;
+        allocInfo.commandBufferCount = 1;
+        VK_ASSERT(vkAllocateCommandBuffers(device, &allocInfo, &cmd), "Could not allocate command buffer!");
+    }
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    VK_ASSERT(vkBeginCommandBuffer(cmd, &beginInfo), "Could not begin command buffer!");
+    return cmd;
+}
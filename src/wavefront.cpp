@@ -0,0 +1,241 @@
+#include "wavefront.h"
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include "loader.h"
+#include "vkutils.h"
+
+WavefrontPathTracer::WavefrontPathTracer(VkPhysicalDevice physicalDevice, GpuAllocator& allocator, VkDevice device, VkPipelineCache pipelineCache, uint32_t queueFamily,
+                                         VkExtent2D extent, uint32_t maxBounces, uint32_t framesInFlight, const SceneBindings& scene, bool wideBVH)
+    : physicalDevice(physicalDevice), allocator(&allocator), device(device), extent(extent), maxBounces(maxBounces) {
+    VkDescriptorSetLayoutBinding bindings[BINDING_COUNT]{};
+    for(uint32_t i = 0; i < BINDING_COUNT; i++) {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = i < IMAGE_BINDINGS ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = BINDING_COUNT;
+    layoutInfo.pBindings = bindings;
+    VK_ASSERT(vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &setLayout), "Could not create wavefront descriptor set layout!");
+
+    VkPushConstantRange pushRange{};
+    pushRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushRange.size = sizeof(PushConstants);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &setLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushRange;
+    VK_ASSERT(vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout), "Could not create wavefront pipeline layout!");
+
+    VkDescriptorPoolSize poolSizes[2]{};
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    poolSizes[0].descriptorCount = IMAGE_BINDINGS;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSizes[1].descriptorCount = BINDING_COUNT - IMAGE_BINDINGS;
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = 2;
+    poolInfo.pPoolSizes = poolSizes;
+    poolInfo.maxSets = 1;
+    VK_ASSERT(vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool), "Could not create wavefront descriptor pool!");
+
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = descriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &setLayout;
+    VK_ASSERT(vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet), "Could not allocate wavefront descriptor set!");
+
+    // Every queue holds one entry per pixel, the most a single bounce can produce
+    uint32_t capacity = extent.width * extent.height;
+    VkDeviceSize vec4Bytes = 4 * sizeof(float) * static_cast<VkDeviceSize>(capacity);
+    auto create = [&](QueueBuffer& queue, VkDeviceSize size, VkBufferUsageFlags usage) {
+        VkUtils::createBuffer(allocator, device, size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | usage,
+                              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, queue.buffer, queue.allocation);
+    };
+    create(rays, 2 * RAY_ATTRIBUTES * vec4Bytes, 0);
+    create(hits, vec4Bytes, 0);
+    create(shadowRays, SHADOW_ATTRIBUTES * vec4Bytes, 0);
+    create(control, sizeof(Control), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+    create(radiance, vec4Bytes, 0);
+
+    VkDescriptorImageInfo imageInfos[IMAGE_BINDINGS]{};
+    imageInfos[ACCUMULATION_IMAGE].imageView = scene.accumulationImage;
+    imageInfos[ACCUMULATION_IMAGE].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    imageInfos[OUTPUT_IMAGE].imageView = scene.outputImage;
+    imageInfos[OUTPUT_IMAGE].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    VkBuffer buffers[BINDING_COUNT - IMAGE_BINDINGS] = {
+        scene.vertices, scene.indices, scene.nodes, scene.triangleIndices, scene.triangleMaterials, scene.materials,
+        scene.lights, rays.buffer, hits.buffer, shadowRays.buffer, control.buffer, radiance.buffer
+    };
+    VkDescriptorBufferInfo bufferInfos[BINDING_COUNT - IMAGE_BINDINGS]{};
+    VkWriteDescriptorSet writes[BINDING_COUNT]{};
+    for(uint32_t i = 0; i < BINDING_COUNT; i++) {
+        writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[i].dstSet = descriptorSet;
+        writes[i].dstBinding = i;
+        writes[i].descriptorCount = 1;
+        if(i < IMAGE_BINDINGS) {
+            writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            writes[i].pImageInfo = &imageInfos[i];
+        }else {
+            VkDescriptorBufferInfo& info = bufferInfos[i - IMAGE_BINDINGS];
+            info.buffer = buffers[i - IMAGE_BINDINGS];
+            info.offset = 0;
+            info.range = VK_WHOLE_SIZE;
+            writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            writes[i].pBufferInfo = &info;
+        }
+    }
+    vkUpdateDescriptorSets(device, BINDING_COUNT, writes, 0, nullptr);
+
+    const char* suffix = wideBVH ? "_wide.spv" : ".spv";
+    generatePipeline = VkUtils::createComputePipeline(device, pipelineCache, pipelineLayout, Loader::readFile("wavefront_generate.spv"));
+    extendPipeline = VkUtils::createComputePipeline(device, pipelineCache, pipelineLayout, Loader::readFile(std::string("wavefront_extend") + suffix));
+    shadePipeline = VkUtils::createComputePipeline(device, pipelineCache, pipelineLayout, Loader::readFile("wavefront_shade.spv"));
+    advancePipeline = VkUtils::createComputePipeline(device, pipelineCache, pipelineLayout, Loader::readFile("wavefront_advance.spv"));
+    shadowPipeline = VkUtils::createComputePipeline(device, pipelineCache, pipelineLayout, Loader::readFile(std::string("wavefront_shadow") + suffix));
+    accumulatePipeline = VkUtils::createComputePipeline(device, pipelineCache, pipelineLayout, Loader::readFile("wavefront_accumulate.spv"));
+
+    push.maxBounces = maxBounces;
+    push.width = extent.width;
+    push.height = extent.height;
+    push.capacity = capacity;
+    push.lightCount = scene.lightCount;
+
+    // Stage timing needs timestamp support on the render queue
+    uint32_t familyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> families(familyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, families.data());
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(physicalDevice, &props);
+    uint32_t validBits = families[queueFamily].timestampValidBits;
+    if(validBits > 0 && props.limits.timestampPeriod > 0.0f) {
+        timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+        timestampPeriod = props.limits.timestampPeriod;
+        // Start, generate, extend + shade + shadow per bounce, accumulate
+        queryCount = 3 + 3 * (maxBounces + 1);
+        frameQueries.resize(framesInFlight);
+
+        VkQueryPoolCreateInfo queryInfo{};
+        queryInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        queryInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        queryInfo.queryCount = queryCount * framesInFlight;
+        VK_ASSERT(vkCreateQueryPool(device, &queryInfo, nullptr, &queryPool), "Could not create wavefront query pool!");
+    }
+}
+
+void WavefrontPathTracer::destroy() {
+    VkPipeline pipelines[] = {generatePipeline, extendPipeline, shadePipeline, advancePipeline, shadowPipeline, accumulatePipeline};
+    for(VkPipeline pipeline : pipelines) {
+        vkDestroyPipeline(device, pipeline, nullptr);
+    }
+    QueueBuffer* buffers[] = {&rays, &hits, &shadowRays, &control, &radiance};
+    for(QueueBuffer* queue : buffers) {
+        VkUtils::destroyBuffer(*allocator, device, queue->buffer, queue->allocation);
+    }
+    if(queryPool != VK_NULL_HANDLE) vkDestroyQueryPool(device, queryPool, nullptr);
+    vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+    vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+    vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+}
+
+void WavefrontPathTracer::dispatch(VkCommandBuffer cmd, VkPipeline pipeline, uint32_t groups) {
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    vkCmdPushConstants(cmd, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &push);
+    vkCmdDispatch(cmd, groups, 1, 1);
+}
+
+void WavefrontPathTracer::dispatchIndirect(VkCommandBuffer cmd, VkPipeline pipeline, VkDeviceSize offset) {
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    vkCmdPushConstants(cmd, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &push);
+    vkCmdDispatchIndirect(cmd, control.buffer, offset);
+}
+
+void WavefrontPathTracer::timestamp(VkCommandBuffer cmd, uint32_t frameSlot, Stage stage) {
+    if(queryPool == VK_NULL_HANDLE) return;
+    // Dispatches are serialized by barriers, so the gap to the previous timestamp is the stage's run time
+    FrameQueries& queries = frameQueries[frameSlot];
+    if(queries.used > 0) queries.stages.push_back(stage);
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, frameSlot * queryCount + queries.used++);
+}
+
+void WavefrontPathTracer::record(VkCommandBuffer cmd, uint32_t frameIndex, uint32_t frameSlot) {
+    uint32_t groups = (push.capacity + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE;
+
+    if(queryPool != VK_NULL_HANDLE) {
+        frameQueries[frameSlot] = FrameQueries{};
+        vkCmdResetQueryPool(cmd, queryPool, frameSlot * queryCount, queryCount);
+    }
+
+    // The previous frame may still read the queues and the control block
+    VkUtils::computeBarrier(cmd);
+    Control initial{};
+    initial.extendArgs[0] = groups;
+    initial.extendArgs[1] = 1;
+    initial.extendArgs[2] = 1;
+    initial.shadowArgs[1] = 1;
+    initial.shadowArgs[2] = 1;
+    initial.activeRays = push.capacity;
+    vkCmdUpdateBuffer(cmd, control.buffer, 0, sizeof(Control), &initial);
+
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+    push.frameIndex = frameIndex;
+    push.bounce = 0;
+    timestamp(cmd, frameSlot, GENERATE);
+    dispatch(cmd, generatePipeline, groups);
+    VkUtils::indirectBarrier(cmd);
+    timestamp(cmd, frameSlot, GENERATE);
+
+    for(uint32_t bounce = 0; bounce <= maxBounces; bounce++) {
+        push.bounce = bounce;
+        dispatchIndirect(cmd, extendPipeline, offsetof(Control, extendArgs));
+        VkUtils::computeBarrier(cmd);
+        timestamp(cmd, frameSlot, EXTEND);
+
+        dispatchIndirect(cmd, shadePipeline, offsetof(Control, extendArgs));
+        VkUtils::computeBarrier(cmd);
+        dispatch(cmd, advancePipeline, 1);
+        VkUtils::indirectBarrier(cmd);
+        timestamp(cmd, frameSlot, SHADE);
+
+        dispatchIndirect(cmd, shadowPipeline, offsetof(Control, shadowArgs));
+        VkUtils::computeBarrier(cmd);
+        timestamp(cmd, frameSlot, SHADOW);
+    }
+
+    dispatch(cmd, accumulatePipeline, groups);
+    timestamp(cmd, frameSlot, ACCUMULATE);
+}
+
+bool WavefrontPathTracer::readStageTimes(uint32_t frameSlot, double milliseconds[STAGE_COUNT]) {
+    if(queryPool == VK_NULL_HANDLE || frameQueries[frameSlot].used == 0) return false;
+    const FrameQueries& queries = frameQueries[frameSlot];
+
+    std::vector<uint64_t> timestamps(queries.used);
+    VkResult result = vkGetQueryPoolResults(device, queryPool, frameSlot * queryCount, queries.used, timestamps.size() * sizeof(uint64_t),
+                                            timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    if(result != VK_SUCCESS) return false;
+
+    for(uint32_t s = 0; s < STAGE_COUNT; s++) milliseconds[s] = 0.0;
+    for(size_t i = 0; i < queries.stages.size(); i++) {
+        uint64_t ticks = (timestamps[i + 1] - timestamps[i]) & timestampMask;
+        milliseconds[queries.stages[i]] += ticks * static_cast<double>(timestampPeriod) / 1e6;
+    }
+    return true;
+}
+
+const char* WavefrontPathTracer::stageName(Stage stage) {
+    static const char* names[STAGE_COUNT] = {"generate", "extend", "shade", "shadow", "accumulate"};
+    return names[stage];
+}
@@ -0,0 +1,387 @@
+#include "widebvh.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+
+static constexpr float NO_HIT = 1e30f;
+
+static AABB triangleBounds(const Scene& scene, uint32_t triangle) {
+    AABB box;
+    for(uint32_t k = 0; k < 3; k++) {
+        const glm::vec4& v = scene.vertices[scene.indices[3 * triangle + k]];
+        box.grow(glm::vec3(v.x, v.y, v.z));
+    }
+    return box;
+}
+
+// Number of wide slots a binary node occupies when it becomes a child
+static uint32_t slotCount(const BVHNode& node) {
+    if(!node.isLeaf()) return 1;
+    return (node.triangleCount + BVH8::MAX_LEAF_TRIANGLES - 1) / BVH8::MAX_LEAF_TRIANGLES;
+}
+
+// Smallest power of two cell that covers range with 255 steps, as a biased exponent
+static uint8_t quantizationExponent(float range) {
+    if(!(range > 0.0f)) return 1;
+    int e;
+    std::frexp(range / 255.0f, &e);
+    return static_cast<uint8_t>(std::clamp(e + 127, 1, 254));
+}
+
+static float cellSize(uint8_t exponent) {
+    return std::ldexp(1.0f, static_cast<int>(exponent) - 127);
+}
+
+static uint8_t quantize(float value, bool roundUp) {
+    float q = roundUp ? std::ceil(value) : std::floor(value);
+    return static_cast<uint8_t>(std::clamp(q, 0.0f, 255.0f));
+}
+
+WideBVH BVH8::collapse(const Scene& scene, const BVH& bvh) {
+    auto start = std::chrono::steady_clock::now();
+
+    struct Slot {
+        AABB bounds;
+        bool internal;
+        // Binary node for interior slots, first entry in bvh.triangleIndices for leaves
+        uint32_t index;
+        uint32_t triangleCount;
+    };
+    struct Task {
+        uint32_t binaryNode;
+        uint32_t wideNode;
+        uint32_t depth;
+    };
+
+    WideBVH wide;
+    wide.nodes.push_back(WideBVHNode{});
+    // An empty scene keeps a root without children
+    if(bvh.triangleIndices.empty()) return wide;
+
+    wide.triangleIndices.reserve(bvh.triangleIndices.size());
+    std::vector<Task> stack = {{0, 0, 0}};
+
+    while(!stack.empty()) {
+        Task task = stack.back();
+        stack.pop_back();
+        wide.depth = std::max(wide.depth, task.depth);
+        if(wide.depth > STACK_SIZE) {
+            throw std::runtime_error("BVH is too deep for the 8 wide traversal stack!");
+        }
+
+        // Start from the two children and keep opening the interior child with the largest
+        // surface area, the one most likely to be hit, until all eight slots are used
+        uint32_t children[WIDTH];
+        uint32_t childCount = 0;
+        uint32_t usedSlots = 0;
+        const BVHNode& root = bvh.nodes[task.binaryNode];
+        if(root.isLeaf()) {
+            children[childCount++] = task.binaryNode;
+        }else {
+            children[childCount++] = root.leftFirst;
+            children[childCount++] = root.leftFirst + 1;
+        }
+        for(uint32_t i = 0; i < childCount; i++) usedSlots += slotCount(bvh.nodes[children[i]]);
+
+        while(true) {
+            int best = -1;
+            float bestArea = -1.0f;
+            for(uint32_t i = 0; i < childCount; i++) {
+                const BVHNode& node = bvh.nodes[children[i]];
+                if(node.isLeaf()) continue;
+                uint32_t opened = usedSlots - 1 + slotCount(bvh.nodes[node.leftFirst]) + slotCount(bvh.nodes[node.leftFirst + 1]);
+                if(opened > WIDTH) continue;
+                AABB box{node.aabbMin, node.aabbMax};
+                if(box.area() > bestArea) {
+                    bestArea = box.area();
+                    best = static_cast<int>(i);
+                }
+            }
+            if(best < 0) break;
+
+            const BVHNode& node = bvh.nodes[children[best]];
+            usedSlots += slotCount(bvh.nodes[node.leftFirst]) + slotCount(bvh.nodes[node.leftFirst + 1]) - 1;
+            children[best] = node.leftFirst;
+            children[childCount++] = node.leftFirst + 1;
+        }
+        if(usedSlots > WIDTH) {
+            throw std::runtime_error("BVH leaves are too large to collapse into an 8 wide BVH!");
+        }
+
+        Slot candidates[WIDTH];
+        uint32_t slotTotal = 0;
+        uint32_t internalCount = 0;
+        for(uint32_t i = 0; i < childCount; i++) {
+            const BVHNode& node = bvh.nodes[children[i]];
+            if(!node.isLeaf()) {
+                candidates[slotTotal++] = {AABB{node.aabbMin, node.aabbMax}, true, children[i], 0};
+                internalCount++;
+                continue;
+            }
+            // Split large leaves into groups of three with tight bounds
+            for(uint32_t first = 0; first < node.triangleCount; first += MAX_LEAF_TRIANGLES) {
+                Slot slot{AABB{}, false, node.leftFirst + first, std::min(MAX_LEAF_TRIANGLES, node.triangleCount - first)};
+                for(uint32_t t = 0; t < slot.triangleCount; t++) {
+                    slot.bounds.grow(triangleBounds(scene, bvh.triangleIndices[slot.index + t]));
+                }
+                candidates[slotTotal++] = slot;
+            }
+        }
+
+        AABB bounds;
+        for(uint32_t i = 0; i < slotTotal; i++) bounds.grow(candidates[i].bounds);
+
+        // Slot s gets the child lying farthest against the direction with the signs of octant s,
+        // so rays of octant o meet the children roughly near to far in slot order k ^ o.
+        // Greedy assignment of the cheapest pairs, like the auction in Ylitie et al.
+        glm::vec3 center = (bounds.min + bounds.max) * 0.5f;
+        float cost[WIDTH][WIDTH];
+        for(uint32_t i = 0; i < slotTotal; i++) {
+            glm::vec3 offset = (candidates[i].bounds.min + candidates[i].bounds.max) * 0.5f - center;
+            for(uint32_t s = 0; s < WIDTH; s++) {
+                glm::vec3 direction((s & 1) ? -1.0f : 1.0f, (s & 2) ? -1.0f : 1.0f, (s & 4) ? -1.0f : 1.0f);
+                cost[i][s] = glm::dot(offset, direction);
+            }
+        }
+        Slot slots[WIDTH];
+        bool slotUsed[WIDTH] = {};
+        bool childPlaced[WIDTH] = {};
+        for(uint32_t n = 0; n < slotTotal; n++) {
+            uint32_t bestChild = 0, bestSlot = 0;
+            float bestCost = INFINITY;
+            for(uint32_t i = 0; i < slotTotal; i++) {
+                for(uint32_t s = 0; s < WIDTH; s++) {
+                    if(!childPlaced[i] && !slotUsed[s] && cost[i][s] < bestCost) {
+                        bestCost = cost[i][s];
+                        bestChild = i;
+                        bestSlot = s;
+                    }
+                }
+            }
+            childPlaced[bestChild] = true;
+            slotUsed[bestSlot] = true;
+            slots[bestSlot] = candidates[bestChild];
+        }
+
+        uint32_t childBase = static_cast<uint32_t>(wide.nodes.size());
+        wide.nodes.resize(wide.nodes.size() + internalCount);
+
+        WideBVHNode& node = wide.nodes[task.wideNode];
+        node = WideBVHNode{};
+        node.origin = bounds.valid() ? bounds.min : glm::vec3(0.0f);
+        glm::vec3 extent = bounds.valid() ? bounds.max - bounds.min : glm::vec3(0.0f);
+        glm::vec3 invCell;
+        for(int axis = 0; axis < 3; axis++) {
+            node.exponent[axis] = quantizationExponent(extent[axis]);
+            invCell[axis] = 1.0f / cellSize(node.exponent[axis]);
+        }
+        node.childBaseIndex = childBase;
+        node.triangleBaseIndex = static_cast<uint32_t>(wide.triangleIndices.size());
+
+        uint32_t nextChild = childBase;
+        for(uint32_t i = 0; i < WIDTH; i++) {
+            if(!slotUsed[i]) continue;
+            const Slot& slot = slots[i];
+            glm::vec3 lo = (slot.bounds.min - node.origin) * invCell;
+            glm::vec3 hi = (slot.bounds.max - node.origin) * invCell;
+            node.qloX[i] = quantize(lo.x, false);
+            node.qloY[i] = quantize(lo.y, false);
+            node.qloZ[i] = quantize(lo.z, false);
+            node.qhiX[i] = quantize(hi.x, true);
+            node.qhiY[i] = quantize(hi.y, true);
+            node.qhiZ[i] = quantize(hi.z, true);
+
+            if(slot.internal) {
+                node.internalMask |= static_cast<uint8_t>(1u << i);
+                node.meta[i] = static_cast<uint8_t>((1u << 5) | (24 + i));
+                stack.push_back({slot.index, nextChild++, task.depth + 1});
+            }else {
+                uint32_t offset = static_cast<uint32_t>(wide.triangleIndices.size()) - node.triangleBaseIndex;
+                uint32_t unary = (1u << slot.triangleCount) - 1;
+                node.meta[i] = static_cast<uint8_t>((unary << 5) | offset);
+                for(uint32_t t = 0; t < slot.triangleCount; t++) {
+                    wide.triangleIndices.push_back(bvh.triangleIndices[slot.index + t]);
+                }
+            }
+        }
+    }
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "BVH8: " << wide.nodes.size() << " nodes (" << wide.nodes.size() * sizeof(WideBVHNode) / 1024
+              << " KiB, binary " << bvh.nodes.size() * sizeof(BVHNode) / 1024 << " KiB) collapsed in " << ms << " ms" << std::endl;
+    return wide;
+}
+
+float BVH8::intersectTriangle(const Scene& scene, uint32_t triangle, const glm::vec3& origin,
+                              const glm::vec3& direction, float& u, float& v) {
+    glm::vec3 v0 = glm::vec3(scene.vertices[scene.indices[3 * triangle + 0]]);
+    glm::vec3 v1 = glm::vec3(scene.vertices[scene.indices[3 * triangle + 1]]);
+    glm::vec3 v2 = glm::vec3(scene.vertices[scene.indices[3 * triangle + 2]]);
+    glm::vec3 e1 = v1 - v0;
+    glm::vec3 e2 = v2 - v0;
+    glm::vec3 p = glm::cross(direction, e2);
+    float det = glm::dot(e1, p);
+    u = 0.0f;
+    v = 0.0f;
+    if(std::abs(det) < 1e-9f) return NO_HIT;
+    float invDet = 1.0f / det;
+    glm::vec3 s = origin - v0;
+    u = glm::dot(s, p) * invDet;
+    if(u < 0.0f || u > 1.0f) return NO_HIT;
+    glm::vec3 q = glm::cross(s, e1);
+    v = glm::dot(direction, q) * invDet;
+    if(v < 0.0f || u + v > 1.0f) return NO_HIT;
+    float t = glm::dot(e2, q) * invDet;
+    return t > 1e-4f ? t : NO_HIT;
+}
+
+static float intersectAABB(const glm::vec3& origin, const glm::vec3& invDirection, const glm::vec3& aabbMin,
+                           const glm::vec3& aabbMax, float tMax) {
+    glm::vec3 t0 = (aabbMin - origin) * invDirection;
+    glm::vec3 t1 = (aabbMax - origin) * invDirection;
+    glm::vec3 tNear = glm::min(t0, t1);
+    glm::vec3 tFar = glm::max(t0, t1);
+    float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+    float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, tMax));
+    return enter <= exit ? enter : NO_HIT;
+}
+
+static uint32_t bitCount(uint32_t v) {
+    uint32_t count = 0;
+    for(; v; v &= v - 1) count++;
+    return count;
+}
+
+static uint32_t lowestBit(uint32_t v) {
+    return bitCount((v & (0u - v)) - 1);
+}
+
+bool BVH8::intersect(const Scene& scene, const WideBVH& bvh, const glm::vec3& origin,
+                     const glm::vec3& direction, float tMax, RayHit& hit) {
+    hit = {tMax, 0.0f, 0.0f, 0xFFFFFFFFu};
+
+    glm::vec3 invDirection = 1.0f / direction;
+    uint32_t octant = (direction.x < 0.0f ? 1 : 0) | (direction.y < 0.0f ? 2 : 0) | (direction.z < 0.0f ? 4 : 0);
+    // Interior children of one node that were hit and not visited yet: the node's child base,
+    // the hit mask in traversal order (bit k is slot k ^ octant) and the interior slot mask
+    struct NodeGroup {
+        uint32_t childBase;
+        uint32_t hitMask;
+        uint32_t internalMask;
+    };
+    NodeGroup stack[STACK_SIZE];
+    uint32_t stackSize = 0;
+    uint32_t nodeIndex = 0;
+
+    while(true) {
+        const WideBVHNode& node = bvh.nodes[nodeIndex];
+        glm::vec3 cell(cellSize(node.exponent[0]), cellSize(node.exponent[1]), cellSize(node.exponent[2]));
+
+        NodeGroup group{node.childBaseIndex, 0, node.internalMask};
+        for(uint32_t slot = 0; slot < WIDTH; slot++) {
+            uint32_t meta = node.meta[slot];
+            if(meta == 0) continue;
+            glm::vec3 lo(node.qloX[slot], node.qloY[slot], node.qloZ[slot]);
+            glm::vec3 hi(node.qhiX[slot], node.qhiY[slot], node.qhiZ[slot]);
+            float t = intersectAABB(origin, invDirection, node.origin + lo * cell, node.origin + hi * cell, hit.t);
+            if(t == NO_HIT) continue;
+
+            if(node.internalMask & (1u << slot)) {
+                group.hitMask |= 1u << (slot ^ octant);
+            }else {
+                uint32_t first = node.triangleBaseIndex + (meta & 0x1F);
+                uint32_t count = bitCount(meta >> 5);
+                for(uint32_t i = 0; i < count; i++) {
+                    uint32_t triangle = bvh.triangleIndices[first + i];
+                    float u, v;
+                    float tt = intersectTriangle(scene, triangle, origin, direction, u, v);
+                    if(tt < hit.t) hit = {tt, u, v, triangle};
+                }
+            }
+        }
+
+        // Continue with the first remaining child and defer the rest of its group as one entry,
+        // so the stack grows by at most one entry per level (collapse bounds the depth)
+        if(group.hitMask == 0) {
+            if(stackSize == 0) break;
+            group = stack[--stackSize];
+        }
+        uint32_t slot = lowestBit(group.hitMask) ^ octant;
+        group.hitMask &= group.hitMask - 1;
+        nodeIndex = group.childBase + bitCount(group.internalMask & ((1u << slot) - 1));
+        if(group.hitMask != 0) stack[stackSize++] = group;
+    }
+
+    return hit.triangle != 0xFFFFFFFFu;
+}
+
+bool BVH8::validate(const Scene& scene, const WideBVH& bvh, uint32_t rayCount, std::ostream& log) {
+    size_t n = scene.triangleCount();
+    if(bvh.nodes.empty() || bvh.triangleIndices.size() != n) {
+        log << "BVH8 validation: unexpected buffer sizes" << std::endl;
+        return false;
+    }
+
+    std::vector<uint32_t> seen(n, 0);
+    for(uint32_t t : bvh.triangleIndices) {
+        if(t >= n || seen[t]++ > 0) {
+            log << "BVH8 validation: triangle index buffer is not a permutation" << std::endl;
+            return false;
+        }
+    }
+
+    for(size_t i = 0; i < bvh.nodes.size(); i++) {
+        const WideBVHNode& node = bvh.nodes[i];
+        if(node.childBaseIndex + bitCount(node.internalMask) > bvh.nodes.size()) {
+            log << "BVH8 validation: node " << i << " points outside the node array" << std::endl;
+            return false;
+        }
+        for(uint32_t slot = 0; slot < WIDTH; slot++) {
+            uint32_t meta = node.meta[slot];
+            bool internal = node.internalMask & (1u << slot);
+            if(internal && meta != ((1u << 5) | (24 + slot))) {
+                log << "BVH8 validation: node " << i << " has a bad interior slot " << slot << std::endl;
+                return false;
+            }
+            if(!internal && meta != 0 && node.triangleBaseIndex + (meta & 0x1F) + bitCount(meta >> 5) > n) {
+                log << "BVH8 validation: node " << i << " references triangles out of range" << std::endl;
+                return false;
+            }
+        }
+    }
+
+    // Random rays through the scene bounds, compared against testing every triangle
+    AABB sceneBounds;
+    for(uint32_t t = 0; t < n; t++) sceneBounds.grow(triangleBounds(scene, static_cast<uint32_t>(t)));
+    if(!sceneBounds.valid()) return true;
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    glm::vec3 extent = sceneBounds.max - sceneBounds.min;
+    for(uint32_t r = 0; r < rayCount; r++) {
+        glm::vec3 origin = sceneBounds.min + extent * glm::vec3(unit(rng), unit(rng), unit(rng));
+        glm::vec3 direction;
+        do {
+            direction = glm::vec3(unit(rng), unit(rng), unit(rng)) * 2.0f - 1.0f;
+        }while(glm::dot(direction, direction) < 1e-4f || glm::dot(direction, direction) > 1.0f);
+        direction = glm::normalize(direction);
+
+        float expected = NO_HIT;
+        for(uint32_t t = 0; t < n; t++) {
+            float u, v;
+            expected = std::min(expected, intersectTriangle(scene, t, origin, direction, u, v));
+        }
+        RayHit hit;
+        bool found = intersect(scene, bvh, origin, direction, NO_HIT, hit);
+        float actual = found ? hit.t : NO_HIT;
+        if(std::abs(actual - expected) > 1e-4f * std::max(1.0f, expected)) {
+            log << "BVH8 validation: ray " << r << " hit t=" << actual << ", expected t=" << expected << std::endl;
+            return false;
+        }
+    }
+    log << "BVH8 validation: " << bvh.nodes.size() << " nodes, " << rayCount << " rays match" << std::endl;
+    return true;
+}